@@ -18,6 +18,7 @@
 
 #include "crackFreePrimitiveGenerator.h"
 #include <maya/MStatus.h>
+#include <maya/MString.h>
 #include <maya/MFnMesh.h>
 #include <maya/MIntArray.h>
 #include <maya/MFloatArray.h>
@@ -25,10 +26,37 @@
 #include <maya/MHWGeometry.h>
 #include <maya/MDrawRegistry.h>
 #include <maya/MComponentDataIndexing.h>
+#include <maya/MThreadPool.h>
+#include <maya/MThreadUtils.h>
+#include <maya/MMutexLock.h>
+#include <maya/MTimer.h>
+#include <vector>
+#include <list>
 #include <map>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
 
 namespace
 {
+	const unsigned int kInvalidId = 0xFFFFFFFF;
+
+	// Below this number of triangles per task, the serial path is faster.
+	const unsigned int kMinTrianglesPerTask = 16384;
+
+	// Small buffers stay on the calling thread
+	unsigned int computeTaskCount(unsigned int numTri)
+	{
+		unsigned int taskCount = std::min(CrackFreePrimitiveGenerator::threadCount(), numTri / kMinTrianglesPerTask);
+		return (taskCount > 0 ? taskCount : 1);
+	}
+
 	struct Edge
 	{
 		Edge(unsigned int v0_ = 0, unsigned int v1_ = 0) : v0(v0_), v1(v1_) {}
@@ -57,243 +85,1865 @@ namespace
 		return (lhs.v0 < rhs.v0) || (lhs.v0 == rhs.v0 && lhs.v1 < rhs.v1);
 	}
 
+	// Runs a list of tasks on the Maya thread pool and waits for all of them to complete.
+	// The Task type must provide a run() method. Falls back to running the tasks
+	// in sequence when there is a single task or when the pool is not available.
+	template <typename Task>
+	class ParallelTasks
+	{
+	public:
+		static void execute(std::vector< Task >& tasks)
+		{
+			if (tasks.size() > 1 && MThreadPool::init() == MS::kSuccess)
+			{
+				MThreadPool::newParallelRegion(decompose, &tasks);
+				MThreadPool::release();
+				return;
+			}
+
+			for (size_t i = 0; i < tasks.size(); ++i)
+				tasks[i].run();
+		}
+
+	private:
+		static void decompose(void* data, MThreadRootTask* root)
+		{
+			std::vector< Task >& tasks = *static_cast< std::vector< Task >* >(data);
+			for (size_t i = 0; i < tasks.size(); ++i)
+				MThreadPool::createTask(runTask, &tasks[i], root);
+			MThreadPool::executeAndJoin(root);
+		}
+
+		static MThreadRetVal runTask(void* data)
+		{
+			static_cast< Task* >(data)->run();
+			return (MThreadRetVal)0;
+		}
+	};
+
+	struct VertexF
+	{
+		static const float kTolerance;
+		VertexF(const float* buffer, unsigned int index)
+		{
+			unsigned int bufferPos = index * 3;
+			x = buffer[bufferPos++];
+			y = buffer[bufferPos++];
+			z = buffer[bufferPos++];
+		}
+
+		bool isEqual(const VertexF &rhs) const
+		{
+			return (fabs(x - rhs.x) < kTolerance && fabs(y - rhs.y) < kTolerance && fabs(z - rhs.z) < kTolerance);
+		}
+
+		float x, y, z;
+	};
+
+	const float VertexF::kTolerance = 1e-5f;
+
+	// Cell of the welding grid containing a position.
+	// Cells are twice the weld tolerance, so a matching position can only be
+	// in one of the 3x3x3 cells around the position cell.
+	struct VertexCell
+	{
+		VertexCell(const VertexF& vertex)
+		{
+			const double invCellSize = 0.5 / VertexF::kTolerance;
+			x = (MInt64)floor((double)vertex.x * invCellSize);
+			y = (MInt64)floor((double)vertex.y * invCellSize);
+			z = (MInt64)floor((double)vertex.z * invCellSize);
+		}
+
+		MInt64 x, y, z;
+	};
+
+	// Size a bucket table for the given number of entries,
+	// the bucket index is given by the top (64 - shift) bits of the hash.
+	unsigned int bucketTableSize(unsigned int numEntries, unsigned int& shift)
+	{
+		unsigned int size = 16;
+		shift = 60;
+		while (size < numEntries * 2)
+		{
+			size <<= 1;
+			--shift;
+		}
+		return size;
+	}
+
+	unsigned int cellBucketIndex(MInt64 cellX, MInt64 cellY, MInt64 cellZ, unsigned int shift)
+	{
+		MUint64 key = (MUint64)cellX * 73856093ULL ^ (MUint64)cellY * 19349663ULL ^ (MUint64)cellZ * 83492791ULL;
+		return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> shift);
+	}
+
+	// Welds the vertices whose positions are within VertexF::kTolerance of each other.
+	//
+	// Positions are quantized with VertexCell and the cells are hashed into a bucket table
+	// allocated once; the welded vertices of a bucket are chained through fNextVertex.
+	// When several welded vertices match, the lowest id wins, which keeps the result
+	// independent of the hashing.
+	class VertexWelder
+	{
+	public:
+		VertexWelder(const float* positionBuffer, unsigned int maxVertices);
+
+		// Return the id of the welded vertex matching this face vertex position,
+		// a new welded vertex is added if none matches.
+		unsigned int getVertexId(unsigned int faceVertexId);
+
+		// Add a welded vertex, the caller knows that no welded vertex matches.
+		unsigned int addVertex(unsigned int faceVertexId);
+
+		unsigned int faceVertexId(unsigned int vertexId) const;
+		unsigned int vertexCount() const;
+
+	private:
+		const float* fPositionBuffer;
+
+		// Bucket -> last welded vertex added to that bucket
+		std::vector< unsigned int > fBucketHeads;
+		unsigned int fBucketShift;
+
+		// Welded vertex -> next welded vertex in the same bucket
+		std::vector< unsigned int > fNextVertex;
+		// Welded vertex -> face vertex holding its position
+		std::vector< unsigned int > fVertexFaceIds;
+	};
+
+	VertexWelder::VertexWelder(const float* positionBuffer, unsigned int maxVertices)
+	: fPositionBuffer(positionBuffer)
+	{
+		fBucketHeads.resize(bucketTableSize(maxVertices, fBucketShift), kInvalidId);
+		fNextVertex.reserve(maxVertices);
+		fVertexFaceIds.reserve(maxVertices);
+	}
+
+	unsigned int VertexWelder::getVertexId(unsigned int faceVertexId)
+	{
+		const VertexF vertex(fPositionBuffer, faceVertexId);
+		const VertexCell cell(vertex);
+
+		unsigned int vertexId = kInvalidId;
+		for (MInt64 z = cell.z - 1; z <= cell.z + 1; ++z)
+		{
+			for (MInt64 y = cell.y - 1; y <= cell.y + 1; ++y)
+			{
+				for (MInt64 x = cell.x - 1; x <= cell.x + 1; ++x)
+				{
+					unsigned int candidateId = fBucketHeads[cellBucketIndex(x, y, z, fBucketShift)];
+					for (; candidateId != kInvalidId; candidateId = fNextVertex[candidateId])
+					{
+						if (candidateId < vertexId && vertex.isEqual(VertexF(fPositionBuffer, fVertexFaceIds[candidateId])))
+							vertexId = candidateId;
+					}
+				}
+			}
+		}
+
+		if (vertexId == kInvalidId)
+			vertexId = addVertex(faceVertexId);
+		return vertexId;
+	}
+
+	unsigned int VertexWelder::addVertex(unsigned int faceVertexId)
+	{
+		const VertexCell cell(VertexF(fPositionBuffer, faceVertexId));
+
+		unsigned int vertexId = (unsigned int)fVertexFaceIds.size();
+		unsigned int& bucketHead = fBucketHeads[cellBucketIndex(cell.x, cell.y, cell.z, fBucketShift)];
+		fNextVertex.push_back(bucketHead);
+		fVertexFaceIds.push_back(faceVertexId);
+		bucketHead = vertexId;
+		return vertexId;
+	}
+
+	unsigned int VertexWelder::faceVertexId(unsigned int vertexId) const
+	{
+		return fVertexFaceIds[vertexId];
+	}
+
+	unsigned int VertexWelder::vertexCount() const
+	{
+		return (unsigned int)fVertexFaceIds.size();
+	}
+
+	// Spatial hash over all the distinct face vertices of an index buffer, in the
+	// order they are first referenced. It is used by the parallel welding to find,
+	// for each vertex, the first earlier vertex within tolerance. Queries are const
+	// and can run concurrently once the grid is built.
+	class VertexGrid
+	{
+	public:
+		VertexGrid(const float* positionBuffer, const std::vector< unsigned int >& faceVertexIds, unsigned int taskCount);
+
+		// Return the index of the first vertex before vertexIndex matching its position, or kInvalidId.
+		unsigned int firstMatch(unsigned int vertexIndex) const;
+
+		void computeBuckets(unsigned int first, unsigned int last);
+
+	private:
+		const float* fPositionBuffer;
+		const std::vector< unsigned int >& fFaceVertexIds;
+
+		std::vector< unsigned int > fBucketHeads;
+		unsigned int fBucketShift;
+
+		// Vertex -> bucket, then vertex -> next vertex in the same bucket, in increasing order
+		std::vector< unsigned int > fVertexBuckets;
+		std::vector< unsigned int > fNextVertex;
+	};
+
+	struct VertexGridBucketTask
+	{
+		void run() { grid->computeBuckets(first, last); }
+
+		VertexGrid* grid;
+		unsigned int first;
+		unsigned int last;
+	};
+
+	VertexGrid::VertexGrid(const float* positionBuffer, const std::vector< unsigned int >& faceVertexIds, unsigned int taskCount)
+	: fPositionBuffer(positionBuffer)
+	, fFaceVertexIds(faceVertexIds)
+	{
+		unsigned int numVertices = (unsigned int)faceVertexIds.size();
+		fBucketHeads.resize(bucketTableSize(numVertices, fBucketShift), kInvalidId);
+		fVertexBuckets.resize(numVertices);
+		fNextVertex.resize(numVertices);
+
+		std::vector< VertexGridBucketTask > tasks(taskCount);
+		for (unsigned int i = 0; i < taskCount; ++i)
+		{
+			tasks[i].grid = this;
+			tasks[i].first = (unsigned int)((MUint64)numVertices * i / taskCount);
+			tasks[i].last = (unsigned int)((MUint64)numVertices * (i + 1) / taskCount);
+		}
+		ParallelTasks< VertexGridBucketTask >::execute(tasks);
+
+		// Chain from the last vertex so that the chains are in increasing order
+		for (unsigned int vertexIndex = numVertices; vertexIndex-- > 0; )
+		{
+			unsigned int& bucketHead = fBucketHeads[fVertexBuckets[vertexIndex]];
+			fNextVertex[vertexIndex] = bucketHead;
+			bucketHead = vertexIndex;
+		}
+	}
+
+	void VertexGrid::computeBuckets(unsigned int first, unsigned int last)
+	{
+		for (unsigned int vertexIndex = first; vertexIndex < last; ++vertexIndex)
+		{
+			const VertexCell cell(VertexF(fPositionBuffer, fFaceVertexIds[vertexIndex]));
+			fVertexBuckets[vertexIndex] = cellBucketIndex(cell.x, cell.y, cell.z, fBucketShift);
+		}
+	}
+
+	unsigned int VertexGrid::firstMatch(unsigned int vertexIndex) const
+	{
+		const VertexF vertex(fPositionBuffer, fFaceVertexIds[vertexIndex]);
+		const VertexCell cell(vertex);
+
+		unsigned int matchIndex = kInvalidId;
+		for (MInt64 z = cell.z - 1; z <= cell.z + 1; ++z)
+		{
+			for (MInt64 y = cell.y - 1; y <= cell.y + 1; ++y)
+			{
+				for (MInt64 x = cell.x - 1; x <= cell.x + 1; ++x)
+				{
+					unsigned int candidateIndex = fBucketHeads[cellBucketIndex(x, y, z, fBucketShift)];
+					for (; candidateIndex < vertexIndex && candidateIndex < matchIndex; candidateIndex = fNextVertex[candidateIndex])
+					{
+						if (vertex.isEqual(VertexF(fPositionBuffer, fFaceVertexIds[candidateIndex])))
+						{
+							matchIndex = candidateIndex;
+							break;
+						}
+					}
+				}
+			}
+		}
+		return matchIndex;
+	}
+
+	struct VertexGridMatchTask
+	{
+		void run()
+		{
+			for (unsigned int vertexIndex = first; vertexIndex < last; ++vertexIndex)
+				(*firstMatches)[vertexIndex] = grid->firstMatch(vertexIndex);
+		}
+
+		const VertexGrid* grid;
+		std::vector< unsigned int >* firstMatches;
+		unsigned int first;
+		unsigned int last;
+	};
+
+	// Weld the positions of the face vertices referenced by the index buffer.
+	// Polygon vertex ids are assigned in the order the face vertices are first referenced,
+	// and the result does not depend on the number of tasks.
+	unsigned int weldPositions(const MUintArray& indices, const float* positionBuffer, unsigned int taskCount, std::vector< unsigned int >& polyVertexIds)
+	{
+		unsigned int numTriVerts = indices.length();
+		unsigned int maxVertices = std::min((unsigned int)polyVertexIds.size(), numTriVerts);
+
+		if (taskCount <= 1)
+		{
+			VertexWelder welder(positionBuffer, maxVertices);
+			for (unsigned int vertexIndex = 0; vertexIndex < numTriVerts; ++vertexIndex)
+			{
+				unsigned int faceVertexId = indices[vertexIndex];
+				if (polyVertexIds[faceVertexId] == kInvalidId)
+					polyVertexIds[faceVertexId] = welder.getVertexId(faceVertexId);
+			}
+			return welder.vertexCount();
+		}
+
+		// List the distinct face vertices in the order they are first referenced
+		std::vector< unsigned int > faceVertexIds;
+		faceVertexIds.reserve(maxVertices);
+		for (unsigned int vertexIndex = 0; vertexIndex < numTriVerts; ++vertexIndex)
+		{
+			unsigned int faceVertexId = indices[vertexIndex];
+			if (polyVertexIds[faceVertexId] == kInvalidId)
+			{
+				polyVertexIds[faceVertexId] = 0;
+				faceVertexIds.push_back(faceVertexId);
+			}
+		}
+		unsigned int numVertices = (unsigned int)faceVertexIds.size();
+
+		// In parallel, find for each vertex the first earlier vertex within tolerance
+		std::vector< unsigned int > firstMatches(numVertices);
+		{
+			VertexGrid grid(positionBuffer, faceVertexIds, taskCount);
+
+			std::vector< VertexGridMatchTask > tasks(taskCount);
+			for (unsigned int i = 0; i < taskCount; ++i)
+			{
+				tasks[i].grid = &grid;
+				tasks[i].firstMatches = &firstMatches;
+				tasks[i].first = (unsigned int)((MUint64)numVertices * i / taskCount);
+				tasks[i].last = (unsigned int)((MUint64)numVertices * (i + 1) / taskCount);
+			}
+			ParallelTasks< VertexGridMatchTask >::execute(tasks);
+		}
+
+		// Resolve the ids in order. The serial welder returns the lowest welded vertex
+		// within tolerance; when the first match was itself welded as a new vertex it is
+		// that lowest one. Only the remaining cases, tolerance chains, need a real query.
+		VertexWelder welder(positionBuffer, numVertices);
+		for (unsigned int vertexIndex = 0; vertexIndex < numVertices; ++vertexIndex)
+		{
+			unsigned int faceVertexId = faceVertexIds[vertexIndex];
+			unsigned int matchIndex = firstMatches[vertexIndex];
+
+			unsigned int vertexId;
+			if (matchIndex == kInvalidId)
+			{
+				vertexId = welder.addVertex(faceVertexId);
+			}
+			else
+			{
+				unsigned int matchFaceVertexId = faceVertexIds[matchIndex];
+				unsigned int matchVertexId = polyVertexIds[matchFaceVertexId];
+				if (welder.faceVertexId(matchVertexId) == matchFaceVertexId)
+					vertexId = matchVertexId;
+				else
+					vertexId = welder.getVertexId(faceVertexId);
+			}
+			polyVertexIds[faceVertexId] = vertexId;
+		}
+		return welder.vertexCount();
+	}
+
+	// Weld the positions of all the face vertices of the index buffer, see weldPositions().
+	// polyVertexIds receives the welded vertex id of each face vertex, kInvalidId when not referenced.
+	// The ids are numbered in the order of the index buffer, so for given indices they only depend
+	// on which face vertices are welded together.
+	unsigned int weldFaceVertices(const MUintArray& indices, const float* positionBuffer, unsigned int taskCount, std::vector< unsigned int >& polyVertexIds)
+	{
+		unsigned int numTriVerts = indices.length();
+		unsigned int numFaceVertices = 0;
+		for (unsigned int vertexIndex = 0; vertexIndex < numTriVerts; ++vertexIndex)
+		{
+			if (indices[vertexIndex] >= numFaceVertices)
+				numFaceVertices = indices[vertexIndex] + 1;
+		}
+
+		polyVertexIds.assign(numFaceVertices, kInvalidId);
+		return weldPositions(indices, positionBuffer, taskCount, polyVertexIds);
+	}
+
+	// Registers the edges of every triangle and answers the adjacency queries.
+	//
+	// The edges are stored in flat open-addressing hash tables keyed by polygon edge
+	// (vertex ids after position welding, ordered so that v0 <= v1). Each slot keeps the
+	// first and the last face edge registered for that polygon edge. The face edge to
+	// polygon edge mapping does not need its own table: it is given by the welded id of
+	// each face vertex, see weldPositions().
+	//
+	// The polygon edges and vertices are split in shards on their first vertex id so that
+	// each shard can be filled by its own task. The triangles are first sorted into one
+	// bucket per shard and per range of triangles, then each shard registers its buckets
+	// in range order. Every shard therefore sees its edges in triangle order, which keeps
+	// the first/last face edge of each slot identical to the serial build.
 	class EdgeMapping
 	{
 	public:
-		EdgeMapping();
+		// Face edges and face vertices of a range of triangles that belong to a shard.
+		// The face edges are oriented like their polygon edge.
+		struct ShardBucket
+		{
+			std::vector< Edge > faceEdges;
+			std::vector< unsigned int > faceVertexIds;
+		};
+
+		EdgeMapping(unsigned int numTriVerts, const std::vector< unsigned int >& faceVertex2PolyVertex, unsigned int numPolyVertices, unsigned int shardCount);
+
+		// Register the edges and the uv coords of a range of triangles, only with a single shard.
+		// uvBuffer is only needed for the dominant positions.
+		void addTriangles(const MUintArray& indices, const float* uvBuffer, unsigned int firstTriangle, unsigned int lastTriangle);
+
+		// Sort the edges and the face vertices of a range of triangles by shard,
+		// buckets receives one entry per shard.
+		void bucketTriangles(const MUintArray& indices, bool addVertices, unsigned int firstTriangle, unsigned int lastTriangle, ShardBucket* buckets) const;
+
+		// Register a bucket filled by bucketTriangles() for a shard.
+		void addBucket(const ShardBucket& bucket, const float* uvBuffer, unsigned int shard);
+
+		unsigned int shardCount() const { return fShardMask + 1; }
+
+		bool adjacentEdge(const Edge& faceEdge, Edge& adjacentEdge) const;
+
+		bool dominantEdge(const Edge& faceEdge, Edge& dominantEdge) const;
+
+		bool dominantPosition(unsigned int faceVertexId, unsigned int& dominantVertexId) const;
+
+		// Size in bytes of the edge and vertex tables
+		size_t memoryUsage() const;
+
+	private:
+		struct EdgeEntry
+		{
+			EdgeEntry() : polyEdge(kInvalidId, kInvalidId) {}
+
+			Edge polyEdge;
+			Edge faceEdge0;
+			Edge faceEdge1;
+		};
+
+		// Polygon edge -> first and last face edges, open addressing with linear probing.
+		class EdgeTable
+		{
+		public:
+			EdgeTable();
+
+			void init(unsigned int numEdges);
+			void add(const Edge& faceEdge, const Edge& polyEdge);
+			const EdgeEntry* find(const Edge& polyEdge) const;
+			size_t memoryUsage() const { return fEntries.size() * sizeof(EdgeEntry); }
+
+		private:
+			unsigned int slotIndex(const Edge& polyEdge) const;
+			void grow();
+
+			std::vector< EdgeEntry > fEntries;
+			unsigned int fShift;
+			unsigned int fCount;
+		};
+
+		struct VertexUV
+		{
+			VertexUV() : faceVertexId(kInvalidId), u(0.0f), v(0.0f) {}
+
+			unsigned int faceVertexId;
+			float u, v;
+		};
+
+		void addPositionUV(unsigned int faceVertexId, const float* uvBuffer);
+
+		bool findPolyEdge(const Edge& faceEdge, Edge& polyEdge, bool& isReversed) const;
+		const EdgeEntry* findEntry(const Edge& polyEdge) const;
+
+		std::vector< EdgeTable > fEdgeTables;
+		unsigned int fShardMask;
+
+		// Face vertex id -> polygon vertex id, owned by the caller.
+		const std::vector< unsigned int >& fFaceVertex2PolyVertex;
+
+		// Polygon vertex id -> dominant face vertex id (the one with the lowest uv coords).
+		std::vector< VertexUV > fPolyVertex2FaceVertexUV;
+	};
+
+	EdgeMapping::EdgeTable::EdgeTable()
+	: fShift(64)
+	, fCount(0)
+	{
+	}
+
+	void EdgeMapping::EdgeTable::init(unsigned int numEdges)
+	{
+		unsigned int capacity = 16;
+		fShift = 60;
+		while (capacity < numEdges)
+		{
+			capacity <<= 1;
+			--fShift;
+		}
+		fEntries.resize(capacity);
+	}
+
+	// Fibonacci hashing of the packed edge, the top bits are used as slot index.
+	unsigned int EdgeMapping::EdgeTable::slotIndex(const Edge& polyEdge) const
+	{
+		MUint64 key = ((MUint64)polyEdge.v0 << 32) | polyEdge.v1;
+		return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> fShift);
+	}
+
+	void EdgeMapping::EdgeTable::add(const Edge& faceEdge, const Edge& polyEdge)
+	{
+		// Keep the load factor under 3/4
+		if ((fCount + 1) * 4 > fEntries.size() * 3)
+			grow();
+
+		unsigned int mask = (unsigned int)fEntries.size() - 1;
+		for (unsigned int slot = slotIndex(polyEdge); ; slot = (slot + 1) & mask)
+		{
+			EdgeEntry& entry = fEntries[slot];
+			if (entry.polyEdge.v0 == kInvalidId)
+			{
+				entry.polyEdge = polyEdge;
+				entry.faceEdge0 = faceEdge;
+				entry.faceEdge1 = faceEdge;
+				++fCount;
+				return;
+			}
+			if (entry.polyEdge.isEqual(polyEdge))
+			{
+				entry.faceEdge1 = faceEdge;
+				return;
+			}
+		}
+	}
+
+	void EdgeMapping::EdgeTable::grow()
+	{
+		std::vector< EdgeEntry > oldEntries(fEntries.size() * 2);
+		oldEntries.swap(fEntries);
+		--fShift;
+
+		unsigned int mask = (unsigned int)fEntries.size() - 1;
+		for (size_t i = 0; i < oldEntries.size(); ++i)
+		{
+			const EdgeEntry& entry = oldEntries[i];
+			if (entry.polyEdge.v0 == kInvalidId)
+				continue;
+
+			unsigned int slot = slotIndex(entry.polyEdge);
+			while (fEntries[slot].polyEdge.v0 != kInvalidId)
+				slot = (slot + 1) & mask;
+			fEntries[slot] = entry;
+		}
+	}
+
+	const EdgeMapping::EdgeEntry* EdgeMapping::EdgeTable::find(const Edge& polyEdge) const
+	{
+		unsigned int mask = (unsigned int)fEntries.size() - 1;
+		for (unsigned int slot = slotIndex(polyEdge); ; slot = (slot + 1) & mask)
+		{
+			const EdgeEntry& entry = fEntries[slot];
+			if (entry.polyEdge.v0 == kInvalidId)
+				return NULL;
+			if (entry.polyEdge.isEqual(polyEdge))
+				return &entry;
+		}
+	}
+
+	EdgeMapping::EdgeMapping(unsigned int numTriVerts, const std::vector< unsigned int >& faceVertex2PolyVertex, unsigned int numPolyVertices, unsigned int shardCount)
+	: fEdgeTables(shardCount)
+	, fShardMask(shardCount - 1)
+	, fFaceVertex2PolyVertex(faceVertex2PolyVertex)
+	, fPolyVertex2FaceVertexUV(numPolyVertices)
+	{
+		// A closed manifold mesh has numTriVerts/2 unique edges,
+		// so the tables usually never need to grow.
+		for (unsigned int shard = 0; shard < shardCount; ++shard)
+			fEdgeTables[shard].init(numTriVerts / shardCount);
+	}
+
+	size_t EdgeMapping::memoryUsage() const
+	{
+		size_t size = fPolyVertex2FaceVertexUV.size() * sizeof(VertexUV);
+		for (size_t shard = 0; shard < fEdgeTables.size(); ++shard)
+			size += fEdgeTables[shard].memoryUsage();
+		return size;
+	}
+
+	void EdgeMapping::addTriangles(const MUintArray& indices, const float* uvBuffer, unsigned int firstTriangle, unsigned int lastTriangle)
+	{
+		EdgeTable& edgeTable = fEdgeTables[0];
+		for (unsigned int vertexIndex = firstTriangle * 3; vertexIndex < lastTriangle * 3; vertexIndex += 3)
+		{
+			unsigned int faceVertexIds[3] = { indices[vertexIndex], indices[vertexIndex + 1], indices[vertexIndex + 2] };
+
+			// The edge is represented by two associated vertex ids pairs : one in face vertices array space and a second in polygon face vertices array space.
+			for (unsigned int i = 0; i < 3; ++i)
+			{
+				Edge faceEdge(faceVertexIds[i], faceVertexIds[(i + 1) % 3]);
+				Edge polyEdge(fFaceVertex2PolyVertex[faceEdge.v0], fFaceVertex2PolyVertex[faceEdge.v1]);
+				if (polyEdge.v1 < polyEdge.v0)
+					edgeTable.add(faceEdge.reversed(), polyEdge.reversed());
+				else
+					edgeTable.add(faceEdge, polyEdge);
+			}
+
+			if (uvBuffer)
+			{
+				for (unsigned int i = 0; i < 3; ++i)
+					addPositionUV(faceVertexIds[i], uvBuffer);
+			}
+		}
+	}
+
+	void EdgeMapping::bucketTriangles(const MUintArray& indices, bool addVertices, unsigned int firstTriangle, unsigned int lastTriangle, ShardBucket* buckets) const
+	{
+		unsigned int shardCount = fShardMask + 1;
+		size_t bucketSize = (size_t)(lastTriangle - firstTriangle) * 3 / shardCount;
+		for (unsigned int shard = 0; shard < shardCount; ++shard)
+		{
+			// Leave some room for the shards getting more than their share
+			buckets[shard].faceEdges.reserve(bucketSize + bucketSize / 8);
+			if (addVertices)
+				buckets[shard].faceVertexIds.reserve(bucketSize + bucketSize / 8);
+		}
+
+		for (unsigned int vertexIndex = firstTriangle * 3; vertexIndex < lastTriangle * 3; vertexIndex += 3)
+		{
+			unsigned int faceVertexIds[3] = { indices[vertexIndex], indices[vertexIndex + 1], indices[vertexIndex + 2] };
+			unsigned int polyVertexIds[3] = { fFaceVertex2PolyVertex[faceVertexIds[0]], fFaceVertex2PolyVertex[faceVertexIds[1]], fFaceVertex2PolyVertex[faceVertexIds[2]] };
+
+			for (unsigned int i = 0; i < 3; ++i)
+			{
+				unsigned int j = (i + 1) % 3;
+				if (polyVertexIds[j] < polyVertexIds[i])
+					buckets[polyVertexIds[j] & fShardMask].faceEdges.push_back(Edge(faceVertexIds[j], faceVertexIds[i]));
+				else
+					buckets[polyVertexIds[i] & fShardMask].faceEdges.push_back(Edge(faceVertexIds[i], faceVertexIds[j]));
+			}
+
+			if (addVertices)
+			{
+				for (unsigned int i = 0; i < 3; ++i)
+					buckets[polyVertexIds[i] & fShardMask].faceVertexIds.push_back(faceVertexIds[i]);
+			}
+		}
+	}
+
+	void EdgeMapping::addBucket(const ShardBucket& bucket, const float* uvBuffer, unsigned int shard)
+	{
+		EdgeTable& edgeTable = fEdgeTables[shard];
+		for (size_t i = 0; i < bucket.faceEdges.size(); ++i)
+		{
+			const Edge& faceEdge = bucket.faceEdges[i];
+			edgeTable.add(faceEdge, Edge(fFaceVertex2PolyVertex[faceEdge.v0], fFaceVertex2PolyVertex[faceEdge.v1]));
+		}
+
+		if (uvBuffer)
+		{
+			for (size_t i = 0; i < bucket.faceVertexIds.size(); ++i)
+				addPositionUV(bucket.faceVertexIds[i], uvBuffer);
+		}
+	}
+
+	// Keep the face vertex with the lowest uv coords of each polygon vertex
+	void EdgeMapping::addPositionUV(unsigned int faceVertexId, const float* uvBuffer)
+	{
+		float u = uvBuffer[faceVertexId * 2];
+		float v = uvBuffer[faceVertexId * 2 + 1];
+
+		VertexUV& vertexUV = fPolyVertex2FaceVertexUV[fFaceVertex2PolyVertex[faceVertexId]];
+		if( vertexUV.faceVertexId == kInvalidId || u < vertexUV.u || ( u == vertexUV.u && v < vertexUV.v ) )
+		{
+			vertexUV.faceVertexId = faceVertexId;
+			vertexUV.u = u;
+			vertexUV.v = v;
+		}
+	}
+
+	const EdgeMapping::EdgeEntry* EdgeMapping::findEntry(const Edge& polyEdge) const
+	{
+		return fEdgeTables[polyEdge.v0 & fShardMask].find(polyEdge);
+	}
+
+	// Get the polygon edge of a registered face edge.
+	// isReversed is set when the face edge is stored in the opposite direction.
+	bool EdgeMapping::findPolyEdge(const Edge& faceEdge, Edge& polyEdge, bool& isReversed) const
+	{
+		if (faceEdge.v0 >= fFaceVertex2PolyVertex.size() || faceEdge.v1 >= fFaceVertex2PolyVertex.size())
+			return false;
+
+		unsigned int polyVertexId0 = fFaceVertex2PolyVertex[faceEdge.v0];
+		unsigned int polyVertexId1 = fFaceVertex2PolyVertex[faceEdge.v1];
+		if (polyVertexId0 == kInvalidId || polyVertexId1 == kInvalidId)
+			return false;
+
+		isReversed = (polyVertexId1 < polyVertexId0);
+		polyEdge = (isReversed ? Edge(polyVertexId1, polyVertexId0) : Edge(polyVertexId0, polyVertexId1));
+		return true;
+	}
+
+	// Find the adjacent edge that is shared between two faces.
+	// The matching is done through the polygon vertex ids.
+	// The returning edge have vertices in face space.
+	bool EdgeMapping::adjacentEdge(const Edge& faceEdge, Edge& adjacentEdge) const
+	{
+		Edge polyEdge;
+		bool isReversed;
+		if (!findPolyEdge(faceEdge, polyEdge, isReversed))
+			return false;
+
+		const EdgeEntry* entry = findEntry(polyEdge);
+		if (entry == NULL)
+			return false;
+
+		const Edge& faceEdge0 = entry->faceEdge0;
+		const Edge& faceEdge1 = entry->faceEdge1;
+
+		bool foundMatch = false;
+		if(faceEdge.isEqual(faceEdge0))
+		{
+			adjacentEdge = faceEdge1;
+			foundMatch = true;
+		}
+		else if(faceEdge.isReverse(faceEdge0))
+		{
+			adjacentEdge = faceEdge1.reversed();
+			foundMatch = true;
+		}
+		else if(faceEdge.isEqual(faceEdge1))
+		{
+			adjacentEdge = faceEdge0;
+			foundMatch = true;
+		}
+		else if(faceEdge.isReverse(faceEdge1))
+		{
+			adjacentEdge = faceEdge0.reversed();
+			foundMatch = true;
+		}
+
+		return foundMatch;
+	}
+
+	bool EdgeMapping::dominantEdge(const Edge& faceEdge, Edge& dominantEdge) const
+	{
+		Edge polyEdge;
+		bool isReversed;
+		if (!findPolyEdge(faceEdge, polyEdge, isReversed))
+			return false;
+
+		const EdgeEntry* entry = findEntry(polyEdge);
+		if (entry == NULL)
+			return false;
+
+		const Edge& faceEdge0 = entry->faceEdge0;
+		const Edge& faceEdge1 = entry->faceEdge1;
+
+		// Face edges are stored in polygon edge order, return them in the query order
+		bool returnReversed = !isReversed;
+		if(faceEdge0 < faceEdge1)
+		{
+			dominantEdge = (returnReversed ? faceEdge0.reversed() : faceEdge0);
+		}
+		else
+		{
+			dominantEdge = (returnReversed ? faceEdge1.reversed() : faceEdge1);
+		}
+
+		return true;
+	}
+
+	bool EdgeMapping::dominantPosition(unsigned int faceVertexId, unsigned int& dominantVertexId) const
+	{
+		if (faceVertexId >= fFaceVertex2PolyVertex.size())
+			return false;
+
+		unsigned int polyVertexId = fFaceVertex2PolyVertex[faceVertexId];
+		if (polyVertexId >= fPolyVertex2FaceVertexUV.size())
+			return false;
+
+		const VertexUV& vertexUV = fPolyVertex2FaceVertexUV[polyVertexId];
+		if (vertexUV.faceVertexId == kInvalidId)
+			return false;
+
+		dominantVertexId = vertexUV.faceVertexId;
+		return true;
+	}
+
+	// Patch layouts, given by the optional parts written after the triangle vertices.
+	template <bool AddAdjacentEdges, bool AddDominantEdges, bool AddDominantPosition>
+	struct PatchLayout
+	{
+		enum
+		{
+			kAdjacentEdges		= AddAdjacentEdges,
+			kDominantEdges		= AddDominantEdges,
+			kDominantPosition	= AddDominantPosition,
+			kTriangleSize		= 3								/* triangles vertices */
+								+ (AddAdjacentEdges ? 3 * 2 : 0)	/* adjacent edges */
+								+ (AddDominantEdges ? 3 * 2 : 0)	/* dominant edges */
+								+ (AddDominantPosition ? 3 : 0)	/* dominant position */
+		};
+	};
+
+	typedef PatchLayout< false, false, false >	PNLayout;
+	typedef PatchLayout< true, false, false >	PNAEN9Layout;
+	typedef PatchLayout< true, true, true >	PNAEN18Layout;
+
+	// Writes the patch indices of a range of triangles.
+	// Each triangle owns a fixed size range of the output, so ranges can be emitted concurrently.
+	//
+	// The emitter is specialized on the index type and on the patch layout, the layout tests
+	// are resolved at compile time. Each patch is first gathered as 32-bit indices and then
+	// written with a fixed size loop, converting to the index type.
+	template <typename IndexType, typename Layout>
+	class PatchEmitter
+	{
+	public:
+		PatchEmitter(const MUintArray& indices, const EdgeMapping& edges, IndexType* indexData)
+		: fIndices(indices)
+		, fEdges(edges)
+		, fIndexData(indexData)
+		{
+		}
+
+		void emit(unsigned int firstTriangle, unsigned int lastTriangle) const;
+
+	private:
+		const MUintArray& fIndices;
+		const EdgeMapping& fEdges;
+		IndexType* fIndexData;
+	};
+
+	template <typename IndexType, typename Layout>
+	void PatchEmitter< IndexType, Layout >::emit(unsigned int firstTriangle, unsigned int lastTriangle) const
+	{
+		IndexType* patchData = fIndexData + (size_t)firstTriangle * Layout::kTriangleSize;
+		for(unsigned int triId = firstTriangle * 3; triId < lastTriangle * 3; triId += 3, patchData += Layout::kTriangleSize)
+		{
+			unsigned int vertexId0 = fIndices[triId];
+			unsigned int vertexId1 = fIndices[triId + 1];
+			unsigned int vertexId2 = fIndices[triId + 2];
+
+			unsigned int patch[Layout::kTriangleSize];
+			unsigned int patchId = 0;
+
+			// Triangle vertices
+			patch[patchId++] = vertexId0;
+			patch[patchId++] = vertexId1;
+			patch[patchId++] = vertexId2;
+
+			// Adjacent edges
+			if(Layout::kAdjacentEdges)
+			{
+				Edge adjacentEdge;
+
+				// Edge0 : vertexId0 - vertexId1
+				fEdges.adjacentEdge(Edge(vertexId0, vertexId1), adjacentEdge);
+				patch[patchId++] = adjacentEdge.v0;
+				patch[patchId++] = adjacentEdge.v1;
+
+				// Edge1 : vertexId1 - vertexId2
+				fEdges.adjacentEdge(Edge(vertexId1, vertexId2), adjacentEdge);
+				patch[patchId++] = adjacentEdge.v0;
+				patch[patchId++] = adjacentEdge.v1;
+
+				// Edge2 : vertexId2 - vertexId0
+				fEdges.adjacentEdge(Edge(vertexId2, vertexId0), adjacentEdge);
+				patch[patchId++] = adjacentEdge.v0;
+				patch[patchId++] = adjacentEdge.v1;
+			}
+
+			// Dominant edges
+			if(Layout::kDominantEdges)
+			{
+				Edge dominantEdge;
+
+				// Edge0 : vertexId0 - vertexId1
+				fEdges.dominantEdge(Edge(vertexId0, vertexId1), dominantEdge);
+				patch[patchId++] = dominantEdge.v0;
+				patch[patchId++] = dominantEdge.v1;
+
+				// Edge1 : vertexId1 - vertexId2
+				fEdges.dominantEdge(Edge(vertexId1, vertexId2), dominantEdge);
+				patch[patchId++] = dominantEdge.v0;
+				patch[patchId++] = dominantEdge.v1;
+
+				// Edge2 : vertexId2 - vertexId0
+				fEdges.dominantEdge(Edge(vertexId2, vertexId0), dominantEdge);
+				patch[patchId++] = dominantEdge.v0;
+				patch[patchId++] = dominantEdge.v1;
+			}
+
+			// Dominant position
+			if(Layout::kDominantPosition)
+			{
+				// Without uv coords, a vertex is its own dominant position
+				unsigned int dominantVertexId = vertexId0;
+				fEdges.dominantPosition(vertexId0, dominantVertexId);
+				patch[patchId++] = dominantVertexId;
+
+				dominantVertexId = vertexId1;
+				fEdges.dominantPosition(vertexId1, dominantVertexId);
+				patch[patchId++] = dominantVertexId;
+
+				dominantVertexId = vertexId2;
+				fEdges.dominantPosition(vertexId2, dominantVertexId);
+				patch[patchId++] = dominantVertexId;
+			}
+
+			for (unsigned int i = 0; i < Layout::kTriangleSize; ++i)
+				patchData[i] = (IndexType)patch[i];
+		}
+	}
+
+	template <typename Emitter>
+	struct PatchEmitterTask
+	{
+		void run() { emitter->emit(first, last); }
+
+		const Emitter* emitter;
+		unsigned int first;
+		unsigned int last;
+	};
+
+	// Write the patches, one range of triangles per task
+	template <typename IndexType, typename Layout>
+	void emitPatches(const MUintArray& indices, const EdgeMapping& edges, IndexType* indexData, unsigned int taskCount)
+	{
+		typedef PatchEmitter< IndexType, Layout > Emitter;
+		Emitter emitter(indices, edges, indexData);
+
+		unsigned int numTri = indices.length() / 3;
+		std::vector< PatchEmitterTask< Emitter > > tasks(taskCount);
+		for (unsigned int i = 0; i < taskCount; ++i)
+		{
+			tasks[i].emitter = &emitter;
+			tasks[i].first = (unsigned int)((MUint64)numTri * i / taskCount);
+			tasks[i].last = (unsigned int)((MUint64)numTri * (i + 1) / taskCount);
+		}
+		ParallelTasks< PatchEmitterTask< Emitter > >::execute(tasks);
+	}
+
+	// Select the emitter instantiation matching the layout, once per buffer.
+	template <typename IndexType>
+	void emitPatches(const MUintArray& indices, const EdgeMapping& edges,
+					 bool bAddAdjacentEdges, bool bAddDominantEdges, bool bAddDominantPosition,
+					 IndexType* indexData, unsigned int taskCount)
+	{
+		int layout = (bAddAdjacentEdges ? 1 : 0) | (bAddDominantEdges ? 2 : 0) | (bAddDominantPosition ? 4 : 0);
+		switch (layout)
+		{
+			case 0: emitPatches< IndexType, PNLayout >(indices, edges, indexData, taskCount); break;
+			case 1: emitPatches< IndexType, PNAEN9Layout >(indices, edges, indexData, taskCount); break;
+			case 7: emitPatches< IndexType, PNAEN18Layout >(indices, edges, indexData, taskCount); break;
+			// Layouts without a registered generator
+			case 2: emitPatches< IndexType, PatchLayout< false, true, false > >(indices, edges, indexData, taskCount); break;
+			case 3: emitPatches< IndexType, PatchLayout< true, true, false > >(indices, edges, indexData, taskCount); break;
+			case 4: emitPatches< IndexType, PatchLayout< false, false, true > >(indices, edges, indexData, taskCount); break;
+			case 5: emitPatches< IndexType, PatchLayout< true, false, true > >(indices, edges, indexData, taskCount); break;
+			case 6: emitPatches< IndexType, PatchLayout< false, true, true > >(indices, edges, indexData, taskCount); break;
+		}
+	}
+
+	// Sort the edges of a range of triangles by shard
+	struct EdgeBucketTask
+	{
+		void run() { edges->bucketTriangles(*indices, addVertices, first, last, buckets); }
+
+		const EdgeMapping* edges;
+		const MUintArray* indices;
+		bool addVertices;
+		unsigned int first;
+		unsigned int last;
+		EdgeMapping::ShardBucket* buckets;
+	};
+
+	// Register the buckets of a shard, in triangle range order
+	struct EdgeMappingTask
+	{
+		void run()
+		{
+			for (size_t range = 0; range < buckets->size(); ++range)
+				edges->addBucket((*buckets)[range][shard], uvBuffer, shard);
+		}
+
+		EdgeMapping* edges;
+		const std::vector< std::vector< EdgeMapping::ShardBucket > >* buckets;
+		const float* uvBuffer;
+		unsigned int shard;
+	};
+
+	// Entries of the post-transform cache, used to reorder the patches and to measure the reuse.
+	const unsigned int kVertexCacheSize = 32;
+
+	// Patches are reordered by chunks of this size, so the order does not depend on the thread count.
+	const unsigned int kReorderChunkSize = 65536;
+
+	// Reorder the patches for control point reuse in the post-transform cache.
+	//
+	// This is the Tipsify algorithm (Sander, Nehab, Barczak, "Fast Triangle Reordering for
+	// Vertex Locality and Reduced Overdraw") applied to the control points of the patches:
+	// the patches around a fanning control point are emitted together, then the next fanning
+	// control point is picked among the control points just emitted, preferring the ones that
+	// will still be in the cache once all their patches are emitted.
+	// Each chunk of patches is reordered on its own and the chunks keep their place in the buffer.
+	template <typename IndexType>
+	class PatchReorderer
+	{
+	public:
+		PatchReorderer(IndexType* indexData, unsigned int triSize)
+		: fIndexData(indexData)
+		, fTriSize(triSize)
+		{
+		}
+
+		void reorder(unsigned int first, unsigned int last) const;
+
+	private:
+		bool isRepeated(const unsigned int* patch, unsigned int controlPoint) const
+		{
+			for (unsigned int i = 0; i < controlPoint; ++i)
+			{
+				if (patch[i] == patch[controlPoint])
+					return true;
+			}
+			return false;
+		}
+
+		IndexType* fIndexData;
+		unsigned int fTriSize;
+	};
+
+	template <typename IndexType>
+	void PatchReorderer< IndexType >::reorder(unsigned int first, unsigned int last) const
+	{
+		unsigned int numPatches = last - first;
+		if (numPatches < 2)
+			return;
+
+		IndexType* patchData = fIndexData + (size_t)first * fTriSize;
+		unsigned int numRefs = numPatches * fTriSize;
+
+		// Number the control points of the chunk from 0
+		std::vector< unsigned int > controlPointIds(patchData, patchData + numRefs);
+		std::sort(controlPointIds.begin(), controlPointIds.end());
+		controlPointIds.erase(std::unique(controlPointIds.begin(), controlPointIds.end()), controlPointIds.end());
+		unsigned int numControlPoints = (unsigned int)controlPointIds.size();
+
+		std::vector< unsigned int > refs(numRefs);
+		for (unsigned int i = 0; i < numRefs; ++i)
+			refs[i] = (unsigned int)(std::lower_bound(controlPointIds.begin(), controlPointIds.end(), (unsigned int)patchData[i]) - controlPointIds.begin());
+
+		// Patches of each control point, a control point used twice by a patch is counted once
+		std::vector< unsigned int > liveCounts(numControlPoints, 0);
+		for (unsigned int i = 0; i < numRefs; ++i)
+		{
+			if (!isRepeated(&refs[i - i % fTriSize], i % fTriSize))
+				++liveCounts[refs[i]];
+		}
+
+		std::vector< unsigned int > adjacencyOffsets(numControlPoints + 1, 0);
+		for (unsigned int i = 0; i < numControlPoints; ++i)
+			adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveCounts[i];
+
+		std::vector< unsigned int > adjacency(adjacencyOffsets[numControlPoints]);
+		{
+			std::vector< unsigned int > cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (unsigned int i = 0; i < numRefs; ++i)
+			{
+				if (!isRepeated(&refs[i - i % fTriSize], i % fTriSize))
+					adjacency[cursors[refs[i]]++] = i / fTriSize;
+			}
+		}
+
+		// A patch brings about 2 new control points in the cache per triangle vertex
+		const unsigned int newPerPatch = 2 * fTriSize / 3;
+
+		std::vector< unsigned int > cacheTimes(numControlPoints, 0);
+		std::vector< bool > emitted(numPatches, false);
+		std::vector< unsigned int > deadEnds;
+		std::vector< unsigned int > candidates;
+		std::vector< unsigned int > order;
+		order.reserve(numPatches);
+
+		unsigned int time = kVertexCacheSize + 1;
+		unsigned int cursor = 0;
+		unsigned int fanning = refs[0];
+		while (fanning != kInvalidId)
+		{
+			// Emit the patches around the fanning control point
+			candidates.clear();
+			for (unsigned int i = adjacencyOffsets[fanning]; i < adjacencyOffsets[fanning + 1]; ++i)
+			{
+				unsigned int patch = adjacency[i];
+				if (emitted[patch])
+					continue;
+
+				emitted[patch] = true;
+				order.push_back(patch);
+
+				const unsigned int* patchRefs = &refs[patch * fTriSize];
+				for (unsigned int j = 0; j < fTriSize; ++j)
+				{
+					if (isRepeated(patchRefs, j))
+						continue;
+
+					unsigned int controlPoint = patchRefs[j];
+					deadEnds.push_back(controlPoint);
+					candidates.push_back(controlPoint);
+					--liveCounts[controlPoint];
+					if (time - cacheTimes[controlPoint] > kVertexCacheSize)
+						cacheTimes[controlPoint] = time++;
+				}
+			}
+
+			// Next fanning control point, the oldest candidate still in the cache after fanning
+			fanning = kInvalidId;
+			unsigned int bestPriority = 0;
+			for (size_t i = 0; i < candidates.size(); ++i)
+			{
+				unsigned int controlPoint = candidates[i];
+				if (liveCounts[controlPoint] == 0)
+					continue;
+
+				unsigned int priority = 1;
+				if (time - cacheTimes[controlPoint] + newPerPatch * liveCounts[controlPoint] <= kVertexCacheSize)
+					priority += time - cacheTimes[controlPoint];
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					fanning = controlPoint;
+				}
+			}
+
+			// Dead end: a recently emitted control point, else the next one in the source order
+			while (fanning == kInvalidId && !deadEnds.empty())
+			{
+				if (liveCounts[deadEnds.back()] > 0)
+					fanning = deadEnds.back();
+				deadEnds.pop_back();
+			}
+			for (; fanning == kInvalidId && cursor < numRefs; ++cursor)
+			{
+				if (liveCounts[refs[cursor]] > 0)
+					fanning = refs[cursor];
+			}
+		}
+
+		// Write the patches in their new order
+		std::vector< IndexType > sourceData(patchData, patchData + numRefs);
+		for (unsigned int i = 0; i < numPatches; ++i)
+		{
+			const IndexType* sourcePatch = &sourceData[(size_t)order[i] * fTriSize];
+			std::copy(sourcePatch, sourcePatch + fTriSize, patchData + (size_t)i * fTriSize);
+		}
+	}
+
+	template <typename IndexType>
+	struct PatchReorderTask
+	{
+		void run()
+		{
+			for (unsigned int chunk = first; chunk < last; chunk += kReorderChunkSize)
+				reorderer->reorder(chunk, std::min(chunk + kReorderChunkSize, last));
+		}
+
+		const PatchReorderer< IndexType >* reorderer;
+		unsigned int first;
+		unsigned int last;
+	};
+
+	// Reorder the patches, each task gets a range of whole chunks.
+	template <typename IndexType>
+	void reorderPatches(IndexType* indexData, unsigned int numTri, unsigned int triSize, unsigned int taskCount)
+	{
+		PatchReorderer< IndexType > reorderer(indexData, triSize);
+
+		unsigned int numChunks = (numTri + kReorderChunkSize - 1) / kReorderChunkSize;
+		taskCount = std::max(std::min(taskCount, numChunks), 1u);
+		std::vector< PatchReorderTask< IndexType > > tasks(taskCount);
+		for (unsigned int i = 0; i < taskCount; ++i)
+		{
+			tasks[i].reorderer = &reorderer;
+			tasks[i].first = std::min((unsigned int)((MUint64)numChunks * i / taskCount) * kReorderChunkSize, numTri);
+			tasks[i].last = std::min((unsigned int)((MUint64)numChunks * (i + 1) / taskCount) * kReorderChunkSize, numTri);
+		}
+		ParallelTasks< PatchReorderTask< IndexType > >::execute(tasks);
+	}
+
+	// Generate the patch indices of a triangle list,
+	// from the welded vertex ids given by weldFaceVertices().
+	void buildPatches( const MUintArray& originalBufferIndices,
+					   const std::vector< unsigned int >& polyVertexIds,
+					   unsigned int numPolyVertices,
+					   const float* uvBufferFloat,
+					   bool bAddAdjacentEdges,
+					   bool bAddDominantEdges,
+					   bool bAddDominantPosition,
+					   MHWRender::MGeometry::DataType indexBufferDataType,
+					   void* indexData,
+					   unsigned int taskCount,
+					   CrackFreePrimitiveGenerator::BuildStats* stats )
+	{
+		unsigned int numTriVerts = originalBufferIndices.length();
+		unsigned int numTri = numTriVerts / 3;
+
+		MTimer timer;
+		if (stats) timer.beginTimer();
+
+		// Register the edges, one task per shard
+		unsigned int shardCount = 1;
+		while (shardCount * 2 <= taskCount)
+			shardCount *= 2;
+
+		EdgeMapping edges(numTriVerts, polyVertexIds, numPolyVertices, shardCount);
+		const float* uvBuffer = (bAddDominantPosition ? uvBufferFloat : NULL);
+		if (shardCount == 1)
+		{
+			edges.addTriangles(originalBufferIndices, uvBuffer, 0, numTri);
+		}
+		else
+		{
+			// Sort the triangles by shard, one task per range of triangles,
+			// then register each shard from its own buckets
+			std::vector< std::vector< EdgeMapping::ShardBucket > > buckets(taskCount, std::vector< EdgeMapping::ShardBucket >(shardCount));
+			{
+				std::vector< EdgeBucketTask > tasks(taskCount);
+				for (unsigned int i = 0; i < taskCount; ++i)
+				{
+					tasks[i].edges = &edges;
+					tasks[i].indices = &originalBufferIndices;
+					tasks[i].addVertices = (uvBuffer != NULL);
+					tasks[i].first = (unsigned int)((MUint64)numTri * i / taskCount);
+					tasks[i].last = (unsigned int)((MUint64)numTri * (i + 1) / taskCount);
+					tasks[i].buckets = &buckets[i][0];
+				}
+				ParallelTasks< EdgeBucketTask >::execute(tasks);
+			}
+
+			std::vector< EdgeMappingTask > tasks(shardCount);
+			for (unsigned int shard = 0; shard < shardCount; ++shard)
+			{
+				tasks[shard].edges = &edges;
+				tasks[shard].buckets = &buckets;
+				tasks[shard].uvBuffer = uvBuffer;
+				tasks[shard].shard = shard;
+			}
+			ParallelTasks< EdgeMappingTask >::execute(tasks);
+		}
+		if (stats) { timer.endTimer(); stats->edgeTime = timer.elapsedTime(); timer.beginTimer(); }
+
+		// Write the patches
+		if (indexBufferDataType == MHWRender::MGeometry::kUnsignedInt32)
+			emitPatches(originalBufferIndices, edges, bAddAdjacentEdges, bAddDominantEdges, bAddDominantPosition, (unsigned int*)indexData, taskCount);
+		else if (indexBufferDataType == MHWRender::MGeometry::kUnsignedInt16 || indexBufferDataType == MHWRender::MGeometry::kUnsignedChar)
+			emitPatches(originalBufferIndices, edges, bAddAdjacentEdges, bAddDominantEdges, bAddDominantPosition, (unsigned short*)indexData, taskCount);
+		if (stats) { timer.endTimer(); stats->emitTime = timer.elapsedTime(); }
+
+		// Reorder the patches for the post-transform cache
+		if (CrackFreePrimitiveGenerator::reorderPatches())
+		{
+			if (stats) timer.beginTimer();
+			unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(bAddAdjacentEdges, bAddDominantEdges, bAddDominantPosition);
+			if (indexBufferDataType == MHWRender::MGeometry::kUnsignedInt32)
+				reorderPatches((unsigned int*)indexData, numTri, triSize, taskCount);
+			else if (indexBufferDataType == MHWRender::MGeometry::kUnsignedInt16 || indexBufferDataType == MHWRender::MGeometry::kUnsignedChar)
+				reorderPatches((unsigned short*)indexData, numTri, triSize, taskCount);
+			if (stats) { timer.endTimer(); stats->reorderTime = timer.elapsedTime(); }
+		}
+
+		if (stats)
+		{
+			stats->taskCount = taskCount;
+			stats->numPolyVertices = numPolyVertices;
+			stats->tableSize = polyVertexIds.size() * sizeof(unsigned int) + edges.memoryUsage();
+		}
+	}
+
+	// Hash a buffer of 32-bit words, the values are only compared on a key match.
+	MUint64 hashWords(MUint64 hash, const unsigned int* words, unsigned int numWords)
+	{
+		for (unsigned int i = 0; i < numWords; ++i)
+			hash = (hash ^ words[i]) * 0x100000001B3ULL;
+		return hash;
+	}
+
+	// Patch indices generated by mutateIndexing, reused while the topology does not change.
+	//
+	// Entries are keyed by a hash of the source face vertex indices, the patch layout,
+	// the index type and, when dominant positions are generated, the uv coords. The source
+	// indices are kept to resolve hash collisions, along with the welded vertex ids of the
+	// first build. Positions are not part of the key: a deformed mesh is welded again and
+	// hits the cache as long as the same face vertices end up welded together, as with
+	// skinning or blend shapes. Face vertices drifting apart or coming together both change
+	// the welded ids, which rebuilds the patches.
+	//
+	// The least recently used entries are evicted to keep the cache under its size limit.
+	// The cache can be used from several threads.
+	class PatchCache
+	{
+	public:
+		struct Key
+		{
+			Key(const MUintArray& indices, const float* uvBuffer,
+				bool bAddAdjacentEdges, bool bAddDominantEdges, bool bAddDominantPosition,
+				MHWRender::MGeometry::DataType indexBufferDataType);
 
-		void addTriangle(unsigned int faceVertexId0, unsigned int faceVertexId1, unsigned int faceVertexId2, unsigned int polyVertexId0, unsigned int polyVertexId1, unsigned int polyVertexId2);
-		void addEdge(const Edge& faceEdge, const Edge& polyEdge);
+			MUint64 hash;
+			unsigned int layout;
+			unsigned int indexSize;
+			unsigned int numTriVerts;
+			unsigned int numFaceVertices;
+			unsigned int dataSize;
+		};
 
-		void addPositionUV(unsigned int faceVertexId, unsigned int polyVertexId, float u, float v);
+		PatchCache();
 
-		bool adjacentEdge(const Edge& faceEdge, Edge& adjacentEdge) const;
+		// Is there an entry for the key, the welding still has to be checked by find().
+		// A key without entry counts as a miss.
+		bool contains(const Key& key);
 
-		bool dominantEdge(const Edge& faceEdge, Edge& dominantEdge) const;
+		// Copy the cached patches matching the key and the welding into indexData, return false on a miss.
+		bool find(const Key& key, const MUintArray& indices, const std::vector< unsigned int >& polyVertexIds, void* indexData);
 
-		bool dominantPosition(unsigned int faceVertexId, unsigned int& dominantVertexId) const;
+		void add(const Key& key, const MUintArray& indices, const std::vector< unsigned int >& polyVertexIds, const void* indexData);
+
+		void clear();
+		void setSizeLimit(size_t sizeLimit);
+		CrackFreePrimitiveGenerator::CacheStats stats();
 
 	private:
-		// Map each face edge to its polygon edge.
-		typedef std::map< Edge, Edge > FaceEdge2PolyEdgeMap;
-		FaceEdge2PolyEdgeMap fFaceEdge2PolyEdgeMap;
-
-		// Map each poly edge to both face edges that match.
-		typedef std::map< Edge, std::pair< Edge, Edge > > PolyEdge2FaceEdgeMap;
-		PolyEdge2FaceEdgeMap fPolyEdge2FaceEdgesMap;
-
-		// Map a single face vertex id to its polygon vertex id.
-		typedef std::map< unsigned int, unsigned int > FaceVertex2PolyVertexMap;
-		FaceVertex2PolyVertexMap fFaceVertex2PolyVertexMap;
-
-		// Map dominant vertex position via lowest uv coords.
-		typedef std::pair< unsigned int, std::pair< float, float > > VertexUVPair;
-		typedef std::map< unsigned int, VertexUVPair > PolyVertex2FaceVertexUVMap;
-		PolyVertex2FaceVertexUVMap fPolyVertex2FaceVertexUVMap;
+		struct Entry
+		{
+			size_t size() const;
+
+			MUint64 hash;
+			std::vector< unsigned int > sourceIndices;
+			std::vector< unsigned int > polyVertexIds;
+			std::vector< unsigned char > patchData;
+		};
+
+		// Most recently used first
+		typedef std::list< Entry > EntryList;
+		typedef std::map< MUint64, EntryList::iterator > EntryMap;
+
+		void evict(size_t sizeLimit);
+
+		EntryList fEntries;
+		EntryMap fEntryMap;
+		size_t fSize;
+		size_t fSizeLimit;
+		unsigned int fHitCount;
+		unsigned int fMissCount;
+		unsigned int fEvictionCount;
+		MMutexLock fLock;
 	};
 
-	EdgeMapping::EdgeMapping()
+	PatchCache::Key::Key(const MUintArray& indices, const float* uvBuffer,
+						 bool bAddAdjacentEdges, bool bAddDominantEdges, bool bAddDominantPosition,
+						 MHWRender::MGeometry::DataType indexBufferDataType)
 	{
+		numTriVerts = indices.length();
+		unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(bAddAdjacentEdges, bAddDominantEdges, bAddDominantPosition);
+		indexSize = (indexBufferDataType == MHWRender::MGeometry::kUnsignedInt32 ? 4 : 2);
+		dataSize = (numTriVerts / 3) * triSize * indexSize;
+
+		numFaceVertices = 0;
+		for (unsigned int vertexIndex = 0; vertexIndex < numTriVerts; ++vertexIndex)
+		{
+			if (indices[vertexIndex] >= numFaceVertices)
+				numFaceVertices = indices[vertexIndex] + 1;
+		}
+
+		layout = (bAddAdjacentEdges ? 1 : 0) | (bAddDominantEdges ? 2 : 0) | (bAddDominantPosition ? 4 : 0) | (uvBuffer ? 8 : 0)
+			| (CrackFreePrimitiveGenerator::reorderPatches() ? 16 : 0);
+		const unsigned int header[] = { layout, indexSize, numTriVerts };
+		hash = hashWords(0xCBF29CE484222325ULL, header, 3);
+		for (unsigned int vertexIndex = 0; vertexIndex < numTriVerts; ++vertexIndex)
+			hash = (hash ^ indices[vertexIndex]) * 0x100000001B3ULL;
+
+		// The dominant positions are picked from the uv coords
+		if (bAddDominantPosition && uvBuffer)
+			hash = hashWords(hash, (const unsigned int*)uvBuffer, numFaceVertices * 2);
 	}
 
-	void EdgeMapping::addTriangle(unsigned int faceVertexId0, unsigned int faceVertexId1, unsigned int faceVertexId2, unsigned int polyVertexId0, unsigned int polyVertexId1, unsigned int polyVertexId2)
+	size_t PatchCache::Entry::size() const
 	{
-		addEdge( Edge(faceVertexId0, faceVertexId1), Edge(polyVertexId0, polyVertexId1) );
-		addEdge( Edge(faceVertexId1, faceVertexId2), Edge(polyVertexId1, polyVertexId2) );
-		addEdge( Edge(faceVertexId2, faceVertexId0), Edge(polyVertexId2, polyVertexId0) );
+		return sizeof(Entry)
+			+ sourceIndices.size() * sizeof(unsigned int)
+			+ polyVertexIds.size() * sizeof(unsigned int)
+			+ patchData.size();
 	}
 
-	// Add a new edge
-	// The edge is represented by two associated vertex ids pairs : one in face vertices array space and a second in polygon face vertices array space.
-	void EdgeMapping::addEdge(const Edge& faceEdge, const Edge& polyEdge)
+	PatchCache::PatchCache()
+	: fSize(0)
+	, fSizeLimit(0)
+	, fHitCount(0)
+	, fMissCount(0)
+	, fEvictionCount(0)
 	{
-		if(polyEdge.v1 < polyEdge.v0)
-		{
-			// Revert edges
-			Edge faceEdgeR = faceEdge.reversed();
-			Edge polyEdgeR = polyEdge.reversed();
-			addEdge(faceEdgeR, polyEdgeR);
-			return;
-		}
+		// Size limit in megabytes
+		static const char* cacheSize = getenv("DX11SHADER_PNAEN_CACHE_SIZE");
+		int sizeLimit = (cacheSize ? atoi(cacheSize) : 256);
+		fSizeLimit = (size_t)std::max(sizeLimit, 0) << 20;
+	}
 
-		fFaceEdge2PolyEdgeMap[faceEdge] = polyEdge;
-		
-		PolyEdge2FaceEdgeMap::iterator itP2F = fPolyEdge2FaceEdgesMap.find( polyEdge );
-		if(itP2F == fPolyEdge2FaceEdgesMap.end())
-		{
-			fPolyEdge2FaceEdgesMap[polyEdge] = std::make_pair( faceEdge, faceEdge );
-		}
-		else
-		{
-			itP2F->second.second = faceEdge;
-		}
+	bool PatchCache::contains(const Key& key)
+	{
+		fLock.lock();
+		bool found = (fEntryMap.find(key.hash) != fEntryMap.end());
+		if (!found)
+			++fMissCount;
+		fLock.unlock();
+		return found;
 	}
 
-	void EdgeMapping::addPositionUV(unsigned int faceVertexId, unsigned int polyVertexId, float u, float v)
+	bool PatchCache::find(const Key& key, const MUintArray& indices, const std::vector< unsigned int >& polyVertexIds, void* indexData)
 	{
-		fFaceVertex2PolyVertexMap[faceVertexId] = polyVertexId;
+		fLock.lock();
 
-		PolyVertex2FaceVertexUVMap::iterator it = fPolyVertex2FaceVertexUVMap.find(polyVertexId);
-		if(it == fPolyVertex2FaceVertexUVMap.end())
+		bool found = false;
+		EntryMap::iterator itMap = fEntryMap.find(key.hash);
+		if (itMap != fEntryMap.end())
 		{
-			fPolyVertex2FaceVertexUVMap[polyVertexId] = std::make_pair( faceVertexId, std::make_pair(u,v) );
+			const Entry& entry = *itMap->second;
+			found = (entry.patchData.size() == key.dataSize
+				&& entry.sourceIndices.size() == indices.length());
+
+			for (unsigned int vertexIndex = 0; found && vertexIndex < indices.length(); ++vertexIndex)
+				found = (entry.sourceIndices[vertexIndex] == indices[vertexIndex]);
+
+			// The same face vertices must be welded together
+			found = found && (entry.polyVertexIds == polyVertexIds);
+
+			if (found)
+			{
+				if (key.dataSize > 0)
+					memcpy(indexData, &entry.patchData[0], key.dataSize);
+				fEntries.splice(fEntries.begin(), fEntries, itMap->second);
+			}
 		}
+
+		if (found)
+			++fHitCount;
 		else
+			++fMissCount;
+
+		fLock.unlock();
+		return found;
+	}
+
+	void PatchCache::add(const Key& key, const MUintArray& indices, const std::vector< unsigned int >& polyVertexIds, const void* indexData)
+	{
+		Entry entry;
+		entry.hash = key.hash;
+
+		// Build the entry before taking the lock
+		unsigned int numTriVerts = indices.length();
+		entry.sourceIndices.resize(numTriVerts);
+		for (unsigned int vertexIndex = 0; vertexIndex < numTriVerts; ++vertexIndex)
+			entry.sourceIndices[vertexIndex] = indices[vertexIndex];
+
+		entry.polyVertexIds = polyVertexIds;
+
+		entry.patchData.resize(key.dataSize);
+		if (key.dataSize > 0)
+			memcpy(&entry.patchData[0], indexData, key.dataSize);
+
+		fLock.lock();
+
+		size_t entrySize = entry.size();
+		if (entrySize <= fSizeLimit)
 		{
-			VertexUVPair& vertexUVPair = it->second;
-			float lastU = vertexUVPair.second.first;
-			float lastV = vertexUVPair.second.second;
-			if( u < lastU || ( u == lastU && v < lastV ) )
+			// Replace the entry of a previous topology with the same hash
+			EntryMap::iterator itMap = fEntryMap.find(key.hash);
+			if (itMap != fEntryMap.end())
 			{
-				vertexUVPair.first = faceVertexId;
-				vertexUVPair.second = std::make_pair(u,v);
+				fSize -= itMap->second->size();
+				fEntries.erase(itMap->second);
+				fEntryMap.erase(itMap);
 			}
+
+			evict(fSizeLimit - entrySize);
+
+			fEntries.push_front(Entry());
+			fEntries.front().hash = entry.hash;
+			fEntries.front().sourceIndices.swap(entry.sourceIndices);
+			fEntries.front().polyVertexIds.swap(entry.polyVertexIds);
+			fEntries.front().patchData.swap(entry.patchData);
+			fEntryMap[key.hash] = fEntries.begin();
+			fSize += entrySize;
 		}
+
+		fLock.unlock();
 	}
 
-	// Find the adjacent edge that is shared between two faces.
-	// The matching is done through the polygon vertex ids.
-	// The returning edge have vertices in face space.
-	bool EdgeMapping::adjacentEdge(const Edge& faceEdge, Edge& adjacentEdge) const
+	// Evict the least recently used entries until the cache size is under sizeLimit.
+	void PatchCache::evict(size_t sizeLimit)
 	{
-		FaceEdge2PolyEdgeMap::const_iterator itF2P = fFaceEdge2PolyEdgeMap.find( faceEdge );
-		if(itF2P == fFaceEdge2PolyEdgeMap.end())
+		while (fSize > sizeLimit && !fEntries.empty())
 		{
-			Edge faceEdgeR = faceEdge.reversed();
-			itF2P = fFaceEdge2PolyEdgeMap.find( faceEdgeR );
-			if(itF2P == fFaceEdge2PolyEdgeMap.end())
-				return false;
+			fSize -= fEntries.back().size();
+			fEntryMap.erase(fEntries.back().hash);
+			fEntries.pop_back();
+			++fEvictionCount;
 		}
+	}
 
-		const Edge& polyEdge = itF2P->second;
+	void PatchCache::clear()
+	{
+		fLock.lock();
+		fEntries.clear();
+		fEntryMap.clear();
+		fSize = 0;
+		fLock.unlock();
+	}
 
-		PolyEdge2FaceEdgeMap::const_iterator itP2F = fPolyEdge2FaceEdgesMap.find( polyEdge );
-		if(itP2F == fPolyEdge2FaceEdgesMap.end())
-			return false;
+	void PatchCache::setSizeLimit(size_t sizeLimit)
+	{
+		fLock.lock();
+		fSizeLimit = sizeLimit;
+		evict(fSizeLimit);
+		fLock.unlock();
+	}
 
-		const Edge& faceEdge0 = itP2F->second.first;
-		const Edge& faceEdge1 = itP2F->second.second;
+	CrackFreePrimitiveGenerator::CacheStats PatchCache::stats()
+	{
+		fLock.lock();
+		CrackFreePrimitiveGenerator::CacheStats stats;
+		stats.hitCount = fHitCount;
+		stats.missCount = fMissCount;
+		stats.evictionCount = fEvictionCount;
+		stats.entryCount = (unsigned int)fEntries.size();
+		stats.size = fSize;
+		stats.sizeLimit = fSizeLimit;
+		fLock.unlock();
+		return stats;
+	}
 
-		bool foundMatch = false;
-		if(faceEdge.isEqual(faceEdge0))
-		{
-			adjacentEdge = faceEdge1;
-			foundMatch = true;
-		}
-		else if(faceEdge.isReverse(faceEdge0))
+	PatchCache sPatchCache;
+
+	// Checksum of a byte buffer, 32-bit words then the remaining bytes.
+	MUint64 checksum(const unsigned char* data, size_t size)
+	{
+		MUint64 hash = 0x84222325CBF29CE4ULL;
+		size_t numWords = size / 4;
+		for (size_t i = 0; i < numWords; ++i)
 		{
-			adjacentEdge = faceEdge1.reversed();
-			foundMatch = true;
+			unsigned int word;
+			memcpy(&word, data + i * 4, 4);
+			hash = (hash ^ word) * 0x100000001B3ULL;
 		}
-		else if(faceEdge.isEqual(faceEdge1))
+		for (size_t i = numWords * 4; i < size; ++i)
+			hash = (hash ^ data[i]) * 0x100000001B3ULL;
+		return hash;
+	}
+
+	// Optional on-disk cache of the patch indices of static meshes, so reopening a scene
+	// does not rebuild them. It is enabled by setting DX11SHADER_PNAEN_CACHE_DIR to a
+	// writable directory, which can be shared by several Maya sessions.
+	//
+	// Each buffer is stored in its own file, named after a content hash of the source indices,
+	// the positions, the uv coords, the patch layout and the index type. A file is a
+	// PatchFileHeader followed by the patch indices; it is memory-mapped to be read and is
+	// rejected, then deleted, when its version, its description or the checksum of its
+	// indices do not match. Files are written to a temporary name and then renamed, so a
+	// reader never maps a partial file.
+	//
+	// When the files exceed the size budget, DX11SHADER_PNAEN_DISK_CACHE_SIZE in megabytes
+	// or 1024 MB by default, the least recently used ones are deleted. A hit sets the
+	// last write time of its file, which is the time used to pick the files to delete.
+	class PatchDiskCache
+	{
+	public:
+		PatchDiskCache();
+
+		bool isEnabled() const;
+
+		// Hash of the content the patches are generated from, on top of the PatchCache key.
+		MUint64 contentHash(const PatchCache::Key& key, const float* positionBuffer, const float* uvBuffer) const;
+
+		// Copy the patches stored for this content into indexData, return false on a miss.
+		bool find(const PatchCache::Key& key, MUint64 contentHash, void* indexData);
+
+		void add(const PatchCache::Key& key, MUint64 contentHash, const void* indexData);
+
+		// Delete all the cache files, return the number of files deleted.
+		unsigned int purge();
+
+		unsigned int hitCount() const { return fHitCount; }
+		unsigned int missCount() const { return fMissCount; }
+
+	private:
+		struct PatchFileHeader
 		{
-			adjacentEdge = faceEdge0;
-			foundMatch = true;
-		}
-		else if(faceEdge.isReverse(faceEdge1))
+			unsigned int magic;
+			unsigned int version;
+			unsigned int layout;
+			unsigned int indexSize;
+			unsigned int numTriVerts;
+			unsigned int dataSize;
+			MUint64 contentHash;
+			MUint64 dataChecksum;
+		};
+
+		static const unsigned int kMagic = 0x45414E50; // "PNAE"
+		static const unsigned int kVersion = 1;
+
+		MString filePath(MUint64 contentHash) const;
+		static void touchFile(const MString& path);
+		void trim();
+
+		MString fDirectory;
+		MUint64 fSizeLimit;
+
+		// Size of the cache files, computed on the first write
+		MUint64 fSize;
+		bool fSizeKnown;
+
+		unsigned int fHitCount;
+		unsigned int fMissCount;
+		MMutexLock fLock;
+	};
+
+	PatchDiskCache::PatchDiskCache()
+	: fSizeLimit(0)
+	, fSize(0)
+	, fSizeKnown(false)
+	, fHitCount(0)
+	, fMissCount(0)
+	{
+		static const char* cacheDir = getenv("DX11SHADER_PNAEN_CACHE_DIR");
+		if (cacheDir && cacheDir[0] != 0)
 		{
-			adjacentEdge = faceEdge0.reversed();
-			foundMatch = true;
+			fDirectory = cacheDir;
+			CreateDirectoryA(fDirectory.asChar(), NULL);
 		}
 
-		return foundMatch;
+		static const char* cacheSize = getenv("DX11SHADER_PNAEN_DISK_CACHE_SIZE");
+		int sizeLimit = (cacheSize ? atoi(cacheSize) : 1024);
+		fSizeLimit = (MUint64)std::max(sizeLimit, 0) << 20;
 	}
 
-	bool EdgeMapping::dominantEdge(const Edge& faceEdge, Edge& dominantEdge) const
+	bool PatchDiskCache::isEnabled() const
 	{
-		bool returnReversed = true;
-		FaceEdge2PolyEdgeMap::const_iterator itF2P = fFaceEdge2PolyEdgeMap.find( faceEdge );
-		if(itF2P == fFaceEdge2PolyEdgeMap.end())
-		{
-			Edge faceEdgeR = faceEdge.reversed();
-			itF2P = fFaceEdge2PolyEdgeMap.find( faceEdgeR );
-			if(itF2P == fFaceEdge2PolyEdgeMap.end())
-				return false;
-			returnReversed = false;
-		}
+		return fDirectory.length() > 0 && fSizeLimit > 0;
+	}
 
-		const Edge& polyEdge = itF2P->second;
+	MUint64 PatchDiskCache::contentHash(const PatchCache::Key& key, const float* positionBuffer, const float* uvBuffer) const
+	{
+		MUint64 hash = hashWords(key.hash, (const unsigned int*)positionBuffer, key.numFaceVertices * 3);
+		if (uvBuffer)
+			hash = hashWords(hash, (const unsigned int*)uvBuffer, key.numFaceVertices * 2);
+		return hash;
+	}
 
-		PolyEdge2FaceEdgeMap::const_iterator itP2F = fPolyEdge2FaceEdgesMap.find( polyEdge );
-		if(itP2F == fPolyEdge2FaceEdgesMap.end())
-			return false;
+	MString PatchDiskCache::filePath(MUint64 contentHash) const
+	{
+		char fileName[32];
+		sprintf(fileName, "/%016llx.pnaen", (unsigned long long)contentHash);
+		return fDirectory + fileName;
+	}
 
-		const Edge& faceEdge0 = itP2F->second.first;
-		const Edge& faceEdge1 = itP2F->second.second;
+	bool PatchDiskCache::find(const PatchCache::Key& key, MUint64 contentHash, void* indexData)
+	{
+		MString path = filePath(contentHash);
 
-		if(faceEdge0 < faceEdge1)
+		bool found = false;
+		bool isCorrupted = false;
+		HANDLE file = CreateFileA(path.asChar(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file != INVALID_HANDLE_VALUE)
 		{
-			dominantEdge = (returnReversed ? faceEdge0.reversed() : faceEdge0);
+			LARGE_INTEGER fileSize;
+			HANDLE mapping = NULL;
+			if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart == (LONGLONG)(sizeof(PatchFileHeader) + key.dataSize))
+				mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+			const unsigned char* view = (mapping ? (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL);
+			if (view)
+			{
+				PatchFileHeader header;
+				memcpy(&header, view, sizeof(header));
+				const unsigned char* data = view + sizeof(header);
+
+				found = (header.magic == kMagic
+					&& header.version == kVersion
+					&& header.layout == key.layout
+					&& header.indexSize == key.indexSize
+					&& header.numTriVerts == key.numTriVerts
+					&& header.dataSize == key.dataSize
+					&& header.contentHash == contentHash
+					&& header.dataChecksum == checksum(data, key.dataSize));
+
+				if (found)
+					memcpy(indexData, data, key.dataSize);
+				else
+					isCorrupted = true;
+
+				UnmapViewOfFile(view);
+			}
+			else
+			{
+				isCorrupted = true;
+			}
+
+			if (mapping)
+				CloseHandle(mapping);
+			CloseHandle(file);
 		}
-		else
+
+		fLock.lock();
+		if (isCorrupted)
 		{
-			dominantEdge = (returnReversed ? faceEdge1.reversed() : faceEdge1);
+			// Deleted now, rewritten after the rebuild. The files are measured again on the next write.
+			if (DeleteFileA(path.asChar()))
+				fSizeKnown = false;
 		}
+		if (found)
+			++fHitCount;
+		else
+			++fMissCount;
+		fLock.unlock();
 
-		return true;
+		if (found)
+			touchFile(path);
+		return found;
 	}
 
-	bool EdgeMapping::dominantPosition(unsigned int faceVertexId, unsigned int& dominantVertexId) const
+	// Mark a file as just used. Failing is harmless, the file is only evicted sooner.
+	void PatchDiskCache::touchFile(const MString& path)
 	{
-		FaceVertex2PolyVertexMap::const_iterator itF2P = fFaceVertex2PolyVertexMap.find(faceVertexId);
-		if(itF2P == fFaceVertex2PolyVertexMap.end())
-			return false;
+		HANDLE file = CreateFileA(path.asChar(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			FILETIME now;
+			GetSystemTimeAsFileTime(&now);
+			SetFileTime(file, NULL, NULL, &now);
+			CloseHandle(file);
+		}
+	}
 
-		unsigned polyVertexId = itF2P->second;
+	void PatchDiskCache::add(const PatchCache::Key& key, MUint64 contentHash, const void* indexData)
+	{
+		if (sizeof(PatchFileHeader) + key.dataSize > fSizeLimit)
+			return;
 
-		PolyVertex2FaceVertexUVMap::const_iterator itP2FUV = fPolyVertex2FaceVertexUVMap.find(polyVertexId);
-		if(itP2FUV == fPolyVertex2FaceVertexUVMap.end())
-			return false;
+		PatchFileHeader header;
+		header.magic = kMagic;
+		header.version = kVersion;
+		header.layout = key.layout;
+		header.indexSize = key.indexSize;
+		header.numTriVerts = key.numTriVerts;
+		header.dataSize = key.dataSize;
+		header.contentHash = contentHash;
+		header.dataChecksum = checksum((const unsigned char*)indexData, key.dataSize);
+
+		// Write under a name unique to this thread then move it in place
+		MString path = filePath(contentHash);
+		MString tmpPath = path;
+		tmpPath += ".";
+		tmpPath += (unsigned int)GetCurrentProcessId();
+		tmpPath += ".";
+		tmpPath += (unsigned int)GetCurrentThreadId();
+		tmpPath += ".tmp";
+
+		FILE* file = fopen(tmpPath.asChar(), "wb");
+		if (file == NULL)
+			return;
 
-		dominantVertexId = itP2FUV->second.first;
-		return true;
-	}
+		bool written = (fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(indexData, 1, key.dataSize, file) == key.dataSize);
+		written = (fclose(file) == 0) && written;
 
-	struct VertexF
-	{
-		static const float kTolerance;
-		VertexF(const float* buffer, unsigned int index)
+		if (!written || !MoveFileExA(tmpPath.asChar(), path.asChar(), MOVEFILE_REPLACE_EXISTING))
 		{
-			unsigned int bufferPos = index * 3;
-			x = buffer[bufferPos++];
-			y = buffer[bufferPos++];
-			z = buffer[bufferPos++];
+			DeleteFileA(tmpPath.asChar());
+			return;
 		}
 
-		bool isEqual(const VertexF &rhs) const
+		fLock.lock();
+		fSize += sizeof(header) + key.dataSize;
+		if (!fSizeKnown || fSize > fSizeLimit)
+			trim();
+		fLock.unlock();
+	}
+
+	// Measure the cache files and, when over budget, delete the oldest ones
+	// until the files are under 3/4 of the budget.
+	void PatchDiskCache::trim()
+	{
+		typedef std::multimap< MUint64, MString > FileMap;
+		FileMap files;
+
+		fSize = 0;
+		WIN32_FIND_DATAA findData;
+		HANDLE find = FindFirstFileA((fDirectory + "/*.pnaen").asChar(), &findData);
+		if (find != INVALID_HANDLE_VALUE)
 		{
-			return (fabs(x - rhs.x) < kTolerance && fabs(y - rhs.y) < kTolerance && fabs(z - rhs.z) < kTolerance);
+			do
+			{
+				MUint64 fileSize = ((MUint64)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+				MUint64 writeTime = ((MUint64)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime;
+				files.insert(FileMap::value_type(writeTime, fDirectory + "/" + findData.cFileName));
+				fSize += fileSize;
+			}
+			while (FindNextFileA(find, &findData));
+			FindClose(find);
 		}
+		fSizeKnown = true;
 
-		float x, y, z;
-	};
-
-	const float VertexF::kTolerance = 1e-5f;
+		if (fSize <= fSizeLimit)
+			return;
 
-	bool operator< (const VertexF& lhs, const VertexF& rhs)
-	{
-		return ((lhs.x - rhs.x) < -VertexF::kTolerance) || 
-			   (fabs(lhs.x - rhs.x) < VertexF::kTolerance && (lhs.y - rhs.y) < -VertexF::kTolerance) || 
-			   (fabs(lhs.x - rhs.x) < VertexF::kTolerance && fabs(lhs.y - rhs.y) < VertexF::kTolerance && (lhs.z - rhs.z) < -VertexF::kTolerance);
+		for (FileMap::iterator it = files.begin(); it != files.end() && fSize > fSizeLimit / 4 * 3; ++it)
+		{
+			WIN32_FILE_ATTRIBUTE_DATA attributes;
+			if (GetFileAttributesExA(it->second.asChar(), GetFileExInfoStandard, &attributes) && DeleteFileA(it->second.asChar()))
+				fSize -= ((MUint64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+		}
 	}
 
-	struct VertexFMap
+	unsigned int PatchDiskCache::purge()
 	{
-		unsigned int getVertexId( const VertexF& v );
+		if (fDirectory.length() == 0)
+			return 0;
 
-		typedef std::map<VertexF, unsigned int> TVtxMap;
-		TVtxMap vertexMap;
-	};
+		fLock.lock();
 
-	unsigned int VertexFMap::getVertexId( const VertexF& v )
-	{
-		VertexFMap::TVtxMap::const_iterator itVtx = vertexMap.find(v);
-		if (itVtx != vertexMap.end())
-			return itVtx->second;
-		unsigned int nextId = (unsigned int)vertexMap.size();
-		vertexMap.insert(TVtxMap::value_type(v,nextId));
-		return nextId;
+		unsigned int numDeleted = 0;
+		WIN32_FIND_DATAA findData;
+		HANDLE find = FindFirstFileA((fDirectory + "/*.pnaen*").asChar(), &findData);
+		if (find != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				if (DeleteFileA((fDirectory + "/" + findData.cFileName).asChar()))
+					++numDeleted;
+			}
+			while (FindNextFileA(find, &findData));
+			FindClose(find);
+		}
+		fSize = 0;
+		fSizeKnown = true;
+
+		fLock.unlock();
+		return numDeleted;
 	}
+
+	PatchDiskCache sPatchDiskCache;
 }
 
 // Mode 1 : PN Triangles; no divergent normals and no displacement crack fix
@@ -320,185 +1970,86 @@ unsigned int CrackFreePrimitiveGenerator::computeTriangleSize(bool bAddAdjacentE
 		+ (bAddDominantPosition ? 3 : 0);	/* dominant position */
 }
 
-void CrackFreePrimitiveGenerator::mutateIndexBuffer( const MUintArray& originalBufferIndices, 
-						const float* positionBufferFloat, 
-						const float* uvBufferFloat, 
-						bool bAddAdjacentEdges,
-						bool bAddDominantEdges,
-						bool bAddDominantPosition,
-						MHWRender::MGeometry::DataType indexBufferDataType,
-						void* indexData )
-{
-	unsigned int numTriVerts = originalBufferIndices.length();
+unsigned int CrackFreePrimitiveGenerator::sThreadCount = 0;
 
-	EdgeMapping edges;
+unsigned int CrackFreePrimitiveGenerator::threadCount()
+{
+	if (sThreadCount == 0)
 	{
-		VertexFMap vertexMap;
-
-		// Iterate all triangles found in the old index buffer:
-		unsigned int vertexIndex = 0;
-
-		while (vertexIndex < numTriVerts)
-		{
-			unsigned int faceVertexId0 = originalBufferIndices[vertexIndex++];
-			unsigned int polyVertexId0 = vertexMap.getVertexId(VertexF(positionBufferFloat, faceVertexId0));
-
-			unsigned int faceVertexId1 = originalBufferIndices[vertexIndex++];
-			unsigned int polyVertexId1 = vertexMap.getVertexId(VertexF(positionBufferFloat, faceVertexId1));
-
-			unsigned int faceVertexId2 = originalBufferIndices[vertexIndex++];
-			unsigned int polyVertexId2 = vertexMap.getVertexId(VertexF(positionBufferFloat, faceVertexId2));
-
-			edges.addTriangle(faceVertexId0, faceVertexId1, faceVertexId2, polyVertexId0, polyVertexId1, polyVertexId2);
-
-			if(bAddDominantPosition && uvBufferFloat)
-			{
-				unsigned int uvIndex;
-				uvIndex = faceVertexId0 * 2;
-				edges.addPositionUV(faceVertexId0, polyVertexId0, uvBufferFloat[uvIndex], uvBufferFloat[uvIndex+1]);
-
-				uvIndex = faceVertexId1 * 2;
-				edges.addPositionUV(faceVertexId1, polyVertexId1, uvBufferFloat[uvIndex], uvBufferFloat[uvIndex+1]);
-
-				uvIndex = faceVertexId2 * 2;
-				edges.addPositionUV(faceVertexId2, polyVertexId2, uvBufferFloat[uvIndex], uvBufferFloat[uvIndex+1]);
-			}
-		}
+		static const char* pnaenThreads = getenv("DX11SHADER_PNAEN_THREADS");
+		int count = (pnaenThreads ? atoi(pnaenThreads) : 0);
+		sThreadCount = (count > 0 ? (unsigned int)count : (unsigned int)std::max(MThreadUtils::getNumThreads(), 1));
 	}
+	return sThreadCount;
+}
 
-	unsigned int newTriId = 0;
-	for(unsigned int triId = 0; triId < numTriVerts; )
-	{
-		unsigned int vertexId0 = originalBufferIndices[triId++];
-		unsigned int vertexId1 = originalBufferIndices[triId++];
-		unsigned int vertexId2 = originalBufferIndices[triId++];
-
-		if (indexBufferDataType == MHWRender::MGeometry::kUnsignedInt32) {
-			// Triangle vertices
-			((unsigned int*)indexData)[newTriId++] = vertexId0;
-			((unsigned int*)indexData)[newTriId++] = vertexId1;
-			((unsigned int*)indexData)[newTriId++] = vertexId2;
-
-			// Adjacent edges
-			if(bAddAdjacentEdges)
-			{
-				Edge adjacentEdge;
-
-				// Edge0 : vertexId0 - vertexId1
-				edges.adjacentEdge(Edge(vertexId0, vertexId1), adjacentEdge);
-				((unsigned int*)indexData)[newTriId++] = adjacentEdge.v0;
-				((unsigned int*)indexData)[newTriId++] = adjacentEdge.v1;
-
-				// Edge1 : vertexId1 - vertexId2
-				edges.adjacentEdge(Edge(vertexId1, vertexId2), adjacentEdge);
-				((unsigned int*)indexData)[newTriId++] = adjacentEdge.v0;
-				((unsigned int*)indexData)[newTriId++] = adjacentEdge.v1;
-
-				// Edge2 : vertexId2 - vertexId0
-				edges.adjacentEdge(Edge(vertexId2, vertexId0), adjacentEdge);
-				((unsigned int*)indexData)[newTriId++] = adjacentEdge.v0;
-				((unsigned int*)indexData)[newTriId++] = adjacentEdge.v1;
-			}
-
-			// Dominant edges
-			if(bAddDominantEdges)
-			{
-				Edge dominantEdge;
-
-				// Edge0 : vertexId0 - vertexId1
-				edges.dominantEdge(Edge(vertexId0, vertexId1), dominantEdge);
-				((unsigned int*)indexData)[newTriId++] = dominantEdge.v0;
-				((unsigned int*)indexData)[newTriId++] = dominantEdge.v1;
-
-				// Edge1 : vertexId1 - vertexId2
-				edges.dominantEdge(Edge(vertexId1, vertexId2), dominantEdge);
-				((unsigned int*)indexData)[newTriId++] = dominantEdge.v0;
-				((unsigned int*)indexData)[newTriId++] = dominantEdge.v1;
-
-				// Edge2 : vertexId2 - vertexId0
-				edges.dominantEdge(Edge(vertexId2, vertexId0), dominantEdge);
-				((unsigned int*)indexData)[newTriId++] = dominantEdge.v0;
-				((unsigned int*)indexData)[newTriId++] = dominantEdge.v1;
-			}
-
-			// Dominant position
-			if(bAddDominantPosition)
-			{
-				unsigned int dominantVertexId;
-
-				edges.dominantPosition(vertexId0, dominantVertexId);
-				((unsigned int*)indexData)[newTriId++] = dominantVertexId;
-
-				edges.dominantPosition(vertexId1, dominantVertexId);
-				((unsigned int*)indexData)[newTriId++] = dominantVertexId;
-
-				edges.dominantPosition(vertexId2, dominantVertexId);
-				((unsigned int*)indexData)[newTriId++] = dominantVertexId;
-			}
-		}
-		else if (indexBufferDataType == MHWRender::MGeometry::kUnsignedChar) {
-			((unsigned short*)indexData)[newTriId++] = (unsigned short)vertexId0;
-			((unsigned short*)indexData)[newTriId++] = (unsigned short)vertexId1;
-			((unsigned short*)indexData)[newTriId++] = (unsigned short)vertexId2;
-
-			// Adjacent edges
-			if(bAddAdjacentEdges)
-			{
-				Edge adjacentEdge;
+void CrackFreePrimitiveGenerator::setThreadCount(unsigned int count)
+{
+	sThreadCount = count;
+}
 
-				// Edge0 : vertexId0 - vertexId1
-				edges.adjacentEdge(Edge(vertexId0, vertexId1), adjacentEdge);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)adjacentEdge.v0;
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)adjacentEdge.v1;
+bool CrackFreePrimitiveGenerator::sReorderPatches = (getenv("DX11SHADER_PNAEN_REORDER") != NULL);
 
-				// Edge1 : vertexId1 - vertexId2
-				edges.adjacentEdge(Edge(vertexId1, vertexId2), adjacentEdge);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)adjacentEdge.v0;
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)adjacentEdge.v1;
+bool CrackFreePrimitiveGenerator::reorderPatches()
+{
+	return sReorderPatches;
+}
 
-				// Edge2 : vertexId2 - vertexId0
-				edges.adjacentEdge(Edge(vertexId2, vertexId0), adjacentEdge);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)adjacentEdge.v0;
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)adjacentEdge.v1;
-			}
+void CrackFreePrimitiveGenerator::setReorderPatches(bool reorder)
+{
+	sReorderPatches = reorder;
+}
 
-			// Dominant edges
-			if(bAddDominantEdges)
-			{
-				Edge dominantEdge;
+CrackFreePrimitiveGenerator::CacheStats CrackFreePrimitiveGenerator::cacheStats()
+{
+	CacheStats stats = sPatchCache.stats();
+	stats.diskHitCount = sPatchDiskCache.hitCount();
+	stats.diskMissCount = sPatchDiskCache.missCount();
+	return stats;
+}
 
-				// Edge0 : vertexId0 - vertexId1
-				edges.dominantEdge(Edge(vertexId0, vertexId1), dominantEdge);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantEdge.v0;
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantEdge.v1;
+void CrackFreePrimitiveGenerator::setCacheSizeLimit(size_t sizeLimit)
+{
+	sPatchCache.setSizeLimit(sizeLimit);
+}
 
-				// Edge1 : vertexId1 - vertexId2
-				edges.dominantEdge(Edge(vertexId1, vertexId2), dominantEdge);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantEdge.v0;
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantEdge.v1;
+void CrackFreePrimitiveGenerator::clearCache()
+{
+	sPatchCache.clear();
+}
 
-				// Edge2 : vertexId2 - vertexId0
-				edges.dominantEdge(Edge(vertexId2, vertexId0), dominantEdge);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantEdge.v0;
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantEdge.v1;
-			}
+unsigned int CrackFreePrimitiveGenerator::purgeDiskCache()
+{
+	return sPatchDiskCache.purge();
+}
 
-			// Dominant position
-			if(bAddDominantPosition)
-			{
-				unsigned int dominantVertexId;
+void CrackFreePrimitiveGenerator::mutateIndexBuffer( const MUintArray& originalBufferIndices, 
+						const float* positionBufferFloat, 
+						const float* uvBufferFloat, 
+						bool bAddAdjacentEdges,
+						bool bAddDominantEdges,
+						bool bAddDominantPosition,
+						MHWRender::MGeometry::DataType indexBufferDataType,
+						void* indexData,
+						BuildStats* stats )
+{
+	unsigned int numTri = originalBufferIndices.length() / 3;
+	unsigned int taskCount = computeTaskCount(numTri);
 
-				edges.dominantPosition(vertexId0, dominantVertexId);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantVertexId;
+	MTimer timer;
+	if (stats)
+	{
+		memset(stats, 0, sizeof(BuildStats));
+		timer.beginTimer();
+	}
 
-				edges.dominantPosition(vertexId1, dominantVertexId);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantVertexId;
+	std::vector< unsigned int > polyVertexIds;
+	unsigned int numPolyVertices = weldFaceVertices(originalBufferIndices, positionBufferFloat, taskCount, polyVertexIds);
+	if (stats) { timer.endTimer(); stats->weldTime = timer.elapsedTime(); }
 
-				edges.dominantPosition(vertexId2, dominantVertexId);
-				((unsigned short*)indexData)[newTriId++] = (unsigned short)dominantVertexId;
-			}
-		}
-	}
+	buildPatches( originalBufferIndices, polyVertexIds, numPolyVertices, uvBufferFloat,
+				  bAddAdjacentEdges, bAddDominantEdges, bAddDominantPosition,
+				  indexBufferDataType, indexData, taskCount, stats );
 }
 
 
@@ -543,11 +2094,56 @@ MHWRender::MGeometry::Primitive CrackFreePrimitiveGenerator::mutateIndexing(cons
 		unsigned int bufferSize = numTri * triSize;
 
 		void* indexData = indexBuffer.acquire(bufferSize, true /*writeOnly - we don't need the current buffer values*/);
+		MHWRender::MGeometry::DataType indexBufferDataType = indexBuffer.dataType();
 		if (indexData != NULL)
 		{
-			mutateIndexBuffer( originalBufferIndices, positionBufferFloat, uvBufferFloat, 
-							   fAddAdjacentEdges, fAddDominantEdges, fAddDominantPosition,
-							   indexBuffer.dataType(), indexData );
+			bool isCached = (indexBufferDataType == MHWRender::MGeometry::kUnsignedInt32
+				|| indexBufferDataType == MHWRender::MGeometry::kUnsignedInt16
+				|| indexBufferDataType == MHWRender::MGeometry::kUnsignedChar);
+
+			// Reuse the patches of a previous build when only the positions moved,
+			// then the patches saved on disk by a previous session.
+			PatchCache::Key key(originalBufferIndices, uvBufferFloat, fAddAdjacentEdges, fAddDominantEdges, fAddDominantPosition, indexBufferDataType);
+			unsigned int taskCount = computeTaskCount(numTri);
+			std::vector< unsigned int > polyVertexIds;
+			unsigned int numPolyVertices = 0;
+			bool isWelded = false;
+
+			bool found = false;
+			bool isKnownTopology = (isCached && sPatchCache.contains(key));
+			if (isKnownTopology)
+			{
+				numPolyVertices = weldFaceVertices(originalBufferIndices, positionBufferFloat, taskCount, polyVertexIds);
+				isWelded = true;
+				found = sPatchCache.find(key, originalBufferIndices, polyVertexIds, indexData);
+			}
+
+			if (!found)
+			{
+				bool useDiskCache = (isCached && sPatchDiskCache.isEnabled());
+				MUint64 contentHash = (useDiskCache ? sPatchDiskCache.contentHash(key, positionBufferFloat, uvBufferFloat) : 0);
+				if (useDiskCache && sPatchDiskCache.find(key, contentHash, indexData))
+				{
+					// Keep the patches in memory for the next frames, in case the mesh deforms
+					numPolyVertices = weldFaceVertices(originalBufferIndices, positionBufferFloat, taskCount, polyVertexIds);
+					sPatchCache.add(key, originalBufferIndices, polyVertexIds, indexData);
+				}
+				else
+				{
+					if (!isWelded)
+						numPolyVertices = weldFaceVertices(originalBufferIndices, positionBufferFloat, taskCount, polyVertexIds);
+					buildPatches( originalBufferIndices, polyVertexIds, numPolyVertices, uvBufferFloat,
+								  fAddAdjacentEdges, fAddDominantEdges, fAddDominantPosition,
+								  indexBufferDataType, indexData, taskCount, NULL );
+
+					if (isCached)
+						sPatchCache.add(key, originalBufferIndices, polyVertexIds, indexData);
+					// When the topology was already built with other positions, the mesh deforms
+					// and its frames are not worth a file each
+					if (useDiskCache && !isKnownTopology)
+						sPatchDiskCache.add(key, contentHash, indexData);
+				}
+			}
 		}
 
 		if (positionBuffer) positionBuffer->unmap();
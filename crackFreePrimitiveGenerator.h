@@ -38,7 +38,22 @@ public:
 		MHWRender::MIndexBuffer& mutatedBuffer,
 		int& primitiveStride) const;
 
+	// Time spent in each phase of mutateIndexBuffer, in seconds, and the size of its tables.
+	struct BuildStats
+	{
+		double weldTime;
+		double edgeTime;
+		double emitTime;
+		double reorderTime;
+		unsigned int taskCount;
+		unsigned int numPolyVertices;
+		size_t tableSize;
+	};
+
 	// This will allow cleaning up the swatch for PNAEN geometries:
+	// indexData receives 32-bit indices for kUnsignedInt32, 16-bit indices for kUnsignedInt16
+	// and kUnsignedChar, the caller makes sure the vertex ids fit.
+	// The phases are only timed when stats is given.
 	static void mutateIndexBuffer( const MUintArray& originalBufferIndices, 
 						const float* positionBufferFloat, 
 						const float* uvBufferFloat, 
@@ -46,12 +61,48 @@ public:
 						bool bAddDominantEdges,
 						bool bAddDominantPosition,
 						MHWRender::MGeometry::DataType indexBufferDataType,
-						void* indexData );
+						void* indexData,
+						BuildStats* stats = NULL );
 
 	static unsigned int computeTriangleSize( bool bAddAdjacentEdges,
 							bool bAddDominantEdges,
 							bool bAddDominantPosition);
 
+	// Number of threads used by mutateIndexBuffer on large buffers, 1 forces the serial path.
+	// Defaults to the DX11SHADER_PNAEN_THREADS environment variable, or to the Maya thread count.
+	// The generated indices do not depend on this value.
+	static unsigned int threadCount();
+	static void setThreadCount(unsigned int count);
+
+	// Reorder the generated patches for control point reuse in the post-transform cache.
+	// Off by default, set the DX11SHADER_PNAEN_REORDER environment variable to turn it on.
+	static bool reorderPatches();
+	static void setReorderPatches(bool reorder);
+
+	// mutateIndexing keeps the patches it generates in a cache keyed by the topology of the
+	// source indices, so deforming a mesh does not rebuild them. The size limit is in bytes,
+	// it defaults to the DX11SHADER_PNAEN_CACHE_SIZE environment variable in megabytes, or 256 MB.
+	//
+	// When DX11SHADER_PNAEN_CACHE_DIR is set, the patches are also saved in that directory
+	// and reused by the next sessions for identical meshes.
+	struct CacheStats
+	{
+		unsigned int hitCount;
+		unsigned int missCount;
+		unsigned int evictionCount;
+		unsigned int entryCount;
+		size_t size;
+		size_t sizeLimit;
+		unsigned int diskHitCount;
+		unsigned int diskMissCount;
+	};
+	static CacheStats cacheStats();
+	static void setCacheSizeLimit(size_t sizeLimit);
+	static void clearCache();
+
+	// Delete the files of the on-disk cache, return the number of files deleted.
+	static unsigned int purgeDiskCache();
+
 	static MHWRender::MPxIndexBufferMutator* createCrackFreePrimitiveGenerator18();
 	static MHWRender::MPxIndexBufferMutator* createCrackFreePrimitiveGenerator9();
 
@@ -59,4 +110,7 @@ private:
 	bool fAddAdjacentEdges;
 	bool fAddDominantEdges;
 	bool fAddDominantPosition;
+
+	static unsigned int sThreadCount;
+	static bool sReorderPatches;
 };
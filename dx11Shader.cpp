@@ -46,6 +46,7 @@
 #include <maya/MRenderProfile.h>
 #include <maya/MGeometryList.h>
 #include <maya/MPointArray.h>
+#include <maya/MMatrix.h>
 
 #include <maya/MViewport2Renderer.h>
 #include <maya/MDrawContext.h>
@@ -773,6 +774,64 @@ namespace
 		If no hull shader, return simple topology based on primitive type (points, lines, triangles ...)
 		If a hull shader is detected return the according patchlist based on the primitive type and primitive patch mode
 	*/
+	// The pass semantics a "drawContext" pass annotation can name, as bits
+	const MString* const sDrawContextSemantics[] =
+	{
+		&MHWRender::MPassContext::kColorPassSemantic,
+		&MHWRender::MPassContext::kShadowPassSemantic,
+		&MHWRender::MPassContext::kDepthPassSemantic,
+		&MHWRender::MPassContext::kNormalDepthPassSemantic,
+		&MHWRender::MPassContext::kTransparentPeelSemantic,
+		&MHWRender::MPassContext::kTransparentPeelAndAvgSemantic,
+		&MHWRender::MPassContext::kTransparentWeightedAvgSemantic,
+	};
+
+	unsigned int drawContextBit(const MString& drawContext)
+	{
+		for (unsigned int i = 0; i < sizeof(sDrawContextSemantics) / sizeof(sDrawContextSemantics[0]); ++i)
+		{
+			if (::_stricmp(drawContext.asChar(), sDrawContextSemantics[i]->asChar()) == 0)
+				return 1u << i;
+		}
+		return 0;
+	}
+
+	unsigned int drawContextBits(const MStringArray& passSem)
+	{
+		unsigned int bits = 0;
+		for (unsigned int i = 0; i < passSem.length(); ++i)
+			bits |= drawContextBit(passSem[i]);
+		return bits;
+	}
+
+	bool passContainsHullShader(ID3DX11EffectPass* dxPass)
+	{
+		D3DX11_PASS_SHADER_DESC hullShaderDesc;
+		HRESULT hr = dxPass->GetHullShaderDesc(&hullShaderDesc);
+
+		bool bContainsHullShader = false;
+		if(SUCCEEDED(hr) && hullShaderDesc.pShaderVariable && hullShaderDesc.pShaderVariable->IsValid())
+		{
+			// The most recent Effect11 library will return a pointer to an empty shader
+			// so we need to make sure there is actual bytecode before we ask for the
+			// shader itself.
+			D3DX11_EFFECT_SHADER_DESC hullEffectDesc;
+			hr = hullShaderDesc.pShaderVariable->GetShaderDesc(hullShaderDesc.ShaderIndex,&hullEffectDesc);
+
+			if (SUCCEEDED(hr) && hullEffectDesc.BytecodeLength) // This will not work if Optimize() has been called.
+			{
+				ID3D11HullShader* pHullShader = NULL;
+				hullShaderDesc.pShaderVariable->GetHullShader(hullShaderDesc.ShaderIndex,&pHullShader);
+				if(pHullShader)
+				{
+					bContainsHullShader = true;
+					pHullShader->Release();
+				}
+			}
+		}
+		return bContainsHullShader;
+	}
+
 	D3D11_PRIMITIVE_TOPOLOGY getPrimitiveTopology(MHWRender::MGeometry::Primitive primitiveType, int primitiveStride, bool containsHullShader)
 	{
 		D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
@@ -811,6 +870,175 @@ namespace
 		return topology;
 	}
 
+	/*
+		Widen the indices of a mapped index buffer to 32-bit.
+		The index type is resolved once per buffer by widenIndices().
+	*/
+	template <typename IndexType>
+	void widenIndices(const IndexType* indices, unsigned int indexCount, MUintArray& widenedIndices)
+	{
+		for (unsigned int iidx = 0; iidx < indexCount; ++iidx)
+			widenedIndices[iidx] = (unsigned int)indices[iidx];
+	}
+
+	void widenIndices(MHWRender::MGeometry::DataType indexDataType, const void* indices, unsigned int indexCount, MUintArray& widenedIndices)
+	{
+		switch (indexDataType)
+		{
+			case MHWRender::MGeometry::kChar:			widenIndices((const __int8*)indices, indexCount, widenedIndices); break;
+			case MHWRender::MGeometry::kUnsignedChar:	widenIndices((const unsigned __int8*)indices, indexCount, widenedIndices); break;
+			case MHWRender::MGeometry::kInt16:			widenIndices((const __int16*)indices, indexCount, widenedIndices); break;
+			case MHWRender::MGeometry::kUnsignedInt16:	widenIndices((const unsigned __int16*)indices, indexCount, widenedIndices); break;
+			case MHWRender::MGeometry::kInt32:			widenIndices((const __int32*)indices, indexCount, widenedIndices); break;
+			case MHWRender::MGeometry::kUnsignedInt32:	widenIndices((const unsigned __int32*)indices, indexCount, widenedIndices); break;
+			default:	break;
+		}
+	}
+
+	MUint64 hashBytes(MUint64 hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+		return hash;
+	}
+
+	/*
+		PN-AEN index buffers generated for the swatch geometry.
+
+		The swatch geometry is acquired for each swatch render but its content does not change.
+		The generated index buffers are looked up by the identity of the geometry: its D3D index,
+		position and uv buffers, plus the patch layout and the index format. A reference is kept on
+		these buffers so their addresses cannot be reused by another geometry while the entry lives.
+		The content is only hashed for a geometry not seen yet, to share the patches generated for
+		the same content when Maya allocates new buffers. The buffers are released when the device
+		changes or is removed, and when the plug-in is unloaded.
+	*/
+	class SwatchPatchBufferCache
+	{
+	public:
+		struct GeometryId
+		{
+			enum { kIndices, kPositions, kUVs, kBufferCount };
+
+			ID3D11Buffer* buffers[kBufferCount];
+			unsigned int description[4];
+
+			bool operator<(const GeometryId& rhs) const
+			{
+				int order = memcmp(buffers, rhs.buffers, sizeof(buffers));
+				return order < 0 || (order == 0 && memcmp(description, rhs.description, sizeof(description)) < 0);
+			}
+		};
+
+		// Return a new reference on the buffer cached for this geometry, or NULL.
+		static ID3D11Buffer* find(ID3D11Device* device, const GeometryId& geometry, unsigned int& indexCount)
+		{
+			checkDevice(device);
+
+			GeometryMap::const_iterator it = sGeometries.find(geometry);
+			if (it == sGeometries.end())
+				return NULL;
+			return find(device, it->second, indexCount);
+		}
+
+		// Return a new reference on the buffer cached for this content hash, or NULL.
+		static ID3D11Buffer* find(ID3D11Device* device, MUint64 contentKey, unsigned int& indexCount)
+		{
+			checkDevice(device);
+
+			EntryMap::const_iterator it = sEntries.find(contentKey);
+			if (it == sEntries.end())
+				return NULL;
+
+			indexCount = it->second.indexCount;
+			it->second.buffer->AddRef();
+			return it->second.buffer;
+		}
+
+		static void add(ID3D11Device* device, MUint64 contentKey, ID3D11Buffer* buffer, unsigned int indexCount)
+		{
+			if (device != sDevice)
+				return;
+
+			// Only a few swatch geometries are expected, start over if they keep changing
+			if (sEntries.size() >= kMaxEntries)
+				clear(device);
+
+			buffer->AddRef();
+			Entry& entry = sEntries[contentKey];
+			if (entry.buffer)
+				entry.buffer->Release();
+			entry.buffer = buffer;
+			entry.indexCount = indexCount;
+		}
+
+		// Look the content up by this geometry from now on
+		static void addGeometry(ID3D11Device* device, const GeometryId& geometry, MUint64 contentKey)
+		{
+			if (device != sDevice || sEntries.find(contentKey) == sEntries.end())
+				return;
+
+			if (sGeometries.size() >= kMaxEntries)
+				clearGeometries();
+
+			std::pair<GeometryMap::iterator, bool> inserted = sGeometries.insert(std::make_pair(geometry, contentKey));
+			if (inserted.second)
+			{
+				for (int i = 0; i < GeometryId::kBufferCount; ++i)
+					geometry.buffers[i]->AddRef();
+			}
+			else
+				inserted.first->second = contentKey;
+		}
+
+		static void clear(ID3D11Device* device = NULL)
+		{
+			clearGeometries();
+			for (EntryMap::iterator it = sEntries.begin(); it != sEntries.end(); ++it)
+				it->second.buffer->Release();
+			sEntries.clear();
+			sDevice = device;
+		}
+
+	private:
+		struct Entry
+		{
+			Entry() : buffer(NULL), indexCount(0) {}
+
+			ID3D11Buffer* buffer;
+			unsigned int indexCount;
+		};
+		typedef std::map<MUint64, Entry> EntryMap;
+		typedef std::map<GeometryId, MUint64> GeometryMap;
+
+		static const size_t kMaxEntries = 16;
+
+		static void checkDevice(ID3D11Device* device)
+		{
+			if (device != sDevice || (device != NULL && device->GetDeviceRemovedReason() != S_OK))
+				clear(device);
+		}
+
+		static void clearGeometries()
+		{
+			for (GeometryMap::iterator it = sGeometries.begin(); it != sGeometries.end(); ++it)
+			{
+				for (int i = 0; i < GeometryId::kBufferCount; ++i)
+					it->first.buffers[i]->Release();
+			}
+			sGeometries.clear();
+		}
+
+		static EntryMap sEntries;
+		static GeometryMap sGeometries;
+		static ID3D11Device* sDevice;
+	};
+
+	SwatchPatchBufferCache::EntryMap SwatchPatchBufferCache::sEntries;
+	SwatchPatchBufferCache::GeometryMap SwatchPatchBufferCache::sGeometries;
+	ID3D11Device* SwatchPatchBufferCache::sDevice = NULL;
+
 	struct MatchingParameter
 	{
 		MHWRender::MGeometry::Semantic semantic;
@@ -1045,45 +1273,18 @@ namespace
 	}
 
 	/*
-		Convenient function to create the list of varying parameter for a specified technique.
+		Convenient function to create the list of varying parameter for a specified technique,
+		from the vertex inputs of its passes gathered by the effect schema.
 		This is used when loading an effect to the dx11shader and also when creating a temporary
 		effect for the swatch and uv editor render.
 	*/
-	void buildVaryingParameterList(dx11ShaderDX11EffectTechnique* dxTechnique, unsigned int numPasses, MVaryingParameterList& varyingParameters, MString &errorLog, MString &warningLog, MString &customIndexBufferType)
+	void buildVaryingParameterList(const CEffectSchema::VaryingInputList& inputs, MVaryingParameterList& varyingParameters, MString &errorLog, MString &warningLog, MString &customIndexBufferType)
 	{
-		SetOfMString registeredSemantics;
-		for (unsigned int passId = 0; passId < numPasses; ++passId)
+		for (size_t i = 0; i < inputs.size(); ++i)
 		{
-			dx11ShaderDX11Pass* dxPass = dxTechnique->GetPassByIndex(passId);
-			if(dxPass == NULL || dxPass->IsValid() == false)
-				continue;
-
-			D3DX11_PASS_SHADER_DESC vertexShaderDesc;
-			dxPass->GetVertexShaderDesc(&vertexShaderDesc);
-
-			ID3DX11EffectShaderVariable* shaderVar = vertexShaderDesc.pShaderVariable;
-			if(shaderVar == NULL)
-				continue;
-
-			unsigned int shaderIndex = vertexShaderDesc.ShaderIndex;
-			D3DX11_EFFECT_SHADER_DESC shaderDesc;
-			shaderVar->GetShaderDesc(shaderIndex, &shaderDesc);
-			for (unsigned int varId = 0; varId < shaderDesc.NumInputSignatureEntries; ++varId)
-			{
-				D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
-				shaderVar->GetInputSignatureElementDesc(shaderIndex, varId, &paramDesc);
-
-				// Build a unique name based on semantic name + semantic index
-				MString uniqueName;
-				uniqueName.set( (double)paramDesc.SemanticIndex, 0 );
-				uniqueName = MString(paramDesc.SemanticName) + MString("_") + uniqueName;
-
-				if( registeredSemantics.count(uniqueName) == 0 )
-				{
-					appendVaryingParameter(paramDesc, varyingParameters, errorLog, warningLog, customIndexBufferType);
-					registeredSemantics.insert(uniqueName);
-				}
-			}
+			D3D11_SIGNATURE_PARAMETER_DESC paramDesc = inputs[i].desc;
+			paramDesc.SemanticName = inputs[i].semanticName.asChar();
+			appendVaryingParameter(paramDesc, varyingParameters, errorLog, warningLog, customIndexBufferType);
 		}
 	}
 
@@ -1118,19 +1319,18 @@ namespace
 			return false;
 		}
 
+		// The temporary effect is not shared, neither is its schema
+		CEffectSchema* schema = CDX11EffectCompileHelper::acquireEffectSchema(dxEffect);
+
 		// Create a new uniform parameters list and fill it from the effect
 		{
 			uniformParameters = new MUniformParameterList;
 
-			D3DX11_EFFECT_DESC effectDesc;
-			dxEffect->GetDesc(&effectDesc);
-			for (unsigned int varId = 0; varId < effectDesc.GlobalVariables; ++varId)
+			const CEffectSchema::UniformDescList& uniforms = schema->uniforms();
+			for (size_t i = 0; i < uniforms.size(); ++i)
 			{
-				ID3DX11EffectVariable* dxVar = dxEffect->GetVariableByIndex(varId);
-				CUniformParameterBuilder builder;
-				builder.init(dxVar, shaderNode, varId);
-				if(builder.build())
-					uniformParameters->append(builder.getParameter());
+				ID3DX11EffectVariable* dxVar = dxEffect->GetVariableByIndex(uniforms[i].variableIndex);
+				uniformParameters->append(CUniformParameterBuilder::createParameter(uniforms[i], dxVar, shaderNode));
 			}
 		}
 
@@ -1139,9 +1339,10 @@ namespace
 			varyingParameters = new MVaryingParameterList;
 
 			MString warningLog;
-			buildVaryingParameterList(dxTechnique, numPasses, *varyingParameters, errorLog, warningLog, customIndexBufferType);
+			buildVaryingParameterList(schema->varyingInputs(0), *varyingParameters, errorLog, warningLog, customIndexBufferType);
 		}
 
+		schema->release();
 		return true;
 	}
 
@@ -1407,6 +1608,125 @@ namespace
 
 		return attr;
 	}
+
+	/*
+	The view and projection matrices and the viewport size are the same for all
+	the shaders drawn in a pass. They are read once from the draw context for
+	all the nodes, instead of once per node through its uniform parameters.
+	The passes of a frame, like the shadow map passes, share the frame stamp
+	but not the camera: the values are read again when the view, the
+	projection or the viewport of the draw context differ, and the nodes push
+	them again when the version of the values changed.
+	*/
+	class FrameGlobals
+	{
+	public:
+		enum Slot
+		{
+			kView,
+			kViewTranspose,
+			kViewInverse,
+			kViewInverseTranspose,
+			kProjection,
+			kProjectionTranspose,
+			kProjectionInverse,
+			kProjectionInverseTranspose,
+			kViewProjection,
+			kViewProjectionTranspose,
+			kViewProjectionInverse,
+			kViewProjectionInverseTranspose,
+			kMatrixSlotCount,
+			kViewportPixelSize = kMatrixSlotCount,
+			kSlotCount
+		};
+
+		// Slot of the shared values of the parameter, -1 when it is not driven by the frame
+		static int slot(MUniformParameter& uniform)
+		{
+			if (uniform.type() != MUniformParameter::kTypeFloat)
+				return -1;
+
+			const MUniformParameter::DataSemantic sem = uniform.semantic();
+			if (sem == MUniformParameter::kSemanticViewportPixelSize)
+				return (uniform.numRows() * uniform.numColumns() == 2) ? kViewportPixelSize : -1;
+
+			if (uniform.numRows() != 4 || uniform.numColumns() != 4)
+				return -1;
+			for (int i = 0; i < kMatrixSlotCount; ++i)
+			{
+				if (sMatrices[i].semantic == sem)
+					return i;
+			}
+			return -1;
+		}
+
+		static const FrameGlobals& get(const MHWRender::MDrawContext& context)
+		{
+			static FrameGlobals sGlobals;
+			const MMatrix view = context.getMatrix(MHWRender::MFrameContext::kViewMtx);
+			const MMatrix projection = context.getMatrix(MHWRender::MFrameContext::kProjectionMtx);
+			int originX, originY, width, height;
+			context.getViewportDimensions(originX, originY, width, height);
+
+			if (sGlobals.fVersion == 0 || sGlobals.fView != view || sGlobals.fProjection != projection ||
+				sGlobals.fWidth != width || sGlobals.fHeight != height)
+			{
+				for (int i = 0; i < kMatrixSlotCount; ++i)
+				{
+					MMatrix matrix = context.getMatrix(sMatrices[i].matrixType);
+					matrix.get(sGlobals.fValues[i]);
+				}
+				sGlobals.fValues[kViewportPixelSize][0][0] = (float)width;
+				sGlobals.fValues[kViewportPixelSize][0][1] = (float)height;
+
+				sGlobals.fView = view;
+				sGlobals.fProjection = projection;
+				sGlobals.fWidth = width;
+				sGlobals.fHeight = height;
+				if (++sGlobals.fVersion == 0)
+					++sGlobals.fVersion;
+			}
+			return sGlobals;
+		}
+
+		const float* values(int slot) const { return &fValues[slot][0][0]; }
+
+		// Changes when the values are read again, never 0
+		unsigned int version() const { return fVersion; }
+
+	private:
+		FrameGlobals() : fWidth(0), fHeight(0), fVersion(0) {}
+
+		struct MatrixSlot
+		{
+			MUniformParameter::DataSemantic semantic;
+			MHWRender::MFrameContext::MatrixType matrixType;
+		};
+		static const MatrixSlot sMatrices[kMatrixSlotCount];
+
+		MMatrix fView;
+		MMatrix fProjection;
+		int fWidth;
+		int fHeight;
+		unsigned int fVersion;
+		float fValues[kSlotCount][4][4];
+	};
+
+	const FrameGlobals::MatrixSlot FrameGlobals::sMatrices[FrameGlobals::kMatrixSlotCount] =
+	{
+		{ MUniformParameter::kSemanticViewMatrix,								MHWRender::MFrameContext::kViewMtx },
+		{ MUniformParameter::kSemanticViewTransposeMatrix,						MHWRender::MFrameContext::kViewTransposeMtx },
+		{ MUniformParameter::kSemanticViewInverseMatrix,						MHWRender::MFrameContext::kViewInverseMtx },
+		{ MUniformParameter::kSemanticViewInverseTransposeMatrix,				MHWRender::MFrameContext::kViewInverseTransposeMtx },
+		{ MUniformParameter::kSemanticProjectionMatrix,							MHWRender::MFrameContext::kProjectionMtx },
+		{ MUniformParameter::kSemanticProjectionTransposeMatrix,				MHWRender::MFrameContext::kProjectionTranposeMtx },
+		{ MUniformParameter::kSemanticProjectionInverseMatrix,					MHWRender::MFrameContext::kProjectionInverseMtx },
+		{ MUniformParameter::kSemanticProjectionInverseTransposeMatrix,			MHWRender::MFrameContext::kProjectionInverseTransposeMtx },
+		{ MUniformParameter::kSemanticViewProjectionMatrix,						MHWRender::MFrameContext::kViewProjMtx },
+		{ MUniformParameter::kSemanticViewProjectionTransposeMatrix,			MHWRender::MFrameContext::kViewProjTransposeMtx },
+		{ MUniformParameter::kSemanticViewProjectionInverseMatrix,				MHWRender::MFrameContext::kViewProjInverseMtx },
+		{ MUniformParameter::kSemanticViewProjectionInverseTransposeMatrix,		MHWRender::MFrameContext::kViewProjInverseTransposeMtx },
+	};
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1472,9 +1792,12 @@ dx11ShaderNode::ELightType dx11ShaderNode::LightParameterInfo::lightType() const
 dx11ShaderNode::dx11ShaderNode()
 	: fGeometryVersionId(0)
 	, fLastFrameStamp((MUint64)-1)
+	, fFrameGlobalsVersion(0)
+	, fUniformAttributeIndicesResolved(false)
 	, fDuplicateNodeSource(NULL)
 	, fPostDuplicateCallBackId(NULL)
 	, fEffect(NULL)
+	, fEffectSchema(NULL)
 	, fTechniqueTextureMipMapLevels(1)
 	, fTechniqueIndexBufferType()
 	, fVaryingParametersUpdateId(0)
@@ -1494,6 +1817,7 @@ dx11ShaderNode::dx11ShaderNode()
 	, fLastTime(0)
 	, fVariableNameAsAttributeName(true)
 	, fMayaGammaCorrectVar(NULL)
+	, fPassDrawContextBits(0)
 	, fImplicitAmbientLight(-1)
 {
 	resetData();
@@ -1522,6 +1846,7 @@ dx11ShaderNode::dx11ShaderNode()
 dx11ShaderNode::~dx11ShaderNode()
 {
 	PostSceneUpdateAttributeRefresher::remove(this);
+	CDX11EffectCompileHelper::cancelBuild(this);
 	resetData();
 	fErrorLog.clear();
 }
@@ -1937,7 +2262,7 @@ bool dx11ShaderNode::getInternalValueInContext( const MPlug& plug, MDataHandle&
 	{
 		if (plug == sShader)
 		{
-			handle.set( fEffectName );
+			handle.set( fPendingEffectName.length() > 0 ? fPendingEffectName : fEffectName );
 		}
 		else if (plug == sTechnique)
 		{
@@ -2004,6 +2329,23 @@ MStatus dx11ShaderNode::setDependentsDirty(const MPlug & plugBeingDirtied, MPlug
 			shaderLightInfo.fIsDirty = true;
 	}
 
+	// Remember which uniform parameter needs to be pushed to the effect:
+	if (!fUniformAttributeIndicesResolved)
+		resolveUniformAttributeIndices();
+	if (!fUniformAttributeIndices.empty())
+	{
+		MPlug parameterPlug(plugBeingDirtied);
+		while (parameterPlug.isChild())
+			parameterPlug = parameterPlug.parent();
+		if (parameterPlug.isElement())
+			parameterPlug = parameterPlug.array();
+
+		MFnAttribute attr(parameterPlug.attribute());
+		std::map<std::string, int>::const_iterator it = fUniformAttributeIndices.find(attr.name().asChar());
+		if (it != fUniformAttributeIndices.end())
+			markUniformDirty(it->second);
+	}
+
 	return MPxHardwareShader::setDependentsDirty(plugBeingDirtied, affectedPlugs);
 }
 
@@ -2044,11 +2386,23 @@ void dx11ShaderNode::setTopoDirty()
 // Effect Management
 // ***********************************
 
+/*
+	Release the PN-AEN index buffers kept for the swatch rendering
+*/
+void dx11ShaderNode::releaseSwatchBuffers()
+{
+	SwatchPatchBufferCache::clear();
+}
+
 /*
 	Reload all the nodes that shared the same specified effect
 */
 bool dx11ShaderNode::reloadAll(const MString& effectName)
 {
+	// The file may have been moved, created or edited since it was searched
+	CDX11EffectCompileHelper::clearResolvedPaths();
+	CDX11EffectCompileHelper::clearFileTimeStamps();
+
 	CDX11EffectCompileHelper::ShaderNodeList nodes;
 	CDX11EffectCompileHelper::getNodesUsingEffect(effectName, nodes);
 	CDX11EffectCompileHelper::ShaderNodeList::const_iterator it = nodes.begin();
@@ -2085,6 +2439,21 @@ bool dx11ShaderNode::reloadAll(const MString& effectName)
 	return true;
 }
 
+/*
+	Reload the nodes of the effects that need to be compiled again,
+	the nodes of the other effects keep their effect
+*/
+unsigned int dx11ShaderNode::reloadOutdated()
+{
+	MStringArray effectNames;
+	CDX11EffectCompileHelper::getOutdatedEffects(effectNames);
+	for(unsigned int i = 0; i < effectNames.length(); ++i)
+	{
+		reloadAll(effectNames[i]);
+	}
+	return effectNames.length();
+}
+
 /*
 	Reload the effect from the current file
 */
@@ -2092,6 +2461,14 @@ bool dx11ShaderNode::reload()
 {
 	int currTechnique = fTechniqueIdx; //activeTechnique();
 
+	if (fPendingEffectName.length() > 0)
+	{
+		// Still compiling, it will load the new file
+		MString effectName = fPendingEffectName;
+		loadEffect(effectName);
+		return true;
+	}
+
 	loadEffect(fEffectName);
 
 	if(currTechnique >= 0 && currTechnique < techniqueCount())
@@ -2128,6 +2505,10 @@ bool dx11ShaderNode::loadEffect( const MString& shader)
 
 	bool loadedEffect = false;
 
+	// A new load replaces the one being compiled
+	CDX11EffectCompileHelper::cancelBuild(this);
+	fPendingEffectName.clear();
+
 	bool fileExits = true;
 	if (MFileIO::isReadingFile() || MFileIO::isOpeningFile()) {
 		MString resolvedFileName = CDX11EffectCompileHelper::resolveShaderFileName(shader, &fileExits);
@@ -2191,7 +2572,7 @@ bool dx11ShaderNode::loadEffect( const MString& shader)
 		}
 	}
 
-	if(loadedEffect == false)
+	if(loadedEffect == false && fPendingEffectName.length() == 0)
 	{
 		// Always keep the effect name, especially in OpenGL mode.
 		fEffectName = shader;
@@ -2208,6 +2589,13 @@ bool dx11ShaderNode::loadFromFile( const MString &fileName, dx11ShaderDX11Device
 	if (!dxDevice)
 		return false;
 
+	if (CDX11EffectCompileHelper::buildAsync(this, dxDevice, fileName, fErrorLog, effectCompiledCB))
+	{
+		// Keep the current effect until the compilation is done, see effectCompiledCB()
+		fPendingEffectName = fileName;
+		return false;
+	}
+
 	resetData();
 
 	fEffect = CDX11EffectCompileHelper::build(this, dxDevice, fileName, fErrorLog);
@@ -2234,6 +2622,56 @@ bool dx11ShaderNode::loadFromFile( const MString &fileName, dx11ShaderDX11Device
 	return true;
 }
 
+/*
+	Called on idle once the effect file given to loadFromFile() is compiled.
+	The effect is now in the caches: load it like a synchronous load would, but keep
+	the technique chosen while it was compiling, for example the one read from the scene file.
+*/
+/*static*/
+void dx11ShaderNode::effectCompiledCB( dx11ShaderNode* node, bool succeeded, const MString& errorLog )
+{
+	MString effectName = node->fPendingEffectName;
+	if (effectName.length() == 0)
+		return;
+
+	if (!succeeded)
+	{
+		node->fPendingEffectName.clear();
+		node->resetData();
+		node->fEffectName = effectName;
+		node->fErrorLog += errorLog;
+		node->displayErrorAndWarnings();
+		return;
+	}
+
+	const bool reloading = (effectName == node->fEffectName);
+	MString techniqueName = (node->fEffect == NULL ? node->fTechniqueName : MString());
+
+	if (reloading)
+	{
+		node->fPendingEffectName.clear();
+		node->reload();
+	}
+	else
+	{
+		node->loadEffect(effectName);
+	}
+
+	if (techniqueName.length() > 0 && techniqueName != node->fTechniqueName)
+	{
+		const MStringArray& techniqueNames = node->techniques();
+		for (unsigned int i = 0; i < techniqueNames.length(); ++i)
+		{
+			if (techniqueNames[i] == techniqueName)
+			{
+				MPlug techniquePlug( node->thisMObject(), sTechnique);
+				techniquePlug.setValue( techniqueName );
+				break;
+			}
+		}
+	}
+}
+
 /*
 	Load an effect from a system memory buffer.
 	A unique identifier should be supplied
@@ -2300,6 +2738,12 @@ void dx11ShaderNode::resetData(bool clearEffect)
 	fTechnique = NULL;
 	if (clearEffect && fEffect)
 	{
+		if (fEffectSchema)
+		{
+			fEffectSchema->release();
+			fEffectSchema = NULL;
+		}
+
 		CDX11EffectCompileHelper::releaseEffect(this, fEffect, fEffectName);
 		fEffect = NULL;
 
@@ -2317,6 +2761,8 @@ void dx11ShaderNode::resetData(bool clearEffect)
 	// Should Clear the uniform parameters
 	// ------------------------------------------
 	fUniformParameters.setLength(0);
+	fUniformSetters.clear();
+	buildUniformChangeTracking();
 
 	// Should Clear the varying parameters
 	// ------------------------------------------
@@ -2347,8 +2793,11 @@ void dx11ShaderNode::resetData(bool clearEffect)
 	fUVEditorGLTextureScaleU = fUVEditorGLTextureScaleV = 1.0f;
 #endif //USE_GL_TEXTURE_CACHING
 
-	// clear has hull shader map cache
-	fPassHasHullShaderMap.clear();
+	// clear the passes of the technique
+	fPassInfos.clear();
+	fPassDrawContextBits = 0;
+	fTemporaryPassInfos.clear();
+	fTemporaryUniformSetters.clear();
 
 	// clear and release input layout cache
 	{
@@ -2378,27 +2827,17 @@ void dx11ShaderNode::resetData(bool clearEffect)
 */
 bool dx11ShaderNode::techniqueHandlesContext(const MString& requestedContext) const
 {
-	bool handlesContext = false;
+	const unsigned int requestedBit = drawContextBit(requestedContext);
+	if (requestedBit)
+		return (fPassDrawContextBits & requestedBit) != 0;
 
-	if(fEffect && fEffect->IsValid() && fTechnique && fTechnique->IsValid())
+	for (size_t iPass = 0; iPass < fPassInfos.size(); ++iPass)
 	{
-		D3DX11_TECHNIQUE_DESC desc;
-		fTechnique->GetDesc(&desc);
-		for (unsigned int iPass = 0; iPass < desc.Passes && !handlesContext; ++iPass)
-		{
-			ID3DX11EffectPass *dxPass = fTechnique->GetPassByIndex(iPass);
-			if(dxPass && dxPass->IsValid())
-			{
-				MString drawContext;
-				getAnnotation(dxPass, "drawContext", drawContext);
-				if (::_stricmp(drawContext.asChar(), requestedContext.asChar()) == 0)
-				{
-					handlesContext = true;
-				}
-			}
-		}
+		const PassInfo& passInfo = fPassInfos[iPass];
+		if (passInfo.drawContextBit == 0 && ::_stricmp(passInfo.drawContext.asChar(), requestedContext.asChar()) == 0)
+			return true;
 	}
-	return handlesContext;
+	return false;
 }
 
 /*
@@ -2408,6 +2847,8 @@ bool dx11ShaderNode::techniqueHandlesContext(const MString& requestedContext) co
 bool dx11ShaderNode::initializeTechniques()
 {
 	fTechnique = NULL;
+	fPassInfos.clear();
+	fPassDrawContextBits = 0;
 	fTechniqueIdx = -1;
 	fTechniqueName.clear();
 	fTechniqueNames.clear();
@@ -2526,6 +2967,7 @@ bool dx11ShaderNode::setTechnique( int techniqueNumber )
     D3DX11_TECHNIQUE_DESC desc;
     fTechnique->GetDesc(&desc);
     fPassCount = desc.Passes;
+	buildPassInfos();
 
 	// Light names are affected by the chosen technique:
 	// -------------------------------------------------
@@ -2933,19 +3375,11 @@ bool dx11ShaderNode::techniqueSupportsAdvancedTransparency() const
 // Pass Management
 // ***********************************
 
-dx11ShaderDX11Pass* dx11ShaderNode::activatePass( dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11EffectTechnique* dxTechnique, unsigned int passId, ERenderType renderType ) const
-{
-	// When called for swatch or UV, we want the color pass:
-	MStringArray colorSem;
-	colorSem.append(MHWRender::MPassContext::kColorPassSemantic);
-	return activatePass( dxDevice, dxContext, dxTechnique, passId, colorSem, renderType );
-}
-
 /*
 	This method does the main expensive work of setting the active pass.
 */
 dx11ShaderDX11Pass* dx11ShaderNode::activatePass( dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11EffectTechnique* dxTechnique,
-												  unsigned int passId, const MStringArray& passSem, ERenderType renderType ) const
+												  unsigned int passId, const MStringArray& passSem, unsigned int passSemBits, ERenderType renderType ) const
 {
 	dx11ShaderDX11Pass* dxPass = dxTechnique->GetPassByIndex(passId);
 	if(dxPass == NULL || dxPass->IsValid() == false)
@@ -2959,21 +3393,23 @@ dx11ShaderDX11Pass* dx11ShaderNode::activatePass( dx11ShaderDX11Device *dxDevice
 		return NULL;
 	}
 
+	const PassInfo* passInfo = findPassInfo(passId, dxPass);
+
 	bool canActivate = true;
 
-	MString drawContext;
-	getAnnotation(dxPass, "drawContext", drawContext);
-	if (drawContext.length())
+	if (passInfo->drawContext.length())
 	{
 		// If the shader defines pass contexts, then we must make sure we are in the right one
-		// before activating:
-		canActivate = false;
-		for (unsigned int i=0; i<passSem.length() && !canActivate; i++)
+		// before activating. Only the contexts that are not pass semantics are compared by name.
+		if (passInfo->drawContextBit)
 		{
-			if (::_stricmp(passSem[i].asChar(), drawContext.asChar()) == 0)
-			{
-				canActivate = true;
-			}
+			canActivate = (passInfo->drawContextBit & passSemBits) != 0;
+		}
+		else
+		{
+			canActivate = false;
+			for (unsigned int i=0; i<passSem.length() && !canActivate; i++)
+				canActivate = (::_stricmp(passSem[i].asChar(), passInfo->drawContext.asChar()) == 0);
 		}
 	}
 
@@ -2982,14 +3418,10 @@ dx11ShaderDX11Pass* dx11ShaderNode::activatePass( dx11ShaderDX11Device *dxDevice
 		return NULL;
 	}
 
-	// Get state block mask : identify the states changed by the pass
-	D3DX11_STATE_BLOCK_MASK stateBlockMask;
-	memset(&stateBlockMask, 0, sizeof(D3DX11_STATE_BLOCK_MASK));
-	dxPass->ComputeStateBlockMask(&stateBlockMask);
-
 	// In case the pass modifies the rasterizer state, store the current state description
+	const bool changesRasterizerState = passInfo->changesRasterizerState;
 	D3D11_RASTERIZER_DESC orgRasterizerDesc;
-	if(stateBlockMask.RSRasterizerState)
+	if(changesRasterizerState)
 	{
 		ID3D11RasterizerState* orgRasterizerState;
 		dxContext->RSGetState(&orgRasterizerState);
@@ -3004,7 +3436,7 @@ dx11ShaderDX11Pass* dx11ShaderNode::activatePass( dx11ShaderDX11Device *dxDevice
 
 	dxPass->Apply(0, dxContext);
 
-	if(stateBlockMask.RSRasterizerState || renderType != RENDER_SCENE)
+	if(changesRasterizerState || renderType != RENDER_SCENE)
 	{
 		// Check new rasterizer state against stored one
 		ID3D11RasterizerState* newRasterizerState;
@@ -3032,7 +3464,7 @@ dx11ShaderDX11Pass* dx11ShaderNode::activatePass( dx11ShaderDX11Device *dxDevice
 
 		// SetRasterizerState used in a shader will change the state as a block, and not attribute by attribute.
 		// Restore depth attributes to prevent visual issue on the wireframe.
-		if( stateBlockMask.RSRasterizerState &&
+		if( changesRasterizerState &&
 			( newRasterizerDesc.DepthBias != orgRasterizerDesc.DepthBias ||
 			  newRasterizerDesc.SlopeScaledDepthBias != orgRasterizerDesc.SlopeScaledDepthBias ) )
 		{
@@ -3106,42 +3538,99 @@ dx11ShaderDX11Pass* dx11ShaderNode::activatePass( dx11ShaderDX11Device *dxDevice
 	return dxPass;
 }
 
-bool dx11ShaderNode::passHasHullShader(dx11ShaderDX11Pass* dxPass) const
+bool dx11ShaderNode::passHasHullShader(unsigned int passId, dx11ShaderDX11Pass* dxPass) const
+{
+	return findPassInfo(passId, dxPass)->hasHullShader;
+}
+
+/*
+	Gather what the draws need to know about the pass.
+*/
+void dx11ShaderNode::buildPassInfo(dx11ShaderDX11Pass* dxPass, PassInfo& info)
 {
-	PassHasHullShaderMap::const_iterator it = fPassHasHullShaderMap.find(dxPass);
-	if(it != fPassHasHullShaderMap.end())
-		return it->second;
+	info.pass = dxPass;
+
+	info.drawContext.clear();
+	getAnnotation(dxPass, "drawContext", info.drawContext);
+	info.drawContextBit = (info.drawContext.length() ? drawContextBit(info.drawContext) : 0);
+
+	info.hasHullShader = passContainsHullShader(dxPass);
 
-	D3DX11_PASS_SHADER_DESC hullShaderDesc;
-	HRESULT hr = dxPass->GetHullShaderDesc(&hullShaderDesc);
+	// Get state block mask : identify the states changed by the pass
+	D3DX11_STATE_BLOCK_MASK stateBlockMask;
+	memset(&stateBlockMask, 0, sizeof(D3DX11_STATE_BLOCK_MASK));
+	dxPass->ComputeStateBlockMask(&stateBlockMask);
+	info.changesRasterizerState = (stateBlockMask.RSRasterizerState != 0);
 
-	bool bContainsHullShader = false;
-	if(SUCCEEDED(hr) && hullShaderDesc.pShaderVariable && hullShaderDesc.pShaderVariable->IsValid())
+	D3DX11_PASS_DESC descPass;
+	if (SUCCEEDED(dxPass->GetDesc(&descPass)))
+	{
+		info.inputSignature = descPass.pIAInputSignature;
+		info.inputSignatureSize = descPass.IAInputSignatureSize;
+	}
+	else
 	{
-		// The most recent Effect11 library will return a pointer to an empty shader
-		// so we need to make sure there is actual bytecode before we ask for the
-		// shader itself.
-		D3DX11_EFFECT_SHADER_DESC hullEffectDesc;
-		hr = hullShaderDesc.pShaderVariable->GetShaderDesc(hullShaderDesc.ShaderIndex,&hullEffectDesc);
+		info.inputSignature = NULL;
+		info.inputSignatureSize = 0;
+	}
+}
 
-		if (SUCCEEDED(hr) && hullEffectDesc.BytecodeLength) // This will not work if Optimize() has been called.
-		{
-			ID3D11HullShader* pHullShader = NULL;
-			hullShaderDesc.pShaderVariable->GetHullShader(hullShaderDesc.ShaderIndex,&pHullShader);
-			if(pHullShader)
-			{
-				bContainsHullShader = true;
-				pHullShader->Release();
-			}
+/*
+	Build the pass table of the active technique, along with the draw
+	contexts handled by its passes.
+*/
+void dx11ShaderNode::buildPassInfos()
+{
+	fPassInfos.clear();
+	fPassDrawContextBits = 0;
+
+	if (!fTechnique || !fTechnique->IsValid())
+		return;
+
+	fPassInfos.reserve(fPassCount);
+	for (unsigned int iPass = 0; iPass < fPassCount; ++iPass)
+	{
+		dx11ShaderDX11Pass* dxPass = fTechnique->GetPassByIndex(iPass);
+		if (dxPass == NULL || dxPass->IsValid() == false)
+		{
+			// Keep the table indexed by pass, activatePass() reports the invalid pass
+			PassInfo invalidPassInfo;
+			invalidPassInfo.pass = NULL;
+			invalidPassInfo.drawContextBit = 0;
+			invalidPassInfo.hasHullShader = false;
+			invalidPassInfo.changesRasterizerState = false;
+			invalidPassInfo.inputSignature = NULL;
+			invalidPassInfo.inputSignatureSize = 0;
+			fPassInfos.push_back(invalidPassInfo);
+			continue;
 		}
+
+		fPassInfos.push_back(PassInfo());
+		buildPassInfo(dxPass, fPassInfos.back());
+		fPassDrawContextBits |= fPassInfos.back().drawContextBit;
 	}
+}
 
-	fPassHasHullShaderMap[dxPass] = bContainsHullShader;
+/*
+	The passes of the active technique are found by their index in the pass
+	table. The passes of the temporary effects used by the swatches are not in
+	the table, they are gathered once and kept until the effect is released.
+*/
+const dx11ShaderNode::PassInfo* dx11ShaderNode::findPassInfo(unsigned int passId, dx11ShaderDX11Pass* dxPass) const
+{
+	if (passId < fPassInfos.size() && fPassInfos[passId].pass == dxPass)
+		return &fPassInfos[passId];
 
-	return bContainsHullShader;
+	TemporaryPassInfoMap::iterator it = fTemporaryPassInfos.find(dxPass);
+	if (it == fTemporaryPassInfos.end())
+	{
+		it = fTemporaryPassInfos.insert(TemporaryPassInfoMap::value_type(dxPass, PassInfo())).first;
+		buildPassInfo(dxPass, it->second);
+	}
+	return &it->second;
 }
 
-dx11ShaderDX11InputLayout* dx11ShaderNode::getInputLayout(dx11ShaderDX11Device* dxDevice, dx11ShaderDX11Pass* dxPass, unsigned int numLayouts, const dx11ShaderDX11InputElementDesc* layoutDesc) const
+dx11ShaderDX11InputLayout* dx11ShaderNode::getInputLayout(dx11ShaderDX11Device* dxDevice, unsigned int passId, dx11ShaderDX11Pass* dxPass, unsigned int numLayouts, const dx11ShaderDX11InputElementDesc* layoutDesc) const
 {
 	PassInputLayoutMap::iterator it = fPassInputLayoutMap.find(dxPass);
 	if(it != fPassInputLayoutMap.end())
@@ -3176,11 +3665,10 @@ dx11ShaderDX11InputLayout* dx11ShaderNode::getInputLayout(dx11ShaderDX11Device*
 		fPassInputLayoutMap.erase(it);
 	}
 
-	D3DX11_PASS_DESC descPass;
-	dxPass->GetDesc(&descPass);
+	const PassInfo* passInfo = findPassInfo(passId, dxPass);
 
 	ID3D11InputLayout* inputLayout = NULL;
-	dxDevice->CreateInputLayout(layoutDesc, numLayouts, descPass.pIAInputSignature, descPass.IAInputSignatureSize, &inputLayout);
+	dxDevice->CreateInputLayout(layoutDesc, numLayouts, passInfo->inputSignature, passInfo->inputSignatureSize, &inputLayout);
 
 	// Cache the new layout
 	if(inputLayout != NULL)
@@ -3430,6 +3918,8 @@ MStatus dx11ShaderNode::renderSwatchImage( MImage & image )
 	if(dxEffect)
 	{
 		CDX11EffectCompileHelper::releaseEffect(this, dxEffect, "TemporaryEffect");
+		fTemporaryPassInfos.clear();
+		fTemporaryUniformSetters.clear();
 
 		// The parameters lists were created for the temporary effect
 		delete uniformParameters;
@@ -3785,6 +4275,8 @@ MStatus dx11ShaderNode::renderImage( const MPxHardwareShader::ShaderContext& sha
 	if(dxEffect)
 	{
 		CDX11EffectCompileHelper::releaseEffect(this, dxEffect, "TemporaryEffect");
+		fTemporaryPassInfos.clear();
+		fTemporaryUniformSetters.clear();
 
 		// The parameters lists were created for the temporary effect
 		delete uniformParameters;
@@ -4012,12 +4504,13 @@ bool dx11ShaderNode::renderTechnique(dx11ShaderDX11Device *dxDevice, dx11ShaderD
 {
 	bool result = false;
 
+	const unsigned int passSemBits = drawContextBits(passSem);
 	for(unsigned int passId = 0; passId < numPasses; ++passId)
 	{
-		dx11ShaderDX11Pass* dxPass = activatePass(dxDevice, dxContext, dxTechnique, passId, passSem, renderType);
+		dx11ShaderDX11Pass* dxPass = activatePass(dxDevice, dxContext, dxTechnique, passId, passSem, passSemBits, renderType);
 		if(dxPass)
 		{
-			result |= renderPass(dxDevice, dxContext, dxPass, renderItemList, varyingParameters, renderType, indexBufferType);
+			result |= renderPass(dxDevice, dxContext, dxPass, passId, renderItemList, varyingParameters, renderType, indexBufferType);
 		}
 	}
 
@@ -4027,7 +4520,7 @@ bool dx11ShaderNode::renderTechnique(dx11ShaderDX11Device *dxDevice, dx11ShaderD
 /*
 	Render all the geometries within the renderItemList using specified pass
 */
-bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass,
+bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass, unsigned int passId,
 								const RenderItemList& renderItemList,
 								const MVaryingParameterList& varyingParameters, ERenderType renderType, const MString& indexBufferType) const
 {
@@ -4044,7 +4537,7 @@ bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11De
 			{
 				int primitiveStride;
 				MHWRender::MGeometry::Primitive primitiveType = renderItem->primitive(primitiveStride);
-				result |= renderPass(dxDevice, dxContext, dxPass, geometry, primitiveType, primitiveStride, varyingParameters, renderType, indexBufferType);
+				result |= renderPass(dxDevice, dxContext, dxPass, passId, geometry, primitiveType, primitiveStride, varyingParameters, renderType, indexBufferType);
 			}
 		}
 	}
@@ -4063,12 +4556,16 @@ bool dx11ShaderNode::renderTechnique(dx11ShaderDX11Device *dxDevice, dx11ShaderD
 {
 	bool result = false;
 
+	// When called for swatch or UV, we want the color pass:
+	MStringArray colorSem;
+	colorSem.append(MHWRender::MPassContext::kColorPassSemantic);
+	const unsigned int colorSemBits = drawContextBits(colorSem);
 	for(unsigned int passId = 0; passId < numPasses; ++passId)
 	{
-		dx11ShaderDX11Pass* dxPass = activatePass(dxDevice, dxContext, dxTechnique, passId, renderType);
+		dx11ShaderDX11Pass* dxPass = activatePass(dxDevice, dxContext, dxTechnique, passId, colorSem, colorSemBits, renderType);
 		if(dxPass)
 		{
-			result |= renderPass(dxDevice, dxContext, dxPass, geometry, primitiveType, primitiveStride, varyingParameters, renderType, indexBufferType);
+			result |= renderPass(dxDevice, dxContext, dxPass, passId, geometry, primitiveType, primitiveStride, varyingParameters, renderType, indexBufferType);
 		}
 	}
 
@@ -4125,12 +4622,13 @@ bool dx11ShaderNode::renderTechnique(dx11ShaderDX11Device *dxDevice, dx11ShaderD
 
 	For the swatch rendering, the geometry buffers are provided by MGeometryUtilities,
 	if the crack free tessellation (PNAEN9 and PNAEN18) is enabled,
-	temporary buffers are created and the CrackFreePrimitiveGenerator is applied.
+	the CrackFreePrimitiveGenerator is applied and the resulting index buffer
+	is kept for the next swatch renders of the same geometry.
 
 	To improve the rendering performance, the input layout is cached and reused as much as possible
 	until the list of vertex buffers changes - usually when another technique is selected.
 */
-bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass,
+bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass, unsigned int passId,
 								const MHWRender::MGeometry* geometry, MHWRender::MGeometry::Primitive primitiveType, unsigned int primitiveStride,
 								const MVaryingParameterList& varyingParameters, ERenderType renderType, const MString& indexBufferType) const
 {
@@ -4139,13 +4637,13 @@ bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11De
 	if(idxBufferCount == 0 || vtxBufferCount == 0 || vtxBufferCount >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT)
 		return false;
 
-	bool bContainsHullShader = passHasHullShader(dxPass);
+	bool bContainsHullShader = passHasHullShader(passId, dxPass);
 
 	bool bAddPNAENAdjacentEdges = false;
 	bool bAddPNAENDominantEdges = false;
 	bool bAddPNAENDominantPosition = false;
-	std::vector<float> floatPNAENPositionBuffer;
-	std::vector<float> floatPNAENUVBuffer;
+	MHWRender::MVertexBuffer* pnaenPositionBuffer = NULL;
+	MHWRender::MVertexBuffer* pnaenUVBuffer = NULL;
 	if(renderType == RENDER_SWATCH)
 	{
 		if(indexBufferType == "PNAEN18") {
@@ -4215,20 +4713,14 @@ bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11De
 		if(semanticBufferCount == 0)
 			continue;
 
-		if (bAddPNAENAdjacentEdges &&
-			( (semantic == MHWRender::MGeometry::kPosition && floatPNAENPositionBuffer.empty()) ||
-				(semantic == MHWRender::MGeometry::kTexture && floatPNAENUVBuffer.empty()) ) )
+		// Keep the buffers the PN-AEN patches are generated from
+		if (bAddPNAENAdjacentEdges)
 		{
-			std::vector<float>& data = (semantic == MHWRender::MGeometry::kPosition ? floatPNAENPositionBuffer : floatPNAENUVBuffer);
-
-			unsigned int size = buffer->vertexCount() * dimension;
-			data.resize(size);
-
 			MHWRender::MVertexBuffer* nonConstBuffer = const_cast<MHWRender::MVertexBuffer*>(buffer);
-
-			const void* values = nonConstBuffer->map();
-			memcpy(&data[0], values, size * sizeof(float));
-			nonConstBuffer->unmap();
+			if (semantic == MHWRender::MGeometry::kPosition && pnaenPositionBuffer == NULL)
+				pnaenPositionBuffer = nonConstBuffer;
+			else if (semantic == MHWRender::MGeometry::kTexture && pnaenUVBuffer == NULL)
+				pnaenUVBuffer = nonConstBuffer;
 		}
 
 		// We can have multiple bindings at the same input slot:
@@ -4352,7 +4844,7 @@ bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11De
 	dxContext->IASetVertexBuffers(0, numBoundBuffers, vtxBuffers, strides, offsets);
 
 	// Acquire and set input layout based on vertex buffers
-	ID3D11InputLayout* inputLayout = getInputLayout(dxDevice, dxPass, numBoundBuffers, layout);
+	ID3D11InputLayout* inputLayout = getInputLayout(dxDevice, passId, dxPass, numBoundBuffers, layout);
 	if (inputLayout == NULL) return false;
 	dxContext->IASetInputLayout(inputLayout);
 
@@ -4397,49 +4889,84 @@ bool dx11ShaderNode::renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11De
 		unsigned int indexBufferSize = buffer->size();
 
 		ID3D11Buffer* customIdxBuffer = idxBuffer;
-		if (bAddPNAENAdjacentEdges && floatPNAENPositionBuffer.empty() == false && floatPNAENUVBuffer.empty() == false && formatSize != 2)
+		if (bAddPNAENAdjacentEdges && pnaenPositionBuffer != NULL && pnaenUVBuffer != NULL)
 		{
 			unsigned int indexCount = indexBufferSize;
+			unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(bAddPNAENAdjacentEdges, bAddPNAENDominantEdges, bAddPNAENDominantPosition);
 
-			MUintArray currentIndexBuffer;
-			currentIndexBuffer.setLength(indexCount);
+			// The patches multiply the index count, use 16-bit indices whenever the vertex ids fit,
+			// whatever the source index type.
+			bool use16BitPatches = (pnaenPositionBuffer->vertexCount() <= 0x10000);
+			MHWRender::MGeometry::DataType patchDataType = (use16BitPatches ? MHWRender::MGeometry::kUnsignedInt16 : MHWRender::MGeometry::kUnsignedInt32);
+			unsigned int patchFormatSize = (use16BitPatches ? 2 : 4);
+
+			// The swatch geometry does not change, look the patches up by its buffers first
+			SwatchPatchBufferCache::GeometryId geometryId;
+			geometryId.buffers[SwatchPatchBufferCache::GeometryId::kIndices] = idxBuffer;
+			geometryId.buffers[SwatchPatchBufferCache::GeometryId::kPositions] = (ID3D11Buffer*)pnaenPositionBuffer->resourceHandle();
+			geometryId.buffers[SwatchPatchBufferCache::GeometryId::kUVs] = (ID3D11Buffer*)pnaenUVBuffer->resourceHandle();
+			geometryId.description[0] = indexCount;
+			geometryId.description[1] = (unsigned int)indexDataType;
+			geometryId.description[2] = triSize;
+			geometryId.description[3] = (unsigned int)patchDataType;
+
+			bool hasGeometryId = (idxBuffer != NULL && geometryId.buffers[SwatchPatchBufferCache::GeometryId::kPositions] != NULL
+				&& geometryId.buffers[SwatchPatchBufferCache::GeometryId::kUVs] != NULL);
 
-			MHWRender::MIndexBuffer* nonConstBuffer = const_cast<MHWRender::MIndexBuffer*>(buffer);
+			customIdxBuffer = NULL;
+			if (hasGeometryId)
+				customIdxBuffer = SwatchPatchBufferCache::find(dxDevice, geometryId, indexBufferSize);
 
-			void* indices = nonConstBuffer->map();
-			for (unsigned int iidx = 0; iidx < indexCount; ++iidx)
+			if (customIdxBuffer == NULL)
 			{
-				switch (indexDataType)
+				MHWRender::MIndexBuffer* nonConstBuffer = const_cast<MHWRender::MIndexBuffer*>(buffer);
+				const void* indices = nonConstBuffer->map();
+				const float* positions = (const float*)pnaenPositionBuffer->map();
+				const float* uvs = (const float*)pnaenUVBuffer->map();
+
+				// New geometry, reuse the patches generated for the same content
+				MUint64 contentKey = hashBytes(0xCBF29CE484222325ULL, indices, indexCount * formatSize);
+				contentKey = hashBytes(contentKey, positions, pnaenPositionBuffer->vertexCount() * pnaenPositionBuffer->descriptor().dimension() * sizeof(float));
+				contentKey = hashBytes(contentKey, uvs, pnaenUVBuffer->vertexCount() * pnaenUVBuffer->descriptor().dimension() * sizeof(float));
+				contentKey = hashBytes(contentKey, geometryId.description, sizeof(geometryId.description));
+
+				customIdxBuffer = SwatchPatchBufferCache::find(dxDevice, contentKey, indexBufferSize);
+				if (customIdxBuffer == NULL)
 				{
-					case MHWRender::MGeometry::kChar:			currentIndexBuffer[iidx] = (unsigned int)((__int8*)indices)[iidx]; break;
-					case MHWRender::MGeometry::kUnsignedChar:	currentIndexBuffer[iidx] = (unsigned int)((unsigned __int8*)indices)[iidx]; break;
-					case MHWRender::MGeometry::kInt16:			currentIndexBuffer[iidx] = (unsigned int)((__int16*)indices)[iidx]; break;
-					case MHWRender::MGeometry::kUnsignedInt16:	currentIndexBuffer[iidx] = (unsigned int)((unsigned __int16*)indices)[iidx]; break;
-					case MHWRender::MGeometry::kInt32:			currentIndexBuffer[iidx] = (unsigned int)((__int32*)indices)[iidx]; break;
-					case MHWRender::MGeometry::kUnsignedInt32:	currentIndexBuffer[iidx] = (unsigned int)((unsigned __int32*)indices)[iidx]; break;
-					default:	continue;
+					MUintArray currentIndexBuffer;
+					currentIndexBuffer.setLength(indexCount);
+					widenIndices(indexDataType, indices, indexCount, currentIndexBuffer);
+
+					unsigned int numTri = indexCount/3;
+					indexBufferSize = numTri * triSize;
+					unsigned int dataBufferSize = indexBufferSize * patchFormatSize;
+					char* patchIndices = new char[dataBufferSize];
+					// The patch layout and index type are dispatched once for the whole buffer
+					CrackFreePrimitiveGenerator::mutateIndexBuffer( currentIndexBuffer, positions, uvs,
+										bAddPNAENAdjacentEdges, bAddPNAENDominantEdges, bAddPNAENDominantPosition,
+										patchDataType, patchIndices );
+
+					// Create new index buffer
+					const D3D11_BUFFER_DESC bufDesc = { dataBufferSize, D3D11_USAGE_IMMUTABLE, D3D11_BIND_INDEX_BUFFER, 0, 0, 0 };
+					const D3D11_SUBRESOURCE_DATA bufData = { patchIndices, 0, 0 };
+					dxDevice->CreateBuffer(&bufDesc, &bufData, &customIdxBuffer);
+					delete [] patchIndices;
+
+					if (customIdxBuffer)
+						SwatchPatchBufferCache::add(dxDevice, contentKey, customIdxBuffer, indexBufferSize);
 				}
-			}
-			nonConstBuffer->unmap();
 
-			unsigned int numTri = indexCount/3;
-			unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(bAddPNAENAdjacentEdges, bAddPNAENDominantEdges, bAddPNAENDominantPosition);
-			indexBufferSize = numTri * triSize;
-			unsigned int dataBufferSize = indexBufferSize * formatSize;
-			indices = new char[dataBufferSize];
-			CrackFreePrimitiveGenerator::mutateIndexBuffer( currentIndexBuffer, &floatPNAENPositionBuffer[0], &floatPNAENUVBuffer[0],
-								bAddPNAENAdjacentEdges, bAddPNAENDominantEdges, bAddPNAENDominantPosition,
-								(formatSize == 1 ? MHWRender::MGeometry::kUnsignedChar : MHWRender::MGeometry::kUnsignedInt32), indices );
+				if (customIdxBuffer && hasGeometryId)
+					SwatchPatchBufferCache::addGeometry(dxDevice, geometryId, contentKey);
+
+				pnaenUVBuffer->unmap();
+				pnaenPositionBuffer->unmap();
+				nonConstBuffer->unmap();
+			}
 
+			format = (use16BitPatches ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT);
 			primitiveStride = triSize;
 			primitiveType = MHWRender::MGeometry::kPatch;
-
-			// Create new index buffer
-			const D3D11_BUFFER_DESC bufDesc = { dataBufferSize, D3D11_USAGE_IMMUTABLE, D3D11_BIND_INDEX_BUFFER, 0, 0, 0 };
-			const D3D11_SUBRESOURCE_DATA bufData = { indices, 0, 0 };
-			customIdxBuffer = NULL;
-			dxDevice->CreateBuffer(&bufDesc, &bufData, &customIdxBuffer);
-			delete [] indices;
 		}
 
 		if (customIdxBuffer)
@@ -4530,12 +5057,14 @@ bool dx11ShaderNode::updateParameters( const MHWRender::MDrawContext& context, M
 		// We are rendering the swatch using current effect
 		// Reset the renderId, to be sure that the next updateParameters() will go through
 		fLastFrameStamp = (MUint64)-1;
+		fFrameGlobalsVersion = 0;
 		fForceUpdateTexture = false;
 	}
 	else
 	{
 		// We are rendering the proxy swatch or the uv texture (temporary effect)
 		fLastFrameStamp = (MUint64)-1;
+		fFrameGlobalsVersion = 0;
 		updateLightParameters = false;
 		// We need to update the texture when rendering the swatch or uv texture using a custom effect
 		updateTextures = true;
@@ -4565,81 +5094,105 @@ bool dx11ShaderNode::updateParameters( const MHWRender::MDrawContext& context, M
 
 	// Update uniform values
 	// -------------------------------------
-	D3DX11_EFFECT_TYPE_DESC descType;
-	for( int u = uniformParameters.length(); u--; ) {
-		MUniformParameter uniform = uniformParameters.getElement(u);
+	// The temporary effects used by the swatches come with their own parameters,
+	// their setters are kept until the temporary effect is released
+	UniformSetterList untrackedSetters;
+	const UniformSetterList* setters = &fUniformSetters;
+	const bool tracked = (&uniformParameters == &fUniformParameters && fUniformSetters.size() == (size_t)uniformParameters.length());
+	if (!tracked) {
+		if (&uniformParameters != &fUniformParameters) {
+			UniformSetterList& temporarySetters = fTemporaryUniformSetters[&uniformParameters];
+			if (temporarySetters.size() != (size_t)uniformParameters.length())
+				buildUniformSetters(uniformParameters, temporarySetters);
+			setters = &temporarySetters;
+		}
+		else {
+			buildUniformSetters(uniformParameters, untrackedSetters);
+			setters = &untrackedSetters;
+		}
+	}
 
-		if( uniform.hasChanged(context) || lightParametersToUpdate.count(u) || (updateTextures && uniform.isATexture()) ) {
+	/*
+	The parameters of the node only need to be looked at when their plug was
+	dirtied, when they are driven by Maya, or when they are light or texture
+	parameters that must be refreshed. Set the DX11SHADER_CHECK_DIRTY_UNIFORMS
+	environment variable to look at all of them instead, the parameters that
+	changed without being marked dirty are then reported.
+	*/
+	static const bool checkDirtyUniforms = (getenv("DX11SHADER_CHECK_DIRTY_UNIFORMS") != NULL);
+	// The parameters shared by the pass are set by updateFrameGlobalParameters()
+	const bool useFrameGlobals = (tracked && renderType == RENDER_SCENE);
+	if (useFrameGlobals)
+		updateFrameGlobalParameters( context );
+	if (tracked) {
+		fUniformCandidates.clear();
+		addUniformCandidates(fDirtyUniforms);
+		addUniformCandidates(fSemanticUniforms);
+		if (!useFrameGlobals)
+			addUniformCandidates(fFrameGlobalUniforms);
+		for (std::set<int>::const_iterator it = lightParametersToUpdate.begin(); it != lightParametersToUpdate.end(); ++it)
+			addUniformCandidate(*it);
+		if (updateTextures) {
+			for (size_t i = 0; i < fUniformSetters.size(); ++i) {
+				if (fUniformSetters[i].resource && !fUniformSetters[i].set)
+					addUniformCandidate((int)i);
+			}
+		}
+	}
+	const bool fullScan = !tracked || checkDirtyUniforms;
 
-			ID3DX11EffectVariable* effectVariable = (ID3DX11EffectVariable *)uniform.userData();
-			if (!effectVariable)  break;
+	for( int i = (fullScan ? uniformParameters.length() : (int)fUniformCandidates.size()); i--; ) {
+		const int u = (fullScan ? i : fUniformCandidates[i]);
+		MUniformParameter uniform = uniformParameters.getElement(u);
 
-			effectVariable->GetType()->GetDesc(&descType);
+		const bool changed = uniform.hasChanged(context);
+		if( changed && tracked && checkDirtyUniforms && !fUniformIsCandidate[u] &&
+			!(useFrameGlobals && fUniformFrameGlobalSlots[u] >= 0) ) {
+			MGlobal::displayWarning( dx11ShaderStrings::getString( dx11ShaderStrings::kWarningUndirtiedParameter, uniform.name() ) );
+		}
 
-			switch( uniform.type()) {
-				case MUniformParameter::kTypeFloat: {
+		if( changed || (tracked && fUniformIsDirty[u]) || lightParametersToUpdate.count(u) || (updateTextures && uniform.isATexture()) ) {
 
-					const float* data = uniform.getAsFloatArray(context);
-					if (data) {
-						if (descType.Class == D3D10_SVC_SCALAR) {
-							effectVariable->AsScalar()->SetFloat( data[0] );
-						} else if (descType.Class == D3D10_SVC_VECTOR) {
-							effectVariable->AsVector()->SetFloatVector( (float*)data );
-						} else if (descType.Class == D3D10_SVC_MATRIX_COLUMNS) {
-							effectVariable->AsMatrix()->SetMatrix( (float*)data );
-						} else if (descType.Class == D3D10_SVC_MATRIX_ROWS) {
-							effectVariable->AsMatrix()->SetMatrixTranspose( (float*)data );
-						} else {
-							// @@@@@ Error ?!?!
-						}
-					}
-				} break;
-				case MUniformParameter::kTypeInt:
-				case MUniformParameter::kTypeEnum:
-					{
-					if (descType.Class == D3D10_SVC_SCALAR) {
-						effectVariable->AsScalar()->SetInt( uniform.getAsInt(context) );
-					} else {
-						// @@@@@ Error ?!?!
-					}
-				} break;
-				case MUniformParameter::kTypeBool: {
-					if (descType.Class == D3D10_SVC_SCALAR) {
-						effectVariable->AsScalar()->SetBool( uniform.getAsBool(context) );
-					} else {
-						// @@@@@ Error ?!?!
-					}
-				} break;
-				case MUniformParameter::kTypeString: {
-					// @@@@@ Error ?!?!
-				} break;
-				default: {
-					if( uniform.isATexture()) {
-						ID3DX11EffectShaderResourceVariable* resourceVar = effectVariable->AsShaderResource();
-						if (resourceVar) {
-							MUniformParameter::DataSemantic sem = uniform.semantic();
-							if (sem == MUniformParameter::kSemanticTranspDepthTexture) {
-								const MHWRender::MTexture *tex = context.getInternalTexture(
-									MHWRender::MDrawContext::kDepthPeelingTranspDepthTexture);
-								resourceVar->SetResource((ID3D11ShaderResourceView*)tex->resourceHandle());
-							}
-							else if (sem == MUniformParameter::kSemanticOpaqueDepthTexture) {
-								const MHWRender::MTexture *tex = context.getInternalTexture(
-									MHWRender::MDrawContext::kDepthPeelingOpaqueDepthTexture);
-								resourceVar->SetResource((ID3D11ShaderResourceView*)tex->resourceHandle());
-							} else {
-								MString textureName, layerName;
-								int alphaChannelIdx;
-								getTextureDesc(context, uniform, textureName, layerName, alphaChannelIdx);
-								assignTexture(resourceVar, textureName, layerName, alphaChannelIdx, resourceTexture);
-							}
-						}
-					}
-				} break;
+			const UniformSetter& setter = (*setters)[u];
+			if (!setter.variable) {
+				// The candidates are not in the parameter order, only skip this one
+				if (fullScan) break;
+				continue;
+			}
+
+			if (setter.set) {
+				setter.set(setter, uniform, context);
+			}
+			else if (setter.resource) {
+				ID3DX11EffectShaderResourceVariable* resourceVar = setter.resource;
+				MUniformParameter::DataSemantic sem = uniform.semantic();
+				if (sem == MUniformParameter::kSemanticTranspDepthTexture) {
+					const MHWRender::MTexture *tex = context.getInternalTexture(
+						MHWRender::MDrawContext::kDepthPeelingTranspDepthTexture);
+					resourceVar->SetResource((ID3D11ShaderResourceView*)tex->resourceHandle());
+				}
+				else if (sem == MUniformParameter::kSemanticOpaqueDepthTexture) {
+					const MHWRender::MTexture *tex = context.getInternalTexture(
+						MHWRender::MDrawContext::kDepthPeelingOpaqueDepthTexture);
+					resourceVar->SetResource((ID3D11ShaderResourceView*)tex->resourceHandle());
+				} else {
+					MString textureName, layerName;
+					int alphaChannelIdx;
+					getTextureDesc(context, uniform, textureName, layerName, alphaChannelIdx);
+					assignTexture(resourceVar, textureName, layerName, alphaChannelIdx, resourceTexture);
+				}
 			}
 		}
 	}
 
+	if (tracked) {
+		for (size_t i = 0; i < fDirtyUniforms.size(); ++i)
+			fUniformIsDirty[fDirtyUniforms[i]] = 0;
+		fDirtyUniforms.clear();
+		for (size_t i = 0; i < fUniformCandidates.size(); ++i)
+			fUniformIsCandidate[fUniformCandidates[i]] = 0;
+	}
+
 	if(updateLightParameters)
 	{
 		// Update using draw context properties if light is explicitely connected.
@@ -4653,6 +5206,200 @@ bool dx11ShaderNode::updateParameters( const MHWRender::MDrawContext& context, M
 	return true;
 }
 
+/*
+Resolve once how each uniform parameter is set, instead of looking at the type
+of its effect variable every time it changes: the variable is cast to the
+interface matching its class and the setter is picked from the parameter type.
+Parameters whose type does not match their variable get no setter and are
+never pushed, strings included.
+*/
+void dx11ShaderNode::buildUniformSetters(MUniformParameterList& uniformParameters, UniformSetterList& setters)
+{
+	struct Set
+	{
+		static void floats(const UniformSetter& setter, MUniformParameter& uniform, const MHWRender::MDrawContext& context)
+		{
+			const float* data = uniform.getAsFloatArray(context);
+			if (data) setter.setFloats( setter, data );
+		}
+		static void floatScalar(const UniformSetter& setter, const float* data)
+		{
+			setter.scalar->SetFloat( data[0] );
+		}
+		static void floatVector(const UniformSetter& setter, const float* data)
+		{
+			setter.vector->SetFloatVector( (float*)data );
+		}
+		static void matrix(const UniformSetter& setter, const float* data)
+		{
+			setter.matrix->SetMatrix( (float*)data );
+		}
+		static void matrixTranspose(const UniformSetter& setter, const float* data)
+		{
+			setter.matrix->SetMatrixTranspose( (float*)data );
+		}
+		static void intScalar(const UniformSetter& setter, MUniformParameter& uniform, const MHWRender::MDrawContext& context)
+		{
+			setter.scalar->SetInt( uniform.getAsInt(context) );
+		}
+		static void boolScalar(const UniformSetter& setter, MUniformParameter& uniform, const MHWRender::MDrawContext& context)
+		{
+			setter.scalar->SetBool( uniform.getAsBool(context) );
+		}
+	};
+
+	D3DX11_EFFECT_TYPE_DESC descType;
+	setters.resize(uniformParameters.length());
+	for( int u = 0; u < uniformParameters.length(); ++u ) {
+		MUniformParameter uniform = uniformParameters.getElement(u);
+		UniformSetter& setter = setters[u];
+		setter.variable = (ID3DX11EffectVariable *)uniform.userData();
+		setter.resource = NULL;
+		setter.set = NULL;
+		setter.setFloats = NULL;
+		if (!setter.variable)  continue;
+
+		setter.variable->GetType()->GetDesc(&descType);
+
+		switch( uniform.type()) {
+			case MUniformParameter::kTypeFloat: {
+				if (descType.Class == D3D10_SVC_SCALAR) {
+					setter.scalar = setter.variable->AsScalar();
+					setter.setFloats = Set::floatScalar;
+				} else if (descType.Class == D3D10_SVC_VECTOR) {
+					setter.vector = setter.variable->AsVector();
+					setter.setFloats = Set::floatVector;
+				} else if (descType.Class == D3D10_SVC_MATRIX_COLUMNS) {
+					setter.matrix = setter.variable->AsMatrix();
+					setter.setFloats = Set::matrix;
+				} else if (descType.Class == D3D10_SVC_MATRIX_ROWS) {
+					setter.matrix = setter.variable->AsMatrix();
+					setter.setFloats = Set::matrixTranspose;
+				}
+				if (setter.setFloats) {
+					setter.set = Set::floats;
+				}
+			} break;
+			case MUniformParameter::kTypeInt:
+			case MUniformParameter::kTypeEnum: {
+				if (descType.Class == D3D10_SVC_SCALAR) {
+					setter.scalar = setter.variable->AsScalar();
+					setter.set = Set::intScalar;
+				}
+			} break;
+			case MUniformParameter::kTypeBool: {
+				if (descType.Class == D3D10_SVC_SCALAR) {
+					setter.scalar = setter.variable->AsScalar();
+					setter.set = Set::boolScalar;
+				}
+			} break;
+			case MUniformParameter::kTypeString:
+				break;
+			default: {
+				if( uniform.isATexture()) {
+					ID3DX11EffectShaderResourceVariable* resourceVar = setter.variable->AsShaderResource();
+					if (resourceVar) {
+						setter.resource = resourceVar;
+					}
+				}
+			} break;
+		}
+	}
+}
+
+/*
+Index the parameters for setDependentsDirty() and updateParameters(): the
+node only pushes to the effect the parameters whose plug was dirtied, plus
+the ones Maya drives through their semantic, which change without their
+plug. All the parameters start dirty so the new effect gets all the values.
+*/
+void dx11ShaderNode::buildUniformChangeTracking()
+{
+	const int parameterCount = fUniformParameters.length();
+
+	fUniformAttributeIndices.clear();
+	fUniformAttributeIndicesResolved = false;
+	fSemanticUniforms.clear();
+	fFrameGlobalUniforms.clear();
+	fUniformFrameGlobalSlots.assign(parameterCount, -1);
+	fDirtyUniforms.clear();
+	fUniformIsDirty.assign(parameterCount, 0);
+	fUniformCandidates.clear();
+	fUniformIsCandidate.assign(parameterCount, 0);
+
+	// Push the shared values of the frame to the new parameters on the next update
+	fLastFrameStamp = (MUint64)-1;
+	fFrameGlobalsVersion = 0;
+
+	for( int u = 0; u < parameterCount; ++u ) {
+		MUniformParameter uniform = fUniformParameters.getElement(u);
+
+		const int frameGlobalSlot = FrameGlobals::slot(uniform);
+		if (frameGlobalSlot >= 0 && (size_t)u < fUniformSetters.size() && fUniformSetters[u].setFloats) {
+			fUniformFrameGlobalSlots[u] = frameGlobalSlot;
+			fFrameGlobalUniforms.push_back(u);
+			continue;
+		}
+
+		const MUniformParameter::DataSemantic sem = uniform.semantic();
+		if (sem != MUniformParameter::kSemanticUnknown &&
+			(!uniform.isATexture() || sem == MUniformParameter::kSemanticTranspDepthTexture || sem == MUniformParameter::kSemanticOpaqueDepthTexture)) {
+			fSemanticUniforms.push_back(u);
+		}
+
+		markUniformDirty(u);
+	}
+}
+
+/*
+The attribute of a parameter is not always named after its variable, and is
+only created once the parameters are handed to the node: index the
+parameters by the attribute of their plug, when setDependentsDirty() first
+needs it after all the plugs exist.
+*/
+void dx11ShaderNode::resolveUniformAttributeIndices()
+{
+	fUniformAttributeIndices.clear();
+
+	const int parameterCount = fUniformParameters.length();
+	bool resolved = true;
+	for( int u = 0; u < parameterCount; ++u ) {
+		MUniformParameter uniform = fUniformParameters.getElement(u);
+		MPlug plug = uniform.getPlug();
+		if (plug.isNull()) {
+			resolved = false;
+			continue;
+		}
+
+		MFnAttribute attr(plug.attribute());
+		fUniformAttributeIndices[attr.name().asChar()] = u;
+	}
+
+	fUniformAttributeIndicesResolved = resolved;
+}
+
+void dx11ShaderNode::markUniformDirty(int parameterIndex)
+{
+	if (parameterIndex >= 0 && parameterIndex < (int)fUniformIsDirty.size() && !fUniformIsDirty[parameterIndex]) {
+		fUniformIsDirty[parameterIndex] = 1;
+		fDirtyUniforms.push_back(parameterIndex);
+	}
+}
+
+void dx11ShaderNode::addUniformCandidate(int parameterIndex) const
+{
+	if (parameterIndex >= 0 && parameterIndex < (int)fUniformIsCandidate.size() && !fUniformIsCandidate[parameterIndex]) {
+		fUniformIsCandidate[parameterIndex] = 1;
+		fUniformCandidates.push_back(parameterIndex);
+	}
+}
+
+void dx11ShaderNode::addUniformCandidates(const std::vector<int>& parameterIndices) const
+{
+	for (size_t i = 0; i < parameterIndices.size(); ++i)
+		addUniformCandidate(parameterIndices[i]);
+}
+
 void dx11ShaderNode::updateViewportGlobalParameters( const MHWRender::MDrawContext& context ) const
 {
 	if(fMayaGammaCorrectVar)
@@ -4662,6 +5409,25 @@ void dx11ShaderNode::updateViewportGlobalParameters( const MHWRender::MDrawConte
 	}
 }
 
+void dx11ShaderNode::updateFrameGlobalParameters( const MHWRender::MDrawContext& context ) const
+{
+	if (fFrameGlobalUniforms.empty())
+		return;
+
+	// Only push the values when the pass changed them since this node last did
+	const FrameGlobals& frameGlobals = FrameGlobals::get( context );
+	if (frameGlobals.version() == fFrameGlobalsVersion)
+		return;
+	fFrameGlobalsVersion = frameGlobals.version();
+
+	for (size_t i = 0; i < fFrameGlobalUniforms.size(); ++i)
+	{
+		const int u = fFrameGlobalUniforms[i];
+		const UniformSetter& setter = fUniformSetters[u];
+		setter.setFloats( setter, frameGlobals.values(fUniformFrameGlobalSlots[u]) );
+	}
+}
+
 /*
 The effect needs to compute shadows only if three conditions are met:
 	1- Shadowcasting is globally enabled (Lighting->Shadow in view)
@@ -4733,6 +5499,8 @@ void dx11ShaderNode::clearParameters()
 	clearLightConnectionData();
 
 	fUniformParameters.setLength(0);
+	fUniformSetters.clear();
+	buildUniformChangeTracking();
 	setUniformParameters( fUniformParameters, true );
 
 	fVaryingParametersUpdateId = 0;
@@ -4761,12 +5529,12 @@ void dx11ShaderNode::preBuildUniformParameterList()
 }
 
 /*
-Build the uniform parameter list by processing all the parameter information
-stored in the effect. We let the CUniformParameterBuilder helper class take
-care of extracting all the information, then we sort all parameters according
-to a potentially defined UIOrder. This is also where we properly order the
-UIGroups defined in the parameter annotations, and create the helper structure
-that remembers which parameter belongs to which group.
+Build the uniform parameter list from the schema of the effect. The schema holds all
+the parameter information stored in the effect, extracted once for all the nodes
+using the effect by the CUniformParameterBuilder helper class: the parameters sorted
+according to a potentially defined UIOrder, the UIGroups defined in the parameter
+annotations sorted the same way, and which parameter belongs to which group.
+The node creates its parameters from it, bound to the variables of its own effect.
 */
 bool dx11ShaderNode::buildUniformParameterList()
 {
@@ -4779,64 +5547,29 @@ bool dx11ShaderNode::buildUniformParameterList()
 		return false;
 	}
 
-    D3DX11_EFFECT_DESC		desc;
-    fEffect->GetDesc(&desc);
+	if (fEffectSchema == NULL) {
+		fEffectSchema = CDX11EffectCompileHelper::acquireEffectSchema(fEffect);
+	}
+	fWarningLog += fEffectSchema->warnings();
 
-    // Iterate the effect parameters, processing each one.
+    // Create the parameters, bound to the variables of the node's effect
 	// --------------------------------------------------------------
 	fUniformParameters.setLength(0);
-	std::vector< CUniformParameterBuilder > builders;
-	std::vector< CUniformParameterBuilder* > successfulBuilder;
-	builders.resize(desc.GlobalVariables);
-	for (unsigned int i = 0; i < desc.GlobalVariables; i++)
+	const CEffectSchema::UniformDescList& uniforms = fEffectSchema->uniforms();
+	for (size_t i = 0; i < uniforms.size(); i++)
 	{
-        ID3DX11EffectVariable* pD3DVar = fEffect->GetVariableByIndex(i);
-		CUniformParameterBuilder& builder = builders[i];
-		builder.init(pD3DVar,this,i);
-		if(builder.build())
-		{
-			successfulBuilder.push_back(&builder);
-		}
-		else
-		{
-			fWarningLog += builder.getWarnings();
-		}
+        ID3DX11EffectVariable* pD3DVar = fEffect->GetVariableByIndex(uniforms[i].variableIndex);
+		fUniformParameters.append(CUniformParameterBuilder::createParameter(uniforms[i], pD3DVar, this));
     }
-	std::sort(successfulBuilder.begin(),successfulBuilder.end(),CUniformParameterBuilder::compareUIOrder );
-
-	fUIGroupParameters.clear();
-	fUIGroupParameters.resize(fUIGroupNames.length());
 
-	// All the groups were initially added in the same order as
-	// they were returned from the compiler. We want them to be
-	// sorted by UIOrder instead:
-	std::vector<int> uiGroupRemapping;
-	uiGroupRemapping.resize(fUIGroupNames.length(), -1);
-	int numRemapped = 0;
-	MStringArray sortedUIGroupNames;
+	fUIGroupNames = fEffectSchema->uiGroupNames();
+	fUIGroupParameters = fEffectSchema->uiGroupParameters();
+	fLightNames = fEffectSchema->lightNames();
 
-	std::vector< CUniformParameterBuilder* >::iterator iter = successfulBuilder.begin();
-	for(; iter != successfulBuilder.end();++iter)
-	{
-		CUniformParameterBuilder* pBuilder(*iter);
-		fUniformParameters.append(pBuilder->getParameter());
-
-		int uiGroupIndex = pBuilder->getUIGroupIndex();
-		if (uiGroupIndex >= 0)
-		{
-			if (uiGroupRemapping[uiGroupIndex] == -1) {
-				sortedUIGroupNames.append(fUIGroupNames[(unsigned int)uiGroupIndex]);
-				uiGroupRemapping[uiGroupIndex] = numRemapped;
-				++numRemapped;
-			}
-			uiGroupIndex = uiGroupRemapping[uiGroupIndex];
-
-			fUIGroupParameters[uiGroupIndex].push_back(fUniformParameters.length() - 1);
-		}
-	}
-	fUIGroupNames = sortedUIGroupNames;
+	buildUniformSetters(fUniformParameters, fUniformSetters);
+	buildUniformChangeTracking();
 
-	updateImplicitLightParameterCache( successfulBuilder);
+	updateImplicitLightParameterCache(*fEffectSchema);
 	displayErrorAndWarnings();
 	return true;
 }
@@ -4863,13 +5596,13 @@ bool dx11ShaderNode::buildVaryingParameterList()
 	fVaryingParametersUpdateId = 0;
 	fVaryingParameters.setLength(0);
 
-    ID3DX11EffectTechnique* dxTechnique = fEffect->GetTechniqueByIndex( fTechniqueIdx );
-	if (dxTechnique)
-	{
-	    D3DX11_TECHNIQUE_DESC descTechnique;
-		dxTechnique->GetDesc(&descTechnique);
+	if (fEffectSchema == NULL) {
+		fEffectSchema = CDX11EffectCompileHelper::acquireEffectSchema(fEffect);
+	}
 
-		::buildVaryingParameterList(dxTechnique, descTechnique.Passes, fVaryingParameters, fErrorLog, fWarningLog, fTechniqueIndexBufferType);
+	if (fTechniqueIdx >= 0)
+	{
+		::buildVaryingParameterList(fEffectSchema->varyingInputs(fTechniqueIdx), fVaryingParameters, fErrorLog, fWarningLog, fTechniqueIndexBufferType);
 	}
 
 	buildVertexDescriptorFromVaryingParameters();
@@ -6014,7 +6747,7 @@ void dx11ShaderNode::updateExplicitLightConnections(const MHWRender::MDrawContex
 						 connection panel and to filter which scene lights can appear in the dropdowns for
 						 explicit connection
 */
-void dx11ShaderNode::updateImplicitLightParameterCache(std::vector<CUniformParameterBuilder*>& builders)
+void dx11ShaderNode::updateImplicitLightParameterCache(const CEffectSchema& schema)
 {
 	MFnDependencyNode fnDepThisNode(thisMObject());
 	MDGModifier implicitModifier;
@@ -6063,18 +6796,16 @@ void dx11ShaderNode::updateImplicitLightParameterCache(std::vector<CUniformParam
 		the light group name, or by finding a semantic type that is exclusive to one
 		light type (like cone angle).
 	*/
-	std::vector<CUniformParameterBuilder*>::iterator iter = builders.begin();
+	const CEffectSchema::UniformDescList& uniforms = schema.uniforms();
+	CEffectSchema::UniformDescList::const_iterator iter = uniforms.begin();
 	int index = 0;
 	CUniformParameterBuilder::ELightType currLightType = CUniformParameterBuilder::eNotLight;
 	CUniformParameterBuilder::ELightParameterType paramType;
-	for(;iter != builders.end();++iter,++index)
+	for(;iter != uniforms.end();++iter,++index)
 	{
-		CUniformParameterBuilder* currBuilder = *iter;
-
-		if(!currBuilder->isValidUniformParameter())
-			continue;
+		const CUniformParameterBuilder::Desc& currDesc = *iter;
 
-		int lightIndex = currBuilder->getLightIndex();
+		int lightIndex = currDesc.lightIndex;
 		if (lightIndex < 0)
 			continue;
 
@@ -6083,14 +6814,14 @@ void dx11ShaderNode::updateImplicitLightParameterCache(std::vector<CUniformParam
 		// A shader parameter can have a light group "Object" annotation but have
 		// no recognized light semantics. In this case we do not need to add
 		// this parameter to the light parameter set.
-		if(currBuilder->getLightType() !=  CUniformParameterBuilder::eNotLight)
+		if(currDesc.lightType !=  CUniformParameterBuilder::eNotLight)
 		{
 			if(currLightType == CUniformParameterBuilder::eNotLight)
 			{
-				currLightType = currBuilder->getLightType();
+				currLightType = currDesc.lightType;
 			}
 
-			paramType = currBuilder->getLightParameterType();
+			paramType = currDesc.lightParameterType;
 			if (paramType == CUniformParameterBuilder::eLightType)
 			{
 				// This light can be connected to any scene light and react correctly:
@@ -6099,7 +6830,7 @@ void dx11ShaderNode::updateImplicitLightParameterCache(std::vector<CUniformParam
 
 			currLight.fConnectableParameters.insert(LightParameterInfo::TConnectableParameters::value_type(index, paramType));
 
-			switch(currBuilder->getLightType())
+			switch(currDesc.lightType)
 			{
 			case CUniformParameterBuilder::eUndefinedLight:
 				currLight.fLightType = eUndefinedLight;
@@ -42,6 +42,9 @@
 	#define dx11ShaderDX11InputElementDesc D3D11_INPUT_ELEMENT_DESC
 	#define dx11ShaderDX11EffectVariable ID3DX11EffectVariable
 	#define dx11ShaderDX11EffectShaderResourceVariable ID3DX11EffectShaderResourceVariable
+	#define dx11ShaderDX11EffectScalarVariable ID3DX11EffectScalarVariable
+	#define dx11ShaderDX11EffectVectorVariable ID3DX11EffectVectorVariable
+	#define dx11ShaderDX11EffectMatrixVariable ID3DX11EffectMatrixVariable
 	#define dx11ShaderDX11RasterizerState ID3D11RasterizerState
 	#define dx11ShaderDX11DepthStencilState ID3D11DepthStencilState
 	#define dx11ShaderDX11BlendState ID3D11BlendState
@@ -55,15 +58,20 @@
 	#define dx11ShaderDX11InputElementDesc void
 	#define dx11ShaderDX11EffectVariable void
 	#define dx11ShaderDX11EffectShaderResourceVariable void
+	#define dx11ShaderDX11EffectScalarVariable void
+	#define dx11ShaderDX11EffectVectorVariable void
+	#define dx11ShaderDX11EffectMatrixVariable void
 	#define dx11ShaderDX11RasterizerState void
 	#define dx11ShaderDX11DepthStencilState void
 	#define dx11ShaderDX11BlendState void
 #endif
 #include <map>
 #include <set>
+#include <string>
 #include <vector>
 
 class CUniformParameterBuilder;
+class CEffectSchema;
 class MRenderProfile;
 
 namespace MHWRender {
@@ -194,6 +202,12 @@ public:
 	static bool reloadAll(const MString& effectName);
 	bool reload();
 
+	// Reload the effects whose file or included files changed, return the number of effects reloaded
+	static unsigned int reloadOutdated();
+
+	// Release the index buffers generated for the swatch rendering, called on plug-in unload
+	static void releaseSwatchBuffers();
+
 	const MString& effectName() const;
 	dx11ShaderDX11Effect* effect() const;
 
@@ -203,6 +217,7 @@ private:
 	bool loadEffect( const MString& effectName );
 
 	bool loadFromFile( const MString& fileName, dx11ShaderDX11Device* dxDevice);
+	static void effectCompiledCB( dx11ShaderNode* node, bool succeeded, const MString& errorLog );
 	bool loadFromBuffer( const MString& identifier, const void* pData, unsigned int dataSize, dx11ShaderDX11Device* dxDevice);
 
 	bool initializeEffect();
@@ -250,11 +265,33 @@ public:
 	int passCount() const;
 
 private:
-	dx11ShaderDX11Pass* activatePass( dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11EffectTechnique* dxTechnique, unsigned int passId, ERenderType renderType ) const;
-	dx11ShaderDX11Pass* activatePass( dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11EffectTechnique* dxTechnique, unsigned int passId, const MStringArray& passSem, ERenderType renderType ) const;
+	/*
+		What the draws need to know about a pass of the active technique, gathered
+		once by setTechnique() instead of querying the effect on every draw.
+	*/
+	struct PassInfo
+	{
+		dx11ShaderDX11Pass* pass;
+		// The "drawContext" annotation of the pass, empty when the pass is drawn in all contexts,
+		// and its bit when it names one of the pass semantics of drawContextBit()
+		MString drawContext;
+		unsigned int drawContextBit;
+		bool hasHullShader;
+		// From the state block mask of the pass
+		bool changesRasterizerState;
+		const void* inputSignature;
+		size_t inputSignatureSize;
+	};
+	typedef std::vector<PassInfo> PassInfoList;
+	static void buildPassInfo(dx11ShaderDX11Pass* dxPass, PassInfo& info);
+	void buildPassInfos();
+	const PassInfo* findPassInfo(unsigned int passId, dx11ShaderDX11Pass* dxPass) const;
+
+	// passSemBits are the drawContextBit() of the pass semantics, computed once per draw
+	dx11ShaderDX11Pass* activatePass( dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11EffectTechnique* dxTechnique, unsigned int passId, const MStringArray& passSem, unsigned int passSemBits, ERenderType renderType ) const;
 
-	bool passHasHullShader(dx11ShaderDX11Pass* dxPass) const;
-	dx11ShaderDX11InputLayout* getInputLayout(dx11ShaderDX11Device* dxDevice, dx11ShaderDX11Pass* dxPass, unsigned int numLayouts, const dx11ShaderDX11InputElementDesc* layoutDesc) const;
+	bool passHasHullShader(unsigned int passId, dx11ShaderDX11Pass* dxPass) const;
+	dx11ShaderDX11InputLayout* getInputLayout(dx11ShaderDX11Device* dxDevice, unsigned int passId, dx11ShaderDX11Pass* dxPass, unsigned int numLayouts, const dx11ShaderDX11InputElementDesc* layoutDesc) const;
 
 	/////////////////////////////////
 	// Rendering
@@ -283,7 +320,7 @@ private:
 					unsigned int numPasses, const MStringArray& passSem,
 					const RenderItemList& renderItemList,
 					const MVaryingParameterList& varyingParameters, ERenderType renderType, const MString& indexBufferType) const;
-	bool renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass,
+	bool renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass, unsigned int passId,
 					const RenderItemList& renderItemList,
 					const MVaryingParameterList& varyingParameters, ERenderType renderType, const MString& indexBufferType) const;
 
@@ -292,7 +329,7 @@ private:
 					const MHWRender::MGeometry* geometry, MHWRender::MGeometry::Primitive primitiveType, unsigned int primitiveStride,
 					const MVaryingParameterList& varyingParameters, ERenderType renderType, const MString& indexBufferType ) const;
 
-	bool renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass,
+	bool renderPass(dx11ShaderDX11Device *dxDevice, dx11ShaderDX11DeviceContext *dxContext, dx11ShaderDX11Pass* dxPass, unsigned int passId,
 					const MHWRender::MGeometry* geometry, MHWRender::MGeometry::Primitive primitiveType, unsigned int primitiveStride,
 					const MVaryingParameterList& varyingParameters, ERenderType renderType, const MString& indexBufferType) const;
 
@@ -309,7 +346,42 @@ public:
 private:
 	typedef std::map< dx11ShaderDX11EffectShaderResourceVariable*, MHWRender::MTexture* > ResourceTextureMap;
 	bool updateParameters( const MHWRender::MDrawContext& context, MUniformParameterList& uniformParameters, ResourceTextureMap &resourceTexture, ERenderType renderType ) const;
+
+	/*
+		How each uniform parameter is pushed to its effect variable, resolved once when the
+		parameter list is built: the variable is already cast to the interface matching its
+		class, and the setter matches the parameter type. Textures have no setter, they are
+		assigned by updateParameters() from the resource variable.
+	*/
+	struct UniformSetter;
+	typedef void (*UniformSetFunction)(const UniformSetter& setter, MUniformParameter& uniform, const MHWRender::MDrawContext& context);
+	typedef void (*UniformSetFloatsFunction)(const UniformSetter& setter, const float* data);
+	struct UniformSetter
+	{
+		dx11ShaderDX11EffectVariable* variable;
+		union
+		{
+			dx11ShaderDX11EffectScalarVariable* scalar;
+			dx11ShaderDX11EffectVectorVariable* vector;
+			dx11ShaderDX11EffectMatrixVariable* matrix;
+			dx11ShaderDX11EffectShaderResourceVariable* resource;
+		};
+		UniformSetFunction set;
+		// Float parameters only, set from values not coming from the parameter
+		UniformSetFloatsFunction setFloats;
+	};
+	typedef std::vector<UniformSetter> UniformSetterList;
+	static void buildUniformSetters(MUniformParameterList& uniformParameters, UniformSetterList& setters);
+
+	// Parameters to push at the next update, see setDependentsDirty()
+	void buildUniformChangeTracking();
+	void resolveUniformAttributeIndices();
+	void markUniformDirty(int parameterIndex);
+	void addUniformCandidate(int parameterIndex) const;
+	void addUniformCandidates(const std::vector<int>& parameterIndices) const;
+
 	void updateViewportGlobalParameters( const MHWRender::MDrawContext& context ) const;
+	void updateFrameGlobalParameters( const MHWRender::MDrawContext& context ) const;
 
 public:
 	void updateShaderBasedGeoChanges();
@@ -368,7 +440,7 @@ private:
 	void updateExplicitLightConnections(const MHWRender::MDrawContext& context, ERenderType renderType) const;
 
 private:
-	void updateImplicitLightParameterCache(std::vector<CUniformParameterBuilder*>& builders);
+	void updateImplicitLightParameterCache(const CEffectSchema& schema);
 	void clearLightConnectionData();
 
 private:
@@ -438,6 +510,8 @@ private:
 
 	// Identifier to track scene-render-frame in order to optimize the updateParameter routine.
 	mutable MUint64					fLastFrameStamp;
+	// Version of the values shared by the nodes drawn in a pass that were last pushed to the effect, 0 for none
+	mutable unsigned int			fFrameGlobalsVersion;
 
 	// For duplicate
 	dx11ShaderNode*					fDuplicateNodeSource;
@@ -447,8 +521,12 @@ private:
 	///////////// Effect Management
 	// Effect name
 	MString							fEffectName;
+	// Effect file compiled in the background, the current effect is kept until it is done
+	MString							fPendingEffectName;
 	// Pointer to effect
 	dx11ShaderDX11Effect*			fEffect;
+	// Reflection of the effect, shared with the nodes using the same effect
+	CEffectSchema*					fEffectSchema;
 
 	///////////// Technique Management
 	// List of techniques by name
@@ -481,6 +559,23 @@ private:
 	///////////// Uniform Parameters
 	// List of uuniform parameters.
 	MUniformParameterList			fUniformParameters;
+	// Setters of the uniform parameters, in the same order
+	UniformSetterList				fUniformSetters;
+	// Parameters whose plug was dirtied since they were last pushed to the effect
+	mutable std::vector<int>		fDirtyUniforms;
+	mutable std::vector<char>		fUniformIsDirty;
+	// Parameters driven by Maya instead of their plug (matrices, time, view...), checked on every update
+	std::vector<int>				fSemanticUniforms;
+	// Parameter index by the name of its attribute, read from the parameter plugs once the attributes exist
+	std::map<std::string, int>		fUniformAttributeIndices;
+	bool							fUniformAttributeIndicesResolved;
+	// Parameters looked at by updateParameters(), kept between the draws with their flags
+	mutable std::vector<int>		fUniformCandidates;
+	mutable std::vector<char>		fUniformIsCandidate;
+	// Parameters set from the values shared by all the nodes drawn in a frame (view, projection...),
+	// and the slot of the shared values of each parameter, -1 when it is not shared
+	std::vector<int>				fFrameGlobalUniforms;
+	std::vector<int>				fUniformFrameGlobalSlots;
 
 	///////////// Varying Parameters
 	// List of vertex buffer descriptions.
@@ -532,8 +627,17 @@ private:
 	dx11ShaderDX11EffectVariable*	fMayaGammaCorrectVar;
 
 	///////////// Some caching
-	typedef std::map< dx11ShaderDX11Pass*, bool > PassHasHullShaderMap;
-	mutable PassHasHullShaderMap	fPassHasHullShaderMap;
+	// Passes of the active technique, and the draw contexts they handle
+	PassInfoList					fPassInfos;
+	unsigned int					fPassDrawContextBits;
+	// Passes of the temporary effects used by the swatches, which are not in the pass table,
+	// gathered on their first draw until the temporary effect is released
+	typedef std::map<dx11ShaderDX11Pass*, PassInfo> TemporaryPassInfoMap;
+	mutable TemporaryPassInfoMap	fTemporaryPassInfos;
+	// Setters of the parameter lists of the temporary effects, built on their first draw
+	// and dropped with the temporary effect like its passes
+	typedef std::map<const MUniformParameterList*, UniformSetterList> TemporaryUniformSetterMap;
+	mutable TemporaryUniformSetterMap	fTemporaryUniformSetters;
 
 	struct CachedInputElementDesc
 	{
@@ -15,7 +15,10 @@
 #include "dx11ShaderCmd.h"
 #include "dx11Shader.h"
 #include "dx11ShaderStrings.h"
+#include "crackFreePrimitiveGenerator.h"
+#include "dx11ShaderCompileHelper.h"
 #include <maya/MGlobal.h>
+#include <maya/MIntArray.h>
 #include <maya/MArgDatabase.h>
 #include <maya/MCommandResult.h>
 #include <maya/MDagPath.h>
@@ -123,6 +126,44 @@
 #define kDisconnectLightFlag					"-d"
 #define kDisconnectLightFlagLong				"-disconnectLight"
 
+// Deletes the PN-AEN patches saved in the DX11SHADER_PNAEN_CACHE_DIR directory and
+// returns the number of files deleted. This flag does not need a shader node:
+//
+//  example:
+//		dx11Shader -purgePNAENCache;
+//		Result: 42 // 
+#define kPurgePNAENCacheFlag					"-ppc"
+#define kPurgePNAENCacheFlagLong				"-purgePNAENCache"
+
+// Reloads the effects whose file, or one of the files it includes, changed since it was
+// compiled, and returns the number of effects reloaded. This flag does not need a shader node:
+//
+//  example:
+//		dx11Shader -reloadOutdated;
+//		Result: 1 // 
+#define kReloadOutdatedFlag						"-ro"
+#define kReloadOutdatedFlagLong					"-reloadOutdated"
+
+// Returns the counters of the LRU keeping the last compiled effects: hits, misses, evictions,
+// entries, then the size of the entries and the size limit in kilobytes.
+// This flag does not need a shader node:
+//
+//  example:
+//		dx11Shader -effectCacheStats;
+//		Result: 12 3 0 3 412 65536 // 
+#define kEffectCacheStatsFlag					"-ecs"
+#define kEffectCacheStatsFlagLong				"-effectCacheStats"
+
+// Returns the counters of the effect and include file names resolved in the search paths:
+// lookups, hits, hits on files not found, stat calls avoided by the hits, and entries.
+// This flag does not need a shader node:
+//
+//  example:
+//		dx11Shader -pathCacheStats;
+//		Result: 240 228 12 1824 12 // 
+#define kPathCacheStatsFlag						"-pcs"
+#define kPathCacheStatsFlagLong					"-pathCacheStats"
+
 
 
 dx11ShaderCmd::dx11ShaderCmd()
@@ -138,8 +179,47 @@ MStatus dx11ShaderCmd::doIt( const MArgList& args )
 	// Parse the shader node
 	//
 	MArgParser parser( syntax(), args );
+	if( parser.isFlagSet(kPurgePNAENCacheFlag) )
+	{
+		setResult( (int)CrackFreePrimitiveGenerator::purgeDiskCache() );
+		return MS::kSuccess;
+	}
+	if( parser.isFlagSet(kReloadOutdatedFlag) )
+	{
+		setResult( (int)dx11ShaderNode::reloadOutdated() );
+		return MS::kSuccess;
+	}
+	if( parser.isFlagSet(kEffectCacheStatsFlag) )
+	{
+		CDX11EffectCompileHelper::EffectCacheStats stats = CDX11EffectCompileHelper::effectCacheStats();
+		MIntArray result;
+		result.append( (int)stats.hitCount );
+		result.append( (int)stats.missCount );
+		result.append( (int)stats.evictionCount );
+		result.append( (int)stats.entryCount );
+		result.append( (int)(stats.size >> 10) );
+		result.append( (int)(stats.sizeLimit >> 10) );
+		setResult( result );
+		return MS::kSuccess;
+	}
+	if( parser.isFlagSet(kPathCacheStatsFlag) )
+	{
+		CDX11EffectCompileHelper::PathCacheStats stats = CDX11EffectCompileHelper::pathCacheStats();
+		MIntArray result;
+		result.append( (int)stats.lookupCount );
+		result.append( (int)stats.hitCount );
+		result.append( (int)stats.notFoundHitCount );
+		result.append( (int)stats.statCallsAvoided );
+		result.append( (int)stats.entryCount );
+		setResult( result );
+		return MS::kSuccess;
+	}
+
 	MString nodeName;
-	parser.getCommandArgument( 0, nodeName );
+	MStringArray objects;
+	parser.getObjects( objects );
+	if( objects.length() > 0 )
+		nodeName = objects[0];
 
 
 	MSelectionList list;
@@ -342,7 +422,13 @@ MSyntax dx11ShaderCmd::newSyntax()
 	syntax.addFlag( kListUIGroupInformationFlag, kListUIGroupInformationFlagLong);
 	syntax.addFlag( kListUIGroupParametersFlag, kListUIGroupParametersFlagLong, MSyntax::kString );
 	syntax.addFlag( kDisconnectLightFlag, kDisconnectLightFlagLong, MSyntax::kString);
-	syntax.addArg( MSyntax::kString );	
+	syntax.addFlag( kPurgePNAENCacheFlag, kPurgePNAENCacheFlagLong);
+	syntax.addFlag( kReloadOutdatedFlag, kReloadOutdatedFlagLong);
+	syntax.addFlag( kEffectCacheStatsFlag, kEffectCacheStatsFlagLong);
+	syntax.addFlag( kPathCacheStatsFlag, kPathCacheStatsFlagLong);
+	// The shader node, optional with -purgePNAENCache
+	syntax.setObjectType( MSyntax::kStringObjects, 0, 1 );
+	syntax.useSelectionAsDefault( false );
 	return syntax;
 }
 
@@ -16,9 +16,18 @@
 #include <maya/MGlobal.h>
 #include <maya/MFileObject.h>
 #include <maya/MSceneMessage.h>
+#include <maya/MEventMessage.h>
+#include <maya/MTimerMessage.h>
+#include <maya/MTimer.h>
+#include <maya/MMutexLock.h>
 
 #include "dx11ShaderCompileHelper.h"
+#include "dx11ShaderEffectCache.h"
+#include "dx11ShaderEffectCollection.h"
+#include "dx11ShaderCompileQueue.h"
+#include "dx11ShaderFileWatcher.h"
 #include "dx11ShaderStrings.h"
+#include "dx11ShaderUniformParamBuilder.h"
 
 // Includes for DX11
 #define WIN32_LEAN_AND_MEAN
@@ -36,7 +45,10 @@
 #include <string.h>
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <list>
+#include <vector>
+#include <algorithm>
 
 /*!
 	CDX11EffectCompileHelper::EffectCollection
@@ -46,34 +58,292 @@
 	It has to be cloned because each effect need to have distinct parameters.
 
 	CDX11EffectCompileHelper::CompiledEffectCache
-	Is a simple LRU for the last 8 compiled effects.
+	Is an LRU of the last compiled effects, bounded by the size of their bytecode: 64 MB by default,
+	DX11SHADER_EFFECT_LRU_SIZE sets it in megabytes.
 	Since the collection above is only used to store the effects currently active in the scene,
 	this LRU is used to prevent reloading over and over the MayaUberShader which is assigned by default on each new dx11Shader.
 	2 callbacks are registered to flush the LRU when the scene is closed and when maya is about to close:
 	MsceneMessage::addCallback(MSceneMessage::kMayaExiting)
 	MsceneMessage::addCallback(MSceneMessage::kBeforeNew)
+
+	CEffectDiskCache
+	Keeps the bytecode of the compiled .fx files on disk, so the next sessions do not compile them again.
+	It is stored in DX11SHADER_EFFECT_CACHE_DIR, or by default in the dx11ShaderCache folder of the Maya
+	user directory. DX11SHADER_EFFECT_CACHE_SIZE sets its size limit in megabytes, 256 MB by default,
+	0 disables it.
+
+	CIncludeFileCache
+	Keeps the content of the files included by the effects, so a header included by many effects
+	is read once. The compiler reads the cached content directly. DX11SHADER_INCLUDE_CACHE_SIZE
+	sets the size of the contents kept when no compilation uses them, in megabytes, 32 MB by default.
+
+	CDX11EffectCompileHelper::ResolvedPathCache
+	Keeps the files found by CFileReferenceHelper, or not found, so the search paths are not queried
+	and stat'ed again for each load and each include. It is cleared when the workspace or DX11SHADER_ROOT
+	changes, and the files not found are forgotten when a scene is opened or reloaded.
+
+	CEffectCompileQueue
+	When DX11SHADER_ASYNC_COMPILE is set, the .fx files are compiled on worker threads (see buildAsync)
+	and the nodes keep their current effect meanwhile. Only the creation of the effect and its loading
+	by the nodes are done on the main thread, from an idle callback.
+	The same is done while a scene file is read, unless DX11SHADER_SCENE_PREWARM is 0, and the
+	compilations are waited for once it is read (see addScenePrewarmCallbacks).
 */
 
 namespace CDX11EffectCompileHelper
 {
+	struct MStringSorter {
+		bool operator() (const MString& lhs, const MString& rhs) const
+		{
+			return strcmp(lhs.asChar(), rhs.asChar()) < 0;
+		}
+	};
+
+	/*
+		Resolved file names, keyed by the name to resolve and the reference path it is relative to.
+		An empty resolved name records a file not found. The entries depend on the search paths,
+		the cache is cleared when they change: each clear starts a new generation, and the files
+		resolved during the previous one are not added.
+		The workspace part of the search paths is kept here as well.
+		The entries can be read and added from the worker threads compiling the effects.
+	*/
+	class ResolvedPathCache
+	{
+	public:
+		ResolvedPathCache();
+		~ResolvedPathCache();
+
+		bool find(const MString& fileName, const MString& referencePath, MString& resolvedFileName, unsigned int& generation);
+		void add(const MString& fileName, const MString& referencePath, const MString& resolvedFileName, unsigned int statCount, unsigned int generation);
+		void clear(bool notFoundOnly = false);
+		PathCacheStats stats();
+
+		// Main thread
+		MString workspaceSearchPaths();
+		MString shaderRootSearchPaths();
+
+	private:
+		struct Entry
+		{
+			MString resolvedFileName;
+			unsigned int statCount;
+		};
+		typedef std::map< MString, Entry, MStringSorter > EntryMap;
+
+		static MString entryKey(const MString& fileName, const MString& referencePath);
+		static void workspaceChanged(void* data);
+		static void sceneChanged(void* data);
+
+		EntryMap mEntries;
+		unsigned int mGeneration;
+		PathCacheStats mStats;
+		MMutexLock mLock;
+
+		bool mWorkspaceKnown;
+		MString mWorkspaceSearchPaths;
+		MString mShaderRoot;
+
+		MCallbackId mCallbackIds[5];
+	};
+
+	ResolvedPathCache::ResolvedPathCache()
+		: mGeneration(0)
+		, mWorkspaceKnown(false)
+	{
+		memset(&mStats, 0, sizeof(mStats));
+
+		const char* shaderRoot = getenv("DX11SHADER_ROOT");
+		mShaderRoot = (shaderRoot ? shaderRoot : "");
+
+		mCallbackIds[0] = MSceneMessage::addCallback(MSceneMessage::kWorkspaceChanged, ResolvedPathCache::workspaceChanged, this);
+		mCallbackIds[1] = MSceneMessage::addCallback(MSceneMessage::kBeforeNew, ResolvedPathCache::sceneChanged, this);
+		mCallbackIds[2] = MSceneMessage::addCallback(MSceneMessage::kBeforeOpen, ResolvedPathCache::sceneChanged, this);
+		mCallbackIds[3] = MSceneMessage::addCallback(MSceneMessage::kBeforeImport, ResolvedPathCache::sceneChanged, this);
+		mCallbackIds[4] = MSceneMessage::addCallback(MSceneMessage::kBeforeLoadReference, ResolvedPathCache::sceneChanged, this);
+	}
+
+	ResolvedPathCache::~ResolvedPathCache()
+	{
+		for (unsigned int i = 0; i < 5; ++i)
+			MMessage::removeCallback(mCallbackIds[i]);
+	}
+
+	MString ResolvedPathCache::entryKey(const MString& fileName, const MString& referencePath)
+	{
+		return referencePath + "\n" + fileName;
+	}
+
+	bool ResolvedPathCache::find(const MString& fileName, const MString& referencePath, MString& resolvedFileName, unsigned int& generation)
+	{
+		mLock.lock();
+		++mStats.lookupCount;
+		generation = mGeneration;
+		EntryMap::const_iterator it = mEntries.find(entryKey(fileName, referencePath));
+		bool found = (it != mEntries.end());
+		if (found)
+		{
+			resolvedFileName = it->second.resolvedFileName;
+			++mStats.hitCount;
+			if (resolvedFileName.length() == 0)
+				++mStats.notFoundHitCount;
+			mStats.statCallsAvoided += it->second.statCount;
+		}
+		mLock.unlock();
+		return found;
+	}
+
+	void ResolvedPathCache::add(const MString& fileName, const MString& referencePath, const MString& resolvedFileName, unsigned int statCount, unsigned int generation)
+	{
+		mLock.lock();
+		if (generation == mGeneration)
+		{
+			Entry& entry = mEntries[entryKey(fileName, referencePath)];
+			entry.resolvedFileName = resolvedFileName;
+			entry.statCount = statCount;
+		}
+		mLock.unlock();
+	}
+
+	void ResolvedPathCache::clear(bool notFoundOnly)
+	{
+		mLock.lock();
+		if (notFoundOnly)
+		{
+			for (EntryMap::iterator it = mEntries.begin(); it != mEntries.end(); )
+			{
+				if (it->second.resolvedFileName.length() == 0)
+					mEntries.erase(it++);
+				else
+					++it;
+			}
+		}
+		else
+		{
+			mEntries.clear();
+			mWorkspaceKnown = false;
+		}
+		++mGeneration;
+		mLock.unlock();
+	}
+
+	PathCacheStats ResolvedPathCache::stats()
+	{
+		mLock.lock();
+		PathCacheStats stats = mStats;
+		stats.entryCount = (unsigned int)mEntries.size();
+		mLock.unlock();
+		return stats;
+	}
+
+	MString ResolvedPathCache::workspaceSearchPaths()
+	{
+		if (mWorkspaceKnown)
+			return mWorkspaceSearchPaths;
+
+		// Add the standard Maya project paths
+		MString searchPaths;
+		MString workspace;
+		MStatus status = MGlobal::executeCommand(MString("workspace -q -rd;"),workspace);
+		if ( status == MS::kSuccess)
+		{
+			searchPaths += workspace;
+			searchPaths += ";";
+			searchPaths += workspace;
+			searchPaths += "/renderData/shaders";
+			MString shadersRelativePath;
+			status = MGlobal::executeCommand(MString("workspace -fre shaders"),shadersRelativePath);
+			if(status== MS::kSuccess)
+			{
+				searchPaths += ";";
+				searchPaths += workspace;
+				searchPaths += shadersRelativePath;
+			}
+		}
+
+		mLock.lock();
+		mWorkspaceSearchPaths = searchPaths;
+		mWorkspaceKnown = true;
+		mLock.unlock();
+		return searchPaths;
+	}
+
+	MString ResolvedPathCache::shaderRootSearchPaths()
+	{
+		MString searchPaths;
+		if (mShaderRoot.length() > 0)
+		{
+			searchPaths += mShaderRoot;
+			searchPaths += ";";
+			searchPaths += mShaderRoot;
+			searchPaths += "/shaders";
+		}
+		return searchPaths;
+	}
+
+	void ResolvedPathCache::workspaceChanged(void* data)
+	{
+		((ResolvedPathCache*)data)->clear();
+	}
+
+	// DX11SHADER_ROOT may have been changed from a script, files created since the last scene may now be found
+	void ResolvedPathCache::sceneChanged(void* data)
+	{
+		ResolvedPathCache* cache = (ResolvedPathCache*)data;
+
+		const char* shaderRoot = getenv("DX11SHADER_ROOT");
+		MString currentShaderRoot(shaderRoot ? shaderRoot : "");
+		if (currentShaderRoot != cache->mShaderRoot)
+		{
+			cache->mShaderRoot = currentShaderRoot;
+			cache->clear();
+		}
+		else
+		{
+			cache->clear(true /*notFoundOnly*/);
+		}
+	}
+
+	// Created on the main thread, by the first resolveShaderFileName()
+	ResolvedPathCache& resolvedPathCache()
+	{
+		static ResolvedPathCache sCache;
+		return sCache;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
 	class CFileReferenceHelper
 	{
 	public:
+		CFileReferenceHelper() : searchPathsFrozen(false) {}
+
 		MString resolveFileName(const char* fileName) const;
 		void setReferencePath(MString fileName);
 
+		// Query the search paths now and keep them, the helper can then resolve
+		// files on a worker thread, where the workspace cannot be queried
+		void freezeSearchPaths();
+
 	protected:
-		MString findFile(const char* fileName) const;
+		MString findFile(const char* fileName, unsigned int& statCount) const;
 		MString getSearchPaths() const;
 
 		MString referencePath;
+		MString frozenSearchPaths;
+		bool searchPathsFrozen;
 	};
 
 	MString CFileReferenceHelper::resolveFileName(const char* fileName) const
 	{
+		MString file;
+		unsigned int generation = 0;
+		if (resolvedPathCache().find(fileName, referencePath, file, generation))
+			return file;
+
 		//Check if filename exists
+		unsigned int statCount = 0;
 		MString currFileName(fileName);
-		MString file = findFile(currFileName.asChar());
+		file = findFile(currFileName.asChar(), statCount);
 
 		int hasFile = file.length() > 0;
 
@@ -86,16 +356,17 @@ namespace CDX11EffectCompileHelper
 			if (idx != -1)
 			{
 				currFileName = currFileName.substring(idx+1,currFileName.length()-1);
-				file = findFile(currFileName.asChar());
+				file = findFile(currFileName.asChar(), statCount);
 			}
 		}
 
 		if (file.length() == 0)
 		{
 			MString expandedFileName(MString(fileName).expandEnvironmentVariablesAndTilde());
-			file = findFile(expandedFileName.asChar());
+			file = findFile(expandedFileName.asChar(), statCount);
 		}
 
+		resolvedPathCache().add(fileName, referencePath, file, statCount, generation);
 		return file;
 	}
 
@@ -113,14 +384,18 @@ namespace CDX11EffectCompileHelper
 		}
 	}
 
-	MString CFileReferenceHelper::findFile(const char* fileName) const
+	MString CFileReferenceHelper::findFile(const char* fileName, unsigned int& statCount) const
 	{
 		struct stat statBuf;
 		MString name (fileName);
 		const bool fullyQualified = name.index('/') == 0 || name.index('\\') == 0 || name.index(':') == 1;
-		if (fullyQualified && stat(name.asChar(), &statBuf) != -1) 
+		if (fullyQualified)
 		{
-			return name;
+			++statCount;
+			if (stat(name.asChar(), &statBuf) != -1) 
+			{
+				return name;
+			}
 		}
 		
 		char path[MAX_PATH];
@@ -168,6 +443,7 @@ namespace CDX11EffectCompileHelper
 				file = MString(path) + resolvedName;
 
 		
+			++statCount;
 			if (stat(file.asChar(), &statBuf) != -1) 
 			{
 				return file;
@@ -176,29 +452,20 @@ namespace CDX11EffectCompileHelper
 		return MString();
 	}
 
+	void CFileReferenceHelper::freezeSearchPaths()
+	{
+		searchPathsFrozen = false;
+		frozenSearchPaths = getSearchPaths();
+		searchPathsFrozen = true;
+	}
+
 	MString CFileReferenceHelper::getSearchPaths() const
 	{
-		// Build a list of places we'll look for textures
-		MString searchPaths;
+		if (searchPathsFrozen)
+			return frozenSearchPaths;
 
-		// Add the standard Maya project paths
-		MString workspace;
-		MStatus status = MGlobal::executeCommand(MString("workspace -q -rd;"),workspace);
-		if ( status == MS::kSuccess)
-		{
-			searchPaths += workspace;
-			searchPaths += ";";
-			searchPaths += workspace;
-			searchPaths += "/renderData/shaders";
-			MString shadersRelativePath;
-			status = MGlobal::executeCommand(MString("workspace -fre shaders"),shadersRelativePath);
-			if(status== MS::kSuccess)
-			{
-				searchPaths += ";";
-				searchPaths += workspace;
-				searchPaths += shadersRelativePath;
-			}
-		}
+		// Build a list of places we'll look for textures
+		MString searchPaths = resolvedPathCache().workspaceSearchPaths();
 
 		if(referencePath.length() > 0)
 		{
@@ -209,17 +476,14 @@ namespace CDX11EffectCompileHelper
 			searchPaths += referencePath;
 		}
 
-		static char * dx11ShaderRoot = getenv("DX11SHADER_ROOT");
-		if (dx11ShaderRoot)
+		MString shaderRootSearchPaths = resolvedPathCache().shaderRootSearchPaths();
+		if (shaderRootSearchPaths.length() > 0)
 		{
 			if(searchPaths.length() > 0)
 			{
 				searchPaths += ";";
 			}
-			searchPaths += dx11ShaderRoot;
-			searchPaths += ";";
-			searchPaths += dx11ShaderRoot;
-			searchPaths += "/shaders";
+			searchPaths += shaderRootSearchPaths;
 		}
 
 		searchPaths += ";";
@@ -230,41 +494,117 @@ namespace CDX11EffectCompileHelper
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
+	time_t fileTimeStamp(const MString& fileName)
+	{
+		struct stat statBuf;
+		if( stat(fileName.asChar(), &statBuf) != 0 )
+			return 0;
+
+		return statBuf.st_mtime;
+	}
+
+	// The files included by an effect, directly or not, with their time stamps when it was compiled
+	struct IncludedFile
+	{
+		MString fileName;
+		time_t timeStamp;
+	};
+	typedef std::vector< IncludedFile > IncludedFileList;
+
+	void addIncludedFile(IncludedFileList& includedFiles, const MString& fileName)
+	{
+		for (size_t i = 0; i < includedFiles.size(); ++i)
+		{
+			if (includedFiles[i].fileName == fileName)
+				return;
+		}
+
+		IncludedFile includedFile;
+		includedFile.fileName = fileName;
+		includedFile.timeStamp = fileTimeStamp(fileName);
+		includedFiles.push_back(includedFile);
+	}
+
+	bool includedFilesChanged(const IncludedFileList& includedFiles)
+	{
+		for (size_t i = 0; i < includedFiles.size(); ++i)
+		{
+			if (includedFiles[i].timeStamp != fileTimeStamp(includedFiles[i].fileName))
+				return true;
+		}
+		return false;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Size limit in megabytes, 32 MB by default
+	size_t includeFileCacheSizeLimit()
+	{
+		static const char* cacheSize = getenv("DX11SHADER_INCLUDE_CACHE_SIZE");
+		int sizeLimit = (cacheSize ? atoi(cacheSize) : 32);
+		return (size_t)std::max(sizeLimit, 0) << 20;
+	}
+
+	// Created on the main thread, by the first CIncludeHelper
+	CIncludeFileCache& includeFileCache()
+	{
+		static CIncludeFileCache sCache(includeFileCacheSizeLimit());
+		return sCache;
+	}
+
 	class CIncludeHelper: public ID3D10Include, public CFileReferenceHelper
 	{
 	public:
+		CIncludeHelper() : dependencies(NULL), includedFiles(NULL) { includeFileCache(); }
+
+		// Record the files opened by the compiler:
+		// their name and content hash for the effect cache, their path and time stamp for the in-memory caches
+		void recordIncludes(CEffectDiskCache::DependencyList* dependencyList, IncludedFileList* includedFileList)
+		{
+			dependencies = dependencyList;
+			includedFiles = includedFileList;
+		}
+
 		STDMETHOD(Open)(D3D10_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes)
 		{
 			MString resolvedFileName = resolveFileName(pFileName);
-			// Read the file content
-			FILE* file = fopen(resolvedFileName.asChar(), "rb");
-			if(file == NULL)
+
+			// The content is shared with the other compilations, it is given back in Close()
+			size_t size = 0;
+			MUint64 contentHash = 0;
+			const char* buffer = includeFileCache().acquire(resolvedFileName, size, contentHash);
+			if(buffer == NULL)
 			{
 				return E_FAIL;
 			}
 
-			// Get the file size
-			fseek(file, 0, SEEK_END);
-			long size = ftell(file);
-			fseek(file, 0, SEEK_SET);
-
-			// Get the file content
-			char *buffer = new char[size];
-			fread(buffer, 1, size, file);
-			fclose(file);
-
 			// Save the file data into ppData and the size into pBytes.
 			*ppData = buffer;
 			*pBytes = UINT(size);
 
+			if (dependencies)
+			{
+				CEffectDiskCache::Dependency dependency;
+				dependency.name = pFileName;
+				dependency.contentHash = contentHash;
+				dependencies->push_back(dependency);
+			}
+			if (includedFiles)
+			{
+				addIncludedFile(*includedFiles, resolvedFileName);
+			}
+
 			return S_OK;
 		}
 		STDMETHOD(Close)(LPCVOID pData)
 		{
-			char* pChar = (char*)pData;
-			delete [] pChar;
+			includeFileCache().release((const char*)pData);
 			return S_OK;
 		}
+
+	protected:
+		CEffectDiskCache::DependencyList* dependencies;
+		IncludedFileList* includedFiles;
 	};
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -302,6 +642,135 @@ namespace CDX11EffectCompileHelper
 		return flags;
 	}
 
+	bool readFile(const MString& fileName, std::vector< char >& content)
+	{
+		FILE* file = fopen(fileName.asChar(), "rb");
+		if(file == NULL)
+			return false;
+
+		// Get the file size
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		// Get the file content
+		content.resize(size > 0 ? size : 0);
+		bool read = (size == 0 || (size > 0 && fread(&content[0], 1, size, file) == (size_t)size));
+		fclose(file);
+		return read;
+	}
+
+	MString effectCacheDirectory()
+	{
+		static const char* cacheDir = getenv("DX11SHADER_EFFECT_CACHE_DIR");
+		if (cacheDir)
+			return MString(cacheDir);
+
+		MString userAppDir;
+		if (MGlobal::executeCommand(MString("internalVar -userAppDir"), userAppDir) == MS::kSuccess && userAppDir.length() > 0)
+			return userAppDir + "dx11ShaderCache";
+		return MString();
+	}
+
+	MUint64 effectCacheSizeLimit()
+	{
+		static const char* cacheSize = getenv("DX11SHADER_EFFECT_CACHE_SIZE");
+		int sizeLimit = (cacheSize ? atoi(cacheSize) : 256);
+		return (MUint64)std::max(sizeLimit, 0) << 20;
+	}
+
+	CEffectDiskCache& effectDiskCache()
+	{
+		static CEffectDiskCache sCache(effectCacheDirectory(), effectCacheSizeLimit());
+		return sCache;
+	}
+
+	// Key of a compilation in the effect cache, the included files are checked separately
+	MUint64 effectCacheKey(const char* source, size_t sourceSize, D3D10_SHADER_MACRO* macros, unsigned int compileFlags)
+	{
+		CEffectHash hash;
+		hash.add(/*MSG0*/"fx_5_0");
+#ifdef D3D_COMPILER_VERSION
+		hash.add((unsigned int)D3D_COMPILER_VERSION);
+#endif
+		hash.add(compileFlags);
+		for (D3D10_SHADER_MACRO* macro = macros; macro && macro->Name; ++macro)
+		{
+			hash.add(macro->Name);
+			hash.add(macro->Definition);
+		}
+		hash.add(source, sourceSize);
+		return hash.value();
+	}
+
+	// Check that the included files resolve to the same content as when the effect was compiled
+	bool dependenciesMatch(const CEffectDiskCache::DependencyList& dependencies, const CIncludeHelper& includeHelper, IncludedFileList& includedFiles)
+	{
+		for (size_t i = 0; i < dependencies.size(); ++i)
+		{
+			MString resolvedFileName = includeHelper.resolveFileName(dependencies[i].name.asChar());
+			if (resolvedFileName.length() == 0)
+				return false;
+
+			// Read through the include cache, the compilation may follow
+			size_t size = 0;
+			MUint64 contentHash = 0;
+			const char* content = includeFileCache().acquire(resolvedFileName, size, contentHash);
+			if (content == NULL)
+				return false;
+			includeFileCache().release(content);
+
+			if (contentHash != dependencies[i].contentHash)
+				return false;
+
+			addIncludedFile(includedFiles, resolvedFileName);
+		}
+		return true;
+	}
+
+	// Compile the effect source, or load the bytecode of the same compilation from the effect cache.
+	// includedFiles receives the files included by the source.
+	HRESULT compileEffect(const char* source, size_t sourceSize, const char* sourceName, CIncludeHelper& includeHelper, unsigned int compileFlags,
+						  ID3DBlob** shader, ID3DBlob** error, IncludedFileList& includedFiles)
+	{
+		D3D10_SHADER_MACRO* macros = getD3DMacros();
+
+		CEffectDiskCache& cache = effectDiskCache();
+		MUint64 key = 0;
+		if (cache.isEnabled())
+		{
+			key = effectCacheKey(source, sourceSize, macros, compileFlags);
+
+			CEffectDiskCache::DependencyList dependencies;
+			std::vector< char > bytecode;
+			includedFiles.clear();
+			if (cache.find(key, dependencies, bytecode) && !bytecode.empty() && dependenciesMatch(dependencies, includeHelper, includedFiles))
+			{
+				HRESULT hr = D3DCreateBlob(bytecode.size(), shader);
+				if( SUCCEEDED( hr ) )
+				{
+					memcpy((*shader)->GetBufferPointer(), &bytecode[0], bytecode.size());
+					return hr;
+				}
+			}
+		}
+
+		CEffectDiskCache::DependencyList dependencies;
+		includedFiles.clear();
+		includeHelper.recordIncludes(&dependencies, &includedFiles);
+#if _MSC_VER < 1700
+		HRESULT hr = D3DX11CompileFromMemory(source, sourceSize, sourceName, macros, &includeHelper, NULL, /*MSG0*/"fx_5_0", compileFlags, 0, NULL, shader, error, NULL);
+#else
+		HRESULT hr = D3DCompile(source, sourceSize, sourceName, macros, &includeHelper, NULL, /*MSG0*/"fx_5_0", compileFlags, 0, shader, error);
+#endif
+		includeHelper.recordIncludes(NULL, NULL);
+
+		if (cache.isEnabled() && SUCCEEDED(hr) && *shader)
+			cache.add(key, dependencies, (*shader)->GetBufferPointer(), (unsigned int)(*shader)->GetBufferSize());
+
+		return hr;
+	}
+
 	bool effectHasHullShader(ID3DX11Effect* effect)
 	{
 		if(effect)
@@ -343,6 +812,83 @@ namespace CDX11EffectCompileHelper
 		return false;
 	}
 
+	// Whether an effect source needs the strict compile flags, that is whether it has a hull shader,
+	// is only known once it was compiled without them. The answer is remembered for the next
+	// compilations of the same source, in memory and as a one byte entry of the effect disk cache.
+	class StrictnessMemo
+	{
+	public:
+		enum State { kUnknown, kStrict, kNotStrict };
+
+		State find(MUint64 sourceKey);
+		void set(MUint64 sourceKey, bool needsStrictness);
+
+	private:
+		static MUint64 diskKey(MUint64 sourceKey);
+
+		typedef std::map< MUint64, bool > StateMap;
+		StateMap mStates;
+		MMutexLock mLock;
+	};
+
+	MUint64 StrictnessMemo::diskKey(MUint64 sourceKey)
+	{
+		// Tagged so that it differs from the key of the compilation itself
+		return CEffectHash().add(/*MSG0*/"needsStrictness").add(&sourceKey, sizeof(sourceKey)).value();
+	}
+
+	StrictnessMemo::State StrictnessMemo::find(MUint64 sourceKey)
+	{
+		mLock.lock();
+		StateMap::const_iterator it = mStates.find(sourceKey);
+		State state = (it == mStates.end() ? kUnknown : (it->second ? kStrict : kNotStrict));
+		mLock.unlock();
+		if (state != kUnknown)
+			return state;
+
+		CEffectDiskCache& cache = effectDiskCache();
+		if (cache.isEnabled())
+		{
+			CEffectDiskCache::DependencyList dependencies;
+			std::vector< char > data;
+			if (cache.find(diskKey(sourceKey), dependencies, data) && data.size() == 1)
+			{
+				state = (data[0] == '1' ? kStrict : kNotStrict);
+				mLock.lock();
+				mStates[sourceKey] = (state == kStrict);
+				mLock.unlock();
+			}
+		}
+		return state;
+	}
+
+	void StrictnessMemo::set(MUint64 sourceKey, bool needsStrictness)
+	{
+		mLock.lock();
+		StateMap::iterator it = mStates.find(sourceKey);
+		bool known = (it != mStates.end());
+		bool changed = (!known || it->second != needsStrictness);
+		mStates[sourceKey] = needsStrictness;
+		mLock.unlock();
+
+		// Most effects have no hull shader, only the strict ones and the corrections are written
+		CEffectDiskCache& cache = effectDiskCache();
+		if (changed && cache.isEnabled() && (needsStrictness || known))
+			cache.add(diskKey(sourceKey), CEffectDiskCache::DependencyList(), needsStrictness ? "1" : "0", 1);
+	}
+
+	StrictnessMemo& strictnessMemo()
+	{
+		static StrictnessMemo sMemo;
+		return sMemo;
+	}
+
+	// The source key is the key of the compilation without strictness
+	MUint64 strictnessSourceKey(const char* source, size_t sourceSize)
+	{
+		return effectCacheKey(source, sourceSize, getD3DMacros(), getShaderCompileFlags(false));
+	}
+
 	bool isValidEffectFile(const MString& fileName, bool& isCompiled)
 	{
 		MString extension;
@@ -381,258 +927,249 @@ namespace CDX11EffectCompileHelper
 		errorLog += msg;
 	}
 
-	////////////////////////////////////////////////////////////////////////////////////////////////////
-
-	time_t fileTimeStamp(const MString& fileName)
+	void pushAbsolutePathError(const MString& fileName, const MString& resolvedFileName, MString &errorLog)
 	{
-		struct stat statBuf;
-		if( stat(fileName.asChar(), &statBuf) != 0 )
-			return 0;
-
-		return statBuf.st_mtime;
-	}
-
-	struct EffectKey
-	{
-		ID3D11Device* device;
-		MString fileName;
-		time_t timeStamp;
-	};
+		if( resolvedFileName != fileName && MFileObject::isAbsolutePath(fileName) )
+		{
+			MStringArray args;
+			args.append(fileName);
+			args.append(resolvedFileName);
 
-	bool operator< (const EffectKey& lhs, const EffectKey& rhs)
-	{
-		return (lhs.device <  rhs.device) ||
-			   (lhs.device == rhs.device && ( (lhs.timeStamp <  rhs.timeStamp) ||
-											  (lhs.timeStamp == rhs.timeStamp && strcmp(lhs.fileName.asChar(), rhs.fileName.asChar()) < 0) ) );
+			MString msg = dx11ShaderStrings::getString( dx11ShaderStrings::kErrorAbsolutePathNotFound, args );
+			errorLog += msg;
+		}
 	}
 
-	struct MStringSorter {
-		bool operator() (const MString& lhs, const MString& rhs) const
-		{
-			return strcmp(lhs.asChar(), rhs.asChar()) < 0;
-		}
-	};
+	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	class EffectCollection
+	// Reading and compiling an effect file. run() makes no Maya or device call,
+	// so it can be done on a worker thread; createEffect() needs the main thread.
+	class EffectCompilation
 	{
 	public:
-		ID3DX11Effect* acquire(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName);
-		ID3DX11Effect* acquire(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName, ID3DX11Effect* reference, ID3DX11Effect* source = NULL);
-		void release(dx11ShaderNode* node, ID3DX11Effect *effect, const MString& fileName);
-		void getNodesUsingEffect(const MString& fileName, ShaderNodeList &nodes) const;
+		EffectCompilation(const MString& resolvedFileName, bool compiledEffect, bool useStrictness);
+		~EffectCompilation();
+
+		void run();
+		ID3DX11Effect* createEffect(ID3D11Device* device, const MString& fileName, MString &errorLog);
+		bool needsStrictness(ID3DX11Effect* effect) const;
 
-		ID3DX11Effect* getReferenceEffectAndFileName(ID3DX11Effect *effect, MString& fileName) const;
+		const MString& resolvedFileName() const { return mResolvedFileName; }
+		bool useStrictness() const { return mUseStrictness; }
+		const IncludedFileList& includedFiles() const { return mIncludedFiles; }
+		size_t bytecodeSize() const { return mShader ? mShader->GetBufferSize() : 0; }
 
 	private:
-		typedef std::map< EffectKey, ID3DX11Effect* > Key2ReferenceEffectMap;
-		Key2ReferenceEffectMap key2ReferenceEffectMap;
-
-		typedef std::pair< EffectKey, unsigned int > EffectKeyCountPair;
-		typedef std::map< ID3DX11Effect*, EffectKeyCountPair > ReferenceCountMap;
-		ReferenceCountMap referenceCountMap;
-
-		typedef std::map< ID3DX11Effect*, ID3DX11Effect* > Clone2ReferenceMap;
-		Clone2ReferenceMap clone2ReferenceMap;
-
-		// We need to keep track of dx11ShaderNodes at all times,
-		// even when compilation failed and we have no ID3DX11Effect
-		// to deal with. This will allow the "Reload" button to work
-		// after a shader file failed to compile.
-		typedef std::set< dx11ShaderNode* > NodeSet;
-		typedef std::map< MString, NodeSet, MStringSorter > Path2NodesMap;
-		Path2NodesMap path2NodesMap;
+		MString mResolvedFileName;
+		bool mCompiledEffect;
+		bool mUseStrictness;
+		MUint64 mSourceKey;
+		CIncludeHelper mIncludeHelper;
+
+		HRESULT mResult;
+		ID3DBlob* mShader;
+		ID3DBlob* mError;
+		IncludedFileList mIncludedFiles;
+
+		EffectCompilation(const EffectCompilation&);
+		const EffectCompilation& operator=(const EffectCompilation&);
 	};
 
-	//! Acquire effect from specified fileName
-	//! If a reference effect is found for this fileName, return a cloned instance
-	//! Update collection keeps track of :
-	//!   cloned effect -> reference effect
-	//!   fileName -> node
-	ID3DX11Effect* EffectCollection::acquire(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName)
+	EffectCompilation::EffectCompilation(const MString& resolvedFileName, bool compiledEffect, bool useStrictness)
+		: mResolvedFileName(resolvedFileName)
+		, mCompiledEffect(compiledEffect)
+		, mUseStrictness(useStrictness)
+		, mSourceKey(0)
+		, mResult(S_FALSE)
+		, mShader(NULL)
+		, mError(NULL)
 	{
-		ID3DX11Effect* effect = NULL;
-
-		EffectKey key = { device, fileName, fileTimeStamp(fileName) } ;
+		mIncludeHelper.setReferencePath(resolvedFileName);
+		mIncludeHelper.freezeSearchPaths();
 
-		// Find reference in cache
-		Key2ReferenceEffectMap::const_iterator it = key2ReferenceEffectMap.find(key);
-		if(it != key2ReferenceEffectMap.end())
-		{
-			ID3DX11Effect* reference = it->second;
-			effect = acquire(node, device, fileName, reference);
-		}
-
-		return effect;
+		// Created here rather than on the worker thread, it queries Maya for its directory
+		effectDiskCache();
+		strictnessMemo();
 	}
 
-	//! Acquire effect from reference
-	//! Return a cloned instance of the effect
-	//! Update collection keeps track of :
-	//!   cloned effect -> reference effect
-	//!   fileName -> node
-	ID3DX11Effect* EffectCollection::acquire(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName, ID3DX11Effect* reference, ID3DX11Effect* source )
+	EffectCompilation::~EffectCompilation()
 	{
-		// Keep track of fileName -> node lookup, whenever the effect was loaded or not
-		path2NodesMap[fileName].insert(node);
-
-		if( reference == NULL )
-			return NULL;
-		if( source == NULL)
-			source = reference;
-
-		// Add the reference in cache if not in yet.
-		EffectKey key = { device, fileName, fileTimeStamp(fileName) } ;
-		{
-			Key2ReferenceEffectMap::const_iterator it = key2ReferenceEffectMap.find(key);
-			if(it == key2ReferenceEffectMap.end()) {
-				key2ReferenceEffectMap.insert( std::make_pair(key, reference) );
-			}
+		if( mShader ) {
+			mShader->Release();
 		}
+		if( mError ) {
+			mError->Release();
+		}
+	}
 
-		// Clone effect
-		ID3DX11Effect* effect = NULL;
-		HRESULT hr = source->CloneEffect(0, &effect);
-		if( FAILED( hr ) || effect == NULL )
-			return NULL;
-
-		// Increase the number of clone for this reference
-		// Equivalent to the number of time this effect is used
+	void EffectCompilation::run()
+	{
+		if( mCompiledEffect )
 		{
-			ReferenceCountMap::iterator it = referenceCountMap.find(reference);
-			if(it == referenceCountMap.end())
+			FILE* file = fopen(mResolvedFileName.asChar(), "rb");
+			if(file)
 			{
-				// Not there yet, set count to 1 and register key
-				referenceCountMap.insert( std::make_pair(reference, std::make_pair(key, 1) ) );
-			}
-			else
-			{
-				// Already there add 1
-				++(it->second.second);
+				// Get the file size
+				fseek(file, 0, SEEK_END);
+				long size = ftell(file);
+				fseek(file, 0, SEEK_SET);
+
+				// Get the file content
+				mResult = D3DCreateBlob(size, &mShader);
+				if( SUCCEEDED( mResult ) ) 
+				{
+					fread(mShader->GetBufferPointer(), 1, size, file);
+				}
+				fclose(file);
 			}
 		}
-
-		// Keep track of clone -> reference lookup
-		clone2ReferenceMap.insert( std::make_pair(effect, reference) );
-
-		return effect;
-	}
-
-	//! Release the effect from cache,
-	//! and release the reference if this effect was it last clone
-	void EffectCollection::release(dx11ShaderNode* node, ID3DX11Effect *effect, const MString& fileName)
-	{
-		if (effect)
+		else
 		{
-			Clone2ReferenceMap::iterator it = clone2ReferenceMap.find(effect);
-			if(it != clone2ReferenceMap.end())
+			// Compiled from memory, so the cache key and the compiler see the same source
+			std::vector< char > source;
+			if( readFile(mResolvedFileName, source) && !source.empty() )
 			{
-				ID3DX11Effect* reference = it->second;
+				mSourceKey = strictnessSourceKey(&source[0], source.size());
 
-				ReferenceCountMap::iterator it2 = referenceCountMap.find(reference);
-				if(it2 != referenceCountMap.end())
+				// Go straight to the strict flags when the source is known to need them
+				if( mUseStrictness == false && strictnessMemo().find(mSourceKey) == StrictnessMemo::kStrict )
 				{
-					// This was the last clone for this reference, we can release it
-					if(it2->second.second == 1)
+					mResult = compileEffect(&source[0], source.size(), mResolvedFileName.asChar(), mIncludeHelper, getShaderCompileFlags(true), &mShader, &mError, mIncludedFiles);
+					if( SUCCEEDED( mResult ) && mShader )
 					{
-						EffectKey &key = it2->second.first;
-						key2ReferenceEffectMap.erase(key);
-						referenceCountMap.erase(it2);
-						reference->Release();
-					}
-					else
-					{
-						--(it2->second.second);
+						mUseStrictness = true;
+						return;
 					}
+
+					// An included file changed since, compile it the usual way
+					if( mShader ) { mShader->Release(); mShader = NULL; }
+					if( mError ) { mError->Release(); mError = NULL; }
+					strictnessMemo().set(mSourceKey, false);
 				}
 
-				clone2ReferenceMap.erase(it);
+				unsigned int compileFlags = getShaderCompileFlags(mUseStrictness);
+				mResult = compileEffect(&source[0], source.size(), mResolvedFileName.asChar(), mIncludeHelper, compileFlags, &mShader, &mError, mIncludedFiles);
 			}
-
-			effect->Release();
 		}
-
-		// Remove this node from the fileName -> nodes lookup
-		path2NodesMap[fileName].erase(node);
-		// No more not for this fileName, clear it
-		if (path2NodesMap[fileName].empty())
-			path2NodesMap.erase(fileName);
 	}
 
-	//! Return the effect used as reference and the effect file name
-	ID3DX11Effect* EffectCollection::getReferenceEffectAndFileName(ID3DX11Effect *effect, MString& fileName) const
+	ID3DX11Effect* EffectCompilation::createEffect(ID3D11Device* device, const MString& fileName, MString &errorLog)
 	{
-		ID3DX11Effect* reference = NULL;
-
-		Clone2ReferenceMap::const_iterator it = clone2ReferenceMap.find(effect);
-		if(it != clone2ReferenceMap.end())
+		ID3DX11Effect* effect = NULL;
+		if( FAILED( mResult ) || mShader == NULL )
 		{
-			reference = it->second;
-
-			Key2ReferenceEffectMap::const_iterator it2 = key2ReferenceEffectMap.begin();
-			Key2ReferenceEffectMap::const_iterator it2End = key2ReferenceEffectMap.end();
-			for(; it2 != it2End; ++it2)
+			pushError(fileName, errorLog, mError);
+		}
+		else
+		{
+			HRESULT hr = D3DX11CreateEffectFromMemory(mShader->GetBufferPointer(), mShader->GetBufferSize(), 0, device, &effect);
+			if( FAILED( hr ) || effect == NULL )
 			{
-				if(it2->second == reference)
-				{
-					fileName = it2->first.fileName;
-					break;
-				}
+				pushError(fileName, errorLog, mError);
 			}
 		}
+		return effect;
+	}
 
-		return reference;
+	// If the effect has a hull shader we need to recompile it
+	// with strict flag otherwise it won't support the tesselation properly :
+	// for example, the geometry may not be visible.
+	// The answer is remembered so that run() uses the strict flags next time.
+	bool EffectCompilation::needsStrictness(ID3DX11Effect* effect) const
+	{
+		if( mCompiledEffect || mUseStrictness || effect == NULL )
+			return false;
+
+		bool hasHullShader = effectHasHullShader(effect);
+		strictnessMemo().set(mSourceKey, hasHullShader);
+		return hasHullShader;
 	}
 
-	void EffectCollection::getNodesUsingEffect(const MString& fileName, ShaderNodeList &nodes) const
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// The collection of the effects in use, over the D3D effects
+	struct EffectCollectionTraits
 	{
-		Path2NodesMap::const_iterator itNodeSet = path2NodesMap.find(fileName);
-		if (itNodeSet != path2NodesMap.end())
+		typedef ID3DX11Effect Effect;
+		typedef ID3D11Device Device;
+		typedef dx11ShaderNode Node;
+		typedef CEffectSchema Schema;
+		typedef CDX11EffectCompileHelper::IncludedFileList IncludedFileList;
+
+		static ID3DX11Effect* clone(ID3DX11Effect* source)
 		{
-			const NodeSet& nodeSet = itNodeSet->second;
-			for (NodeSet::const_iterator itNode = nodeSet.begin(); itNode != nodeSet.end(); ++itNode)
-			{
-				nodes.push_back(*itNode);
-			}
+			ID3DX11Effect* effect = NULL;
+			HRESULT hr = source->CloneEffect(0, &effect);
+			return FAILED( hr ) ? NULL : effect;
 		}
-	}
+
+		static void release(ID3DX11Effect* effect)							{ effect->Release(); }
+		static CEffectSchema* createSchema(ID3DX11Effect* effect)			{ return CEffectSchema::create(effect); }
+		static time_t fileTimeStamp(const MString& fileName)				{ return CDX11EffectCompileHelper::fileTimeStamp(fileName); }
+		static bool includedFilesChanged(const IncludedFileList& files)		{ return CDX11EffectCompileHelper::includedFilesChanged(files); }
+	};
+	typedef CEffectCollection< EffectCollectionTraits > EffectCollection;
 
 	static EffectCollection gEffectCollection;
 
 	class CompiledEffectCache {
-		// Very basic LRU cache for effect files:
+		// LRU cache for effect files, bounded by the estimated size of the effects:
 	public:
 		CompiledEffectCache();
 		~CompiledEffectCache();
 		static CompiledEffectCache* get();
-		ID3DX11Effect* find( ID3D11Device* device, const MString& fileName );
-		void add(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect );
+		bool contains( ID3D11Device* device, const MString& fileName );
+		ID3DX11Effect* find( ID3D11Device* device, const MString& fileName, IncludedFileList& includedFiles );
+		void add(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect, const IncludedFileList& includedFiles, size_t bytecodeSize );
+		static EffectCacheStats stats();
 	private:
 		struct CacheData {
-			CacheData(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect, int firstAccess);
+			CacheData(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect, const IncludedFileList& includedFiles, size_t size);
 			~CacheData();
 			ID3D11Device* mDevice;
 			MString mFileName;
 			time_t mTimeStamp;
+			IncludedFileList mIncludedFiles;
 			ID3DX11Effect* mEffect;
-			int mLastAccess;
+			size_t mSize;
 		private:
 			CacheData(const CacheData&);
 			const CacheData& operator=(const CacheData&);
 		};
-		std::list<CacheData*> mCached;
-		int mAccessClock;
-		static const size_t kCacheSize = 8;
+
+		// Most recently used first, looked up by a hash of the device and the file name
+		typedef std::list<CacheData*> CacheList;
+		typedef std::unordered_map<MUint64, CacheList::iterator> CacheMap;
+
+		static MUint64 cacheKey(ID3D11Device* device, const MString& fileName);
+		CacheMap::iterator lookup(ID3D11Device* device, const MString& fileName);
+		static bool isUpToDate(const CacheData* cacheItem);
+		void remove(CacheMap::iterator itMap);
+		void evict(size_t sizeLimit);
+
+		CacheList mCached;
+		CacheMap mCacheMap;
+		size_t mSize;
+		static size_t sizeLimit();
+
+		// Kept when the cache is flushed
+		static unsigned int sHitCount;
+		static unsigned int sMissCount;
+		static unsigned int sEvictionCount;
+
 		MCallbackId mExitCallback;
 		MCallbackId mFileNewCallback;
 	    static void flushCache( void *data);
 		static CompiledEffectCache* sCachePtr;
 	};
 
-	CompiledEffectCache::CacheData::CacheData(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect, int firstAccess)
+	// The memory used by an effect is estimated from its bytecode
+	CompiledEffectCache::CacheData::CacheData(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect, const IncludedFileList& includedFiles, size_t size)
 		: mDevice(device)
 		, mFileName(fileName)
+		, mIncludedFiles(includedFiles)
 		, mEffect(NULL)
-		, mLastAccess(firstAccess)
+		, mSize(sizeof(CacheData) + size)
 	{
 		if (effect)
 			effect->CloneEffect(0, &mEffect);
@@ -645,14 +1182,18 @@ namespace CDX11EffectCompileHelper
 			mEffect->Release();
 	}
 
-	CompiledEffectCache::CompiledEffectCache() : mAccessClock(0) {
+	unsigned int CompiledEffectCache::sHitCount = 0;
+	unsigned int CompiledEffectCache::sMissCount = 0;
+	unsigned int CompiledEffectCache::sEvictionCount = 0;
+
+	CompiledEffectCache::CompiledEffectCache() : mSize(0) {
 	    mExitCallback = MSceneMessage::addCallback(MSceneMessage::kMayaExiting, CompiledEffectCache::flushCache );
 	    mFileNewCallback = MSceneMessage::addCallback(MSceneMessage::kBeforeNew, CompiledEffectCache::flushCache );
 	}
 
 	CompiledEffectCache::~CompiledEffectCache()
 	{
-		std::list<CacheData*>::iterator itCache = mCached.begin();
+		CacheList::iterator itCache = mCached.begin();
 		for ( ; itCache != mCached.end(); ++itCache )
 		{
 			delete *itCache;
@@ -676,48 +1217,414 @@ namespace CDX11EffectCompileHelper
 
 	CompiledEffectCache* CompiledEffectCache::sCachePtr = NULL;
 
-	ID3DX11Effect* CompiledEffectCache::find( ID3D11Device* device, const MString& fileName )
+	// Size limit in megabytes, 64 MB by default
+	size_t CompiledEffectCache::sizeLimit()
+	{
+		static const char* cacheSize = getenv("DX11SHADER_EFFECT_LRU_SIZE");
+		int sizeLimit = (cacheSize ? atoi(cacheSize) : 64);
+		return (size_t)std::max(sizeLimit, 0) << 20;
+	}
+
+	MUint64 CompiledEffectCache::cacheKey(ID3D11Device* device, const MString& fileName)
+	{
+		return CEffectHash().add(&device, sizeof(device)).add(fileName.asChar()).value();
+	}
+
+	CompiledEffectCache::CacheMap::iterator CompiledEffectCache::lookup(ID3D11Device* device, const MString& fileName)
+	{
+		CacheMap::iterator itMap = mCacheMap.find(cacheKey(device, fileName));
+		if ( itMap != mCacheMap.end() )
+		{
+			// Different files with the same hash are never found
+			const CacheData *cacheItem = *itMap->second;
+			if ( cacheItem->mDevice != device || cacheItem->mFileName != fileName )
+				itMap = mCacheMap.end();
+		}
+		return itMap;
+	}
+
+	// Only the entry looked up is checked against its file and its included files
+	bool CompiledEffectCache::isUpToDate(const CacheData* cacheItem)
+	{
+		return cacheItem->mTimeStamp == fileTimeStamp(cacheItem->mFileName) && !includedFilesChanged(cacheItem->mIncludedFiles);
+	}
+
+	void CompiledEffectCache::remove(CacheMap::iterator itMap)
+	{
+		CacheData* cacheItem = *itMap->second;
+		mSize -= cacheItem->mSize;
+		mCached.erase(itMap->second);
+		mCacheMap.erase(itMap);
+		delete cacheItem;
+	}
+
+	// Evict the least recently used entries until the cache size is under sizeLimit.
+	void CompiledEffectCache::evict(size_t sizeLimit)
+	{
+		while (mSize > sizeLimit && !mCached.empty())
+		{
+			remove(mCacheMap.find(cacheKey(mCached.back()->mDevice, mCached.back()->mFileName)));
+			++sEvictionCount;
+		}
+	}
+
+	bool CompiledEffectCache::contains( ID3D11Device* device, const MString& fileName )
+	{
+		CacheMap::iterator itMap = lookup(device, fileName);
+		return itMap != mCacheMap.end() && isUpToDate(*itMap->second);
+	}
+
+	ID3DX11Effect* CompiledEffectCache::find( ID3D11Device* device, const MString& fileName, IncludedFileList& includedFiles )
 	{
 		ID3DX11Effect* effect = NULL;
-		// For small caches, a linear search is fine.
-		std::list<CacheData*>::iterator itCache = mCached.begin();
-		for ( ; itCache != mCached.end(); ++itCache )
+
+		CacheMap::iterator itMap = lookup(device, fileName);
+		if ( itMap != mCacheMap.end() )
 		{
-			CompiledEffectCache::CacheData *cacheItem(*itCache);
-			if ( cacheItem->mDevice == device &&
-				 cacheItem->mFileName == fileName &&
-				 cacheItem->mTimeStamp == fileTimeStamp(fileName) ) 
+			CacheData *cacheItem = *itMap->second;
+			if ( isUpToDate(cacheItem) )
 			{
-				cacheItem->mLastAccess = ++mAccessClock;
+				mCached.splice(mCached.begin(), mCached, itMap->second);
 				cacheItem->mEffect->CloneEffect(0, &effect);
-				break;
+				includedFiles = cacheItem->mIncludedFiles;
+			}
+			else
+			{
+				// Outdated, the effect will be compiled again
+				remove(itMap);
 			}
 		}
 
+		if (effect)
+			++sHitCount;
+		else
+			++sMissCount;
+
 		return effect;
 	}
 
-	void CompiledEffectCache::add(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect )
+	void CompiledEffectCache::add(ID3D11Device* device, const MString& fileName, ID3DX11Effect* effect, const IncludedFileList& includedFiles, size_t bytecodeSize )
 	{
-		if (mCached.size() > kCacheSize)
+		// Replace the previous compilation of the file
+		CacheMap::iterator itFound = lookup(device, fileName);
+		if ( itFound != mCacheMap.end() )
+			remove(itFound);
+
+		CacheData* newData(new CacheData(device, fileName, effect, includedFiles, bytecodeSize));
+		size_t limit = sizeLimit();
+		if (newData->mEffect == NULL || newData->mSize > limit)
 		{
-			std::list<CacheData*>::iterator itCache = mCached.begin();
-			std::list<CacheData*>::iterator oldestItem = itCache;
-			itCache++;
-			for ( ; itCache != mCached.end(); ++itCache )
-			{
-				if ( (*itCache)->mLastAccess < (*oldestItem)->mLastAccess )
-					oldestItem = itCache;
-			}
-			CacheData* oldData(*oldestItem);
-			mCached.erase(oldestItem);
-			delete oldData;
-		}
-		CacheData* newData(new CacheData(device, fileName, effect, ++mAccessClock));
-		if (newData->mEffect)
-			mCached.push_back( newData );
-		else
 			delete newData;
+			return;
+		}
+
+		evict(limit - newData->mSize);
+
+		MUint64 key = cacheKey(device, fileName);
+		CacheMap::iterator itMap = mCacheMap.find(key);
+		if ( itMap != mCacheMap.end() )
+			remove(itMap);	// another file with the same hash
+
+		mCached.push_front( newData );
+		mCacheMap[key] = mCached.begin();
+		mSize += newData->mSize;
+	}
+
+	EffectCacheStats CompiledEffectCache::stats()
+	{
+		EffectCacheStats stats;
+		stats.hitCount = sHitCount;
+		stats.missCount = sMissCount;
+		stats.evictionCount = sEvictionCount;
+		stats.entryCount = (sCachePtr ? (unsigned int)sCachePtr->mCached.size() : 0);
+		stats.size = (sCachePtr ? sCachePtr->mSize : 0);
+		stats.sizeLimit = sizeLimit();
+		return stats;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Scene prewarm: number of scene files being read, and the compilations done meanwhile
+	int sPrewarmDepth = 0;
+	unsigned int sPrewarmEffectCount = 0;
+	double sPrewarmCompileTime = 0.0;
+	MCallbackId sPrewarmCallbackIds[8];
+	unsigned int sPrewarmCallbackCount = 0;
+
+	CEffectCompileQueue& compileQueue()
+	{
+		static CEffectCompileQueue sQueue;
+		return sQueue;
+	}
+
+	// Hot reload: the watcher of the files in use, and the reload waiting for its compilations
+	CFileWatcher* sFileWatcher = NULL;
+	MCallbackId sFileWatcherCallbackId = 0;
+	ReloadCallback sReloadCallback = NULL;
+	MTimer sHotReloadTimer;
+	bool sHotReloading = false;
+	double sHotReloadChangeTime = -1.0;
+	unsigned int sHotReloadEffectCount = 0;
+
+	double hotReloadTime()
+	{
+		sHotReloadTimer.endTimer();
+		return sHotReloadTimer.elapsedTime();
+	}
+
+	// The nodes loaded the effects of the files changed, log the time since the change was seen
+	void endHotReload()
+	{
+		char buffer[64];
+		MStringArray args;
+		sprintf(buffer, "%u", sHotReloadEffectCount);
+		args.append(buffer);
+		sprintf(buffer, "%.2f", hotReloadTime() - sHotReloadChangeTime);
+		args.append(buffer);
+		MGlobal::displayInfo( dx11ShaderStrings::getString( dx11ShaderStrings::kInfoHotReload, args ) );
+
+		sHotReloadChangeTime = -1.0;
+	}
+
+	// Registered while compilations are pending
+	MCallbackId sIdleCallbackId = 0;
+	bool sIdleCallbackRegistered = false;
+
+	void processCompletedBuilds(void* data)
+	{
+		compileQueue().processCompleted();
+
+		if (sHotReloadChangeTime >= 0.0 && compileQueue().pendingCount() == 0)
+			endHotReload();
+
+		if (sIdleCallbackRegistered && compileQueue().pendingCount() == 0)
+		{
+			MMessage::removeCallback(sIdleCallbackId);
+			sIdleCallbackRegistered = false;
+		}
+	}
+
+	/*
+		The effect created by the compile job completing, while its nodes are called back.
+		build() hands it to these nodes before looking the LRU up, so they get it even when
+		the LRU did not keep it, and buildAsync() does not submit its compilation again.
+	*/
+	struct CompletedBuild
+	{
+		ID3D11Device* device;
+		const MString* resolvedFileName;
+		ID3DX11Effect* effect;
+		const IncludedFileList* includedFiles;
+	};
+	CompletedBuild sCompletedBuild = { NULL, NULL, NULL, NULL };
+
+	bool isCompletedBuild(ID3D11Device* device, const MString& resolvedFileName)
+	{
+		return sCompletedBuild.effect != NULL && sCompletedBuild.device == device && *sCompletedBuild.resolvedFileName == resolvedFileName;
+	}
+
+	// Return a clone of the effect of the completing job for this file, or NULL
+	ID3DX11Effect* cloneCompletedEffect(ID3D11Device* device, const MString& resolvedFileName, IncludedFileList& includedFiles)
+	{
+		if( !isCompletedBuild(device, resolvedFileName) )
+			return NULL;
+
+		ID3DX11Effect* effect = NULL;
+		if( FAILED( sCompletedBuild.effect->CloneEffect(0, &effect) ) )
+			return NULL;
+
+		includedFiles = *sCompletedBuild.includedFiles;
+		return effect;
+	}
+
+	/*
+		Compile an effect file on a worker thread.
+		Once done, on the main thread, the effect is created and added to the LRU, then each node
+		waiting for the compilation is called back to load the effect, handed over by sCompletedBuild.
+	*/
+	class EffectCompileJob : public CEffectCompileQueue::Job
+	{
+	public:
+		EffectCompileJob(ID3D11Device* device, const MString& fileName, const MString& resolvedFileName, bool useStrictness, BuildCallback callback)
+			: mDevice(device)
+			, mFileName(fileName)
+			, mCompilation(resolvedFileName, false, useStrictness)
+			, mCallback(callback)
+			, mCompileTime(0.0)
+		{}
+
+		virtual void run();
+		virtual void complete(const CEffectCompileQueue::ClientList& clients);
+
+	private:
+		ID3D11Device* mDevice;
+		MString mFileName;
+		EffectCompilation mCompilation;
+		BuildCallback mCallback;
+		double mCompileTime;
+	};
+
+	void submitCompileJob(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName, const MString& resolvedFileName, bool useStrictness, BuildCallback callback)
+	{
+		// Same file with the same options: the node waits for the pending compilation
+		MString key = resolvedFileName;
+		if (useStrictness)
+			key += /*MSG0*/"|strict";
+
+		compileQueue().submit(key, new EffectCompileJob(device, fileName, resolvedFileName, useStrictness, callback), node);
+
+		if (!sIdleCallbackRegistered)
+		{
+			MStatus status;
+			sIdleCallbackId = MEventMessage::addEventCallback(/*MSG0*/"idle", processCompletedBuilds, NULL, &status);
+			sIdleCallbackRegistered = (status == MS::kSuccess);
+		}
+	}
+
+	void EffectCompileJob::run()
+	{
+		MTimer timer;
+		timer.beginTimer();
+		mCompilation.run();
+		timer.endTimer();
+		mCompileTime = timer.elapsedTime();
+	}
+
+	void EffectCompileJob::complete(const CEffectCompileQueue::ClientList& clients)
+	{
+		const MString& resolvedFileName = mCompilation.resolvedFileName();
+
+		if (sPrewarmDepth > 0)
+			sPrewarmCompileTime += mCompileTime;
+
+		MString errorLog;
+		ID3DX11Effect* effect = mCompilation.createEffect(mDevice, mFileName, errorLog);
+		if( mCompilation.needsStrictness(effect) ) {
+			effect->Release();
+			for (size_t i = 0; i < clients.size(); ++i)
+				submitCompileJob((dx11ShaderNode*)clients[i], mDevice, mFileName, resolvedFileName, true /*useStrictness*/, mCallback);
+			return;
+		}
+
+		if( effect )
+			CompiledEffectCache::get()->add(mDevice, resolvedFileName, effect, mCompilation.includedFiles(), mCompilation.bytecodeSize());
+
+		if (sPrewarmDepth > 0)
+			++sPrewarmEffectCount;
+
+		// The LRU may not keep the effect, the nodes get it from sCompletedBuild
+		CompletedBuild previousBuild = sCompletedBuild;
+		sCompletedBuild.device = mDevice;
+		sCompletedBuild.resolvedFileName = &resolvedFileName;
+		sCompletedBuild.effect = effect;
+		sCompletedBuild.includedFiles = &mCompilation.includedFiles();
+
+		for (size_t i = 0; i < clients.size(); ++i)
+		{
+			dx11ShaderNode* node = (dx11ShaderNode*)clients[i];
+			mCallback(node, effect != NULL, errorLog);
+
+			// Keep track of the node even though the compilation failed, like build() does
+			if( effect == NULL )
+				gEffectCollection.acquire(node, mDevice, resolvedFileName, NULL);
+		}
+
+		sCompletedBuild = previousBuild;
+		if( effect )
+			effect->Release();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	void beginScenePrewarm(void* data)
+	{
+		// The files may have been edited since the effects in use were loaded
+		gEffectCollection.invalidateTimeStamps();
+
+		if (sPrewarmDepth++ == 0)
+		{
+			sPrewarmEffectCount = 0;
+			sPrewarmCompileTime = 0.0;
+		}
+	}
+
+	// The nodes read from the file queued their compilations, wait for them and let the nodes load their effect
+	void endScenePrewarm(void* data)
+	{
+		if (sPrewarmDepth == 0 || --sPrewarmDepth > 0)
+			return;
+
+		// Still counted as prewarm while the nodes load and queue the strict compilations
+		sPrewarmDepth = 1;
+		MTimer timer;
+		timer.beginTimer();
+		finishBuilds();
+		timer.endTimer();
+		sPrewarmDepth = 0;
+
+		if (sPrewarmEffectCount > 0)
+		{
+			double waitTime = timer.elapsedTime();
+
+			char buffer[64];
+			MStringArray args;
+			sprintf(buffer, "%u", sPrewarmEffectCount);
+			args.append(buffer);
+			sprintf(buffer, "%.2f", sPrewarmCompileTime);
+			args.append(buffer);
+			sprintf(buffer, "%.2f", waitTime);
+			args.append(buffer);
+			sprintf(buffer, "%.2f", std::max(sPrewarmCompileTime - waitTime, 0.0));
+			args.append(buffer);
+			MGlobal::displayInfo( dx11ShaderStrings::getString( dx11ShaderStrings::kInfoScenePrewarm, args ) );
+		}
+	}
+
+	bool isScenePrewarmEnabled()
+	{
+		static const char* prewarm = getenv("DX11SHADER_SCENE_PREWARM");
+		return (prewarm == NULL || atoi(prewarm) != 0);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Polling interval in milliseconds, 0 when the hot reload is off
+	int hotReloadInterval()
+	{
+		static const char* hotReload = getenv("DX11SHADER_HOT_RELOAD");
+		int interval = (hotReload ? atoi(hotReload) : 0);
+		return (interval > 0 ? std::max(interval, 100) : 0);
+	}
+
+	// Timer callback: once the changes settled, reload the nodes of the effects outdated by them
+	void checkWatchedFiles(float elapsedTime, float lastTime, void* data)
+	{
+		CFileWatcher::FileList fileNames;
+		gEffectCollection.getWatchedFiles(fileNames);
+		sFileWatcher->setFiles(fileNames);
+
+		CFileWatcher::FileList changedFileNames;
+		double firstChangeTime = 0.0;
+		if (!sFileWatcher->update(hotReloadTime(), changedFileNames, firstChangeTime))
+			return;
+
+		gEffectCollection.invalidateTimeStamps();
+
+		MStringArray effectNames;
+		gEffectCollection.getOutdatedEffects(effectNames);
+		if (effectNames.length() == 0)
+			return;
+
+		// The nodes keep their effect until the new one is compiled, once per file
+		sHotReloading = true;
+		for (unsigned int i = 0; i < effectNames.length(); ++i)
+			sReloadCallback(effectNames[i]);
+		sHotReloading = false;
+
+		sHotReloadEffectCount = effectNames.length();
+		sHotReloadChangeTime = firstChangeTime;
+		if (compileQueue().pendingCount() == 0)
+			endHotReload();
 	}
 }
 
@@ -786,77 +1693,22 @@ ID3DX11Effect* CDX11EffectCompileHelper::build(dx11ShaderNode* node, ID3D11Devic
 	ID3DX11Effect *effect = gEffectCollection.acquire(node, device, resolvedFileName);
 	if( effect == NULL ) {
 
-		effect = CompiledEffectCache::get()->find(device, resolvedFileName);
+		IncludedFileList includedFiles;
+		// A node called back by its compilation takes the effect compiled for it, others look the LRU up
+		effect = cloneCompletedEffect(device, resolvedFileName, includedFiles);
+		if( effect == NULL )
+			effect = CompiledEffectCache::get()->find(device, resolvedFileName, includedFiles);
 		if( effect == NULL ) {
 
-			if( resolvedFileName != fileName && MFileObject::isAbsolutePath(fileName) )
-			{
-				MStringArray args;
-				args.append(fileName);
-				args.append(resolvedFileName);
-
-				MString msg = dx11ShaderStrings::getString( dx11ShaderStrings::kErrorAbsolutePathNotFound, args );
-				errorLog += msg;
-			}
-
-			CIncludeHelper includeHelper;
-			includeHelper.setReferencePath(resolvedFileName);
-
-			ID3DBlob *shader = NULL;
-			ID3DBlob *error = NULL;
-			HRESULT hr = S_FALSE;
-
-			if( compiledEffect )
-			{
-				FILE* file = fopen(resolvedFileName.asChar(), "rb");
-				if(file)
-				{
-					// Get the file size
-					fseek(file, 0, SEEK_END);
-					long size = ftell(file);
-					fseek(file, 0, SEEK_SET);
-
-					// Get the file content
-					hr = D3DCreateBlob(size, &shader);
-					if( SUCCEEDED( hr ) ) 
-					{
-						fread(shader->GetBufferPointer(), 1, size, file);
-					}
-					fclose(file);
-				}
-			}
-			else
-			{
-				unsigned int compileFlags = getShaderCompileFlags(useStrictness);
-				D3D10_SHADER_MACRO* macros = getD3DMacros();
-#if _MSC_VER < 1700
-				hr = D3DX11CompileFromFile(resolvedFileName.asChar(), macros, &includeHelper, NULL, /*MSG0*/"fx_5_0", compileFlags, 0, NULL, &shader, &error, NULL);
-#else
-				hr = D3DCompileFromFile(resolvedFileName.asWChar(), macros, &includeHelper, NULL, /*MSG0*/"fx_5_0", compileFlags, 0, &shader, &error);
-#endif
-			}
-
-			if( FAILED( hr ) || shader == NULL )
-			{
-				pushError(fileName, errorLog, error);
-			}
-			else if( shader )
-			{
-				hr = D3DX11CreateEffectFromMemory(shader->GetBufferPointer(), shader->GetBufferSize(), 0, device, &effect);
-				if( FAILED( hr ) || effect == NULL )
-				{
-					pushError(fileName, errorLog, error);
-				}
-			}
+			pushAbsolutePathError(fileName, resolvedFileName, errorLog);
 
-			if( shader ) {
-				shader->Release();
-			}
+			EffectCompilation compilation(resolvedFileName, compiledEffect, useStrictness);
+			compilation.run();
+			effect = compilation.createEffect(device, fileName, errorLog);
+			includedFiles = compilation.includedFiles();
+			size_t bytecodeSize = compilation.bytecodeSize();
 
-			if( compiledEffect == false && useStrictness == false && effect != NULL && effectHasHullShader(effect) ) {
-				// if the effect has a hull shader we need to recompile it
-				// with strict flag otherwise it won't support the tesselation properly :
-				// for example, the geometry may not be visible
+			if( compilation.needsStrictness(effect) ) {
 				effect->Release();
 				effect = CDX11EffectCompileHelper::build(node, device, fileName, errorLog, true /*useStrictness*/);
 
@@ -866,17 +1718,133 @@ ID3DX11Effect* CDX11EffectCompileHelper::build(dx11ShaderNode* node, ID3D11Devic
 
 			// Effect was compiled,
 			// Add it to LRU cache
-			CompiledEffectCache::get()->add(device, resolvedFileName, effect);
+			CompiledEffectCache::get()->add(device, resolvedFileName, effect, includedFiles, bytecodeSize);
 		}  // CompiledEffectCache::get()
 
 		// The effect was either found in the CompiledEffectCache or compiled,
 		// Acquire effect from collection, will register the compiled effect as reference and will return a clone
-		effect = gEffectCollection.acquire(node, device, resolvedFileName, effect);
+		effect = gEffectCollection.acquire(node, device, resolvedFileName, effect, NULL, &includedFiles);
 	} // gEffectCollection.acquire()
 
 	return effect;
 }
 
+/*
+	Start compiling a text shader file on a worker thread.
+	Return false when the effect is found in the collection or in the LRU, or cannot be compiled,
+	the caller then calls build() as usual.
+	Otherwise the callback is called on idle once the compilation is done, build() then
+	returns the compiled effect right away.
+*/
+bool CDX11EffectCompileHelper::buildAsync(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName, MString &errorLog, BuildCallback callback)
+{
+	cancelBuild(node);
+
+	if( !isAsyncBuildEnabled() )
+		return false;
+
+	// Missing, invalid and precompiled files are handled by build()
+	bool fileExits = false;
+	MString resolvedFileName = CDX11EffectCompileHelper::resolveShaderFileName(fileName, &fileExits);
+	bool compiledEffect = false;
+	if( fileExits == false || isValidEffectFile(resolvedFileName, compiledEffect) == false || compiledEffect )
+		return false;
+
+	// The effect of a completing compilation is loaded by build(), it is never submitted again
+	if( isCompletedBuild(device, resolvedFileName) || gEffectCollection.contains(device, resolvedFileName) || CompiledEffectCache::get()->contains(device, resolvedFileName) )
+		return false;
+
+	pushAbsolutePathError(fileName, resolvedFileName, errorLog);
+
+	submitCompileJob(node, device, fileName, resolvedFileName, false /*useStrictness*/, callback);
+	return true;
+}
+
+/*
+	The node is deleted or loads another effect, it is not called back for its pending compilations.
+*/
+void CDX11EffectCompileHelper::cancelBuild(dx11ShaderNode* node)
+{
+	compileQueue().cancel(node);
+}
+
+/*
+	Wait for the pending compilations and call back their nodes.
+*/
+void CDX11EffectCompileHelper::finishBuilds()
+{
+	compileQueue().flush();
+	processCompletedBuilds(NULL);
+}
+
+bool CDX11EffectCompileHelper::isAsyncBuildEnabled()
+{
+	static bool sAsyncBuild = (getenv("DX11SHADER_ASYNC_COMPILE") != NULL);
+	return sAsyncBuild || sPrewarmDepth > 0 || sHotReloading;
+}
+
+/*
+	While a scene file is read, the effects are compiled in the background like with DX11SHADER_ASYNC_COMPILE:
+	each effect file is compiled once, the effects of the scene are compiled in parallel,
+	and the file reading goes on meanwhile. Once the file is read the compilations are waited for,
+	then the nodes load their effect: the first node of a file gets it from the LRU, the others clone it.
+*/
+void CDX11EffectCompileHelper::addScenePrewarmCallbacks()
+{
+	if (!isScenePrewarmEnabled() || sPrewarmCallbackCount > 0)
+		return;
+
+	MSceneMessage::Message beginMessages[] = { MSceneMessage::kBeforeOpen, MSceneMessage::kBeforeImport, MSceneMessage::kBeforeLoadReference, MSceneMessage::kBeforeCreateReference };
+	MSceneMessage::Message endMessages[] = { MSceneMessage::kAfterOpen, MSceneMessage::kAfterImport, MSceneMessage::kAfterLoadReference, MSceneMessage::kAfterCreateReference };
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		sPrewarmCallbackIds[sPrewarmCallbackCount++] = MSceneMessage::addCallback(beginMessages[i], beginScenePrewarm);
+		sPrewarmCallbackIds[sPrewarmCallbackCount++] = MSceneMessage::addCallback(endMessages[i], endScenePrewarm);
+	}
+}
+
+void CDX11EffectCompileHelper::removeScenePrewarmCallbacks()
+{
+	for (unsigned int i = 0; i < sPrewarmCallbackCount; ++i)
+		MMessage::removeCallback(sPrewarmCallbackIds[i]);
+	sPrewarmCallbackCount = 0;
+	sPrewarmDepth = 0;
+}
+
+/*
+	Hot reload: the effect and included files in use are polled on a timer. A burst of changes
+	is handled once no file changed for a polling interval, then the effects outdated by the
+	changes are compiled in the background and the nodes using them are reloaded.
+	The time from the change to the nodes loading the new effects is logged.
+*/
+void CDX11EffectCompileHelper::startFileWatcher(ReloadCallback reload)
+{
+	int interval = hotReloadInterval();
+	if (interval == 0 || sFileWatcher != NULL)
+		return;
+
+	MStatus status;
+	sFileWatcherCallbackId = MTimerMessage::addTimerCallback(interval / 1000.0f, checkWatchedFiles, NULL, &status);
+	if (status != MS::kSuccess)
+		return;
+
+	sFileWatcher = new CFileWatcher(new CFileWatcher::PollingBackend, interval / 1000.0);
+	sReloadCallback = reload;
+	sHotReloadTimer.beginTimer();
+}
+
+void CDX11EffectCompileHelper::stopFileWatcher()
+{
+	if (sFileWatcher == NULL)
+		return;
+
+	MMessage::removeCallback(sFileWatcherCallbackId);
+	delete sFileWatcher;
+	sFileWatcher = NULL;
+	sReloadCallback = NULL;
+	sHotReloadChangeTime = -1.0;
+}
+
 /*
 	During a duplicate, we already have an effect to use as reference.
 	The source effect will be cloned, and the result added to the cache.
@@ -901,24 +1869,30 @@ ID3DX11Effect* CDX11EffectCompileHelper::build(dx11ShaderNode* node, ID3D11Devic
 }
 
 /*
-	Load a precompiled effect.
-	The effect is not stored in any cache, as the loading of a compiled effect is already fast enough.
+	Load an effect from memory.
+	The effect is not stored in the collection or in the LRU, only its bytecode is kept in the effect cache.
 */
 ID3DX11Effect* CDX11EffectCompileHelper::build(dx11ShaderNode* node, ID3D11Device* device, const void* buffer, unsigned int dataSize, MString &errorLog, bool useStrictness)
 {
+	MUint64 sourceKey = strictnessSourceKey((const char*)buffer, dataSize);
+	if( useStrictness == false && strictnessMemo().find(sourceKey) == StrictnessMemo::kStrict ) {
+		// Known to have a hull shader, the errors of the strict compilation are dropped if it fails
+		MString strictErrorLog;
+		ID3DX11Effect* effect = CDX11EffectCompileHelper::build(node, device, buffer, dataSize, strictErrorLog, true /*useStrictness*/);
+		if( effect ) {
+			return effect;
+		}
+		strictnessMemo().set(sourceKey, false);
+	}
+
 	unsigned int compileFlags = getShaderCompileFlags(useStrictness);
-	D3D10_SHADER_MACRO* macros = getD3DMacros();
 	CIncludeHelper includeHelper;
 
 	ID3DX11Effect *effect = NULL;
 	ID3DBlob *shader = NULL;
 	ID3DBlob *error = NULL;
-	HRESULT hr = S_FALSE;
-#if _MSC_VER < 1700
-	hr = D3DX11CompileFromMemory((char*)buffer, dataSize, NULL, macros, &includeHelper, "", "fx_5_0", compileFlags, 0, NULL, &shader, &error, NULL);
-#else
-	hr = D3DCompile((char*)buffer, dataSize, NULL, macros, &includeHelper, "", "fx_5_0", compileFlags, 0, &shader, &error);
-#endif
+	IncludedFileList includedFiles;
+	HRESULT hr = compileEffect((const char*)buffer, dataSize, NULL, includeHelper, compileFlags, &shader, &error, includedFiles);
 	if( FAILED( hr ) || shader == NULL )
 	{
 		pushError(errorLog, error);
@@ -936,7 +1910,12 @@ ID3DX11Effect* CDX11EffectCompileHelper::build(dx11ShaderNode* node, ID3D11Devic
 		shader->Release();
 	}
 
-	if( useStrictness == false && effect != NULL && effectHasHullShader(effect) ) {
+	bool hasHullShader = (useStrictness == false && effect != NULL && effectHasHullShader(effect));
+	if( useStrictness == false && effect != NULL ) {
+		strictnessMemo().set(sourceKey, hasHullShader);
+	}
+
+	if( hasHullShader ) {
 		// if the effect has a hull shader we need to recompile it
 		// with strict flag otherwise it won't support the tesselation properly :
 		// for example, the geometry may not be visible
@@ -947,6 +1926,55 @@ ID3DX11Effect* CDX11EffectCompileHelper::build(dx11ShaderNode* node, ID3D11Devic
 	return effect;
 }
 
+/*
+	Get the reflection of the effect. The clones of the same reference share it, so it is built
+	once for all the nodes using an effect file.
+*/
+CEffectSchema* CDX11EffectCompileHelper::acquireEffectSchema(ID3DX11Effect* effect)
+{
+	return gEffectCollection.acquireSchema(effect);
+}
+
+/*
+	Get the effect files that changed, or which included files changed, since they were compiled.
+*/
+void CDX11EffectCompileHelper::getOutdatedEffects(MStringArray& fileNames)
+{
+	gEffectCollection.getOutdatedEffects(fileNames);
+}
+
+/*
+	Forget the time stamps of the effect files in use, the files are checked again on the next load.
+*/
+void CDX11EffectCompileHelper::clearFileTimeStamps()
+{
+	gEffectCollection.invalidateTimeStamps();
+}
+
+/*
+	Forget the resolved file names, the files are searched again on the next load.
+*/
+void CDX11EffectCompileHelper::clearResolvedPaths()
+{
+	resolvedPathCache().clear();
+}
+
+/*
+	Get the counters of the resolved file names.
+*/
+CDX11EffectCompileHelper::PathCacheStats CDX11EffectCompileHelper::pathCacheStats()
+{
+	return resolvedPathCache().stats();
+}
+
+/*
+	Get the counters of the LRU of the compiled effects.
+*/
+CDX11EffectCompileHelper::EffectCacheStats CDX11EffectCompileHelper::effectCacheStats()
+{
+	return CompiledEffectCache::stats();
+}
+
 /*
 	Get all the nodes that use the specified file shader.
 	The collection keeps track of which shader is used by which nodes.
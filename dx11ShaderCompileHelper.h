@@ -16,7 +16,9 @@
 struct ID3D11Device;
 struct ID3DX11Effect;
 class MString;
+class MStringArray;
 class dx11ShaderNode;
+class CEffectSchema;
 
 
 /*!
@@ -38,18 +40,83 @@ namespace CDX11EffectCompileHelper
 	// Build an effect from an external file
 	ID3DX11Effect* build(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName, MString &errorLog, bool useStrictness = false);
 
+	// Compile an effect file in the background, return false when build() can load it right away.
+	// Otherwise the callback is called on idle, from the main thread, once the compilation is done.
+	typedef void (*BuildCallback)(dx11ShaderNode* node, bool succeeded, const MString& errorLog);
+	bool buildAsync(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName, MString &errorLog, BuildCallback callback);
+
+	// Stop waiting for the pending compilations of the node
+	void cancelBuild(dx11ShaderNode* node);
+
+	// Wait for all the pending compilations and call back their nodes
+	void finishBuilds();
+
+	// Off by default, set the DX11SHADER_ASYNC_COMPILE environment variable to turn it on.
+	// Always on while a scene file is read, see addScenePrewarmCallbacks.
+	bool isAsyncBuildEnabled();
+
+	// Compile the effects of the nodes read from a scene file in parallel, and wait for them
+	// once the file is read. Set the DX11SHADER_SCENE_PREWARM environment variable to 0 to turn it off.
+	void addScenePrewarmCallbacks();
+	void removeScenePrewarmCallbacks();
+
+	// Reload the nodes when their effect file or an included file changes, their effects are
+	// compiled in the background. Set the DX11SHADER_HOT_RELOAD environment variable to the
+	// polling interval in milliseconds to turn it on.
+	typedef bool (*ReloadCallback)(const MString& effectName);
+	void startFileWatcher(ReloadCallback reload);
+	void stopFileWatcher();
+
 	// Clone an effect - used for the duplicate operation
 	ID3DX11Effect* build(dx11ShaderNode* node, ID3D11Device* device, const MString& fileName, ID3DX11Effect* effectSource, MString &errorLog);
 
 	// Load a compiled effect
 	ID3DX11Effect* build(dx11ShaderNode* node, ID3D11Device* device, const void* buffer, unsigned int dataSize, MString &errorLog, bool useStrictness = false);
 
+	// Get the reflection of an effect, shared by the nodes using the same effect file.
+	// Release it with CEffectSchema::release()
+	CEffectSchema* acquireEffectSchema(ID3DX11Effect* effect);
+
 	// Get the absolute path of an effect file
 	MString resolveShaderFileName(const MString& shaderPath, bool* fileExists = NULL);
 
 	// Get the list of the nodes that use the specified shader file
 	typedef std::list< dx11ShaderNode* > ShaderNodeList;
 	void getNodesUsingEffect(const MString& fileName, ShaderNodeList &nodes);
+
+	// Get the files of the effects in use whose file or included files changed since they were compiled
+	void getOutdatedEffects(MStringArray& fileNames);
+
+	// The time stamps of the effect files in use, and of their included files, are checked once
+	// and remembered until a reload or a change seen by the file watcher. Clearing them makes
+	// the next loads check the files again.
+	void clearFileTimeStamps();
+
+	// The effect and include files found in the search paths are remembered, along with
+	// the files not found. Clearing them makes the next loads search the files again.
+	void clearResolvedPaths();
+
+	struct PathCacheStats
+	{
+		unsigned int lookupCount;
+		unsigned int hitCount;
+		unsigned int notFoundHitCount;
+		unsigned int statCallsAvoided;
+		unsigned int entryCount;
+	};
+	PathCacheStats pathCacheStats();
+
+	// Counters of the LRU keeping the last compiled effects, the sizes are in bytes
+	struct EffectCacheStats
+	{
+		unsigned int hitCount;
+		unsigned int missCount;
+		unsigned int evictionCount;
+		unsigned int entryCount;
+		size_t size;
+		size_t sizeLimit;
+	};
+	EffectCacheStats effectCacheStats();
 };
 
 #endif //_dx11ShaderCompilHelper_h_
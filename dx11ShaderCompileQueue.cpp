@@ -0,0 +1,233 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+#include "dx11ShaderCompileQueue.h"
+
+#include <maya/MThreadAsync.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+	void sleepMilliseconds(unsigned int ms)
+	{
+#ifdef _WIN32
+		Sleep(ms);
+#else
+		usleep(ms * 1000);
+#endif
+	}
+
+	// Runs the tasks on the Maya asynchronous thread pool, initialized by the first task
+	class MayaAsyncScheduler : public CEffectCompileQueue::Scheduler
+	{
+	public:
+		MayaAsyncScheduler() : mInitialized(false), mInitFailed(false) {}
+
+		virtual ~MayaAsyncScheduler()
+		{
+			if (mInitialized)
+				MThreadAsync::release();
+		}
+
+		virtual bool start(Function run, Function done, void* data)
+		{
+			if (!mInitialized && !mInitFailed)
+			{
+				mInitialized = (MThreadAsync::init() == MStatus::kSuccess);
+				mInitFailed = !mInitialized;
+			}
+			if (!mInitialized)
+				return false;
+
+			Task* task = new Task;
+			task->run = run;
+			task->done = done;
+			task->data = data;
+			if (MThreadAsync::createTask(runTask, task, taskDone, task) != MStatus::kSuccess)
+			{
+				delete task;
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		struct Task
+		{
+			Function run;
+			Function done;
+			void* data;
+		};
+
+		static MThreadRetVal runTask(void* data)
+		{
+			Task* task = (Task*)data;
+			task->run(task->data);
+			return 0;
+		}
+
+		static void taskDone(void* data)
+		{
+			Task* task = (Task*)data;
+			task->done(task->data);
+			delete task;
+		}
+
+		bool mInitialized;
+		bool mInitFailed;
+	};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CEffectCompileQueue::CEffectCompileQueue(Scheduler* scheduler)
+: mScheduler(scheduler)
+, mDefaultScheduler(NULL)
+{
+	if (mScheduler == NULL)
+	{
+		mDefaultScheduler = new MayaAsyncScheduler;
+		mScheduler = mDefaultScheduler;
+	}
+}
+
+CEffectCompileQueue::~CEffectCompileQueue()
+{
+	flush();
+	delete mDefaultScheduler;
+}
+
+bool CEffectCompileQueue::submit(const MString& key, Job* job, void* client)
+{
+	mLock.lock();
+
+	for (EntryList::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+	{
+		Entry* entry = *it;
+		if (entry->key == key)
+		{
+			if (std::find(entry->clients.begin(), entry->clients.end(), client) == entry->clients.end())
+				entry->clients.push_back(client);
+			mLock.unlock();
+			delete job;
+			return false;
+		}
+	}
+
+	Entry* entry = new Entry;
+	entry->key = key;
+	entry->job = job;
+	entry->clients.push_back(client);
+	entry->queue = this;
+	entry->done = false;
+	mEntries.push_back(entry);
+	mLock.unlock();
+
+	// Without a worker thread the job runs now, it completes on the next processCompleted()
+	if (!mScheduler->start(runJob, jobDone, entry))
+	{
+		runJob(entry);
+		jobDone(entry);
+	}
+	return true;
+}
+
+void CEffectCompileQueue::cancel(void* client)
+{
+	mLock.lock();
+	for (EntryList::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+	{
+		ClientList& clients = (*it)->clients;
+		clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+	}
+	mLock.unlock();
+}
+
+bool CEffectCompileQueue::isPending(void* client) const
+{
+	bool pending = false;
+	mLock.lock();
+	for (EntryList::const_iterator it = mEntries.begin(); it != mEntries.end() && !pending; ++it)
+	{
+		const ClientList& clients = (*it)->clients;
+		pending = (std::find(clients.begin(), clients.end(), client) != clients.end());
+	}
+	mLock.unlock();
+	return pending;
+}
+
+unsigned int CEffectCompileQueue::pendingCount() const
+{
+	mLock.lock();
+	unsigned int count = (unsigned int)mEntries.size();
+	mLock.unlock();
+	return count;
+}
+
+unsigned int CEffectCompileQueue::processCompleted()
+{
+	// Take the finished entries out first: completing a job may submit new ones
+	EntryList completed;
+	mLock.lock();
+	for (EntryList::iterator it = mEntries.begin(); it != mEntries.end(); )
+	{
+		if ((*it)->done)
+		{
+			completed.push_back(*it);
+			it = mEntries.erase(it);
+		}
+		else
+			++it;
+	}
+	mLock.unlock();
+
+	for (EntryList::iterator it = completed.begin(); it != completed.end(); ++it)
+	{
+		Entry* entry = *it;
+		entry->job->complete(entry->clients);
+		delete entry->job;
+		delete entry;
+	}
+	return (unsigned int)completed.size();
+}
+
+void CEffectCompileQueue::flush()
+{
+	while (pendingCount() > 0)
+	{
+		if (processCompleted() == 0)
+			sleepMilliseconds(5);
+	}
+}
+
+// Worker thread
+void CEffectCompileQueue::runJob(void* data)
+{
+	Entry* entry = (Entry*)data;
+	entry->job->run();
+}
+
+// Worker thread, once runJob returned
+void CEffectCompileQueue::jobDone(void* data)
+{
+	Entry* entry = (Entry*)data;
+	entry->queue->mLock.lock();
+	entry->done = true;
+	entry->queue->mLock.unlock();
+}
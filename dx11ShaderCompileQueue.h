@@ -0,0 +1,107 @@
+#ifndef _dx11ShaderCompileQueue_h_
+#define _dx11ShaderCompileQueue_h_
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+#include <maya/MString.h>
+#include <maya/MMutexLock.h>
+
+#include <vector>
+#include <list>
+
+/*!
+	Runs effect compilations on worker threads, the Maya asynchronous thread pool by
+	default, and hands their results back to the main thread.
+
+	A job is submitted under a key, usually the effect file and its compile options,
+	on behalf of a client. Submitting a key that is already queued or running does not
+	start another compilation: the client is added to the running job, which completes
+	for all its clients at once.
+
+	Job::run() is called on a worker thread and must not use Maya or the D3D device.
+	Job::complete() is called on the main thread, from processCompleted(), with the
+	clients still waiting for the job.
+
+	This class does not depend on D3D, the jobs are defined by CDX11EffectCompileHelper.
+	The worker threads come from a Scheduler, which the tests replace to run the queue
+	without Maya.
+*/
+class CEffectCompileQueue
+{
+public:
+	typedef std::vector< void* > ClientList;
+
+	class Job
+	{
+	public:
+		virtual ~Job() {}
+
+		// Worker thread
+		virtual void run() = 0;
+
+		// Main thread, the job is deleted when it returns
+		virtual void complete(const ClientList& clients) = 0;
+	};
+
+	class Scheduler
+	{
+	public:
+		typedef void (*Function)(void* data);
+
+		virtual ~Scheduler() {}
+
+		// Call run(data) on a worker thread, then done(data) once it returned.
+		// Return false when no worker thread can take the task, neither function is then called.
+		virtual bool start(Function run, Function done, void* data) = 0;
+	};
+
+	// The queue does not own the scheduler, NULL uses the Maya asynchronous thread pool
+	CEffectCompileQueue(Scheduler* scheduler = NULL);
+	~CEffectCompileQueue();
+
+	// Queue the job for the client and take its ownership.
+	// Return false when a job with the same key was pending, the job is then deleted
+	// and the client waits for the pending one.
+	bool submit(const MString& key, Job* job, void* client);
+
+	// The client no longer waits for its jobs, they still run to completion
+	void cancel(void* client);
+
+	bool isPending(void* client) const;
+	unsigned int pendingCount() const;
+
+	// Complete the jobs that finished running, return the number of jobs completed
+	unsigned int processCompleted();
+
+	// Wait for all the jobs and complete them
+	void flush();
+
+private:
+	struct Entry
+	{
+		CEffectCompileQueue* queue;
+		MString key;
+		Job* job;
+		ClientList clients;
+		bool done;
+	};
+	typedef std::list< Entry* > EntryList;
+
+	static void runJob(void* data);
+	static void jobDone(void* data);
+
+	EntryList mEntries;
+	Scheduler* mScheduler;
+	Scheduler* mDefaultScheduler;
+	mutable MMutexLock mLock;
+};
+
+#endif //_dx11ShaderCompileQueue_h_
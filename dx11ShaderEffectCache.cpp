@@ -0,0 +1,542 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+#include "dx11ShaderEffectCache.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace
+{
+	const char* kFileExtension = ".fxcache";
+
+	struct CacheFile
+	{
+		MString path;
+		MUint64 size;
+	};
+
+	// Cache files by last use
+	typedef std::multimap< time_t, CacheFile > CacheFileMap;
+
+	bool isCacheFile(const char* fileName, bool withTemporaryFiles)
+	{
+		const char* extension = strstr(fileName, kFileExtension);
+		if (extension == NULL)
+			return false;
+		return withTemporaryFiles || extension[strlen(kFileExtension)] == 0;
+	}
+
+	void addCacheFile(const MString& directory, const char* fileName, CacheFileMap& files)
+	{
+		CacheFile file;
+		file.path = directory + "/" + fileName;
+
+		struct stat statBuf;
+		if (stat(file.path.asChar(), &statBuf) == 0)
+		{
+			file.size = (MUint64)statBuf.st_size;
+			files.insert(CacheFileMap::value_type(statBuf.st_mtime, file));
+		}
+	}
+
+	void listCacheFiles(const MString& directory, bool withTemporaryFiles, CacheFileMap& files)
+	{
+#ifdef _WIN32
+		WIN32_FIND_DATAA findData;
+		HANDLE find = FindFirstFileA((directory + "/*" + kFileExtension + "*").asChar(), &findData);
+		if (find != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				if (isCacheFile(findData.cFileName, withTemporaryFiles))
+					addCacheFile(directory, findData.cFileName, files);
+			}
+			while (FindNextFileA(find, &findData));
+			FindClose(find);
+		}
+#else
+		DIR* dir = opendir(directory.asChar());
+		if (dir)
+		{
+			struct dirent* entry;
+			while ((entry = readdir(dir)) != NULL)
+			{
+				if (isCacheFile(entry->d_name, withTemporaryFiles))
+					addCacheFile(directory, entry->d_name, files);
+			}
+			closedir(dir);
+		}
+#endif
+	}
+
+	void makeDirectory(const MString& directory)
+	{
+#ifdef _WIN32
+		CreateDirectoryA(directory.asChar(), NULL);
+#else
+		mkdir(directory.asChar(), 0777);
+#endif
+	}
+
+	bool replaceFile(const MString& source, const MString& destination)
+	{
+#ifdef _WIN32
+		return MoveFileExA(source.asChar(), destination.asChar(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+		return rename(source.asChar(), destination.asChar()) == 0;
+#endif
+	}
+
+	// Mark the file as used now
+	void touchFile(const MString& path)
+	{
+#ifdef _WIN32
+		_utime(path.asChar(), NULL);
+#else
+		utime(path.asChar(), NULL);
+#endif
+	}
+
+	unsigned int processId()
+	{
+#ifdef _WIN32
+		return (unsigned int)GetCurrentProcessId();
+#else
+		return (unsigned int)getpid();
+#endif
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CEffectHash& CEffectHash::add(const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+		mValue = (mValue ^ bytes[i]) * 0x100000001B3ULL;
+	return *this;
+}
+
+CEffectHash& CEffectHash::add(const char* str)
+{
+	// Include the terminating zero, so consecutive strings do not run into each other
+	if (str == NULL)
+		str = "";
+	return add(str, strlen(str) + 1);
+}
+
+CEffectHash& CEffectHash::add(unsigned int value)
+{
+	return add(&value, sizeof(value));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CEffectDiskCache::CEffectDiskCache(const MString& directory, MUint64 sizeLimit)
+: mDirectory(directory)
+, mSizeLimit(sizeLimit)
+, mSize(0)
+, mSizeKnown(false)
+, mHitCount(0)
+, mMissCount(0)
+, mTmpFileCount(0)
+{
+	if (isEnabled())
+		makeDirectory(mDirectory);
+}
+
+bool CEffectDiskCache::isEnabled() const
+{
+	return mDirectory.length() > 0 && mSizeLimit > 0;
+}
+
+MString CEffectDiskCache::filePath(MUint64 key) const
+{
+	char fileName[32];
+	sprintf(fileName, "/%016llx", (unsigned long long)key);
+	return mDirectory + fileName + kFileExtension;
+}
+
+bool CEffectDiskCache::find(MUint64 key, DependencyList& dependencies, std::vector< char >& bytecode)
+{
+	if (!isEnabled())
+		return false;
+
+	MString path = filePath(key);
+
+	bool found = false;
+	bool isCorrupted = false;
+	FILE* file = fopen(path.asChar(), "rb");
+	if (file)
+	{
+		EffectFileHeader header;
+		std::vector< char > data;
+		if (fread(&header, sizeof(header), 1, file) == 1
+			&& header.magic == kMagic
+			&& header.version == kVersion
+			&& header.key == key)
+		{
+			data.resize(header.dataSize);
+			found = (header.dataSize > 0
+				&& fread(&data[0], 1, data.size(), file) == data.size()
+				&& CEffectHash().add(&data[0], data.size()).value() == header.dataChecksum);
+		}
+		fclose(file);
+
+		// Dependencies: content hash, name length and name, then the bytecode
+		size_t offset = 0;
+		dependencies.clear();
+		for (unsigned int i = 0; found && i < header.numDependencies; ++i)
+		{
+			Dependency dependency;
+			unsigned int nameLength = 0;
+			found = (offset + sizeof(MUint64) + sizeof(unsigned int) <= data.size());
+			if (found)
+			{
+				memcpy(&dependency.contentHash, &data[offset], sizeof(MUint64));
+				memcpy(&nameLength, &data[offset + sizeof(MUint64)], sizeof(unsigned int));
+				offset += sizeof(MUint64) + sizeof(unsigned int);
+				found = (offset + nameLength <= data.size());
+			}
+			if (found)
+			{
+				dependency.name = MString(&data[offset], nameLength);
+				dependencies.push_back(dependency);
+				offset += nameLength;
+			}
+		}
+
+		if (found)
+			bytecode.assign(data.begin() + offset, data.end());
+		isCorrupted = !found;
+	}
+
+	mLock.lock();
+	if (isCorrupted)
+	{
+		// Deleted now, rewritten after the compilation. The files are measured again on the next write.
+		if (remove(path.asChar()) == 0)
+			mSizeKnown = false;
+	}
+	if (found)
+		++mHitCount;
+	else
+		++mMissCount;
+	mLock.unlock();
+
+	if (found)
+		touchFile(path);
+	return found;
+}
+
+void CEffectDiskCache::add(MUint64 key, const DependencyList& dependencies, const void* bytecode, unsigned int bytecodeSize)
+{
+	if (!isEnabled() || bytecode == NULL || bytecodeSize == 0)
+		return;
+
+	std::vector< char > data;
+	for (size_t i = 0; i < dependencies.size(); ++i)
+	{
+		const Dependency& dependency = dependencies[i];
+		unsigned int nameLength = dependency.name.length();
+		size_t offset = data.size();
+		data.resize(offset + sizeof(MUint64) + sizeof(unsigned int) + nameLength);
+		memcpy(&data[offset], &dependency.contentHash, sizeof(MUint64));
+		memcpy(&data[offset + sizeof(MUint64)], &nameLength, sizeof(unsigned int));
+		if (nameLength > 0)
+			memcpy(&data[offset + sizeof(MUint64) + sizeof(unsigned int)], dependency.name.asChar(), nameLength);
+	}
+	data.insert(data.end(), (const char*)bytecode, (const char*)bytecode + bytecodeSize);
+
+	if (sizeof(EffectFileHeader) + data.size() > mSizeLimit)
+		return;
+
+	EffectFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = kMagic;
+	header.version = kVersion;
+	header.key = key;
+	header.numDependencies = (unsigned int)dependencies.size();
+	header.dataSize = (unsigned int)data.size();
+	header.dataChecksum = CEffectHash().add(&data[0], data.size()).value();
+
+	// Write under a name unique to this process and this call then move it in place
+	MString path = filePath(key);
+	MString tmpPath = path;
+	tmpPath += ".";
+	tmpPath += processId();
+	tmpPath += ".";
+	mLock.lock();
+	tmpPath += ++mTmpFileCount;
+	mLock.unlock();
+	tmpPath += ".tmp";
+
+	FILE* file = fopen(tmpPath.asChar(), "wb");
+	if (file == NULL)
+		return;
+
+	bool written = (fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(&data[0], 1, data.size(), file) == data.size());
+	written = (fclose(file) == 0) && written;
+
+	if (!written || !replaceFile(tmpPath, path))
+	{
+		remove(tmpPath.asChar());
+		return;
+	}
+
+	mLock.lock();
+	mSize += sizeof(header) + data.size();
+	if (!mSizeKnown || mSize > mSizeLimit)
+		trim();
+	mLock.unlock();
+}
+
+// Measure the cache files and, when over the limit, delete the least recently used ones
+// until the files are under 3/4 of the limit.
+void CEffectDiskCache::trim()
+{
+	CacheFileMap files;
+	listCacheFiles(mDirectory, false, files);
+
+	mSize = 0;
+	for (CacheFileMap::const_iterator it = files.begin(); it != files.end(); ++it)
+		mSize += it->second.size;
+	mSizeKnown = true;
+
+	if (mSize <= mSizeLimit)
+		return;
+
+	for (CacheFileMap::const_iterator it = files.begin(); it != files.end() && mSize > mSizeLimit / 4 * 3; ++it)
+	{
+		if (remove(it->second.path.asChar()) == 0)
+			mSize -= it->second.size;
+	}
+}
+
+unsigned int CEffectDiskCache::purge()
+{
+	if (mDirectory.length() == 0)
+		return 0;
+
+	mLock.lock();
+
+	CacheFileMap files;
+	listCacheFiles(mDirectory, true, files);
+
+	unsigned int numDeleted = 0;
+	for (CacheFileMap::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		if (remove(it->second.path.asChar()) == 0)
+			++numDeleted;
+	}
+	mSize = 0;
+	mSizeKnown = true;
+
+	mLock.unlock();
+	return numDeleted;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CIncludeFileCache::FileNameLess::operator()(const MString& lhs, const MString& rhs) const
+{
+	return strcmp(lhs.asChar(), rhs.asChar()) < 0;
+}
+
+CIncludeFileCache::CIncludeFileCache(size_t sizeLimit)
+: mSize(0)
+, mSizeLimit(sizeLimit)
+, mHitCount(0)
+, mMissCount(0)
+{
+}
+
+CIncludeFileCache::~CIncludeFileCache()
+{
+	for (DataContentMap::iterator it = mData.begin(); it != mData.end(); ++it)
+		delete it->second;
+}
+
+const char* CIncludeFileCache::acquire(const MString& fileName, size_t& size, MUint64& contentHash)
+{
+	struct stat statBuf;
+	if (stat(fileName.asChar(), &statBuf) != 0)
+		return NULL;
+
+	mLock.lock();
+	FileContentMap::iterator it = mFiles.find(fileName);
+	if (it != mFiles.end())
+	{
+		Content* content = it->second;
+		bool sameTimeStamp = (content->timeStamp == statBuf.st_mtime && content->data.size() == (size_t)statBuf.st_size + 1);
+		if (sameTimeStamp && isSettled(content))
+		{
+			use(content);
+			++mHitCount;
+			size = content->data.size() - 1;
+			contentHash = content->contentHash;
+			mLock.unlock();
+			return &content->data[0];
+		}
+
+		// Changed, read again. The compilations still using it keep it alive.
+		// Written within the time stamp resolution, it is kept if the new read has the same content.
+		if (!sameTimeStamp)
+		{
+			content->isCurrent = false;
+			mFiles.erase(it);
+			if (content->refCount == 0)
+				destroy(content);
+		}
+	}
+	++mMissCount;
+	mLock.unlock();
+
+	// Read without the lock, the other compilations go on meanwhile
+	Content* content = new Content;
+	content->fileName = fileName;
+	content->timeStamp = statBuf.st_mtime;
+	content->readTime = time(NULL);
+	content->refCount = 0;
+	content->isCurrent = true;
+
+	bool read = false;
+	FILE* file = fopen(fileName.asChar(), "rb");
+	if (file)
+	{
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		if (fileSize >= 0)
+		{
+			content->data.resize(fileSize + 1);
+			read = (fileSize == 0 || fread(&content->data[0], 1, fileSize, file) == (size_t)fileSize);
+			content->data[fileSize] = 0;
+		}
+		fclose(file);
+	}
+	if (!read)
+	{
+		delete content;
+		return NULL;
+	}
+	content->contentHash = CEffectHash().add(&content->data[0], content->data.size() - 1).value();
+
+	mLock.lock();
+	it = mFiles.find(fileName);
+	if (it != mFiles.end() && it->second->timeStamp == content->timeStamp
+		&& it->second->data.size() == content->data.size() && it->second->contentHash == content->contentHash)
+	{
+		// Read by another compilation meanwhile, or read again with the same content
+		if (it->second->readTime < content->readTime)
+			it->second->readTime = content->readTime;
+		delete content;
+		content = it->second;
+	}
+	else
+	{
+		if (it != mFiles.end())
+		{
+			it->second->isCurrent = false;
+			if (it->second->refCount == 0)
+				destroy(it->second);
+			mFiles.erase(it);
+		}
+		mFiles[fileName] = content;
+		mData[&content->data[0]] = content;
+		mSize += content->data.size();
+		content->unusedIt = mUnused.end();
+	}
+	use(content);
+	size = content->data.size() - 1;
+	contentHash = content->contentHash;
+	const char* data = &content->data[0];
+	mLock.unlock();
+	return data;
+}
+
+void CIncludeFileCache::release(const char* data)
+{
+	mLock.lock();
+	DataContentMap::iterator it = mData.find(data);
+	if (it != mData.end())
+	{
+		Content* content = it->second;
+		if (content->refCount > 0 && --content->refCount == 0)
+		{
+			if (content->isCurrent)
+			{
+				content->unusedIt = mUnused.insert(mUnused.begin(), content);
+				trim();
+			}
+			else
+			{
+				destroy(content);
+			}
+		}
+	}
+	mLock.unlock();
+}
+
+// A later write changes the time stamp, the content was read long enough after the last one
+bool CIncludeFileCache::isSettled(const Content* content)
+{
+	return content->readTime > content->timeStamp + kTimeStampResolution;
+}
+
+// Take a reference on the content, it is no longer unused
+void CIncludeFileCache::use(Content* content)
+{
+	if (content->refCount++ == 0 && content->unusedIt != mUnused.end())
+	{
+		mUnused.erase(content->unusedIt);
+		content->unusedIt = mUnused.end();
+	}
+}
+
+// The content is not current, or is evicted, and is no longer used
+void CIncludeFileCache::destroy(Content* content)
+{
+	if (content->unusedIt != mUnused.end())
+		mUnused.erase(content->unusedIt);
+	if (content->isCurrent)
+		mFiles.erase(content->fileName);
+	mSize -= content->data.size();
+	mData.erase(&content->data[0]);
+	delete content;
+}
+
+// Delete the least recently used contents no longer used until the cache is under its size limit
+void CIncludeFileCache::trim()
+{
+	while (mSize > mSizeLimit && !mUnused.empty())
+	{
+		Content* content = mUnused.back();
+		mUnused.pop_back();
+		content->unusedIt = mUnused.end();
+		destroy(content);
+	}
+}
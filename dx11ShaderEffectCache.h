@@ -0,0 +1,185 @@
+#ifndef _dx11ShaderEffectCache_h_
+#define _dx11ShaderEffectCache_h_
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+#include <maya/MString.h>
+#include <maya/MTypes.h>
+#include <maya/MMutexLock.h>
+
+#include <vector>
+#include <map>
+#include <list>
+#include <time.h>
+
+/*!
+	Content hash used to key the compiled effects (64-bit FNV-1a).
+*/
+class CEffectHash
+{
+public:
+	CEffectHash() : mValue(0xCBF29CE484222325ULL) {}
+
+	CEffectHash& add(const void* data, size_t size);
+	CEffectHash& add(const char* str);
+	CEffectHash& add(unsigned int value);
+
+	MUint64 value() const { return mValue; }
+
+private:
+	MUint64 mValue;
+};
+
+/*!
+	Persistent cache of compiled effect bytecode, shared by the Maya sessions.
+
+	An entry is keyed by a hash of what the compilation depends on, computed by the caller:
+	the effect source, the macros, the compile flags and the compiler version. The included
+	files are not known before compiling, so each entry also records the name and the
+	content hash of every file opened by the include handler during the compilation;
+	the caller checks them before using the bytecode, and stores a new compilation under
+	the same key when they changed.
+
+	Each entry is a file named after its key, made of an EffectFileHeader, the dependencies
+	and the bytecode. A file is rejected, then deleted, when its version or the checksum of
+	its content do not match. Files are written to a temporary name and then renamed, and
+	a file is touched each time it is used, so the least recently used ones are deleted
+	when the files exceed the size limit.
+
+	This class does not depend on D3D, the compiler is driven by CDX11EffectCompileHelper.
+*/
+class CEffectDiskCache
+{
+public:
+	struct Dependency
+	{
+		MString name;
+		MUint64 contentHash;
+	};
+	typedef std::vector< Dependency > DependencyList;
+
+	// An empty directory or a null size limit disables the cache
+	CEffectDiskCache(const MString& directory, MUint64 sizeLimit);
+
+	bool isEnabled() const;
+
+	// Read the entry stored for this key, return false when there is none
+	bool find(MUint64 key, DependencyList& dependencies, std::vector< char >& bytecode);
+
+	// Store an entry, replacing the previous one with the same key
+	void add(MUint64 key, const DependencyList& dependencies, const void* bytecode, unsigned int bytecodeSize);
+
+	// Delete all the entries, return the number of files deleted
+	unsigned int purge();
+
+	unsigned int hitCount() const { return mHitCount; }
+	unsigned int missCount() const { return mMissCount; }
+
+private:
+	struct EffectFileHeader
+	{
+		unsigned int magic;
+		unsigned int version;
+		MUint64 key;
+		unsigned int numDependencies;
+		unsigned int dataSize;
+		MUint64 dataChecksum;
+	};
+
+	static const unsigned int kMagic = 0x58464458; // "DXFX"
+	static const unsigned int kVersion = 1;
+
+	MString filePath(MUint64 key) const;
+	void trim();
+
+	MString mDirectory;
+	MUint64 mSizeLimit;
+
+	// Size of the cache files, computed on the first write
+	MUint64 mSize;
+	bool mSizeKnown;
+
+	unsigned int mHitCount;
+	unsigned int mMissCount;
+	unsigned int mTmpFileCount;
+	MMutexLock mLock;
+};
+
+/*!
+	Contents of the files included by the effects, shared by the compilations.
+
+	The include handler gets the content of a file with acquire() and gives it back with release():
+	the compiler reads the cached buffer directly, it is not copied. A file is read again when its
+	time stamp changed; the previous content stays alive until the compilations using it release it.
+	The time stamps only have a resolution of one or two seconds: a file read less than two seconds
+	after it was written is read again, and its content hashed, until it is older than that.
+
+	The contents no longer used are kept up to the size limit, the least recently used are
+	deleted first. The cache can be used from several threads.
+*/
+class CIncludeFileCache
+{
+public:
+	explicit CIncludeFileCache(size_t sizeLimit);
+	~CIncludeFileCache();
+
+	// Return the content of the file and its CEffectHash, or NULL when it cannot be read.
+	// The content is followed by a terminating zero, not counted in size.
+	const char* acquire(const MString& fileName, size_t& size, MUint64& contentHash);
+	void release(const char* data);
+
+	unsigned int hitCount() const { return mHitCount; }
+	unsigned int missCount() const { return mMissCount; }
+
+private:
+	struct Content;
+
+	// Unused contents, most recently used first
+	typedef std::list< Content* > ContentList;
+
+	struct Content
+	{
+		MString fileName;
+		time_t timeStamp;
+		time_t readTime;
+		std::vector< char > data;
+		MUint64 contentHash;
+		unsigned int refCount;
+		bool isCurrent;
+		ContentList::iterator unusedIt;
+	};
+
+	struct FileNameLess
+	{
+		bool operator()(const MString& lhs, const MString& rhs) const;
+	};
+	typedef std::map< MString, Content*, FileNameLess > FileContentMap;
+	typedef std::map< const char*, Content* > DataContentMap;
+
+	// Largest time stamp resolution, two seconds on FAT file systems
+	static const time_t kTimeStampResolution = 2;
+
+	static bool isSettled(const Content* content);
+	void use(Content* content);
+	void destroy(Content* content);
+	void trim();
+
+	FileContentMap mFiles;
+	DataContentMap mData;
+	ContentList mUnused;
+	size_t mSize;
+	size_t mSizeLimit;
+	unsigned int mHitCount;
+	unsigned int mMissCount;
+	MMutexLock mLock;
+};
+
+#endif //_dx11ShaderEffectCache_h_
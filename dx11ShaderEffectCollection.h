@@ -0,0 +1,554 @@
+#ifndef _dx11ShaderEffectCollection_h_
+#define _dx11ShaderEffectCollection_h_
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+#include "dx11ShaderEffectCache.h"
+
+#include <maya/MString.h>
+#include <maya/MMutexLock.h>
+
+#include <string.h>
+#include <time.h>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+/*!
+	The effects in use, shared by the nodes loading the same effect file.
+
+	Each effect file compiled is kept as a reference effect, which the nodes get clones of.
+	The references are keyed by device, file and time stamp, each reference knows its key,
+	its number of clones and the files it included, and each clone knows its reference.
+	All the lookups are hashed.
+
+	contains() and acquire() by file name check the time stamp of the file and the included
+	files of its reference, so a node loading an edited file gets it compiled again. The
+	time stamps they read are remembered until invalidateTimeStamps(), duplicating an effect
+	in use does not touch the files. The file watcher and the reloads invalidate them.
+	getOutdatedEffects() always checks the files.
+
+	The public methods lock the collection.
+
+	This class does not depend on D3D, the types and the file checks come from the Traits:
+		Effect, Device, Node				the effect, device and node types, used through pointers
+		Schema								the reflection of an effect, with addRef() and release()
+		IncludedFileList					a vector of { MString fileName; time_t timeStamp; }
+		Effect* clone(Effect*)				a new effect, or NULL when it cannot be cloned
+		void release(Effect*)
+		Schema* createSchema(Effect*)		returned with a reference count of 1
+		time_t fileTimeStamp(const MString&)
+		bool includedFilesChanged(const IncludedFileList&)
+	CDX11EffectCompileHelper instantiates it with the D3D effects, the tests with a mock.
+*/
+template < class Traits >
+class CEffectCollection
+{
+public:
+	typedef typename Traits::Effect Effect;
+	typedef typename Traits::Device Device;
+	typedef typename Traits::Node Node;
+	typedef typename Traits::Schema Schema;
+	typedef typename Traits::IncludedFileList IncludedFileList;
+
+	CEffectCollection() : generation(1) {}
+
+	bool contains(Device* device, const MString& fileName) const;
+	Effect* acquire(Node* node, Device* device, const MString& fileName);
+	Effect* acquire(Node* node, Device* device, const MString& fileName, Effect* reference, Effect* source = NULL, const IncludedFileList* includedFiles = NULL);
+	void release(Node* node, Effect *effect, const MString& fileName);
+	template < class NodeList > void getNodesUsingEffect(const MString& fileName, NodeList &nodes) const;
+	template < class FileNameArray > void getOutdatedEffects(FileNameArray& fileNames) const;
+	void getWatchedFiles(std::vector< MString >& fileNames) const;
+
+	Effect* getReferenceEffectAndFileName(Effect *effect, MString& fileName) const;
+	Schema* acquireSchema(Effect *effect);
+
+	// The files may have changed, check them again on the next lookups
+	void invalidateTimeStamps();
+
+private:
+	// The effect files are interned by the collection, a key compares their ids rather than their names
+	typedef unsigned int PathId;
+
+	struct EffectKey
+	{
+		Device* device;
+		PathId path;
+		time_t timeStamp;
+
+		bool operator== (const EffectKey& rhs) const
+		{
+			return device == rhs.device && path == rhs.path && timeStamp == rhs.timeStamp;
+		}
+	};
+
+	struct EffectKeyHasher {
+		size_t operator() (const EffectKey& key) const
+		{
+			return (size_t)CEffectHash().add(&key.device, sizeof(key.device)).add(key.path).add(&key.timeStamp, sizeof(key.timeStamp)).value();
+		}
+	};
+
+	struct MStringHasher {
+		size_t operator() (const MString& str) const
+		{
+			return (size_t)CEffectHash().add(str.asChar()).value();
+		}
+	};
+
+	struct MStringEqual {
+		bool operator() (const MString& lhs, const MString& rhs) const
+		{
+			return strcmp(lhs.asChar(), rhs.asChar()) == 0;
+		}
+	};
+
+	struct MStringSorter {
+		bool operator() (const MString& lhs, const MString& rhs) const
+		{
+			return strcmp(lhs.asChar(), rhs.asChar()) < 0;
+		}
+	};
+
+	struct ReferenceData
+	{
+		EffectKey key;
+		unsigned int cloneCount;
+
+		// Reflection of the reference, built for the first node that needs it
+		Schema* schema;
+
+		// The reference is outdated when one of its included files changed,
+		// even though its EffectKey still matches.
+		bool hasIncludedFiles;
+		IncludedFileList includedFiles;
+	};
+
+	// Time stamp of an effect file, valid while its generation is the current one
+	struct TimeStamp
+	{
+		time_t value;
+		unsigned int generation;
+	};
+
+	PathId internPath(const MString& fileName);
+	bool findPath(const MString& fileName, PathId& path) const;
+	time_t timeStamp(PathId path, bool checkFile = false) const;
+	Effect* findUpToDateReference(Device* device, const MString& fileName) const;
+	Effect* acquireClone(Node* node, Device* device, PathId path, Effect* reference, Effect* source, const IncludedFileList* includedFiles);
+
+	// Interned file names, a file name keeps its id once interned
+	typedef std::unordered_map< MString, PathId, MStringHasher, MStringEqual > Path2IdMap;
+	Path2IdMap path2IdMap;
+	std::vector< MString > pathNames;
+	mutable std::vector< TimeStamp > pathTimeStamps;
+	unsigned int generation;
+
+	typedef std::unordered_map< EffectKey, Effect*, EffectKeyHasher > Key2ReferenceEffectMap;
+	Key2ReferenceEffectMap key2ReferenceEffectMap;
+
+	typedef std::unordered_map< Effect*, ReferenceData > ReferenceDataMap;
+	ReferenceDataMap referenceDataMap;
+
+	typedef std::unordered_map< Effect*, Effect* > Clone2ReferenceMap;
+	Clone2ReferenceMap clone2ReferenceMap;
+
+	// We need to keep track of dx11ShaderNodes at all times,
+	// even when compilation failed and we have no effect
+	// to deal with. This will allow the "Reload" button to work
+	// after a shader file failed to compile.
+	typedef std::unordered_set< Node* > NodeSet;
+	typedef std::unordered_map< PathId, NodeSet > Path2NodesMap;
+	Path2NodesMap path2NodesMap;
+
+	mutable MMutexLock mLock;
+};
+
+template < class Traits >
+typename CEffectCollection< Traits >::PathId CEffectCollection< Traits >::internPath(const MString& fileName)
+{
+	typename Path2IdMap::const_iterator it = path2IdMap.find(fileName);
+	if(it != path2IdMap.end())
+		return it->second;
+
+	PathId path = (PathId)pathNames.size();
+	pathNames.push_back(fileName);
+	TimeStamp stamp = { 0, 0 };
+	pathTimeStamps.push_back(stamp);
+	path2IdMap.insert( std::make_pair(fileName, path) );
+	return path;
+}
+
+template < class Traits >
+bool CEffectCollection< Traits >::findPath(const MString& fileName, PathId& path) const
+{
+	typename Path2IdMap::const_iterator it = path2IdMap.find(fileName);
+	if(it == path2IdMap.end())
+		return false;
+
+	path = it->second;
+	return true;
+}
+
+//! Return the time stamp of the file, checked once per generation or when checkFile is set
+template < class Traits >
+time_t CEffectCollection< Traits >::timeStamp(PathId path, bool checkFile) const
+{
+	TimeStamp& stamp = pathTimeStamps[path];
+	if(checkFile || stamp.generation != generation)
+	{
+		stamp.value = Traits::fileTimeStamp(pathNames[path]);
+		stamp.generation = generation;
+	}
+	return stamp.value;
+}
+
+//! Return the reference effect of this fileName, if its file and included files did not change
+template < class Traits >
+typename CEffectCollection< Traits >::Effect* CEffectCollection< Traits >::findUpToDateReference(Device* device, const MString& fileName) const
+{
+	PathId path;
+	if(!findPath(fileName, path))
+		return NULL;
+
+	EffectKey key = { device, path, timeStamp(path, true) } ;
+	typename Key2ReferenceEffectMap::const_iterator it = key2ReferenceEffectMap.find(key);
+	if(it == key2ReferenceEffectMap.end())
+		return NULL;
+
+	Effect* reference = it->second;
+	typename ReferenceDataMap::const_iterator itData = referenceDataMap.find(reference);
+	if(itData != referenceDataMap.end() && itData->second.hasIncludedFiles && Traits::includedFilesChanged(itData->second.includedFiles))
+		return NULL;
+
+	return reference;
+}
+
+//! Return true if an up to date reference effect is found for this fileName
+template < class Traits >
+bool CEffectCollection< Traits >::contains(Device* device, const MString& fileName) const
+{
+	mLock.lock();
+	bool found = (findUpToDateReference(device, fileName) != NULL);
+	mLock.unlock();
+	return found;
+}
+
+//! Acquire effect from specified fileName
+//! If an up to date reference effect is found for this fileName, return a cloned instance
+//! Update collection keeps track of :
+//!   cloned effect -> reference effect
+//!   fileName -> node
+template < class Traits >
+typename CEffectCollection< Traits >::Effect* CEffectCollection< Traits >::acquire(Node* node, Device* device, const MString& fileName)
+{
+	Effect* effect = NULL;
+
+	mLock.lock();
+	// The effect has to be compiled again when its file or one of its included files changed
+	Effect* reference = findUpToDateReference(device, fileName);
+	if(reference != NULL)
+		effect = acquireClone(node, device, internPath(fileName), reference, reference, NULL);
+	mLock.unlock();
+
+	return effect;
+}
+
+//! Acquire effect from reference
+//! Return a cloned instance of the effect
+//! Update collection keeps track of :
+//!   cloned effect -> reference effect
+//!   fileName -> node
+//! includedFiles is given for a newly compiled reference, it replaces
+//! the previous reference of the file when its included files changed.
+template < class Traits >
+typename CEffectCollection< Traits >::Effect* CEffectCollection< Traits >::acquire(Node* node, Device* device, const MString& fileName, Effect* reference, Effect* source, const IncludedFileList* includedFiles )
+{
+	mLock.lock();
+	Effect* effect = acquireClone(node, device, internPath(fileName), reference, source ? source : reference, includedFiles);
+	mLock.unlock();
+	return effect;
+}
+
+template < class Traits >
+typename CEffectCollection< Traits >::Effect* CEffectCollection< Traits >::acquireClone(Node* node, Device* device, PathId path, Effect* reference, Effect* source, const IncludedFileList* includedFiles)
+{
+	// Keep track of fileName -> node lookup, whenever the effect was loaded or not
+	path2NodesMap[path].insert(node);
+
+	if( reference == NULL )
+		return NULL;
+
+	// Add the reference in cache if not in yet.
+	EffectKey key = { device, path, timeStamp(path) } ;
+	{
+		typename Key2ReferenceEffectMap::iterator it = key2ReferenceEffectMap.find(key);
+		if(it == key2ReferenceEffectMap.end()) {
+			key2ReferenceEffectMap.insert( std::make_pair(key, reference) );
+		}
+		else if(includedFiles != NULL) {
+			// The previous reference is outdated, it stays alive until its last clone is released
+			it->second = reference;
+		}
+	}
+
+	// Register the reference with its key, a reference keeps the key it was added with
+	typename ReferenceDataMap::iterator itData = referenceDataMap.find(reference);
+	if(itData == referenceDataMap.end())
+	{
+		ReferenceData data;
+		data.key = key;
+		data.cloneCount = 0;
+		data.schema = NULL;
+		data.hasIncludedFiles = false;
+		itData = referenceDataMap.insert( std::make_pair(reference, data) ).first;
+	}
+	if(includedFiles != NULL) {
+		// Just compiled, the included files are up to date
+		itData->second.hasIncludedFiles = true;
+		itData->second.includedFiles = *includedFiles;
+	}
+
+	// Clone effect
+	Effect* effect = Traits::clone(source);
+	if( effect == NULL )
+		return NULL;
+
+	// Increase the number of clone for this reference
+	// Equivalent to the number of time this effect is used
+	++(itData->second.cloneCount);
+
+	// Keep track of clone -> reference lookup
+	clone2ReferenceMap.insert( std::make_pair(effect, reference) );
+
+	return effect;
+}
+
+//! Release the effect from cache,
+//! and release the reference if this effect was it last clone
+template < class Traits >
+void CEffectCollection< Traits >::release(Node* node, Effect *effect, const MString& fileName)
+{
+	mLock.lock();
+
+	if (effect)
+	{
+		typename Clone2ReferenceMap::iterator it = clone2ReferenceMap.find(effect);
+		if(it != clone2ReferenceMap.end())
+		{
+			Effect* reference = it->second;
+
+			typename ReferenceDataMap::iterator itData = referenceDataMap.find(reference);
+			if(itData != referenceDataMap.end())
+			{
+				// This was the last clone for this reference, we can release it
+				if(itData->second.cloneCount <= 1)
+				{
+					// The key may already point to a newer compilation of the file
+					typename Key2ReferenceEffectMap::iterator itKey = key2ReferenceEffectMap.find(itData->second.key);
+					if(itKey != key2ReferenceEffectMap.end() && itKey->second == reference)
+						key2ReferenceEffectMap.erase(itKey);
+					if(itData->second.schema)
+						itData->second.schema->release();
+					referenceDataMap.erase(itData);
+					Traits::release(reference);
+				}
+				else
+				{
+					--(itData->second.cloneCount);
+				}
+			}
+
+			clone2ReferenceMap.erase(it);
+		}
+
+		Traits::release(effect);
+	}
+
+	// Remove this node from the fileName -> nodes lookup
+	PathId path;
+	if (findPath(fileName, path))
+	{
+		typename Path2NodesMap::iterator itNodeSet = path2NodesMap.find(path);
+		if (itNodeSet != path2NodesMap.end())
+		{
+			itNodeSet->second.erase(node);
+			// No more node for this fileName, clear it
+			if (itNodeSet->second.empty())
+				path2NodesMap.erase(itNodeSet);
+		}
+	}
+
+	mLock.unlock();
+}
+
+//! Return the effect used as reference and the effect file name
+template < class Traits >
+typename CEffectCollection< Traits >::Effect* CEffectCollection< Traits >::getReferenceEffectAndFileName(Effect *effect, MString& fileName) const
+{
+	Effect* reference = NULL;
+
+	mLock.lock();
+	typename Clone2ReferenceMap::const_iterator it = clone2ReferenceMap.find(effect);
+	if(it != clone2ReferenceMap.end())
+	{
+		reference = it->second;
+
+		// An outdated reference is no longer in key2ReferenceEffectMap, but keeps its key
+		typename ReferenceDataMap::const_iterator itData = referenceDataMap.find(reference);
+		if(itData != referenceDataMap.end())
+		{
+			fileName = pathNames[itData->second.key.path];
+		}
+	}
+	mLock.unlock();
+
+	return reference;
+}
+
+//! Return the schema of the reference of this clone, built on first use.
+//! An effect that is not in the collection gets a schema of its own.
+template < class Traits >
+typename CEffectCollection< Traits >::Schema* CEffectCollection< Traits >::acquireSchema(Effect *effect)
+{
+	Effect* reference = NULL;
+
+	mLock.lock();
+	typename Clone2ReferenceMap::const_iterator it = clone2ReferenceMap.find(effect);
+	if(it != clone2ReferenceMap.end())
+	{
+		reference = it->second;
+
+		typename ReferenceDataMap::iterator itData = referenceDataMap.find(reference);
+		if(itData != referenceDataMap.end() && itData->second.schema != NULL)
+		{
+			Schema* schema = itData->second.schema;
+			schema->addRef();
+			mLock.unlock();
+			return schema;
+		}
+	}
+	mLock.unlock();
+
+	if(reference == NULL)
+		return Traits::createSchema(effect);
+
+	// The reference is never bound to a node, its variables hold the values of the effect file
+	Schema* schema = Traits::createSchema(reference);
+
+	mLock.lock();
+	typename ReferenceDataMap::iterator itData = referenceDataMap.find(reference);
+	if(itData != referenceDataMap.end())
+	{
+		if(itData->second.schema == NULL)
+		{
+			itData->second.schema = schema;
+			schema->addRef();
+		}
+		else
+		{
+			// Built meanwhile, use that one
+			schema->release();
+			schema = itData->second.schema;
+			schema->addRef();
+		}
+	}
+	mLock.unlock();
+
+	return schema;
+}
+
+//! Get the files of the effects in use that changed since they were compiled,
+//! either the effect file itself or one of the files it includes
+template < class Traits >
+template < class FileNameArray >
+void CEffectCollection< Traits >::getOutdatedEffects(FileNameArray& fileNames) const
+{
+	std::set< PathId > outdatedPaths;
+
+	mLock.lock();
+	typename ReferenceDataMap::const_iterator it = referenceDataMap.begin();
+	typename ReferenceDataMap::const_iterator itEnd = referenceDataMap.end();
+	for(; it != itEnd; ++it)
+	{
+		const ReferenceData& data = it->second;
+		if(outdatedPaths.count(data.key.path) > 0)
+			continue;
+
+		const MString& fileName = pathNames[data.key.path];
+		bool outdated = (data.key.timeStamp != Traits::fileTimeStamp(fileName));
+		if(!outdated)
+			outdated = (data.hasIncludedFiles && Traits::includedFilesChanged(data.includedFiles));
+
+		if(outdated)
+			outdatedPaths.insert(data.key.path);
+	}
+
+	typename std::set< PathId >::const_iterator itPath = outdatedPaths.begin();
+	for(; itPath != outdatedPaths.end(); ++itPath)
+		fileNames.append(pathNames[*itPath]);
+	mLock.unlock();
+}
+
+//! Get the files of the effects in use and the files they include
+template < class Traits >
+void CEffectCollection< Traits >::getWatchedFiles(std::vector< MString >& fileNames) const
+{
+	std::set< MString, MStringSorter > watchedFileNames;
+
+	mLock.lock();
+	typename ReferenceDataMap::const_iterator it = referenceDataMap.begin();
+	typename ReferenceDataMap::const_iterator itEnd = referenceDataMap.end();
+	for(; it != itEnd; ++it)
+	{
+		const ReferenceData& data = it->second;
+		watchedFileNames.insert(pathNames[data.key.path]);
+
+		for(size_t i = 0; i < data.includedFiles.size(); ++i)
+			watchedFileNames.insert(data.includedFiles[i].fileName);
+	}
+	mLock.unlock();
+
+	fileNames.assign(watchedFileNames.begin(), watchedFileNames.end());
+}
+
+template < class Traits >
+template < class NodeList >
+void CEffectCollection< Traits >::getNodesUsingEffect(const MString& fileName, NodeList &nodes) const
+{
+	mLock.lock();
+	PathId path;
+	if (findPath(fileName, path))
+	{
+		typename Path2NodesMap::const_iterator itNodeSet = path2NodesMap.find(path);
+		if (itNodeSet != path2NodesMap.end())
+		{
+			const NodeSet& nodeSet = itNodeSet->second;
+			for (typename NodeSet::const_iterator itNode = nodeSet.begin(); itNode != nodeSet.end(); ++itNode)
+			{
+				nodes.push_back(*itNode);
+			}
+		}
+	}
+	mLock.unlock();
+}
+
+template < class Traits >
+void CEffectCollection< Traits >::invalidateTimeStamps()
+{
+	mLock.lock();
+	++generation;
+	mLock.unlock();
+}
+
+#endif //_dx11ShaderEffectCollection_h_
@@ -0,0 +1,97 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+#include "dx11ShaderFileWatcher.h"
+
+#include <sys/stat.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFileWatcher::PollingBackend::FileState CFileWatcher::PollingBackend::fileState(const std::string& fileName)
+{
+	FileState state = { 0, 0 };
+	struct stat statBuf;
+	if( stat(fileName.c_str(), &statBuf) == 0 )
+	{
+		state.timeStamp = statBuf.st_mtime;
+		state.size = statBuf.st_size;
+	}
+	return state;
+}
+
+// The new files start from their current state, they are not reported as changed
+void CFileWatcher::PollingBackend::setFiles(const FileList& files)
+{
+	FileStateMap fileStates;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		std::string fileName(files[i].asChar());
+		FileStateMap::const_iterator it = mFiles.find(fileName);
+		fileStates[fileName] = (it != mFiles.end() ? it->second : fileState(fileName));
+	}
+	mFiles.swap(fileStates);
+}
+
+void CFileWatcher::PollingBackend::poll(FileList& changedFiles)
+{
+	for (FileStateMap::iterator it = mFiles.begin(); it != mFiles.end(); ++it)
+	{
+		FileState state = fileState(it->first);
+		if (state.timeStamp != it->second.timeStamp || state.size != it->second.size)
+		{
+			it->second = state;
+			changedFiles.push_back(MString(it->first.c_str()));
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFileWatcher::CFileWatcher(Backend* backend, double settleTime)
+: mBackend(backend)
+, mSettleTime(settleTime)
+, mFirstChangeTime(0.0)
+, mLastChangeTime(0.0)
+{
+}
+
+CFileWatcher::~CFileWatcher()
+{
+	delete mBackend;
+}
+
+void CFileWatcher::setFiles(const FileList& files)
+{
+	mBackend->setFiles(files);
+}
+
+bool CFileWatcher::update(double time, FileList& changedFiles, double& firstChangeTime)
+{
+	FileList files;
+	mBackend->poll(files);
+	if (!files.empty())
+	{
+		if (mChangedFiles.empty())
+			mFirstChangeTime = time;
+		mLastChangeTime = time;
+		for (size_t i = 0; i < files.size(); ++i)
+			mChangedFiles.insert(std::string(files[i].asChar()));
+	}
+
+	if (mChangedFiles.empty() || time - mLastChangeTime < mSettleTime)
+		return false;
+
+	for (std::set< std::string >::const_iterator it = mChangedFiles.begin(); it != mChangedFiles.end(); ++it)
+		changedFiles.push_back(MString(it->c_str()));
+	firstChangeTime = mFirstChangeTime;
+	mChangedFiles.clear();
+	return true;
+}
@@ -0,0 +1,94 @@
+#ifndef _dx11ShaderFileWatcher_h_
+#define _dx11ShaderFileWatcher_h_
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+#include <maya/MString.h>
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+
+/*!
+	Reports the changes of a set of files, once the changes settled.
+
+	The notifications come from a backend, which is given the files to watch and asked
+	for the files changed since the previous call. The polling backend compares the
+	modification time and the size of each file, a native backend can replace it.
+
+	Editors often write a file several times when saving it. The changes are held until
+	no file changed for the settle time, then the whole burst is reported at once.
+
+	This class does not depend on D3D, the reload is done by CDX11EffectCompileHelper.
+*/
+class CFileWatcher
+{
+public:
+	typedef std::vector< MString > FileList;
+
+	class Backend
+	{
+	public:
+		virtual ~Backend() {}
+
+		// Replace the files watched
+		virtual void setFiles(const FileList& files) = 0;
+
+		// Append the files changed since the previous call
+		virtual void poll(FileList& changedFiles) = 0;
+	};
+
+	class PollingBackend : public Backend
+	{
+	public:
+		virtual void setFiles(const FileList& files);
+		virtual void poll(FileList& changedFiles);
+
+	private:
+		struct FileState
+		{
+			time_t timeStamp;
+			off_t size;
+		};
+		static FileState fileState(const std::string& fileName);
+
+		typedef std::map< std::string, FileState > FileStateMap;
+		FileStateMap mFiles;
+	};
+
+	// Take the ownership of the backend, the times are in seconds
+	CFileWatcher(Backend* backend, double settleTime);
+	~CFileWatcher();
+
+	void setFiles(const FileList& files);
+
+	// Poll the backend at the given time.
+	// Return true when changes settled: changedFiles receives the files of the burst,
+	// and firstChangeTime the time its first change was seen.
+	bool update(double time, FileList& changedFiles, double& firstChangeTime);
+
+private:
+	Backend* mBackend;
+	double mSettleTime;
+
+	std::set< std::string > mChangedFiles;
+	double mFirstChangeTime;
+	double mLastChangeTime;
+
+	CFileWatcher(const CFileWatcher&);
+	const CFileWatcher& operator=(const CFileWatcher&);
+};
+
+#endif //_dx11ShaderFileWatcher_h_
@@ -19,6 +19,7 @@
 #include "dx11ShaderStrings.h"
 #include "dx11ConeAngleToHotspotConverter.h"
 #include "crackFreePrimitiveGenerator.h"
+#include "dx11ShaderCompileHelper.h"
 
 #include <maya/MFnPlugin.h>
 #include <maya/MIOStream.h>
@@ -95,6 +96,12 @@ MStatus initializePlugin( MObject obj )
 	CHECK_MSTATUS(
 		MHWRender::MDrawRegistry::registerIndexBufferMutator("PNAEN9", CrackFreePrimitiveGenerator::createCrackFreePrimitiveGenerator9));
 
+	// Compile the effects of the scenes in parallel when they are read
+	CDX11EffectCompileHelper::addScenePrewarmCallbacks();
+
+	// Reload the effects when their files change, when DX11SHADER_HOT_RELOAD is set
+	CDX11EffectCompileHelper::startFileWatcher(dx11ShaderNode::reloadAll);
+
 	// Add and manage default plugin user pref:
 	MGlobal::executeCommandOnIdle("dx11ShaderCreateUI");
 	
@@ -122,6 +129,12 @@ MStatus uninitializePlugin( MObject obj)
 	MStatus   status;
 	MFnPlugin plugin( obj );
 
+	// Let the background compilations finish before the code goes away
+	//
+	CDX11EffectCompileHelper::stopFileWatcher();
+	CDX11EffectCompileHelper::removeScenePrewarmCallbacks();
+	CDX11EffectCompileHelper::finishBuilds();
+
 	// Deregister our node types.
 	//
 	CHECK_MSTATUS( plugin.deregisterCommand( "dx11Shader" ) );
@@ -139,6 +152,8 @@ MStatus uninitializePlugin( MObject obj)
 	//
 	CHECK_MSTATUS(MHWRender::MDrawRegistry::deregisterIndexBufferMutator("PNAEN18"));
 	CHECK_MSTATUS(MHWRender::MDrawRegistry::deregisterIndexBufferMutator("PNAEN9"));
+	CrackFreePrimitiveGenerator::clearCache();
+	dx11ShaderNode::releaseSwatchBuffers();
 
 	// Remove user pref UI:
 	MGlobal::executeCommandOnIdle("dx11ShaderDeleteUI");
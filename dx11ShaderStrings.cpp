@@ -71,11 +71,14 @@ namespace dx11ShaderStrings
 	const MStringResourceId kErrorFileNotFound			( kPluginId, "kErrorFileNotFound", 			MString( "Effect file \"^1s\" not found." ) );
 	const MStringResourceId kErrorInvalidEffectFile		( kPluginId, "kErrorInvalidEffectFile",		MString( "Invalid effect file \"^1s\"." ) );
 	const MStringResourceId kErrorAbsolutePathNotFound	( kPluginId, "kErrorAbsolutePathNotFound",	MString( "Effect file \"^1s\" not found, using \"^2s\" instead.\n" ) );
+	const MStringResourceId kInfoScenePrewarm			( kPluginId, "kInfoScenePrewarm",			MString( "dx11Shader: compiled ^1s effects in parallel while reading the scene, ^2s s of compilation, ^3s s waited after reading, ^4s s saved." ) );
+	const MStringResourceId kInfoHotReload				( kPluginId, "kInfoHotReload",				MString( "dx11Shader: reloaded ^1s changed effects, ^2s s from the file change to the new effects." ) );
 
 	//dx11ShaderNode
 	const MStringResourceId kErrorIndexVaryingParameter	( kPluginId, "kErrorIndexVaryingParameter",	MString( "Unsupported index on varying parameter ^1s. Index will be interpreted as 0\n" ) );
 	const MStringResourceId kErrorVertexRequirement		( kPluginId, "kErrorVertexRequirement", 	MString( "Unsupported per vertex requirement for ^1s^2s. The vector size should be between ^3s and ^4s, the effect requires ^5s\n" ) );
 	const MStringResourceId kWarningVertexRequirement	( kPluginId, "kWarningVertexRequirement", 	MString( "Per vertex requirement for ^1s. The vector size maya provides is ^2s, the effect requires ^3s\n" ) );
+	const MStringResourceId kWarningUndirtiedParameter	( kPluginId, "kWarningUndirtiedParameter",	MString( "dx11Shader: parameter ^1s changed without being marked dirty" ) );
 
 	const MStringResourceId kErrorNoValidTechniques		( kPluginId, "kErrorNoValidTechniques", 	MString( "Cannot initialize techniques. Effect has no valid techniques.\n" ) );
 	const MStringResourceId kErrorSetTechniqueByName	( kPluginId, "kErrorSetTechniqueByName",	MString( "Failed to set technique. Technique ^1s does not exist on effect.\n" ) );
@@ -182,11 +185,14 @@ MStatus dx11ShaderStrings::registerMStringResources(void)
 	MStringResource::registerString( kErrorEffectBuffer );
 	MStringResource::registerString( kErrorFileNotFound );
 	MStringResource::registerString( kErrorAbsolutePathNotFound );
+	MStringResource::registerString( kInfoScenePrewarm );
+	MStringResource::registerString( kInfoHotReload );
 
 	//dx11ShaderNode
 	MStringResource::registerString( kErrorIndexVaryingParameter );
 	MStringResource::registerString( kErrorVertexRequirement );
 	MStringResource::registerString( kWarningVertexRequirement );
+	MStringResource::registerString( kWarningUndirtiedParameter );
 
 	MStringResource::registerString( kErrorNoValidTechniques );
 	MStringResource::registerString( kErrorSetTechniqueByName );
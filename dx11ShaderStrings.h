@@ -71,11 +71,14 @@ namespace dx11ShaderStrings
 	extern const MStringResourceId kErrorFileNotFound;
 	extern const MStringResourceId kErrorInvalidEffectFile;
 	extern const MStringResourceId kErrorAbsolutePathNotFound;
+	extern const MStringResourceId kInfoScenePrewarm;
+	extern const MStringResourceId kInfoHotReload;
 
 	//dx11ShaderNode
 	extern const MStringResourceId kErrorIndexVaryingParameter;
 	extern const MStringResourceId kErrorVertexRequirement;
 	extern const MStringResourceId kWarningVertexRequirement;
+	extern const MStringResourceId kWarningUndirtiedParameter;
 
 	extern const MStringResourceId kErrorNoValidTechniques;
 	extern const MStringResourceId kErrorSetTechniqueByName;
@@ -17,6 +17,9 @@
 #include "dx11ShaderCompileHelper.h"
 #include "dx11ShaderSemantics.h"
 
+#include <algorithm>
+#include <set>
+
 
 namespace
 {
@@ -32,11 +35,30 @@ namespace
 		}
 		return at;
 	}
+
+	// Same name lookup as dx11ShaderNode::getIndexForUIGroupName: the names are also
+	// matched with their non alpha-numeric characters replaced by _
+	int findOrAppendName(MStringArray& names, const MString& name)
+	{
+		unsigned int index = 0;
+		for ( ; index < names.length(); index++)
+		{
+			std::string sanitized(names[index].asChar());
+			for (size_t i=0; i<sanitized.size(); ++i)
+				if (!isalnum(sanitized[i]))
+					sanitized[i] = '_';
+
+			if ( names[index] == name || MString(sanitized.c_str()) == name)
+				return index;
+		}
+		names.append(name);
+		return index;
+	}
 }
 
 CUniformParameterBuilder::CUniformParameterBuilder()
 	:mEffectVariable(NULL)
-	,mShader(NULL)
+	,mSchema(NULL)
 	,mParamType(eUndefined)
 	,mLightType(eNotLight)
 	,mLightIndex(-1)
@@ -46,11 +68,12 @@ CUniformParameterBuilder::CUniformParameterBuilder()
 	,mAnnotationIndex()
 {}
 
-void CUniformParameterBuilder::init(ID3DX11EffectVariable* inEffectVariable,dx11ShaderNode* inShader, int order)
+void CUniformParameterBuilder::init(ID3DX11EffectVariable* inEffectVariable,CEffectSchema* inSchema, int order)
 {
 	mEffectVariable = inEffectVariable;
-	mShader = inShader;
+	mSchema = inSchema;
 	mUIOrder = order;
+	mParamDesc.variableIndex = order;
 	if(mEffectVariable)
 	{
 		mEffectVariable->GetDesc(&mDesc);
@@ -117,7 +140,7 @@ bool CUniformParameterBuilder::build()
 		if( getAnnotation( dx11ShaderAnnotation::kUIGroup, pszUIGroupName) && *pszUIGroupName)
 		{
 			MString uiGroupName(pszUIGroupName);
-			mUIGroupIndex = mShader->getIndexForUIGroupName(uiGroupName, true);
+			mUIGroupIndex = mSchema->getIndexForUIGroupName(uiGroupName);
 		}
 	}
 
@@ -135,20 +158,15 @@ bool CUniformParameterBuilder::build()
 		are not required to be unique by the compiler. The MPxHardwareShader class
 		will add numbers at the end of the short/long names as required to
 		make them unique.
-	*/
-	LPCSTR paramName = NULL;
-
-	bool varAsAttr = false;
-	if (mShader)
-		varAsAttr = mShader->getVariableNameAsAttributeName();
 
+		Whether the variable name is used depends on the technique of the node,
+		the name is chosen in createParameter().
+	*/
 	LPCSTR uiName = NULL ;
-	bool hasUIName = getAnnotation( dx11ShaderAnnotation::kUIName, uiName);
-
-	if( varAsAttr || !hasUIName )
-		paramName = mDesc.Name;
-	else
-		paramName = uiName;
+	mParamDesc.hasUIName = getAnnotation( dx11ShaderAnnotation::kUIName, uiName);
+	if (mParamDesc.hasUIName)
+		mParamDesc.uiName = uiName;
+	mParamDesc.variableName = mDesc.Name;
 
 	/*
 		If an integer parameter has a UIFieldNames annotation, then the
@@ -157,27 +175,19 @@ bool CUniformParameterBuilder::build()
 		changed from integer to enum.
 	*/
 	LPCSTR uiFieldNames = NULL ;
-	MString fieldNames;
 	if(type == MUniformParameter::kTypeInt && getAnnotation(dx11ShaderAnnotation::kUIFieldNames,uiFieldNames) && uiFieldNames)
 	{
-		fieldNames = uiFieldNames;
+		mParamDesc.enumFieldNames = uiFieldNames;
 		type = MUniformParameter::kTypeEnum;
 	}
 
-	MUniformParameter uniform( paramName, type, semantic, mDescType.Rows, mDescType.Columns, (void*)mEffectVariable);
-	mParam = uniform;
-
-	// If shader author has specified to use var as attribute name and provided a UIName, then
-	// tell Maya to use the UIName for the attribute's 'Nice Name':
-	if (varAsAttr && hasUIName)
-		mParam.setUINiceName( uiName );
+	mParamDesc.type = type;
+	mParamDesc.semantic = semantic;
+	mParamDesc.rows = mDescType.Rows;
+	mParamDesc.columns = mDescType.Columns;
 
 	updateRangeFromAnnotation();
 	updateUIVisibilityFromAnnotation();
-	if (fieldNames.length())
-	{
-		mParam.setEnumFieldNames(fieldNames);
-	}
 
 	/*
 		The UIOrder annotation can be used to make sure all parameters
@@ -193,13 +203,16 @@ bool CUniformParameterBuilder::build()
 	*/
 	getAnnotation(dx11ShaderAnnotation::kUIOrder, mUIOrder);
 
-	// set keyable for visible attributes other than textures
-	mParam.setKeyable(!mParam.UIHidden() && !mParam.isATexture());
-
 	bool result = setParameterValueFromEffect();
 	if(result)
 	{
 		mValidUniformParameter = true;
+
+		mParamDesc.lightParameterType = mParamType;
+		mParamDesc.lightType = mLightType;
+		mParamDesc.lightIndex = mLightIndex;
+		mParamDesc.uiGroupIndex = mUIGroupIndex;
+		mParamDesc.uiOrder = mUIOrder;
 	}
 
 	return result;
@@ -214,7 +227,8 @@ void CUniformParameterBuilder::updateUIVisibilityFromAnnotation()
 	BOOL visible = TRUE;
 	if( getBOOLAnnotation( dx11ShaderAnnotation::kSasUiVisible, visible))
 	{
-		mParam.setUIHidden(!visible);
+		mParamDesc.hasUIHidden = true;
+		mParamDesc.uiHidden = !visible;
 	}
 	else
 	{
@@ -222,13 +236,15 @@ void CUniformParameterBuilder::updateUIVisibilityFromAnnotation()
 		bool  foundUIType = getAnnotation( dx11ShaderAnnotation::kUIType,uiTypeValue);
 		if (foundUIType && !_stricmp(uiTypeValue, dx11ShaderAnnotationValue::kNone))
 		{
-			mParam.setUIHidden(true);
+			mParamDesc.hasUIHidden = true;
+			mParamDesc.uiHidden = true;
 		}
 		// As per NVidia SAS docs v1.0.3:
 		foundUIType = getAnnotation( dx11ShaderAnnotation::kUIWidget,uiTypeValue);
 		if (foundUIType && !_stricmp(uiTypeValue, dx11ShaderAnnotationValue::kNone))
 		{
-			mParam.setUIHidden(true);
+			mParamDesc.hasUIHidden = true;
+			mParamDesc.uiHidden = true;
 		}
 	}
 }
@@ -243,7 +259,7 @@ void CUniformParameterBuilder::updateUIVisibilityFromAnnotation()
 */
 void CUniformParameterBuilder::updateRangeFromAnnotation()
 {
-	switch(mParam.type())
+	switch(mParamDesc.type)
 	{
 	case MUniformParameter::kTypeFloat:
 	case MUniformParameter::kTypeInt:
@@ -253,7 +269,8 @@ void CUniformParameterBuilder::updateRangeFromAnnotation()
 			   getAnnotation( dx11ShaderAnnotation::kUIMin,uiMinFloat) ||
 			   getAnnotation( dx11ShaderAnnotation::kuimin,uiMinFloat) )
 			{
-				mParam.setRangeMin(uiMinFloat);
+				mParamDesc.hasRangeMin = true;
+				mParamDesc.rangeMin = uiMinFloat;
 			}
 
 			float uiMaxFloat = NULL;
@@ -261,7 +278,8 @@ void CUniformParameterBuilder::updateRangeFromAnnotation()
 			   getAnnotation( dx11ShaderAnnotation::kUIMax,uiMaxFloat) ||
 			   getAnnotation( dx11ShaderAnnotation::kuimax,uiMaxFloat) )
 			{
-				mParam.setRangeMax(uiMaxFloat);
+				mParamDesc.hasRangeMax = true;
+				mParamDesc.rangeMax = uiMaxFloat;
 			}
 
 			float uiSoftMinFloat = NULL;
@@ -269,7 +287,8 @@ void CUniformParameterBuilder::updateRangeFromAnnotation()
 			   getAnnotation( dx11ShaderAnnotation::kUISoftMin,uiSoftMinFloat) ||
 			   getAnnotation( dx11ShaderAnnotation::kuisoftmin,uiSoftMinFloat) )
 			{
-				mParam.setSoftRangeMin(uiSoftMinFloat);
+				mParamDesc.hasSoftRangeMin = true;
+				mParamDesc.softRangeMin = uiSoftMinFloat;
 			}
 
 			float uiSoftMaxFloat = NULL;
@@ -277,7 +296,8 @@ void CUniformParameterBuilder::updateRangeFromAnnotation()
 			   getAnnotation( dx11ShaderAnnotation::kUISoftMax,uiSoftMaxFloat) ||
 			   getAnnotation( dx11ShaderAnnotation::kuisoftmax,uiSoftMaxFloat) )
 			{
-				mParam.setSoftRangeMax(uiSoftMaxFloat);
+				mParamDesc.hasSoftRangeMax = true;
+				mParamDesc.softRangeMax = uiSoftMaxFloat;
 			}
 		}
 		break;
@@ -297,12 +317,12 @@ void CUniformParameterBuilder::updateRangeFromAnnotation()
 bool CUniformParameterBuilder::setParameterValueFromEffect()
 {
 	int length = getLength();
-	MUniformParameter::DataType type = mParam.type();
+	MUniformParameter::DataType type = mParamDesc.type;
 	switch( type )
 	{
 	case MUniformParameter::kTypeFloat:
 		{
-			std::vector<FLOAT> values;
+			std::vector<FLOAT>& values = mParamDesc.floatValue;
 			values.resize(length);
 			FLOAT* Value = &values[0];
 			switch(mDescType.Class)
@@ -322,8 +342,6 @@ bool CUniformParameterBuilder::setParameterValueFromEffect()
 			default:
 				return false;
 			};
-
-			mParam.setAsFloatArray( Value, length);
 		}
 		break;
 	case MUniformParameter::kTypeString:
@@ -333,7 +351,8 @@ bool CUniformParameterBuilder::setParameterValueFromEffect()
 				LPCSTR Value;
 				if( mEffectVariable->AsString()->GetString( &Value) == S_OK)
 				{
-					mParam.setAsString( MString( Value));
+					mParamDesc.hasStringValue = true;
+					mParamDesc.stringValue = MString( Value);
 				}
 			}
 			else
@@ -354,7 +373,8 @@ bool CUniformParameterBuilder::setParameterValueFromEffect()
 #endif
 				if( mEffectVariable->AsScalar()->GetBool( &Value) == S_OK)
 				{
-					mParam.setAsBool( Value ? true : false);
+					mParamDesc.hasBoolValue = true;
+					mParamDesc.boolValue = Value ? true : false;
 				}
 			}
 			else
@@ -372,7 +392,8 @@ bool CUniformParameterBuilder::setParameterValueFromEffect()
 				INT Value;
 				if( mEffectVariable->AsScalar()->GetInt( &Value) == S_OK)
 				{
-					mParam.setAsInt( Value);
+					mParamDesc.hasIntValue = true;
+					mParamDesc.intValue = Value;
 				}
 			}
 			else
@@ -385,22 +406,16 @@ bool CUniformParameterBuilder::setParameterValueFromEffect()
 	default:
 		if( type >= MUniformParameter::kType1DTexture && type <= MUniformParameter::kTypeEnvTexture)
 		{
-			// We have a texture name but no resource view. Try and load in
-			// a new texture and get a new resource view.
-			MString textureFile;
+			// We have a texture name but no resource view. The texture file of the node,
+			// or the one named here, is loaded by createParameter().
 			LPCSTR resource;
-			MString paramName = mParam.name();
-			if( mShader->getTextureFile( paramName, textureFile ) )
+			if( getAnnotation( dx11ShaderAnnotation::kResourceName, resource) && *resource)
 			{
-				mParam.setAsString( textureFile );
-			}
-			else if( getAnnotation( dx11ShaderAnnotation::kResourceName, resource) && *resource)
-			{
-				mParam.setAsString( mShader->findResource( MString( resource), CDX11EffectCompileHelper::resolveShaderFileName(mShader->effectName()) ));
+				mParamDesc.resourceName = resource;
 			}
 			else if( getAnnotation( dx11ShaderAnnotation::kSasResourceAddress, resource) && *resource)
 			{
-				mParam.setAsString( mShader->findResource( MString( resource), CDX11EffectCompileHelper::resolveShaderFileName(mShader->effectName()) ));
+				mParamDesc.resourceName = resource;
 			}
 		}
 		else
@@ -412,6 +427,94 @@ bool CUniformParameterBuilder::setParameterValueFromEffect()
 	return true;
 }
 
+CUniformParameterBuilder::Desc::Desc()
+	: variableIndex(-1)
+	, hasUIName(false)
+	, type(MUniformParameter::kTypeUnknown)
+	, semantic(MUniformParameter::kSemanticUnknown)
+	, rows(0)
+	, columns(0)
+	, hasRangeMin(false), hasRangeMax(false), hasSoftRangeMin(false), hasSoftRangeMax(false)
+	, rangeMin(0.0f), rangeMax(0.0f), softRangeMin(0.0f), softRangeMax(0.0f)
+	, hasUIHidden(false)
+	, uiHidden(false)
+	, hasStringValue(false)
+	, hasBoolValue(false)
+	, boolValue(false)
+	, hasIntValue(false)
+	, intValue(0)
+	, lightParameterType(eUndefined)
+	, lightType(eNotLight)
+	, lightIndex(-1)
+	, uiGroupIndex(-1)
+	, uiOrder(-1)
+{}
+
+/*
+	Create the uniform parameter of the node from the reflection of the effect variable.
+	Only the parts that depend on the node are done here: the variable is the one of the
+	node's effect, the attribute name depends on the technique of the node, and the
+	textures depend on the node's texture files.
+*/
+MUniformParameter CUniformParameterBuilder::createParameter(const Desc& desc, ID3DX11EffectVariable* effectVariable, dx11ShaderNode* shader)
+{
+	bool varAsAttr = false;
+	if (shader)
+		varAsAttr = shader->getVariableNameAsAttributeName();
+
+	MString paramName;
+	if( varAsAttr || !desc.hasUIName )
+		paramName = desc.variableName;
+	else
+		paramName = desc.uiName;
+
+	MUniformParameter param( paramName, desc.type, desc.semantic, desc.rows, desc.columns, (void*)effectVariable);
+
+	// If shader author has specified to use var as attribute name and provided a UIName, then
+	// tell Maya to use the UIName for the attribute's 'Nice Name':
+	if (varAsAttr && desc.hasUIName)
+		param.setUINiceName( desc.uiName );
+
+	if (desc.hasRangeMin)
+		param.setRangeMin(desc.rangeMin);
+	if (desc.hasRangeMax)
+		param.setRangeMax(desc.rangeMax);
+	if (desc.hasSoftRangeMin)
+		param.setSoftRangeMin(desc.softRangeMin);
+	if (desc.hasSoftRangeMax)
+		param.setSoftRangeMax(desc.softRangeMax);
+	if (desc.hasUIHidden)
+		param.setUIHidden(desc.uiHidden);
+	if (desc.enumFieldNames.length())
+		param.setEnumFieldNames(desc.enumFieldNames);
+
+	// set keyable for visible attributes other than textures
+	param.setKeyable(!param.UIHidden() && !param.isATexture());
+
+	if (!desc.floatValue.empty())
+		param.setAsFloatArray( &desc.floatValue[0], (unsigned int)desc.floatValue.size());
+	else if (desc.hasStringValue)
+		param.setAsString( desc.stringValue );
+	else if (desc.hasBoolValue)
+		param.setAsBool( desc.boolValue );
+	else if (desc.hasIntValue)
+		param.setAsInt( desc.intValue );
+	else if (shader && param.isATexture())
+	{
+		MString textureFile;
+		if( shader->getTextureFile( paramName, textureFile ) )
+		{
+			param.setAsString( textureFile );
+		}
+		else if( desc.resourceName.length() > 0 )
+		{
+			param.setAsString( shader->findResource( desc.resourceName, CDX11EffectCompileHelper::resolveShaderFileName(shader->effectName()) ));
+		}
+	}
+
+	return param;
+}
+
 MUniformParameter::DataType CUniformParameterBuilder::convertType()
 {
 	MUniformParameter::DataType		paramType = MUniformParameter::kTypeUnknown;
@@ -728,8 +831,8 @@ void CUniformParameterBuilder::updateLightInfoFromSemantic()
 	if( getAnnotation( dx11ShaderAnnotation::kObject, objectType) && *objectType)
 	{
 		MString objectAnnotation(objectType);
-		mLightIndex = mShader->getIndexForLightName(objectAnnotation, true);
-		mUIGroupIndex = mShader->getIndexForUIGroupName(objectAnnotation, true);
+		mLightIndex = mSchema->getIndexForLightName(objectAnnotation);
+		mUIGroupIndex = mSchema->getIndexForUIGroupName(objectAnnotation);
 		if(objectAnnotation.rindexW(dx11ShaderAnnotationValue::kLight) >= 0 || objectAnnotation.rindexW(dx11ShaderAnnotationValue::kLamp) >= 0)
 		{
 			mLightType = eUndefinedLight;
@@ -910,8 +1013,8 @@ void CUniformParameterBuilder::updateLightInfoFromSemantic()
 				while (truncationPos < maxChars && isdigit(objectName[truncationPos]))
 					truncationPos++;
 
-				mLightIndex = mShader->getIndexForLightName(name.substring(0,truncationPos-1), true);
-				mUIGroupIndex = mShader->getIndexForUIGroupName(name.substring(0,truncationPos-1), true);
+				mLightIndex = mSchema->getIndexForLightName(name.substring(0,truncationPos-1));
+				mUIGroupIndex = mSchema->getIndexForUIGroupName(name.substring(0,truncationPos-1));
 			}
 		}
 
@@ -1057,3 +1160,155 @@ void CUniformParameterBuilder::logUnrecognisedSemantic(const char* pSemantic)
 
 	mWarnings += dx11ShaderStrings::getString( dx11ShaderStrings::kUnknowSemantic, args );
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CEffectSchema::CEffectSchema()
+	: mRefCount(1)
+{}
+
+CEffectSchema* CEffectSchema::create(ID3DX11Effect* effect)
+{
+	CEffectSchema* schema = new CEffectSchema;
+	if (effect)
+	{
+		schema->buildUniforms(effect);
+		schema->buildVaryingInputs(effect);
+	}
+	return schema;
+}
+
+void CEffectSchema::addRef()
+{
+	++mRefCount;
+}
+
+void CEffectSchema::release()
+{
+	if (--mRefCount == 0)
+		delete this;
+}
+
+int CEffectSchema::getIndexForUIGroupName(const MString& uiGroupName)
+{
+	return findOrAppendName(mUIGroupNames, uiGroupName);
+}
+
+int CEffectSchema::getIndexForLightName(const MString& lightName)
+{
+	return findOrAppendName(mLightNames, lightName);
+}
+
+const CEffectSchema::VaryingInputList& CEffectSchema::varyingInputs(unsigned int techniqueIndex) const
+{
+	static const VaryingInputList sNoInputs;
+	return (techniqueIndex < mVaryingInputs.size() ? mVaryingInputs[techniqueIndex] : sNoInputs);
+}
+
+/*
+	Reflect all the parameters, sort them according to a potentially defined UIOrder,
+	and sort the UIGroups the same way. Each group remembers which parameters belong to it.
+*/
+void CEffectSchema::buildUniforms(ID3DX11Effect* effect)
+{
+	D3DX11_EFFECT_DESC desc;
+	effect->GetDesc(&desc);
+
+	for (unsigned int i = 0; i < desc.GlobalVariables; i++)
+	{
+		CUniformParameterBuilder builder;
+		builder.init(effect->GetVariableByIndex(i), this, i);
+		if(builder.build())
+		{
+			mUniforms.push_back(builder.getDesc());
+		}
+		else
+		{
+			mWarnings += builder.getWarnings();
+		}
+	}
+	std::stable_sort(mUniforms.begin(), mUniforms.end(), CUniformParameterBuilder::compareUIOrder);
+
+	mUIGroupParameters.resize(mUIGroupNames.length());
+
+	// All the groups were initially added in the same order as
+	// they were returned from the compiler. We want them to be
+	// sorted by UIOrder instead:
+	std::vector<int> uiGroupRemapping;
+	uiGroupRemapping.resize(mUIGroupNames.length(), -1);
+	int numRemapped = 0;
+	MStringArray sortedUIGroupNames;
+
+	for (size_t i = 0; i < mUniforms.size(); ++i)
+	{
+		int& uiGroupIndex = mUniforms[i].uiGroupIndex;
+		if (uiGroupIndex >= 0)
+		{
+			if (uiGroupRemapping[uiGroupIndex] == -1) {
+				sortedUIGroupNames.append(mUIGroupNames[(unsigned int)uiGroupIndex]);
+				uiGroupRemapping[uiGroupIndex] = numRemapped;
+				++numRemapped;
+			}
+			uiGroupIndex = uiGroupRemapping[uiGroupIndex];
+
+			mUIGroupParameters[uiGroupIndex].push_back((int)i);
+		}
+	}
+	mUIGroupNames = sortedUIGroupNames;
+}
+
+/*
+	For each technique, gather the vertex shader inputs of all its passes, once per semantic.
+*/
+void CEffectSchema::buildVaryingInputs(ID3DX11Effect* effect)
+{
+	D3DX11_EFFECT_DESC effectDesc;
+	effect->GetDesc(&effectDesc);
+
+	mVaryingInputs.resize(effectDesc.Techniques);
+	for (unsigned int techniqueId = 0; techniqueId < effectDesc.Techniques; ++techniqueId)
+	{
+		ID3DX11EffectTechnique* dxTechnique = effect->GetTechniqueByIndex(techniqueId);
+		if(dxTechnique == NULL || dxTechnique->IsValid() == false)
+			continue;
+
+		D3DX11_TECHNIQUE_DESC techniqueDesc;
+		dxTechnique->GetDesc(&techniqueDesc);
+
+		VaryingInputList& inputs = mVaryingInputs[techniqueId];
+		std::set<std::string> registeredSemantics;
+		for (unsigned int passId = 0; passId < techniqueDesc.Passes; ++passId)
+		{
+			ID3DX11EffectPass* dxPass = dxTechnique->GetPassByIndex(passId);
+			if(dxPass == NULL || dxPass->IsValid() == false)
+				continue;
+
+			D3DX11_PASS_SHADER_DESC vertexShaderDesc;
+			dxPass->GetVertexShaderDesc(&vertexShaderDesc);
+
+			ID3DX11EffectShaderVariable* shaderVar = vertexShaderDesc.pShaderVariable;
+			if(shaderVar == NULL)
+				continue;
+
+			unsigned int shaderIndex = vertexShaderDesc.ShaderIndex;
+			D3DX11_EFFECT_SHADER_DESC shaderDesc;
+			shaderVar->GetShaderDesc(shaderIndex, &shaderDesc);
+			for (unsigned int varId = 0; varId < shaderDesc.NumInputSignatureEntries; ++varId)
+			{
+				VaryingInput input;
+				shaderVar->GetInputSignatureElementDesc(shaderIndex, varId, &input.desc);
+
+				// Build a unique name based on semantic name + semantic index
+				MString uniqueName;
+				uniqueName.set( (double)input.desc.SemanticIndex, 0 );
+				uniqueName = MString(input.desc.SemanticName) + MString("_") + uniqueName;
+
+				if( registeredSemantics.insert(std::string(uniqueName.asChar())).second )
+				{
+					input.semanticName = input.desc.SemanticName;
+					inputs.push_back(input);
+				}
+			}
+		}
+	}
+}
@@ -26,29 +26,34 @@
 // To build against the DX SDK header use the following commented line
 //#include <../Samples/C++/Effects11/Inc/d3dx11effect.h>
 #include <maya/d3dx11effect.h>
+#include <maya/MStringArray.h>
 #include <map>
 #include <string>
+#include <vector>
 
 
 class dx11ShaderNode;
 class MStringResourceId;
+class CEffectSchema;
 
+/*
+	Extracts what the reflection of an effect variable and its annotations tell
+	about a uniform parameter. The result, a Desc, does not depend on the node using
+	the effect: createParameter() makes the uniform parameter of a node from it.
+*/
 class CUniformParameterBuilder
 {
 public:
 	CUniformParameterBuilder();
 	
 
-	void init(ID3DX11EffectVariable* inEffectVariable,dx11ShaderNode* inShader, int order);
+	void init(ID3DX11EffectVariable* inEffectVariable,CEffectSchema* inSchema, int order);
 
 	bool build();
 
 	bool isValidUniformParameter()
 	{return mValidUniformParameter;}
 
-	MUniformParameter& getParameter()
-	{return mParam;}
-
 	ID3DX11EffectVariable* getEffectVariable()
 	{return mEffectVariable; }
 
@@ -121,8 +126,53 @@ public:
 	int getUIOrder()
 	{ return mUIOrder;	}
 
-	static bool compareUIOrder(CUniformParameterBuilder* a, CUniformParameterBuilder* b)
-	{return (a->getUIOrder() < b->getUIOrder());}
+	// The reflection of a uniform parameter
+	struct Desc
+	{
+		Desc();
+
+		int								variableIndex;
+		MString							variableName;
+		MString							uiName;
+		bool							hasUIName;
+		MUniformParameter::DataType		type;
+		MUniformParameter::DataSemantic	semantic;
+		int								rows;
+		int								columns;
+		MString							enumFieldNames;
+
+		bool							hasRangeMin, hasRangeMax, hasSoftRangeMin, hasSoftRangeMax;
+		float							rangeMin, rangeMax, softRangeMin, softRangeMax;
+		bool							hasUIHidden;
+		bool							uiHidden;
+
+		// Default value, as initialized in the effect
+		std::vector<float>				floatValue;
+		bool							hasStringValue;
+		MString							stringValue;
+		bool							hasBoolValue;
+		bool							boolValue;
+		bool							hasIntValue;
+		int								intValue;
+
+		// Texture named by the ResourceName annotation, relative to the effect file
+		MString							resourceName;
+
+		ELightParameterType				lightParameterType;
+		ELightType						lightType;
+		int								lightIndex;
+		int								uiGroupIndex;
+		int								uiOrder;
+	};
+
+	const Desc& getDesc() const
+	{return mParamDesc;}
+
+	static bool compareUIOrder(const Desc& a, const Desc& b)
+	{return (a.uiOrder < b.uiOrder);}
+
+	// Create the uniform parameter of a node, bound to the variable of its effect
+	static MUniformParameter createParameter(const Desc& desc, ID3DX11EffectVariable* effectVariable, dx11ShaderNode* shader);
 
 protected:
 
@@ -154,10 +204,10 @@ protected:
 
 
 	ID3DX11EffectVariable*		mEffectVariable;
-	dx11ShaderNode *			mShader;
+	CEffectSchema *				mSchema;
 	D3DX11_EFFECT_VARIABLE_DESC mDesc;
 	D3DX11_EFFECT_TYPE_DESC		mDescType;
-	MUniformParameter			mParam;
+	Desc						mParamDesc;
 	ELightParameterType			mParamType;
 	MString						mWarnings;
 	ELightType					mLightType;
@@ -169,5 +219,59 @@ protected:
 	TAnnotationIndex			mAnnotationIndex;
 };
 
+/*
+	The reflection of an effect: its uniform parameters sorted by UIOrder, with their
+	UI groups and light groups, and the vertex inputs of each technique.
+
+	Reflecting an effect is the same work for every node using it, so the schema is
+	built once per reference effect and shared by the nodes using its clones, see
+	CDX11EffectCompileHelper::acquireEffectSchema(). It does not change once built.
+*/
+class CEffectSchema
+{
+public:
+	typedef std::vector< CUniformParameterBuilder::Desc > UniformDescList;
+
+	struct VaryingInput
+	{
+		MString semanticName;
+		D3D11_SIGNATURE_PARAMETER_DESC desc;	// SemanticName is only valid in the reference effect
+	};
+	typedef std::vector< VaryingInput > VaryingInputList;
+
+	// Reflect the effect, the schema is returned with a reference count of 1
+	static CEffectSchema* create(ID3DX11Effect* effect);
+
+	void addRef();
+	void release();
+
+	const UniformDescList& uniforms() const { return mUniforms; }
+	const MStringArray& uiGroupNames() const { return mUIGroupNames; }
+	const std::vector<std::vector<int> >& uiGroupParameters() const { return mUIGroupParameters; }
+	const MStringArray& lightNames() const { return mLightNames; }
+	const MString& warnings() const { return mWarnings; }
+
+	// The vertex shader inputs of all the passes of the technique
+	const VaryingInputList& varyingInputs(unsigned int techniqueIndex) const;
+
+	// Used by the CUniformParameterBuilder while the schema is built
+	int getIndexForUIGroupName(const MString& uiGroupName);
+	int getIndexForLightName(const MString& lightName);
+
+private:
+	CEffectSchema();
+
+	void buildUniforms(ID3DX11Effect* effect);
+	void buildVaryingInputs(ID3DX11Effect* effect);
+
+	unsigned int mRefCount;
+	UniformDescList mUniforms;
+	MStringArray mUIGroupNames;
+	std::vector<std::vector<int> > mUIGroupParameters;
+	MStringArray mLightNames;
+	MString mWarnings;
+	std::vector< VaryingInputList > mVaryingInputs;
+};
+
 
 #endif /* _dx11ShaderUniformParamBuilder_h_ */
@@ -0,0 +1,30 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// The PN-AEN patch generation of the original plug-in, before the hashed edge tables,
+// kept for the benchmark to compare against: the positions are welded in a std::map
+// and the edges are matched through std::map tables, on a single thread.
+
+#pragma once
+
+#include <maya/MUintArray.h>
+
+namespace BaselineCrackFreePrimitiveGenerator
+{
+	// The 32-bit branch of the original CrackFreePrimitiveGenerator::mutateIndexBuffer
+	void mutateIndexBuffer( const MUintArray& originalBufferIndices,
+							const float* positionBufferFloat,
+							const float* uvBufferFloat,
+							bool bAddAdjacentEdges,
+							bool bAddDominantEdges,
+							bool bAddDominantPosition,
+							unsigned int* indexData );
+}
@@ -0,0 +1,375 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Stand-alone benchmark of CrackFreePrimitiveGenerator::mutateIndexBuffer.
+//
+// Drives the generator over synthetic meshes and prints one JSON document on stdout with,
+// for each mesh, patch layout, index type and thread count: the time of each phase, the
+// triangles per second and the peak memory. The output hash tells whether the generated
+// indices changed between two builds, and must not change with the thread count.
+//
+// Each case is then built once more with the patch reordering, and the control points of
+// both builds go through a simulated FIFO post-transform cache to report the miss ratios
+// before and after the reordering.
+//
+// With --baseline, each mesh and layout is also built by the original plug-in code, with
+// its std::map edge tables, and the 32-bit cases report its time, the speedup over it and
+// whether both built the same indices. They can differ on fine meshes: the tolerant
+// comparison of the original position map is not a strict ordering, and its lookups can
+// miss an equal position, like the seam vertices of the 1024 x 512 uv sphere.
+//
+// Usage: crackFreePrimitiveGeneratorBenchmark [--quick] [--no-stress] [--no-reorder] [--baseline] [--threads 1,2,4] [--repeat N]
+//   --quick       small meshes only, used as a smoke test
+//   --no-stress   skip the 10M triangle mesh
+//   --no-reorder  skip the reordered builds and the cache simulation
+//   --baseline    compare with the original std::map tables, except on the 10M triangle mesh
+//   --threads    thread counts to run, the Maya thread count by default
+//   --repeat     runs of each case, the fastest is reported (3 by default)
+
+#include "crackFreePrimitiveGenerator.h"
+#include "baselineCrackFreePrimitiveGenerator.h"
+#include "syntheticMeshes.h"
+
+#include <maya/MThreadUtils.h>
+#include <maya/MTimer.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	struct Layout
+	{
+		const char* name;
+		bool addAdjacentEdges;
+		bool addDominantEdges;
+		bool addDominantPosition;
+	};
+
+	const Layout kLayouts[] =
+	{
+		{ "PNAEN9", true, false, false },
+		{ "PNAEN18", true, true, true },
+	};
+
+	struct Options
+	{
+		Options() : quick(false), stress(true), reorder(true), baseline(false), repeat(3) {}
+
+		bool quick;
+		bool stress;
+		bool reorder;
+		bool baseline;
+		unsigned int repeat;
+		std::vector< unsigned int > threadCounts;
+	};
+
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "--quick") == 0)
+				options.quick = true;
+			else if (strcmp(argv[i], "--no-stress") == 0)
+				options.stress = false;
+			else if (strcmp(argv[i], "--no-reorder") == 0)
+				options.reorder = false;
+			else if (strcmp(argv[i], "--baseline") == 0)
+				options.baseline = true;
+			else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+				options.repeat = (unsigned int)std::max(atoi(argv[++i]), 1);
+			else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			{
+				// Comma separated list
+				const char* count = argv[++i];
+				while (count)
+				{
+					options.threadCounts.push_back((unsigned int)std::max(atoi(count), 1));
+					count = strchr(count, ',');
+					if (count)
+						++count;
+				}
+			}
+			else
+				return false;
+		}
+
+		if (options.threadCounts.empty())
+			options.threadCounts.push_back((unsigned int)std::max(MThreadUtils::getNumThreads(), 1));
+		return true;
+	}
+
+	// Reset the peak resident size of the process, so it can be read for each case.
+	// Returns false when the kernel does not support it.
+	bool resetPeakMemory()
+	{
+		FILE* file = fopen("/proc/self/clear_refs", "w");
+		if (file == NULL)
+			return false;
+		bool reset = (fputs("5", file) >= 0);
+		return (fclose(file) == 0) && reset;
+	}
+
+	// Peak resident size in bytes, since the last reset when it succeeded
+	size_t peakMemory()
+	{
+		FILE* file = fopen("/proc/self/status", "r");
+		if (file)
+		{
+			char line[256];
+			unsigned long long peakKb = 0;
+			while (fgets(line, sizeof(line), file))
+			{
+				if (sscanf(line, "VmHWM: %llu kB", &peakKb) == 1)
+					break;
+			}
+			fclose(file);
+			if (peakKb > 0)
+				return (size_t)peakKb << 10;
+		}
+
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return (size_t)usage.ru_maxrss << 10;
+	}
+
+	unsigned long long hashBytes(const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		unsigned long long hash = 0xCBF29CE484222325ULL;
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+		return hash;
+	}
+
+	// Entries of the simulated post-transform cache, the size the patch reordering targets
+	const unsigned int kSimulatedCacheSize = 32;
+
+	// Fraction of the control points missing a FIFO cache of kSimulatedCacheSize entries
+	template < typename IndexType >
+	double cacheMissRatio(const IndexType* indexData, size_t numRefs)
+	{
+		if (numRefs == 0)
+			return 0.0;
+
+		// A control point is in the cache when less than kSimulatedCacheSize misses happened since it was loaded
+		size_t numControlPoints = (size_t)*std::max_element(indexData, indexData + numRefs) + 1;
+		std::vector< unsigned int > loadTimes(numControlPoints, 0);
+		unsigned int time = kSimulatedCacheSize + 1;
+		size_t numMisses = 0;
+		for (size_t i = 0; i < numRefs; ++i)
+		{
+			if (time - loadTimes[indexData[i]] > kSimulatedCacheSize)
+			{
+				loadTimes[indexData[i]] = time++;
+				++numMisses;
+			}
+		}
+		return (double)numMisses / numRefs;
+	}
+
+	double cacheMissRatio(const std::vector< unsigned char >& indexData, MHWRender::MGeometry::DataType indexType)
+	{
+		if (indexData.empty())
+			return 0.0;
+		if (indexType == MHWRender::MGeometry::kUnsignedInt32)
+			return cacheMissRatio((const unsigned int*)&indexData[0], indexData.size() / 4);
+		return cacheMissRatio((const unsigned short*)&indexData[0], indexData.size() / 2);
+	}
+
+	// The build of a mesh and layout by the original plug-in code
+	struct BaselineResult
+	{
+		BaselineResult() : valid(false), time(0.0), peakMemory(0), outputHash(0) {}
+
+		bool valid;
+		double time;
+		size_t peakMemory;
+		unsigned long long outputHash;
+	};
+
+	BaselineResult runBaseline(const SyntheticMesh& mesh, const Layout& layout, unsigned int repeat)
+	{
+		BaselineResult result;
+		unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition);
+		size_t indexCount = (size_t)mesh.triangleCount() * triSize;
+
+		resetPeakMemory();
+		for (unsigned int run = 0; run < repeat; ++run)
+		{
+			std::vector< unsigned int > indexData(indexCount);
+
+			MTimer timer;
+			timer.beginTimer();
+			BaselineCrackFreePrimitiveGenerator::mutateIndexBuffer(mesh.indices, &mesh.positions[0], &mesh.uvs[0],
+				layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition,
+				(indexCount > 0 ? &indexData[0] : NULL));
+			timer.endTimer();
+
+			if (run == 0 || timer.elapsedTime() < result.time)
+				result.time = timer.elapsedTime();
+			if (run == 0)
+				result.outputHash = hashBytes((indexCount > 0 ? &indexData[0] : NULL), indexCount * sizeof(unsigned int));
+		}
+		result.peakMemory = peakMemory();
+		result.valid = true;
+		return result;
+	}
+
+	void runCase(const SyntheticMesh& mesh, const Layout& layout, MHWRender::MGeometry::DataType indexType,
+				 unsigned int threadCount, unsigned int repeat, bool reorder, const BaselineResult& baseline, bool& firstResult)
+	{
+		CrackFreePrimitiveGenerator::setThreadCount(threadCount);
+
+		unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition);
+		size_t indexSize = (indexType == MHWRender::MGeometry::kUnsignedInt32 ? 4 : 2);
+		size_t dataSize = (size_t)mesh.triangleCount() * triSize * indexSize;
+
+		bool peakIsPerCase = resetPeakMemory();
+
+		CrackFreePrimitiveGenerator::BuildStats bestStats = CrackFreePrimitiveGenerator::BuildStats();
+		double bestTime = 0.0;
+		unsigned long long outputHash = 0;
+		double missRatio = 0.0;
+		for (unsigned int run = 0; run < repeat; ++run)
+		{
+			std::vector< unsigned char > indexData(dataSize);
+
+			CrackFreePrimitiveGenerator::BuildStats stats;
+			MTimer timer;
+			timer.beginTimer();
+			CrackFreePrimitiveGenerator::mutateIndexBuffer(mesh.indices, &mesh.positions[0], &mesh.uvs[0],
+				layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition,
+				indexType, (dataSize > 0 ? &indexData[0] : NULL), &stats);
+			timer.endTimer();
+
+			if (run == 0 || timer.elapsedTime() < bestTime)
+			{
+				bestTime = timer.elapsedTime();
+				bestStats = stats;
+			}
+			if (run == 0)
+			{
+				outputHash = hashBytes((dataSize > 0 ? &indexData[0] : NULL), dataSize);
+				if (reorder)
+					missRatio = cacheMissRatio(indexData, indexType);
+			}
+		}
+
+		size_t peak = peakMemory();
+
+		// One more build with the reordering, for its time and the miss ratio it reaches
+		double reorderTime = 0.0;
+		double reorderedMissRatio = 0.0;
+		if (reorder)
+		{
+			std::vector< unsigned char > indexData(dataSize);
+			CrackFreePrimitiveGenerator::BuildStats stats;
+			CrackFreePrimitiveGenerator::setReorderPatches(true);
+			CrackFreePrimitiveGenerator::mutateIndexBuffer(mesh.indices, &mesh.positions[0], &mesh.uvs[0],
+				layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition,
+				indexType, (dataSize > 0 ? &indexData[0] : NULL), &stats);
+			CrackFreePrimitiveGenerator::setReorderPatches(false);
+
+			reorderTime = stats.reorderTime;
+			reorderedMissRatio = cacheMissRatio(indexData, indexType);
+		}
+
+		printf("%s\n    {\"mesh\": \"%s\", \"triangles\": %u, \"faceVertices\": %u, \"layout\": \"%s\", \"indexType\": \"%s\", "
+			"\"threads\": %u, \"tasks\": %u, \"weldedVertices\": %u, "
+			"\"weldMs\": %.3f, \"edgeMs\": %.3f, \"emitMs\": %.3f, \"totalMs\": %.3f, \"trianglesPerSec\": %.0f, "
+			"\"tableBytes\": %llu, \"peakMemoryBytes\": %llu, \"peakMemoryScope\": \"%s\", \"outputHash\": \"%016llx\"",
+			(firstResult ? "" : ","),
+			mesh.name, mesh.triangleCount(), mesh.faceVertexCount(), layout.name, (indexSize == 4 ? "uint32" : "uint16"),
+			threadCount, bestStats.taskCount, bestStats.numPolyVertices,
+			bestStats.weldTime * 1000.0, bestStats.edgeTime * 1000.0, bestStats.emitTime * 1000.0, bestTime * 1000.0,
+			(bestTime > 0.0 ? mesh.triangleCount() / bestTime : 0.0),
+			(unsigned long long)bestStats.tableSize, (unsigned long long)peak, (peakIsPerCase ? "case" : "process"),
+			outputHash);
+		if (reorder)
+		{
+			printf(", \"reorderMs\": %.3f, \"cacheSize\": %u, \"missRatio\": %.4f, \"reorderedMissRatio\": %.4f",
+				reorderTime * 1000.0, kSimulatedCacheSize, missRatio, reorderedMissRatio);
+		}
+		// The original code only built 32-bit indices correctly
+		if (baseline.valid && indexSize == 4)
+		{
+			printf(", \"baselineMs\": %.3f, \"speedup\": %.2f, \"baselinePeakMemoryBytes\": %llu, \"matchesBaseline\": %s",
+				baseline.time * 1000.0, (bestTime > 0.0 ? baseline.time / bestTime : 0.0),
+				(unsigned long long)baseline.peakMemory, (outputHash == baseline.outputHash ? "true" : "false"));
+		}
+		printf("}");
+		fflush(stdout);
+		firstResult = false;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		fprintf(stderr, "Usage: %s [--quick] [--no-stress] [--no-reorder] [--baseline] [--threads 1,2,4] [--repeat N]\n", argv[0]);
+		return 1;
+	}
+
+	// Time the generation alone, the reordering is timed separately.
+	// mutateIndexBuffer does not go through the patch caches.
+	CrackFreePrimitiveGenerator::setReorderPatches(false);
+
+	printf("{\"benchmark\": \"crackFreePrimitiveGenerator\", \"hardwareThreads\": %d, \"repeat\": %u, \"results\": [",
+		MThreadUtils::getNumThreads(), options.repeat);
+
+	bool firstResult = true;
+	for (unsigned int meshIndex = 0; meshIndex < 4; ++meshIndex)
+	{
+		// Built one at a time to keep the peak memory of each case meaningful
+		SyntheticMesh mesh;
+		switch (meshIndex)
+		{
+			case 0: mesh = (options.quick ? makeGrid(64) : makeGrid(700)); break;
+			case 1: mesh = (options.quick ? makeUVSphere(64, 32) : makeUVSphere(1024, 512)); break;
+			case 2: mesh = (options.quick ? makeHardSurface(16) : makeHardSurface(290)); break;
+			case 3:
+				if (options.quick || !options.stress)
+					continue;
+				mesh = makeGrid(2237, "stress10M");
+				break;
+		}
+
+		// 16-bit indices only when the face vertex ids fit
+		bool fits16Bit = (mesh.faceVertexCount() <= 0x10000);
+		for (size_t layoutIndex = 0; layoutIndex < sizeof(kLayouts) / sizeof(kLayouts[0]); ++layoutIndex)
+		{
+			// The stress case only runs the largest layout
+			if (meshIndex == 3 && !kLayouts[layoutIndex].addDominantEdges)
+				continue;
+
+			// The std::map tables of the original code do not scale to the stress case
+			BaselineResult baseline;
+			if (options.baseline && meshIndex != 3)
+				baseline = runBaseline(mesh, kLayouts[layoutIndex], options.repeat);
+
+			for (size_t threadIndex = 0; threadIndex < options.threadCounts.size(); ++threadIndex)
+			{
+				runCase(mesh, kLayouts[layoutIndex], MHWRender::MGeometry::kUnsignedInt32, options.threadCounts[threadIndex], options.repeat, options.reorder, baseline, firstResult);
+				if (fits16Bit)
+					runCase(mesh, kLayouts[layoutIndex], MHWRender::MGeometry::kUnsignedInt16, options.threadCounts[threadIndex], options.repeat, options.reorder, baseline, firstResult);
+			}
+		}
+	}
+
+	printf("\n]}\n");
+	return 0;
+}
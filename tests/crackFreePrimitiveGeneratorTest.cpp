@@ -0,0 +1,256 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Stand-alone test of the patch indices of CrackFreePrimitiveGenerator.
+//
+// The 32-bit patches are the reference: the 16-bit patches, used by the swatch and by the
+// index buffers Maya asks in 16-bit, must hold the same vertex ids, whatever the thread
+// count, the patch reordering and whether mutateIndexing found the patches in its cache.
+// The reference itself must hash to the patches of the original plug-in, built with the
+// std::map edge tables of baselineCrackFreePrimitiveGenerator.cpp.
+
+#include "crackFreePrimitiveGenerator.h"
+#include "syntheticMeshes.h"
+
+#include <maya/MComponentDataIndexing.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+	unsigned int sFailureCount = 0;
+
+	void check(bool condition, const char* mesh, const char* what)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "FAILED: %s: %s\n", mesh, what);
+			++sFailureCount;
+		}
+	}
+
+	struct Layout
+	{
+		bool addAdjacentEdges;
+		bool addDominantEdges;
+		bool addDominantPosition;
+	};
+
+	const Layout kLayouts[] =
+	{
+		{ true, false, false },
+		{ true, true, true },
+	};
+
+	// FNV-1a hash of the patches of the original plug-in, for each layout of kLayouts
+	struct GoldenHashes
+	{
+		unsigned long long layouts[2];
+	};
+
+	const GoldenHashes kGridHashes = { { 0x9f5bb3cbbc100531ULL, 0x9a2590f1f2543d75ULL } };
+	const GoldenHashes kUVSphereHashes = { { 0x50aba33dde0edfc9ULL, 0x7e6ede203f79df29ULL } };
+	const GoldenHashes kHardSurfaceHashes = { { 0xe2be03b56cb69045ULL, 0x92933fb868148011ULL } };
+	const GoldenHashes kGrid16BitLimitHashes = { { 0xb9c138e65982a97fULL, 0xcbacd890be08c58dULL } };
+
+	unsigned long long hashIndices(const std::vector< unsigned int >& indices)
+	{
+		const unsigned char* bytes = (const unsigned char*)(indices.empty() ? NULL : &indices[0]);
+		unsigned long long hash = 0xCBF29CE484222325ULL;
+		for (size_t i = 0; i < indices.size() * sizeof(unsigned int); ++i)
+			hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+		return hash;
+	}
+
+	std::vector< unsigned int > mutate32(const SyntheticMesh& mesh, const Layout& layout)
+	{
+		unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition);
+		std::vector< unsigned int > patches(mesh.triangleCount() * triSize);
+		CrackFreePrimitiveGenerator::mutateIndexBuffer(mesh.indices, &mesh.positions[0], &mesh.uvs[0],
+			layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition,
+			MHWRender::MGeometry::kUnsignedInt32, &patches[0]);
+		return patches;
+	}
+
+	std::vector< unsigned int > mutate16(const SyntheticMesh& mesh, const Layout& layout)
+	{
+		unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition);
+		std::vector< unsigned short > patches(mesh.triangleCount() * triSize);
+		CrackFreePrimitiveGenerator::mutateIndexBuffer(mesh.indices, &mesh.positions[0], &mesh.uvs[0],
+			layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition,
+			MHWRender::MGeometry::kUnsignedInt16, &patches[0]);
+		return std::vector< unsigned int >(patches.begin(), patches.end());
+	}
+
+	// Go through the index buffer mutator, the way Maya calls it
+	std::vector< unsigned int > mutateIndexing(const SyntheticMesh& mesh, const Layout& layout, MHWRender::MGeometry::DataType indexType)
+	{
+		MHWRender::MVertexBuffer positionBuffer(MHWRender::MVertexBufferDescriptor(MHWRender::MGeometry::kPosition),
+			const_cast< float* >(&mesh.positions[0]), mesh.faceVertexCount());
+		MHWRender::MVertexBuffer uvBuffer(MHWRender::MVertexBufferDescriptor(MHWRender::MGeometry::kTexture),
+			const_cast< float* >(&mesh.uvs[0]), mesh.faceVertexCount());
+		MHWRender::MVertexBufferArray vertexBuffers;
+		vertexBuffers.addBuffer("position", &positionBuffer);
+		vertexBuffers.addBuffer("uv", &uvBuffer);
+
+		MHWRender::MComponentDataIndexing indexing;
+		indexing.indices() = mesh.indices;
+		MHWRender::MComponentDataIndexingList indexingList;
+		indexingList.append(indexing);
+
+		CrackFreePrimitiveGenerator generator(layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition);
+		MHWRender::MIndexBuffer indexBuffer(indexType);
+		int primitiveStride = 0;
+		MHWRender::MGeometry::Primitive primitive = generator.mutateIndexing(indexingList, vertexBuffers, indexBuffer, primitiveStride);
+
+		unsigned int triSize = CrackFreePrimitiveGenerator::computeTriangleSize(layout.addAdjacentEdges, layout.addDominantEdges, layout.addDominantPosition);
+		check(primitive == MHWRender::MGeometry::kPatch && primitiveStride == (int)triSize, mesh.name, "mutateIndexing primitive");
+		check(indexBuffer.size() == mesh.triangleCount() * triSize, mesh.name, "mutateIndexing index count");
+
+		std::vector< unsigned int > patches(indexBuffer.size());
+		for (unsigned int i = 0; i < indexBuffer.size(); ++i)
+		{
+			if (indexType == MHWRender::MGeometry::kUnsignedInt32)
+				patches[i] = ((const unsigned int*)indexBuffer.data())[i];
+			else
+				patches[i] = ((const unsigned short*)indexBuffer.data())[i];
+		}
+		return patches;
+	}
+
+	unsigned int countCacheFiles(const char* directory)
+	{
+		unsigned int count = 0;
+		DIR* dir = opendir(directory);
+		if (dir)
+		{
+			while (dirent* entry = readdir(dir))
+			{
+				size_t length = strlen(entry->d_name);
+				if (length > 6 && strcmp(entry->d_name + length - 6, ".pnaen") == 0)
+					++count;
+			}
+			closedir(dir);
+		}
+		return count;
+	}
+
+	// Patches read from the disk cache must be kept in memory, so the next frames of a
+	// deforming mesh are found there instead of being built and written to disk again.
+	// ctest sets DX11SHADER_PNAEN_CACHE_DIR for this test.
+	void testDiskCache()
+	{
+		const char* test = "disk cache";
+		const char* cacheDir = getenv("DX11SHADER_PNAEN_CACHE_DIR");
+		if (cacheDir == NULL || cacheDir[0] == 0)
+		{
+			printf("DX11SHADER_PNAEN_CACHE_DIR is not set, the disk cache is not tested\n");
+			return;
+		}
+
+		CrackFreePrimitiveGenerator::setReorderPatches(false);
+		CrackFreePrimitiveGenerator::purgeDiskCache();
+		CrackFreePrimitiveGenerator::clearCache();
+
+		const Layout& layout = kLayouts[1];
+		SyntheticMesh mesh = makeGrid(16, "diskCacheGrid");
+		std::vector< unsigned int > reference = mutate32(mesh, layout);
+
+		check(mutateIndexing(mesh, layout, MHWRender::MGeometry::kUnsignedInt32) == reference, test, "built patches");
+		check(countCacheFiles(cacheDir) == 1, test, "built patches are written to disk");
+
+		// A new session only has the file
+		CrackFreePrimitiveGenerator::clearCache();
+		CrackFreePrimitiveGenerator::CacheStats before = CrackFreePrimitiveGenerator::cacheStats();
+		check(mutateIndexing(mesh, layout, MHWRender::MGeometry::kUnsignedInt32) == reference, test, "patches read from disk");
+		CrackFreePrimitiveGenerator::CacheStats after = CrackFreePrimitiveGenerator::cacheStats();
+		check(after.diskHitCount == before.diskHitCount + 1, test, "the file is found");
+		check(after.entryCount == 1, test, "patches read from disk are kept in memory");
+
+		// The next frame moves the mesh without changing its welding
+		SyntheticMesh deformed = mesh;
+		for (size_t i = 1; i < deformed.positions.size(); i += 3)
+			deformed.positions[i] += 0.5f;
+		before = after;
+		check(mutateIndexing(deformed, layout, MHWRender::MGeometry::kUnsignedInt32) == reference, test, "deformed frame");
+		after = CrackFreePrimitiveGenerator::cacheStats();
+		check(after.hitCount == before.hitCount + 1, test, "deformed frame is found in memory");
+		check(countCacheFiles(cacheDir) == 1, test, "deformed frame is not written to disk");
+
+		// A frame whose welding changed is built again, still without a file
+		for (size_t i = 0; i < 3; ++i)
+			deformed.positions[3 + i] = deformed.positions[i];
+		mutateIndexing(deformed, layout, MHWRender::MGeometry::kUnsignedInt32);
+		check(countCacheFiles(cacheDir) == 1, test, "rebuilt frame of a known topology is not written to disk");
+
+		CrackFreePrimitiveGenerator::purgeDiskCache();
+		CrackFreePrimitiveGenerator::clearCache();
+	}
+
+	void testMesh(const SyntheticMesh& mesh, const GoldenHashes& goldenHashes)
+	{
+		for (size_t layoutIndex = 0; layoutIndex < sizeof(kLayouts) / sizeof(kLayouts[0]); ++layoutIndex)
+		{
+			const Layout& layout = kLayouts[layoutIndex];
+
+			CrackFreePrimitiveGenerator::setReorderPatches(false);
+			CrackFreePrimitiveGenerator::setThreadCount(1);
+			std::vector< unsigned int > reference = mutate32(mesh, layout);
+
+			bool inRange = true;
+			for (size_t i = 0; i < reference.size(); ++i)
+				inRange = inRange && (reference[i] < mesh.faceVertexCount());
+			check(inRange, mesh.name, "32-bit patch indices are face vertex ids");
+			check(hashIndices(reference) == goldenHashes.layouts[layoutIndex], mesh.name, "32-bit patches match the original plug-in");
+
+			CrackFreePrimitiveGenerator::setThreadCount(4);
+			check(mutate32(mesh, layout) == reference, mesh.name, "32-bit patches do not depend on the thread count");
+			check(mutate16(mesh, layout) == reference, mesh.name, "16-bit patches match the 32-bit patches");
+
+			CrackFreePrimitiveGenerator::clearCache();
+			check(mutateIndexing(mesh, layout, MHWRender::MGeometry::kUnsignedInt32) == reference, mesh.name, "32-bit mutateIndexing");
+			check(mutateIndexing(mesh, layout, MHWRender::MGeometry::kUnsignedInt16) == reference, mesh.name, "16-bit mutateIndexing");
+			check(mutateIndexing(mesh, layout, MHWRender::MGeometry::kUnsignedInt16) == reference, mesh.name, "16-bit mutateIndexing from the cache");
+
+			// The reordered patches are a permutation, the 16-bit ones must follow the same order
+			CrackFreePrimitiveGenerator::setReorderPatches(true);
+			check(mutate16(mesh, layout) == mutate32(mesh, layout), mesh.name, "16-bit reordered patches match the 32-bit ones");
+		}
+	}
+}
+
+int main()
+{
+	testMesh(makeGrid(32), kGridHashes);
+	testMesh(makeUVSphere(48, 24), kUVSphereHashes);
+	testMesh(makeHardSurface(12), kHardSurfaceHashes);
+
+	// 256 x 256 face vertices: the largest id is exactly the last 16-bit value
+	SyntheticMesh boundary = makeGrid(255, "grid16BitLimit");
+	check(boundary.faceVertexCount() == 0x10000, boundary.name, "mesh size");
+	testMesh(boundary, kGrid16BitLimitHashes);
+
+	CrackFreePrimitiveGenerator::CacheStats stats = CrackFreePrimitiveGenerator::cacheStats();
+	check(stats.hitCount > 0, "cache", "mutateIndexing reused cached patches");
+
+	testDiskCache();
+
+	if (sFailureCount > 0)
+	{
+		fprintf(stderr, "%u check(s) failed\n", sFailureCount);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
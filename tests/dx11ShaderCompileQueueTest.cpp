@@ -0,0 +1,300 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Stand-alone test of CEffectCompileQueue, with fake compile jobs and schedulers.
+//
+// The manual scheduler keeps the tasks until the test runs them, so coalescing and
+// cancelling are checked while the job is known to be queued or running. The threaded
+// scheduler runs each task on its own thread, for flush().
+
+#include "dx11ShaderCompileQueue.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	unsigned int sFailureCount = 0;
+
+	void check(bool condition, const char* test, const char* what)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "FAILED: %s: %s\n", test, what);
+			++sFailureCount;
+		}
+	}
+
+	// What the fake compiler did, shared by the jobs of a test
+	struct CompileLog
+	{
+		CompileLog() : runCount(0), completeCount(0), deleteCount(0) {}
+
+		std::atomic< unsigned int > runCount;
+		unsigned int completeCount;
+		std::atomic< unsigned int > deleteCount;
+		std::vector< MString > completedKeys;
+		std::vector< CEffectCompileQueue::ClientList > completedClients;
+	};
+
+	class FakeCompileJob : public CEffectCompileQueue::Job
+	{
+	public:
+		FakeCompileJob(CompileLog& log, const MString& key, unsigned int compileMs = 0)
+		: mLog(log), mKey(key), mCompileMs(compileMs) {}
+
+		virtual ~FakeCompileJob() { ++mLog.deleteCount; }
+
+		virtual void run()
+		{
+			if (mCompileMs > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(mCompileMs));
+			++mLog.runCount;
+		}
+
+		virtual void complete(const CEffectCompileQueue::ClientList& clients)
+		{
+			++mLog.completeCount;
+			mLog.completedKeys.push_back(mKey);
+			mLog.completedClients.push_back(clients);
+		}
+
+	private:
+		CompileLog& mLog;
+		MString mKey;
+		unsigned int mCompileMs;
+	};
+
+	// Keeps the tasks until runAll(), or refuses them like a thread pool that failed to start
+	class ManualScheduler : public CEffectCompileQueue::Scheduler
+	{
+	public:
+		ManualScheduler() : mRefuse(false) {}
+
+		virtual bool start(Function run, Function done, void* data)
+		{
+			if (mRefuse)
+				return false;
+			Task task = { run, done, data };
+			mTasks.push_back(task);
+			return true;
+		}
+
+		unsigned int taskCount() const { return (unsigned int)mTasks.size(); }
+
+		void runAll()
+		{
+			std::vector< Task > tasks;
+			tasks.swap(mTasks);
+			for (size_t i = 0; i < tasks.size(); ++i)
+			{
+				tasks[i].run(tasks[i].data);
+				tasks[i].done(tasks[i].data);
+			}
+		}
+
+		bool mRefuse;
+
+	private:
+		struct Task
+		{
+			Function run;
+			Function done;
+			void* data;
+		};
+		std::vector< Task > mTasks;
+	};
+
+	class ThreadedScheduler : public CEffectCompileQueue::Scheduler
+	{
+	public:
+		virtual bool start(Function run, Function done, void* data)
+		{
+			std::thread([=]() { run(data); done(data); }).detach();
+			return true;
+		}
+	};
+
+	bool hasClients(const CEffectCompileQueue::ClientList& clients, void* client0, void* client1 = NULL)
+	{
+		if (clients.size() != (client1 ? 2u : 1u))
+			return false;
+		return std::find(clients.begin(), clients.end(), client0) != clients.end()
+			&& (client1 == NULL || std::find(clients.begin(), clients.end(), client1) != clients.end());
+	}
+
+	int sClient0, sClient1, sClient2;
+	void* const kClient0 = &sClient0;
+	void* const kClient1 = &sClient1;
+	void* const kClient2 = &sClient2;
+
+	void testCoalescing()
+	{
+		const char* test = "coalescing";
+		CompileLog log;
+		ManualScheduler scheduler;
+		CEffectCompileQueue queue(&scheduler);
+
+		check(queue.submit("a.fx", new FakeCompileJob(log, "a.fx"), kClient0), test, "first submit starts a job");
+		check(!queue.submit("a.fx", new FakeCompileJob(log, "a.fx"), kClient1), test, "same key joins the pending job");
+		check(!queue.submit("a.fx", new FakeCompileJob(log, "a.fx"), kClient0), test, "same client is not added twice");
+		check(queue.submit("b.fx", new FakeCompileJob(log, "b.fx"), kClient2), test, "other key starts a job");
+		check(log.deleteCount == 2, test, "coalesced jobs are deleted at once");
+		check(scheduler.taskCount() == 2 && queue.pendingCount() == 2, test, "one task per key");
+		check(queue.isPending(kClient0) && queue.isPending(kClient1) && queue.isPending(kClient2), test, "clients are pending");
+
+		// Nothing completes before the jobs ran
+		check(queue.processCompleted() == 0 && log.completeCount == 0, test, "no completion while running");
+
+		scheduler.runAll();
+		check(queue.processCompleted() == 2, test, "both jobs complete");
+		check(log.runCount == 2 && log.completeCount == 2 && log.deleteCount == 4, test, "each job ran, completed and was deleted once");
+		check(log.completedKeys[0] == "a.fx" && hasClients(log.completedClients[0], kClient0, kClient1), test, "a.fx completes for its two clients");
+		check(log.completedKeys[1] == "b.fx" && hasClients(log.completedClients[1], kClient2), test, "b.fx completes for its client");
+		check(queue.pendingCount() == 0 && !queue.isPending(kClient0), test, "nothing pending");
+
+		// The key can be compiled again once completed
+		check(queue.submit("a.fx", new FakeCompileJob(log, "a.fx"), kClient0), test, "completed key starts a new job");
+		scheduler.runAll();
+		queue.flush();
+		check(log.runCount == 3, test, "resubmitted job ran");
+	}
+
+	void testCancel()
+	{
+		const char* test = "cancel";
+		CompileLog log;
+		ManualScheduler scheduler;
+		CEffectCompileQueue queue(&scheduler);
+
+		queue.submit("a.fx", new FakeCompileJob(log, "a.fx"), kClient0);
+		queue.submit("a.fx", new FakeCompileJob(log, "a.fx"), kClient1);
+		queue.submit("b.fx", new FakeCompileJob(log, "b.fx"), kClient0);
+
+		queue.cancel(kClient0);
+		check(!queue.isPending(kClient0) && queue.isPending(kClient1), test, "only the cancelled client stops waiting");
+		check(queue.pendingCount() == 2, test, "cancelled jobs still run");
+
+		scheduler.runAll();
+		check(queue.processCompleted() == 2, test, "cancelled jobs complete");
+		check(log.runCount == 2 && log.deleteCount == 3, test, "jobs ran and were deleted");
+		check(hasClients(log.completedClients[0], kClient1), test, "a.fx completes for the remaining client");
+		check(log.completedClients[1].empty(), test, "b.fx completes without clients");
+	}
+
+	// A job completing for its clients may submit new jobs, like a reload does
+	class ResubmittingJob : public FakeCompileJob
+	{
+	public:
+		ResubmittingJob(CompileLog& log, CompileLog& secondLog, CEffectCompileQueue& queue)
+		: FakeCompileJob(log, "first.fx"), mSecondLog(secondLog), mQueue(queue) {}
+
+		virtual void complete(const CEffectCompileQueue::ClientList& clients)
+		{
+			FakeCompileJob::complete(clients);
+			mQueue.submit("second.fx", new FakeCompileJob(mSecondLog, "second.fx"), clients[0]);
+		}
+
+	private:
+		CompileLog& mSecondLog;
+		CEffectCompileQueue& mQueue;
+	};
+
+	void testSubmitFromCompletion()
+	{
+		const char* test = "submit from completion";
+		CompileLog log, secondLog;
+		ManualScheduler scheduler;
+		CEffectCompileQueue queue(&scheduler);
+
+		queue.submit("first.fx", new ResubmittingJob(log, secondLog, queue), kClient0);
+		scheduler.runAll();
+		check(queue.processCompleted() == 1, test, "first job completes");
+		check(queue.pendingCount() == 1 && queue.isPending(kClient0), test, "second job is pending");
+
+		scheduler.runAll();
+		check(queue.processCompleted() == 1 && secondLog.completeCount == 1, test, "second job completes");
+	}
+
+	void testNoWorkerThread()
+	{
+		const char* test = "no worker thread";
+		CompileLog log;
+		ManualScheduler scheduler;
+		scheduler.mRefuse = true;
+		CEffectCompileQueue queue(&scheduler);
+
+		check(queue.submit("a.fx", new FakeCompileJob(log, "a.fx"), kClient0), test, "submit succeeds");
+		check(log.runCount == 1 && log.completeCount == 0, test, "job ran in submit");
+		check(queue.isPending(kClient0), test, "job completes on the main thread only");
+		check(queue.processCompleted() == 1 && log.completeCount == 1, test, "job completes");
+	}
+
+	void testFlush()
+	{
+		const char* test = "flush";
+		CompileLog log;
+		ThreadedScheduler scheduler;
+		CEffectCompileQueue queue(&scheduler);
+
+		const char* keys[] = { "a.fx", "b.fx", "c.fx", "d.fx", "e.fx", "f.fx", "g.fx", "h.fx" };
+		const unsigned int keyCount = sizeof(keys) / sizeof(keys[0]);
+		for (unsigned int i = 0; i < keyCount; ++i)
+		{
+			queue.submit(keys[i], new FakeCompileJob(log, keys[i], 5 + i * 3), kClient0);
+			queue.submit(keys[i], new FakeCompileJob(log, keys[i]), kClient1);
+		}
+
+		queue.flush();
+		check(queue.pendingCount() == 0 && !queue.isPending(kClient0) && !queue.isPending(kClient1), test, "nothing pending after flush");
+		check(log.runCount == keyCount && log.completeCount == keyCount, test, "each key compiled and completed once");
+		check(log.deleteCount == 2 * keyCount, test, "all jobs deleted");
+
+		bool allClients = true;
+		for (unsigned int i = 0; i < log.completedClients.size(); ++i)
+			allClients = allClients && hasClients(log.completedClients[i], kClient0, kClient1);
+		check(allClients, test, "each job completes for both clients");
+	}
+
+	void testFlushOnDestruction()
+	{
+		const char* test = "flush on destruction";
+		CompileLog log;
+		ThreadedScheduler scheduler;
+		{
+			CEffectCompileQueue queue(&scheduler);
+			queue.submit("a.fx", new FakeCompileJob(log, "a.fx", 20), kClient0);
+		}
+		check(log.completeCount == 1 && log.deleteCount == 1, test, "pending job completed by the destructor");
+	}
+}
+
+int main()
+{
+	testCoalescing();
+	testCancel();
+	testSubmitFromCompletion();
+	testNoWorkerThread();
+	testFlush();
+	testFlushOnDestruction();
+
+	if (sFailureCount > 0)
+	{
+		fprintf(stderr, "%u check(s) failed\n", sFailureCount);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,512 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Stand-alone test of the hashing, of the on-disk bytecode cache and of the include file cache
+// of dx11ShaderEffectCache.
+//
+// The compiler is not involved: the bytecode stored in the cache is an arbitrary buffer.
+// The cache files and the include files are written to a temporary directory, corrupted,
+// rewritten and aged by the test.
+
+#include "dx11ShaderEffectCache.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	unsigned int sFailureCount = 0;
+
+	void check(bool condition, const char* test, const char* what)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "FAILED: %s: %s\n", test, what);
+			++sFailureCount;
+		}
+	}
+
+	// Temporary directory, deleted with its files
+	class TestDirectory
+	{
+	public:
+		TestDirectory(const char* name)
+		{
+			char path[] = "/tmp/dx11ShaderEffectCacheTest.XXXXXX";
+			if (mkdtemp(path))
+				mPath = path;
+			mPath += "/";
+			mPath += name;
+			mkdir(mPath.c_str(), 0777);
+		}
+
+		~TestDirectory()
+		{
+			clear();
+			rmdir(mPath.c_str());
+			rmdir(mPath.substr(0, mPath.rfind('/')).c_str());
+		}
+
+		const char* path() const { return mPath.c_str(); }
+
+		std::string filePath(const char* fileName) const { return mPath + "/" + fileName; }
+
+		// Names of the files of the directory ending with the extension
+		std::vector< std::string > files(const char* extension) const
+		{
+			std::vector< std::string > names;
+			DIR* dir = opendir(mPath.c_str());
+			if (dir)
+			{
+				while (dirent* entry = readdir(dir))
+				{
+					size_t length = strlen(entry->d_name);
+					size_t extensionLength = strlen(extension);
+					if (length > extensionLength && strcmp(entry->d_name + length - extensionLength, extension) == 0)
+						names.push_back(entry->d_name);
+				}
+				closedir(dir);
+			}
+			return names;
+		}
+
+		void clear() const
+		{
+			std::vector< std::string > names = files("");
+			for (size_t i = 0; i < names.size(); ++i)
+				remove(filePath(names[i].c_str()).c_str());
+		}
+
+	private:
+		std::string mPath;
+	};
+
+	std::string cacheFileName(MUint64 key)
+	{
+		char fileName[32];
+		sprintf(fileName, "%016llx.fxcache", (unsigned long long)key);
+		return fileName;
+	}
+
+	bool fileExists(const std::string& path)
+	{
+		struct stat statBuf;
+		return stat(path.c_str(), &statBuf) == 0;
+	}
+
+	MUint64 fileSize(const std::string& path)
+	{
+		struct stat statBuf;
+		return (stat(path.c_str(), &statBuf) == 0 ? (MUint64)statBuf.st_size : 0);
+	}
+
+	// Overwrite a byte of a file
+	void patchFile(const std::string& path, long offset, unsigned char value)
+	{
+		FILE* file = fopen(path.c_str(), "r+b");
+		if (file)
+		{
+			fseek(file, offset, SEEK_SET);
+			fputc(value, file);
+			fclose(file);
+		}
+	}
+
+	void setLastUse(const std::string& path, time_t time)
+	{
+		struct utimbuf times;
+		times.actime = time;
+		times.modtime = time;
+		utime(path.c_str(), &times);
+	}
+
+	// Replace the file at once, like an editor saving it, and give it a time stamp
+	void writeFile(const std::string& path, const std::string& content, time_t timeStamp)
+	{
+		std::string tmpPath = path + ".tmp";
+		FILE* file = fopen(tmpPath.c_str(), "wb");
+		if (file)
+		{
+			fwrite(content.data(), 1, content.size(), file);
+			fclose(file);
+		}
+		setLastUse(tmpPath, timeStamp);
+		rename(tmpPath.c_str(), path.c_str());
+	}
+
+	time_t timeStamp(const std::string& path)
+	{
+		struct stat statBuf;
+		return (stat(path.c_str(), &statBuf) == 0 ? statBuf.st_mtime : 0);
+	}
+
+	std::vector< char > makeBytecode(size_t size, char seed)
+	{
+		std::vector< char > bytecode(size);
+		for (size_t i = 0; i < size; ++i)
+			bytecode[i] = (char)(seed + i * 7);
+		return bytecode;
+	}
+
+	void testHash()
+	{
+		const char* test = "hash";
+
+		// The keys of the files written by previous sessions must not change
+		check(CEffectHash().value() == 0xCBF29CE484222325ULL, test, "empty hash");
+		check(CEffectHash().add("a", 1).value() == 0xAF63DC4C8601EC8CULL, test, "64-bit FNV-1a");
+
+		// Strings include their terminating zero, so "ab" + "c" differs from "a" + "bc"
+		check(CEffectHash().add("ab").value() == CEffectHash().add("ab", 3).value(), test, "string with its zero");
+		check(CEffectHash().add("ab").add("c").value() != CEffectHash().add("a").add("bc").value(), test, "strings do not run into each other");
+		check(CEffectHash().add((const char*)NULL).value() == CEffectHash().add("").value(), test, "null string");
+
+		unsigned int value = 0x01020304;
+		check(CEffectHash().add(value).value() == CEffectHash().add(&value, sizeof(value)).value(), test, "integer bytes");
+		check(CEffectHash().add(1u).add(2u).value() != CEffectHash().add(2u).add(1u).value(), test, "order matters");
+		check(CEffectHash().add("effect.fx").add(5u).value() == 0xDAD6D113F9878095ULL, test, "composite key");
+	}
+
+	void testRoundTrip()
+	{
+		const char* test = "round trip";
+		TestDirectory directory("cache");
+		CEffectDiskCache cache(directory.path(), 1 << 20);
+		check(cache.isEnabled(), test, "enabled");
+
+		CEffectDiskCache::DependencyList dependencies(2);
+		dependencies[0].name = "C:/shaders/common.fxh";
+		dependencies[0].contentHash = 0x1122334455667788ULL;
+		dependencies[1].name = "";
+		dependencies[1].contentHash = 42;
+		std::vector< char > bytecode = makeBytecode(1000, 3);
+
+		CEffectDiskCache::DependencyList foundDependencies;
+		std::vector< char > foundBytecode;
+		check(!cache.find(1, foundDependencies, foundBytecode), test, "miss before add");
+
+		cache.add(1, dependencies, &bytecode[0], (unsigned int)bytecode.size());
+		check(fileExists(directory.filePath(cacheFileName(1).c_str())), test, "file named after the key");
+		check(cache.find(1, foundDependencies, foundBytecode), test, "hit after add");
+		check(foundBytecode == bytecode, test, "bytecode");
+		check(foundDependencies.size() == 2
+			&& foundDependencies[0].name == dependencies[0].name && foundDependencies[0].contentHash == dependencies[0].contentHash
+			&& foundDependencies[1].name == dependencies[1].name && foundDependencies[1].contentHash == dependencies[1].contentHash,
+			test, "dependencies");
+		check(cache.hitCount() == 1 && cache.missCount() == 1, test, "hit and miss counts");
+
+		// Another session reads the same files; a new compilation replaces the entry
+		CEffectDiskCache otherSession(directory.path(), 1 << 20);
+		std::vector< char > newBytecode = makeBytecode(500, 9);
+		otherSession.add(1, CEffectDiskCache::DependencyList(), &newBytecode[0], (unsigned int)newBytecode.size());
+		check(cache.find(1, foundDependencies, foundBytecode) && foundBytecode == newBytecode && foundDependencies.empty(),
+			test, "entry replaced by another session");
+		check(directory.files(".tmp").empty(), test, "no temporary file left");
+
+		CEffectDiskCache disabled("", 1 << 20);
+		disabled.add(2, dependencies, &bytecode[0], (unsigned int)bytecode.size());
+		check(!disabled.isEnabled() && !disabled.find(2, foundDependencies, foundBytecode), test, "no directory disables the cache");
+	}
+
+	void testRejectedFiles()
+	{
+		const char* test = "rejected files";
+		TestDirectory directory("cache");
+		CEffectDiskCache cache(directory.path(), 1 << 20);
+
+		std::vector< char > bytecode = makeBytecode(256, 1);
+		CEffectDiskCache::DependencyList dependencies(1);
+		dependencies[0].name = "include.fxh";
+		dependencies[0].contentHash = 7;
+
+		CEffectDiskCache::DependencyList foundDependencies;
+		std::vector< char > foundBytecode;
+
+		// Bytecode byte changed: the checksum does not match
+		cache.add(1, dependencies, &bytecode[0], (unsigned int)bytecode.size());
+		std::string path = directory.filePath(cacheFileName(1).c_str());
+		MUint64 size = fileSize(path);
+		patchFile(path, (long)size - 10, 0xFF);
+		check(!cache.find(1, foundDependencies, foundBytecode), test, "corrupted content is rejected");
+		check(!fileExists(path), test, "corrupted file is deleted");
+
+		// Version field, after the magic
+		cache.add(2, dependencies, &bytecode[0], (unsigned int)bytecode.size());
+		path = directory.filePath(cacheFileName(2).c_str());
+		patchFile(path, 4, 0x7F);
+		check(!cache.find(2, foundDependencies, foundBytecode), test, "other version is rejected");
+		check(!fileExists(path), test, "other version is deleted");
+
+		// Truncated file
+		cache.add(3, dependencies, &bytecode[0], (unsigned int)bytecode.size());
+		path = directory.filePath(cacheFileName(3).c_str());
+		if (truncate(path.c_str(), (off_t)(fileSize(path) / 2)) != 0)
+			check(false, test, "truncate");
+		check(!cache.find(3, foundDependencies, foundBytecode), test, "truncated file is rejected");
+		check(!fileExists(path), test, "truncated file is deleted");
+
+		// Written for another key
+		cache.add(4, dependencies, &bytecode[0], (unsigned int)bytecode.size());
+		rename(directory.filePath(cacheFileName(4).c_str()).c_str(), directory.filePath(cacheFileName(5).c_str()).c_str());
+		check(!cache.find(5, foundDependencies, foundBytecode), test, "file of another key is rejected");
+
+		check(cache.hitCount() == 0 && cache.missCount() == 4, test, "all misses");
+	}
+
+	void testTrim()
+	{
+		const char* test = "trim";
+		TestDirectory directory("cache");
+
+		// Measure a file, all the entries have the same size
+		std::vector< char > bytecode = makeBytecode(4000, 5);
+		MUint64 entrySize = 0;
+		{
+			CEffectDiskCache cache(directory.path(), 1 << 20);
+			cache.add(100, CEffectDiskCache::DependencyList(), &bytecode[0], (unsigned int)bytecode.size());
+			entrySize = fileSize(directory.filePath(cacheFileName(100).c_str()));
+			cache.purge();
+		}
+		check(entrySize > bytecode.size(), test, "entry size");
+
+		// Room for four entries and a half, trimmed down to three entries
+		CEffectDiskCache cache(directory.path(), entrySize * 9 / 2);
+		time_t now = time(NULL);
+		for (MUint64 key = 1; key <= 4; ++key)
+		{
+			cache.add(key, CEffectDiskCache::DependencyList(), &bytecode[0], (unsigned int)bytecode.size());
+			setLastUse(directory.filePath(cacheFileName(key).c_str()), now - 1000 + (time_t)key * 100);
+		}
+		check(directory.files(".fxcache").size() == 4, test, "four entries fit");
+
+		// Using the oldest entry makes it the most recent one
+		CEffectDiskCache::DependencyList foundDependencies;
+		std::vector< char > foundBytecode;
+		check(cache.find(1, foundDependencies, foundBytecode), test, "oldest entry found");
+
+		cache.add(5, CEffectDiskCache::DependencyList(), &bytecode[0], (unsigned int)bytecode.size());
+		check(directory.files(".fxcache").size() == 3, test, "trimmed under 3/4 of the limit");
+		check(fileExists(directory.filePath(cacheFileName(1).c_str())), test, "used entry is kept");
+		check(!fileExists(directory.filePath(cacheFileName(2).c_str())) && !fileExists(directory.filePath(cacheFileName(3).c_str())),
+			test, "least recently used entries are deleted");
+		check(fileExists(directory.filePath(cacheFileName(4).c_str())) && fileExists(directory.filePath(cacheFileName(5).c_str())),
+			test, "recent entries are kept");
+
+		// An entry larger than the cache is not written
+		CEffectDiskCache smallCache(directory.path(), entrySize / 2);
+		smallCache.add(6, CEffectDiskCache::DependencyList(), &bytecode[0], (unsigned int)bytecode.size());
+		check(!fileExists(directory.filePath(cacheFileName(6).c_str())), test, "entry over the limit is not written");
+	}
+
+	void testPurge()
+	{
+		const char* test = "purge";
+		TestDirectory directory("cache");
+		CEffectDiskCache cache(directory.path(), 1 << 20);
+
+		std::vector< char > bytecode = makeBytecode(100, 2);
+		cache.add(1, CEffectDiskCache::DependencyList(), &bytecode[0], (unsigned int)bytecode.size());
+		cache.add(2, CEffectDiskCache::DependencyList(), &bytecode[0], (unsigned int)bytecode.size());
+
+		// Left behind by a session that crashed while writing, and a file that is not the cache's
+		std::string tmpPath = directory.filePath((cacheFileName(3) + ".1234.1.tmp").c_str());
+		fclose(fopen(tmpPath.c_str(), "wb"));
+		std::string otherPath = directory.filePath("notes.txt");
+		fclose(fopen(otherPath.c_str(), "wb"));
+
+		check(cache.purge() == 3, test, "cache and temporary files are deleted");
+		check(directory.files(".fxcache").empty() && directory.files(".tmp").empty(), test, "no cache file left");
+		check(fileExists(otherPath), test, "other files are kept");
+
+		CEffectDiskCache::DependencyList foundDependencies;
+		std::vector< char > foundBytecode;
+		check(!cache.find(1, foundDependencies, foundBytecode), test, "purged entry is not found");
+	}
+
+	void testIncludeFileChanged()
+	{
+		const char* test = "include file changed";
+		TestDirectory directory("include");
+		std::string path = directory.filePath("common.fxh");
+		MString fileName(path.c_str());
+		CIncludeFileCache cache(1 << 20);
+		time_t now = time(NULL);
+		size_t size = 0;
+		MUint64 contentHash = 0;
+
+		// Old enough that a later write changes the time stamp: found without reading it
+		writeFile(path, "float4 oldColor;", now - 60);
+		const char* oldData = cache.acquire(fileName, size, contentHash);
+		check(oldData && strcmp(oldData, "float4 oldColor;") == 0 && size == 16, test, "content with its terminating zero");
+		check(contentHash == CEffectHash().add(oldData, size).value(), test, "content hash");
+		cache.release(oldData);
+		const char* data = cache.acquire(fileName, size, contentHash);
+		check(data == oldData && cache.hitCount() == 1 && cache.missCount() == 1, test, "settled content is shared");
+
+		// The compilation still using the old content keeps it while the file is edited
+		writeFile(path, "float4 newColor;", now - 30);
+		const char* newData = cache.acquire(fileName, size, contentHash);
+		check(newData && newData != oldData && strcmp(newData, "float4 newColor;") == 0, test, "new content");
+		check(strcmp(oldData, "float4 oldColor;") == 0, test, "old content alive while acquired");
+		check(contentHash == CEffectHash().add(newData, size).value(), test, "new content hash");
+		cache.release(oldData);
+		cache.release(newData);
+		check(cache.acquire(fileName, size, contentHash) == newData, test, "new content is current");
+		cache.release(newData);
+		check(cache.missCount() == 2, test, "one read per change");
+
+		// Saved twice within the time stamp resolution, with the same time stamp and size
+		writeFile(path, "float4 aaaColor;", now);
+		const char* firstData = cache.acquire(fileName, size, contentHash);
+		cache.release(firstData);
+		writeFile(path, "float4 bbbColor;", timeStamp(path));
+		const char* secondData = cache.acquire(fileName, size, contentHash);
+		check(secondData && strcmp(secondData, "float4 bbbColor;") == 0, test, "write within the same second is read");
+		check(contentHash == CEffectHash().add("float4 bbbColor;", 16).value(), test, "hash of the write within the same second");
+		cache.release(secondData);
+
+		// Read again while recent, the unchanged content is kept
+		const char* sameData = cache.acquire(fileName, size, contentHash);
+		check(sameData == secondData, test, "recent unchanged content is kept");
+		cache.release(sameData);
+
+		MString missing = (directory.filePath("missing.fxh")).c_str();
+		check(cache.acquire(missing, size, contentHash) == NULL, test, "missing file");
+	}
+
+	void testIncludeSizeLimit()
+	{
+		const char* test = "include size limit";
+		TestDirectory directory("include");
+		time_t now = time(NULL);
+		std::string content(99, 'x');
+		MString fileNames[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			char fileName[32];
+			sprintf(fileName, "file%d.fxh", i);
+			writeFile(directory.filePath(fileName), content, now - 60);
+			fileNames[i] = directory.filePath(fileName).c_str();
+		}
+
+		// Room for two unused contents of 100 bytes with their zero
+		CIncludeFileCache cache(250);
+		size_t size = 0;
+		MUint64 contentHash = 0;
+		for (int i = 0; i < 3; ++i)
+			cache.release(cache.acquire(fileNames[i], size, contentHash));
+		check(cache.missCount() == 3, test, "three reads");
+		cache.release(cache.acquire(fileNames[2], size, contentHash));
+		cache.release(cache.acquire(fileNames[1], size, contentHash));
+		check(cache.hitCount() == 2, test, "recent contents are kept");
+		cache.release(cache.acquire(fileNames[0], size, contentHash));
+		check(cache.missCount() == 4, test, "least recently used content is deleted");
+
+		// The contents in use are kept over the limit
+		CIncludeFileCache smallCache(1);
+		const char* data0 = smallCache.acquire(fileNames[0], size, contentHash);
+		const char* data1 = smallCache.acquire(fileNames[1], size, contentHash);
+		check(data0 && data1 && std::string(data0) == content && std::string(data1) == content, test, "used contents are kept");
+		smallCache.release(data0);
+		smallCache.release(data1);
+		smallCache.release(smallCache.acquire(fileNames[0], size, contentHash));
+		check(smallCache.hitCount() == 0 && smallCache.missCount() == 3, test, "unused contents over the limit are deleted");
+	}
+
+	void testIncludeConcurrentAccess()
+	{
+		const char* test = "include concurrent access";
+		TestDirectory directory("include");
+		time_t now = time(NULL);
+		const int kNumFiles = 3;
+		const int kNumThreads = 4;
+		const int kNumIterations = 2000;
+
+		MString fileNames[kNumFiles];
+		for (int i = 0; i < kNumFiles; ++i)
+		{
+			char fileName[32];
+			sprintf(fileName, "file%d.fxh", i);
+			writeFile(directory.filePath(fileName), std::string(1000 + i, (char)('a' + i)), now - 60);
+			fileNames[i] = directory.filePath(fileName).c_str();
+		}
+
+		// Small enough for the contents to be deleted and read again while others use them
+		CIncludeFileCache cache(2000);
+		unsigned int errorCounts[kNumThreads] = { 0 };
+		std::vector< std::thread > threads;
+		for (int t = 0; t < kNumThreads; ++t)
+		{
+			threads.push_back(std::thread([&, t]() {
+				const char* held = NULL;
+				for (int i = 0; i < kNumIterations; ++i)
+				{
+					int fileIndex = (i * 7 + t) % kNumFiles;
+					size_t size = 0;
+					MUint64 contentHash = 0;
+					const char* data = cache.acquire(fileNames[fileIndex], size, contentHash);
+					if (!data || size != (size_t)(1000 + fileIndex) || data[0] != 'a' + fileIndex || data[size] != 0
+						|| contentHash != CEffectHash().add(data, size).value())
+						++errorCounts[t];
+
+					// Keep a content across the next acquisitions, like a nested include
+					if (held)
+						cache.release(held);
+					held = data;
+				}
+				if (held)
+					cache.release(held);
+			}));
+		}
+
+		// Meanwhile an editor rewrites the first file with the same content
+		for (int i = 0; i < 20; ++i)
+			writeFile(directory.filePath("file0.fxh"), std::string(1000, 'a'), now - 50 + i);
+
+		for (size_t t = 0; t < threads.size(); ++t)
+			threads[t].join();
+
+		unsigned int errorCount = 0;
+		for (int t = 0; t < kNumThreads; ++t)
+			errorCount += errorCounts[t];
+		check(errorCount == 0, test, "consistent contents");
+		check(cache.hitCount() + cache.missCount() == kNumThreads * kNumIterations, test, "all acquisitions counted");
+	}
+}
+
+int main()
+{
+	testHash();
+	testRoundTrip();
+	testRejectedFiles();
+	testTrim();
+	testPurge();
+	testIncludeFileChanged();
+	testIncludeSizeLimit();
+	testIncludeConcurrentAccess();
+
+	if (sFailureCount > 0)
+	{
+		fprintf(stderr, "%u check(s) failed\n", sFailureCount);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,341 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Stand-alone test of CEffectCollection, over mock effects and a fake file system.
+//
+// The mock effects count their references, so the test checks that the collection
+// releases each clone and each reference exactly once. The fake file system counts its
+// time stamp reads, so the test checks that the duplicates do not touch the files until the
+// time stamps are invalidated, while the lookups by file name see the edits.
+
+#include "dx11ShaderEffectCollection.h"
+
+#include <maya/MStringArray.h>
+#include <stdio.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+	unsigned int sFailureCount = 0;
+
+	void check(bool condition, const char* test, const char* what)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "FAILED: %s: %s\n", test, what);
+			++sFailureCount;
+		}
+	}
+
+	// Counts the live mock objects, to find leaks and double releases
+	int sLiveEffects = 0;
+	int sLiveSchemas = 0;
+	unsigned int sSchemasCreated = 0;
+
+	struct MockEffect
+	{
+		MockEffect(int compilation) : compilation(compilation), refCount(1) { ++sLiveEffects; }
+
+		int compilation;	// which compilation of the file it comes from, kept by its clones
+		int refCount;
+	};
+
+	struct MockSchema
+	{
+		MockSchema(MockEffect* effect) : effect(effect), refCount(1) { ++sLiveSchemas; ++sSchemasCreated; }
+
+		void addRef() { ++refCount; }
+		void release()
+		{
+			if (--refCount == 0)
+			{
+				--sLiveSchemas;
+				delete this;
+			}
+		}
+
+		MockEffect* effect;
+		int refCount;
+	};
+
+	struct MockDevice { int id; };
+	struct MockNode { int id; };
+
+	struct MockIncludedFile
+	{
+		MString fileName;
+		time_t timeStamp;
+	};
+	typedef std::vector< MockIncludedFile > MockIncludedFileList;
+
+	// Modification times of the fake files, 0 for a missing file
+	std::map< std::string, time_t > sFileTimes;
+	unsigned int sTimeStampReads = 0;
+
+	time_t fakeTimeStamp(const MString& fileName)
+	{
+		++sTimeStampReads;
+		std::map< std::string, time_t >::const_iterator it = sFileTimes.find(fileName.asChar());
+		return (it == sFileTimes.end() ? 0 : it->second);
+	}
+
+	struct MockTraits
+	{
+		typedef MockEffect Effect;
+		typedef MockDevice Device;
+		typedef MockNode Node;
+		typedef MockSchema Schema;
+		typedef MockIncludedFileList IncludedFileList;
+
+		static MockEffect* clone(MockEffect* source) { return new MockEffect(source->compilation); }
+
+		static void release(MockEffect* effect)
+		{
+			if (--effect->refCount == 0)
+			{
+				--sLiveEffects;
+				delete effect;
+			}
+		}
+
+		static MockSchema* createSchema(MockEffect* effect) { return new MockSchema(effect); }
+
+		static time_t fileTimeStamp(const MString& fileName) { return fakeTimeStamp(fileName); }
+
+		static bool includedFilesChanged(const MockIncludedFileList& includedFiles)
+		{
+			for (size_t i = 0; i < includedFiles.size(); ++i)
+			{
+				if (includedFiles[i].timeStamp != fakeTimeStamp(includedFiles[i].fileName))
+					return true;
+			}
+			return false;
+		}
+	};
+
+	typedef CEffectCollection< MockTraits > Collection;
+
+	MockDevice sDevice = { 0 };
+	MockDevice sOtherDevice = { 1 };
+	MockNode sNodes[4] = { { 0 }, { 1 }, { 2 }, { 3 } };
+
+	// What build() does after compiling: the new effect becomes the reference, the node gets a clone
+	MockEffect* compile(Collection& collection, MockNode* node, const MString& fileName, int compilation, const MockIncludedFileList& includedFiles)
+	{
+		MockEffect* reference = new MockEffect(compilation);
+		return collection.acquire(node, &sDevice, fileName, reference, NULL, &includedFiles);
+	}
+
+	MockIncludedFileList includes(const char* fileName)
+	{
+		MockIncludedFile includedFile = { fileName, sFileTimes[fileName] };
+		return MockIncludedFileList(1, includedFile);
+	}
+
+	void resetFiles()
+	{
+		sFileTimes.clear();
+		sFileTimes["/fx/a.fx"] = 100;
+		sFileTimes["/fx/b.fx"] = 200;
+		sFileTimes["/fx/common.fxh"] = 50;
+	}
+
+	void testSharing()
+	{
+		const char* test = "sharing";
+		resetFiles();
+		{
+			Collection collection;
+			check(collection.acquire(&sNodes[0], &sDevice, "/fx/a.fx") == NULL, test, "empty collection misses");
+			check(!collection.contains(&sDevice, "/fx/a.fx"), test, "empty collection does not contain the file");
+
+			MockEffect* clone0 = compile(collection, &sNodes[0], "/fx/a.fx", 1, includes("/fx/common.fxh"));
+			check(clone0 != NULL && clone0->compilation == 1, test, "compiled effect is cloned");
+			check(collection.contains(&sDevice, "/fx/a.fx"), test, "compiled file is contained");
+			check(!collection.contains(&sOtherDevice, "/fx/a.fx"), test, "other device does not share the effect");
+
+			MockEffect* clone1 = collection.acquire(&sNodes[1], &sDevice, "/fx/a.fx");
+			check(clone1 != NULL && clone1 != clone0 && clone1->compilation == 1, test, "second node gets its own clone");
+
+			MString fileName;
+			MockEffect* reference = collection.getReferenceEffectAndFileName(clone1, fileName);
+			check(reference != NULL && reference == collection.getReferenceEffectAndFileName(clone0, fileName), test, "clones share their reference");
+			check(fileName == "/fx/a.fx", test, "reference knows its file");
+
+			std::list< MockNode* > nodes;
+			collection.getNodesUsingEffect("/fx/a.fx", nodes);
+			check(nodes.size() == 2, test, "both nodes use the file");
+
+			check(sLiveEffects == 3, test, "one reference and two clones");
+			collection.release(&sNodes[0], clone0, "/fx/a.fx");
+			check(sLiveEffects == 2 && collection.contains(&sDevice, "/fx/a.fx"), test, "reference kept while a clone lives");
+			collection.release(&sNodes[1], clone1, "/fx/a.fx");
+			check(sLiveEffects == 0, test, "last release frees the reference");
+			check(!collection.contains(&sDevice, "/fx/a.fx"), test, "released file is no longer contained");
+
+			nodes.clear();
+			collection.getNodesUsingEffect("/fx/a.fx", nodes);
+			check(nodes.empty(), test, "no node uses the file");
+		}
+	}
+
+	void testFailedCompilation()
+	{
+		const char* test = "failed compilation";
+		resetFiles();
+		Collection collection;
+
+		// The node is tracked without an effect, so the reload finds it
+		check(collection.acquire(&sNodes[2], &sDevice, "/fx/b.fx", NULL) == NULL, test, "no effect");
+		std::list< MockNode* > nodes;
+		collection.getNodesUsingEffect("/fx/b.fx", nodes);
+		check(nodes.size() == 1 && nodes.front() == &sNodes[2], test, "node tracked");
+
+		collection.release(&sNodes[2], NULL, "/fx/b.fx");
+		nodes.clear();
+		collection.getNodesUsingEffect("/fx/b.fx", nodes);
+		check(nodes.empty(), test, "node no longer tracked");
+	}
+
+	void testTimeStampMemo()
+	{
+		const char* test = "time stamp memo";
+		resetFiles();
+		Collection collection;
+
+		MockEffect* clone0 = compile(collection, &sNodes[0], "/fx/a.fx", 1, includes("/fx/common.fxh"));
+		std::vector< MockEffect* > clones;
+		clones.push_back(collection.acquire(&sNodes[1], &sDevice, "/fx/a.fx"));
+
+		// Duplicating a node gives the reference of its effect, the file is not read again
+		MString fileName;
+		MockEffect* reference = collection.getReferenceEffectAndFileName(clone0, fileName);
+		unsigned int reads = sTimeStampReads;
+		for (int i = 0; i < 10; ++i)
+			clones.push_back(collection.acquire(&sNodes[2], &sDevice, fileName, reference, clone0));
+		check(sTimeStampReads == reads, test, "duplicates do not read the time stamps");
+
+		// Once invalidated, the time stamp is read again on the next duplicate only
+		collection.invalidateTimeStamps();
+		for (int i = 0; i < 10; ++i)
+			clones.push_back(collection.acquire(&sNodes[2], &sDevice, fileName, reference, clone0));
+		check(sTimeStampReads == reads + 1, test, "time stamp read once after the invalidation");
+
+		// The lookups by file name see the edits without an invalidation
+		check(collection.contains(&sDevice, "/fx/a.fx"), test, "contained");
+		sFileTimes["/fx/common.fxh"] = 51;
+		check(!collection.contains(&sDevice, "/fx/a.fx"), test, "edited include outdates the effect");
+		check(collection.acquire(&sNodes[3], &sDevice, "/fx/a.fx") == NULL, test, "outdated effect is not acquired");
+
+		MStringArray outdated;
+		collection.getOutdatedEffects(outdated);
+		check(outdated.length() == 1 && outdated[0] == "/fx/a.fx", test, "getOutdatedEffects checks the files");
+
+		// The effect is compiled again: it replaces the outdated reference, the old clones keep theirs
+		MockEffect* newClone = compile(collection, &sNodes[3], "/fx/a.fx", 2, includes("/fx/common.fxh"));
+		check(newClone != NULL && newClone->compilation == 2, test, "new compilation");
+		MockEffect* sharedClone = collection.acquire(&sNodes[0], &sDevice, "/fx/a.fx");
+		check(sharedClone != NULL && sharedClone->compilation == 2, test, "next nodes get the new compilation");
+		check(collection.contains(&sDevice, "/fx/a.fx"), test, "new compilation contained");
+
+		// The effect file itself is edited between two acquisitions, like a node loading it through its attribute
+		MockEffect* beforeEdit = collection.acquire(&sNodes[1], &sDevice, "/fx/a.fx");
+		sFileTimes["/fx/a.fx"] = 101;
+		check(beforeEdit != NULL && collection.acquire(&sNodes[2], &sDevice, "/fx/a.fx") == NULL, test, "edited file is not acquired");
+		check(!collection.contains(&sDevice, "/fx/a.fx"), test, "edited file outdates the effect");
+
+		// Releasing everything frees both compilations
+		collection.release(&sNodes[0], clone0, "/fx/a.fx");
+		for (size_t i = 0; i < clones.size(); ++i)
+			collection.release(&sNodes[1], clones[i], "/fx/a.fx");
+		check(sLiveEffects == 4, test, "old compilation freed with its last clone");
+		collection.release(&sNodes[3], newClone, "/fx/a.fx");
+		collection.release(&sNodes[0], sharedClone, "/fx/a.fx");
+		collection.release(&sNodes[1], beforeEdit, "/fx/a.fx");
+		check(sLiveEffects == 0, test, "all effects freed");
+	}
+
+	void testSchema()
+	{
+		const char* test = "schema";
+		resetFiles();
+		Collection collection;
+		sSchemasCreated = 0;
+
+		MockEffect* clone0 = compile(collection, &sNodes[0], "/fx/b.fx", 1, MockIncludedFileList());
+		MockEffect* clone1 = collection.acquire(&sNodes[1], &sDevice, "/fx/b.fx");
+
+		MockSchema* schema0 = collection.acquireSchema(clone0);
+		MockSchema* schema1 = collection.acquireSchema(clone1);
+		check(schema0 == schema1 && sSchemasCreated == 1, test, "clones share the schema of their reference");
+		check(schema0->effect != clone0 && schema0->effect != clone1, test, "schema reflects the reference");
+
+		MockEffect standalone(0);
+		MockSchema* ownSchema = collection.acquireSchema(&standalone);
+		check(ownSchema != schema0 && ownSchema->effect == &standalone, test, "effect out of the collection gets its own schema");
+		ownSchema->release();
+		--sLiveEffects;
+
+		schema0->release();
+		schema1->release();
+		check(sLiveSchemas == 1, test, "collection keeps the schema");
+		collection.release(&sNodes[0], clone0, "/fx/b.fx");
+		collection.release(&sNodes[1], clone1, "/fx/b.fx");
+		check(sLiveSchemas == 0 && sLiveEffects == 0, test, "schema released with the reference");
+	}
+
+	void testWatchedFiles()
+	{
+		const char* test = "watched files";
+		resetFiles();
+		Collection collection;
+
+		MockEffect* clone0 = compile(collection, &sNodes[0], "/fx/b.fx", 1, includes("/fx/common.fxh"));
+		MockEffect* clone1 = compile(collection, &sNodes[1], "/fx/a.fx", 1, includes("/fx/common.fxh"));
+
+		std::vector< MString > fileNames;
+		collection.getWatchedFiles(fileNames);
+		check(fileNames.size() == 3, test, "effect files and shared include, once each");
+		check(fileNames.size() == 3 && fileNames[0] == "/fx/a.fx" && fileNames[1] == "/fx/b.fx" && fileNames[2] == "/fx/common.fxh", test, "sorted names");
+
+		MStringArray outdated;
+		collection.getOutdatedEffects(outdated);
+		check(outdated.length() == 0, test, "nothing outdated");
+		sFileTimes["/fx/common.fxh"] = 60;
+		collection.getOutdatedEffects(outdated);
+		check(outdated.length() == 2, test, "shared include outdates both effects");
+
+		collection.release(&sNodes[0], clone0, "/fx/b.fx");
+		collection.release(&sNodes[1], clone1, "/fx/a.fx");
+		check(sLiveEffects == 0, test, "all effects freed");
+	}
+}
+
+int main()
+{
+	testSharing();
+	testFailedCompilation();
+	testTimeStampMemo();
+	testSchema();
+	testWatchedFiles();
+
+	if (sFailureCount > 0)
+	{
+		fprintf(stderr, "%u check(s) failed\n", sFailureCount);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
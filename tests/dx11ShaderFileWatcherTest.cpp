@@ -0,0 +1,218 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Stand-alone test of CFileWatcher, over a scripted backend and over the polling backend.
+//
+// The scripted backend returns the changes the test queued for each poll, so the settling
+// of the bursts is checked at exact times. The polling backend watches files written to a
+// temporary directory, with time stamps set by the test.
+
+#include "dx11ShaderFileWatcher.h"
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace
+{
+	unsigned int sFailureCount = 0;
+
+	void check(bool condition, const char* test, const char* what)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "FAILED: %s: %s\n", test, what);
+			++sFailureCount;
+		}
+	}
+
+	// Returns the changes queued for each poll, and keeps the files it is given
+	class ScriptedBackend : public CFileWatcher::Backend
+	{
+	public:
+		ScriptedBackend(std::deque< CFileWatcher::FileList >& changes, CFileWatcher::FileList& files)
+		: mChanges(changes)
+		, mFiles(files)
+		{
+		}
+
+		virtual void setFiles(const CFileWatcher::FileList& files)
+		{
+			mFiles = files;
+		}
+
+		virtual void poll(CFileWatcher::FileList& changedFiles)
+		{
+			if (!mChanges.empty())
+			{
+				changedFiles.insert(changedFiles.end(), mChanges.front().begin(), mChanges.front().end());
+				mChanges.pop_front();
+			}
+		}
+
+	private:
+		std::deque< CFileWatcher::FileList >& mChanges;
+		CFileWatcher::FileList& mFiles;
+	};
+
+	CFileWatcher::FileList fileList(const char* fileName0, const char* fileName1 = NULL)
+	{
+		CFileWatcher::FileList files;
+		if (fileName0)
+			files.push_back(MString(fileName0));
+		if (fileName1)
+			files.push_back(MString(fileName1));
+		return files;
+	}
+
+	bool sameFiles(const CFileWatcher::FileList& lhs, const CFileWatcher::FileList& rhs)
+	{
+		if (lhs.size() != rhs.size())
+			return false;
+		for (size_t i = 0; i < lhs.size(); ++i)
+		{
+			if (strcmp(lhs[i].asChar(), rhs[i].asChar()) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	void writeFile(const std::string& path, const char* content, time_t timeStamp)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file)
+		{
+			fputs(content, file);
+			fclose(file);
+		}
+		struct utimbuf times;
+		times.actime = timeStamp;
+		times.modtime = timeStamp;
+		utime(path.c_str(), &times);
+	}
+
+	void testBurst()
+	{
+		const char* test = "burst";
+		std::deque< CFileWatcher::FileList > changes;
+		CFileWatcher::FileList watchedFiles;
+		CFileWatcher watcher(new ScriptedBackend(changes, watchedFiles), 0.5);
+
+		watcher.setFiles(fileList("a.fx", "b.fxh"));
+		check(sameFiles(watchedFiles, fileList("a.fx", "b.fxh")), test, "files given to the backend");
+
+		// An editor writes the include file twice, then the effect
+		changes.push_back(fileList("b.fxh"));
+		changes.push_back(fileList("b.fxh"));
+		changes.push_back(CFileWatcher::FileList());
+		changes.push_back(fileList("a.fx"));
+
+		CFileWatcher::FileList changedFiles;
+		double firstChangeTime = -1.0;
+		check(!watcher.update(10.0, changedFiles, firstChangeTime), test, "first write is held");
+		check(!watcher.update(10.1, changedFiles, firstChangeTime), test, "second write is held");
+		check(!watcher.update(10.3, changedFiles, firstChangeTime), test, "held before the settle time");
+		check(!watcher.update(10.4, changedFiles, firstChangeTime), test, "last write restarts the settle time");
+		check(!watcher.update(10.85, changedFiles, firstChangeTime), test, "held until the settle time after the last write");
+		check(changedFiles.empty() && firstChangeTime == -1.0, test, "nothing reported while held");
+
+		check(watcher.update(10.9, changedFiles, firstChangeTime), test, "reported once settled");
+		check(sameFiles(changedFiles, fileList("a.fx", "b.fxh")), test, "each file of the burst reported once");
+		check(firstChangeTime == 10.0, test, "time of the first change");
+
+		changedFiles.clear();
+		check(!watcher.update(20.0, changedFiles, firstChangeTime), test, "burst reported once");
+		check(changedFiles.empty(), test, "no file after the burst");
+
+		// The next burst starts its own first change time
+		changes.push_back(fileList("a.fx"));
+		check(!watcher.update(30.0, changedFiles, firstChangeTime), test, "next burst is held");
+		check(watcher.update(30.5, changedFiles, firstChangeTime), test, "next burst is reported");
+		check(sameFiles(changedFiles, fileList("a.fx")) && firstChangeTime == 30.0, test, "next burst");
+	}
+
+	void testSetFiles()
+	{
+		const char* test = "set files";
+		char directory[] = "/tmp/dx11ShaderFileWatcherTest.XXXXXX";
+		if (!mkdtemp(directory))
+		{
+			check(false, test, "temporary directory");
+			return;
+		}
+		std::string effectPath = std::string(directory) + "/effect.fx";
+		std::string includePath = std::string(directory) + "/common.fxh";
+		time_t now = time(NULL);
+		writeFile(effectPath, "#include \"common.fxh\"", now - 100);
+		writeFile(includePath, "float4 color;", now - 100);
+
+		CFileWatcher watcher(new CFileWatcher::PollingBackend, 0.0);
+		CFileWatcher::FileList changedFiles;
+		double firstChangeTime = 0.0;
+		watcher.setFiles(fileList(effectPath.c_str()));
+		check(!watcher.update(1.0, changedFiles, firstChangeTime), test, "watched file is not changed");
+
+		// The effect now includes a file, written a while ago
+		watcher.setFiles(fileList(effectPath.c_str(), includePath.c_str()));
+		check(!watcher.update(2.0, changedFiles, firstChangeTime), test, "added file is not changed");
+
+		// The files already watched keep their state: a change made before setFiles() is still seen
+		writeFile(effectPath, "#include \"common.fxh\" ", now - 50);
+		watcher.setFiles(fileList(includePath.c_str(), effectPath.c_str()));
+		check(watcher.update(3.0, changedFiles, firstChangeTime), test, "change before setFiles() is reported");
+		check(sameFiles(changedFiles, fileList(effectPath.c_str())), test, "only the changed file is reported");
+
+		changedFiles.clear();
+		writeFile(includePath, "float4 otherColor;", now - 40);
+		check(watcher.update(4.0, changedFiles, firstChangeTime), test, "added file is watched");
+		check(sameFiles(changedFiles, fileList(includePath.c_str())), test, "added file change");
+
+		// A file no longer watched is not reported
+		changedFiles.clear();
+		watcher.setFiles(fileList(effectPath.c_str()));
+		writeFile(includePath, "float4 color;", now - 30);
+		check(!watcher.update(5.0, changedFiles, firstChangeTime), test, "removed file is not watched");
+
+		// A watched file that does not exist yet is reported when it is created
+		std::string missingPath = std::string(directory) + "/missing.fxh";
+		watcher.setFiles(fileList(effectPath.c_str(), missingPath.c_str()));
+		check(!watcher.update(6.0, changedFiles, firstChangeTime), test, "missing file is not changed");
+		writeFile(missingPath, "float4 color;", now - 20);
+		check(watcher.update(7.0, changedFiles, firstChangeTime), test, "created file is reported");
+		check(sameFiles(changedFiles, fileList(missingPath.c_str())), test, "created file");
+
+		remove(effectPath.c_str());
+		remove(includePath.c_str());
+		remove(missingPath.c_str());
+		rmdir(directory);
+	}
+}
+
+int main()
+{
+	testBurst();
+	testSetFiles();
+
+	if (sFailureCount > 0)
+	{
+		fprintf(stderr, "%u check(s) failed\n", sFailureCount);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,626 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Stand-alone microbenchmark of how dx11ShaderNode::updateParameters pushes a uniform
+// parameter to its effect variable.
+//
+// The effect variables are mocks of the D3DX11 interfaces: their methods are virtual like
+// the COM ones, GetDesc() copies the whole type description and the As*() casts return an
+// invalid variable when the class does not match, like the effects runtime. The parameters
+// are mocks of MUniformParameter holding their values.
+//
+// Both dispatches of the plug-in are reproduced over the mocks:
+//   typeDesc     the original code, GetType()->GetDesc() and an As*() cast for each push
+//   setterTable  the UniformSetter table of buildUniformSetters(), resolved once
+// and both must push the same values. One JSON document is printed on stdout with the
+// parameters pushed per second by each dispatch.
+//
+// Usage: dx11ShaderUniformSetterBenchmark [--quick] [--repeat N]
+//   --quick   fewer pushes, used as a smoke test
+//   --repeat  runs of each dispatch, the fastest is reported (3 by default)
+
+#include <maya/MTimer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	////////////////////////////////////////////////////////////////////////////////////////////////
+	// Mock of the D3DX11 effect interfaces
+
+	enum D3D10_SHADER_VARIABLE_CLASS
+	{
+		D3D10_SVC_SCALAR,
+		D3D10_SVC_VECTOR,
+		D3D10_SVC_MATRIX_ROWS,
+		D3D10_SVC_MATRIX_COLUMNS,
+		D3D10_SVC_OBJECT,
+		D3D10_SVC_STRUCT,
+	};
+
+	struct D3DX11_EFFECT_TYPE_DESC
+	{
+		const char* TypeName;
+		D3D10_SHADER_VARIABLE_CLASS Class;
+		unsigned int Type;
+		unsigned int Elements;
+		unsigned int Members;
+		unsigned int Rows;
+		unsigned int Columns;
+		unsigned int PackedSize;
+		unsigned int UnpackedSize;
+		unsigned int Stride;
+	};
+
+	struct ID3DX11EffectType
+	{
+		virtual ~ID3DX11EffectType() {}
+		virtual bool GetDesc(D3DX11_EFFECT_TYPE_DESC* desc) = 0;
+	};
+
+	struct ID3DX11EffectScalarVariable;
+	struct ID3DX11EffectVectorVariable;
+	struct ID3DX11EffectMatrixVariable;
+	struct ID3DX11EffectShaderResourceVariable;
+
+	struct ID3DX11EffectVariable
+	{
+		virtual ~ID3DX11EffectVariable() {}
+		virtual ID3DX11EffectType* GetType() = 0;
+		virtual ID3DX11EffectScalarVariable* AsScalar() = 0;
+		virtual ID3DX11EffectVectorVariable* AsVector() = 0;
+		virtual ID3DX11EffectMatrixVariable* AsMatrix() = 0;
+		virtual ID3DX11EffectShaderResourceVariable* AsShaderResource() = 0;
+	};
+
+	struct ID3DX11EffectScalarVariable : public ID3DX11EffectVariable
+	{
+		virtual bool SetFloat(float value) = 0;
+		virtual bool SetInt(int value) = 0;
+		virtual bool SetBool(bool value) = 0;
+	};
+
+	struct ID3DX11EffectVectorVariable : public ID3DX11EffectVariable
+	{
+		virtual bool SetFloatVector(float* data) = 0;
+	};
+
+	struct ID3DX11EffectMatrixVariable : public ID3DX11EffectVariable
+	{
+		virtual bool SetMatrix(float* data) = 0;
+		virtual bool SetMatrixTranspose(float* data) = 0;
+	};
+
+	struct ID3DX11EffectShaderResourceVariable : public ID3DX11EffectVariable
+	{
+		virtual bool SetResource(void* resource) = 0;
+	};
+
+	class MockType : public ID3DX11EffectType
+	{
+	public:
+		MockType(const char* typeName, D3D10_SHADER_VARIABLE_CLASS variableClass, unsigned int rows, unsigned int columns)
+		{
+			D3DX11_EFFECT_TYPE_DESC desc = { typeName, variableClass, 3, 0, 0, rows, columns, rows * columns * 4, rows * 16, rows * 16 };
+			mDesc = desc;
+		}
+
+		virtual bool GetDesc(D3DX11_EFFECT_TYPE_DESC* desc)
+		{
+			*desc = mDesc;
+			return true;
+		}
+
+	private:
+		D3DX11_EFFECT_TYPE_DESC mDesc;
+	};
+
+	// The values pushed to the variables, compared between the dispatches
+	struct Sink
+	{
+		Sink() : sum(0.0), count(0) {}
+
+		void add(const float* data, unsigned int size)
+		{
+			for (unsigned int i = 0; i < size; ++i)
+				sum += data[i] * (double)(count % 7 + 1);
+			++count;
+		}
+
+		double sum;
+		unsigned long long count;
+	};
+
+	Sink sSink;
+
+	// A variable of each class implements its interface. The casts to another class return the
+	// invalid variable of that class, whose setters fail, like the effects runtime.
+	template < class Interface >
+	class MockVariable : public Interface
+	{
+	public:
+		explicit MockVariable(ID3DX11EffectType* type) : mType(type) {}
+
+		virtual ID3DX11EffectType* GetType() { return mType; }
+		virtual ID3DX11EffectScalarVariable* AsScalar() { return cast< ID3DX11EffectScalarVariable >(); }
+		virtual ID3DX11EffectVectorVariable* AsVector() { return cast< ID3DX11EffectVectorVariable >(); }
+		virtual ID3DX11EffectMatrixVariable* AsMatrix() { return cast< ID3DX11EffectMatrixVariable >(); }
+		virtual ID3DX11EffectShaderResourceVariable* AsShaderResource() { return cast< ID3DX11EffectShaderResourceVariable >(); }
+
+	private:
+		template < class Other > Other* cast();
+
+		ID3DX11EffectType* mType;
+	};
+
+	class MockScalarVariable : public MockVariable< ID3DX11EffectScalarVariable >
+	{
+	public:
+		explicit MockScalarVariable(ID3DX11EffectType* type) : MockVariable< ID3DX11EffectScalarVariable >(type) {}
+
+		virtual bool SetFloat(float value) { sSink.add(&value, 1); return true; }
+		virtual bool SetInt(int value) { float data = (float)value; sSink.add(&data, 1); return true; }
+		virtual bool SetBool(bool value) { float data = (value ? 1.0f : 0.0f); sSink.add(&data, 1); return true; }
+	};
+
+	class MockVectorVariable : public MockVariable< ID3DX11EffectVectorVariable >
+	{
+	public:
+		explicit MockVectorVariable(ID3DX11EffectType* type) : MockVariable< ID3DX11EffectVectorVariable >(type) {}
+
+		virtual bool SetFloatVector(float* data) { sSink.add(data, 4); return true; }
+	};
+
+	class MockMatrixVariable : public MockVariable< ID3DX11EffectMatrixVariable >
+	{
+	public:
+		explicit MockMatrixVariable(ID3DX11EffectType* type) : MockVariable< ID3DX11EffectMatrixVariable >(type) {}
+
+		virtual bool SetMatrix(float* data) { sSink.add(data, 16); return true; }
+		virtual bool SetMatrixTranspose(float* data)
+		{
+			float transpose[16];
+			for (int i = 0; i < 16; ++i)
+				transpose[i] = data[(i % 4) * 4 + i / 4];
+			sSink.add(transpose, 16);
+			return true;
+		}
+	};
+
+	class MockShaderResourceVariable : public MockVariable< ID3DX11EffectShaderResourceVariable >
+	{
+	public:
+		explicit MockShaderResourceVariable(ID3DX11EffectType* type) : MockVariable< ID3DX11EffectShaderResourceVariable >(type) {}
+
+		virtual bool SetResource(void*) { return true; }
+	};
+
+	// The invalid variables, their setters fail
+	MockType sInvalidType("invalid", D3D10_SVC_STRUCT, 0, 0);
+
+	class InvalidScalarVariable : public MockScalarVariable
+	{
+	public:
+		InvalidScalarVariable() : MockScalarVariable(&sInvalidType) {}
+		virtual bool SetFloat(float) { return false; }
+		virtual bool SetInt(int) { return false; }
+		virtual bool SetBool(bool) { return false; }
+	};
+
+	class InvalidVectorVariable : public MockVectorVariable
+	{
+	public:
+		InvalidVectorVariable() : MockVectorVariable(&sInvalidType) {}
+		virtual bool SetFloatVector(float*) { return false; }
+	};
+
+	class InvalidMatrixVariable : public MockMatrixVariable
+	{
+	public:
+		InvalidMatrixVariable() : MockMatrixVariable(&sInvalidType) {}
+		virtual bool SetMatrix(float*) { return false; }
+		virtual bool SetMatrixTranspose(float*) { return false; }
+	};
+
+	class InvalidShaderResourceVariable : public MockShaderResourceVariable
+	{
+	public:
+		InvalidShaderResourceVariable() : MockShaderResourceVariable(&sInvalidType) {}
+		virtual bool SetResource(void*) { return false; }
+	};
+
+	InvalidScalarVariable sInvalidScalar;
+	InvalidVectorVariable sInvalidVector;
+	InvalidMatrixVariable sInvalidMatrix;
+	InvalidShaderResourceVariable sInvalidShaderResource;
+
+	template < class Other > struct InvalidVariable;
+	template <> struct InvalidVariable< ID3DX11EffectScalarVariable > { static ID3DX11EffectScalarVariable* get() { return &sInvalidScalar; } };
+	template <> struct InvalidVariable< ID3DX11EffectVectorVariable > { static ID3DX11EffectVectorVariable* get() { return &sInvalidVector; } };
+	template <> struct InvalidVariable< ID3DX11EffectMatrixVariable > { static ID3DX11EffectMatrixVariable* get() { return &sInvalidMatrix; } };
+	template <> struct InvalidVariable< ID3DX11EffectShaderResourceVariable > { static ID3DX11EffectShaderResourceVariable* get() { return &sInvalidShaderResource; } };
+
+	template < class Interface, class Other > struct Cast
+	{
+		static Other* get(Interface*) { return InvalidVariable< Other >::get(); }
+	};
+	template < class Interface > struct Cast< Interface, Interface >
+	{
+		static Interface* get(Interface* variable) { return variable; }
+	};
+
+	template < class Interface >
+	template < class Other >
+	Other* MockVariable< Interface >::cast()
+	{
+		return Cast< Interface, Other >::get(this);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////
+	// Mock of MUniformParameter
+
+	class MockUniformParameter
+	{
+	public:
+		enum DataType { kTypeUnknown, kTypeBool, kTypeInt, kTypeFloat, kTypeString, kTypeEnum, kType2DTexture };
+
+		MockUniformParameter(DataType type, ID3DX11EffectVariable* variable, float seed)
+		: mType(type)
+		, mVariable(variable)
+		{
+			for (int i = 0; i < 16; ++i)
+				mValues[i] = seed + (float)i * 0.25f;
+		}
+
+		DataType type() const { return mType; }
+		void* userData() const { return mVariable; }
+		bool isATexture() const { return mType == kType2DTexture; }
+		const float* getAsFloatArray() const { return mValues; }
+		int getAsInt() const { return (int)mValues[0]; }
+		bool getAsBool() const { return mValues[0] > 1.0f; }
+
+	private:
+		DataType mType;
+		ID3DX11EffectVariable* mVariable;
+		float mValues[16];
+	};
+
+	typedef std::vector< MockUniformParameter > MockUniformParameterList;
+
+	////////////////////////////////////////////////////////////////////////////////////////////////
+	// The original dispatch of updateParameters()
+
+	void pushWithTypeDesc(MockUniformParameterList& uniformParameters)
+	{
+		D3DX11_EFFECT_TYPE_DESC descType;
+		for( int u = (int)uniformParameters.size(); u--; ) {
+			MockUniformParameter& uniform = uniformParameters[u];
+
+			ID3DX11EffectVariable* effectVariable = (ID3DX11EffectVariable *)uniform.userData();
+			if (!effectVariable)  break;
+
+			effectVariable->GetType()->GetDesc(&descType);
+
+			switch( uniform.type()) {
+				case MockUniformParameter::kTypeFloat: {
+
+					const float* data = uniform.getAsFloatArray();
+					if (data) {
+						if (descType.Class == D3D10_SVC_SCALAR) {
+							effectVariable->AsScalar()->SetFloat( data[0] );
+						} else if (descType.Class == D3D10_SVC_VECTOR) {
+							effectVariable->AsVector()->SetFloatVector( (float*)data );
+						} else if (descType.Class == D3D10_SVC_MATRIX_COLUMNS) {
+							effectVariable->AsMatrix()->SetMatrix( (float*)data );
+						} else if (descType.Class == D3D10_SVC_MATRIX_ROWS) {
+							effectVariable->AsMatrix()->SetMatrixTranspose( (float*)data );
+						}
+					}
+				} break;
+				case MockUniformParameter::kTypeInt:
+				case MockUniformParameter::kTypeEnum: {
+					if (descType.Class == D3D10_SVC_SCALAR) {
+						effectVariable->AsScalar()->SetInt( uniform.getAsInt() );
+					}
+				} break;
+				case MockUniformParameter::kTypeBool: {
+					if (descType.Class == D3D10_SVC_SCALAR) {
+						effectVariable->AsScalar()->SetBool( uniform.getAsBool() );
+					}
+				} break;
+				case MockUniformParameter::kTypeString:
+					break;
+				default: {
+					if( uniform.isATexture()) {
+						ID3DX11EffectShaderResourceVariable* resourceVar = effectVariable->AsShaderResource();
+						if (resourceVar) {
+							resourceVar->SetResource(NULL);
+						}
+					}
+				} break;
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////
+	// The setter table of buildUniformSetters()
+
+	struct UniformSetter;
+	typedef void (*UniformSetFunction)(const UniformSetter& setter, MockUniformParameter& uniform);
+	typedef void (*UniformSetFloatsFunction)(const UniformSetter& setter, const float* data);
+	struct UniformSetter
+	{
+		ID3DX11EffectVariable* variable;
+		union
+		{
+			ID3DX11EffectScalarVariable* scalar;
+			ID3DX11EffectVectorVariable* vector;
+			ID3DX11EffectMatrixVariable* matrix;
+			ID3DX11EffectShaderResourceVariable* resource;
+		};
+		UniformSetFunction set;
+		UniformSetFloatsFunction setFloats;
+	};
+	typedef std::vector< UniformSetter > UniformSetterList;
+
+	void buildUniformSetters(MockUniformParameterList& uniformParameters, UniformSetterList& setters)
+	{
+		struct Set
+		{
+			static void floats(const UniformSetter& setter, MockUniformParameter& uniform)
+			{
+				const float* data = uniform.getAsFloatArray();
+				if (data) setter.setFloats( setter, data );
+			}
+			static void floatScalar(const UniformSetter& setter, const float* data)
+			{
+				setter.scalar->SetFloat( data[0] );
+			}
+			static void floatVector(const UniformSetter& setter, const float* data)
+			{
+				setter.vector->SetFloatVector( (float*)data );
+			}
+			static void matrix(const UniformSetter& setter, const float* data)
+			{
+				setter.matrix->SetMatrix( (float*)data );
+			}
+			static void matrixTranspose(const UniformSetter& setter, const float* data)
+			{
+				setter.matrix->SetMatrixTranspose( (float*)data );
+			}
+			static void intScalar(const UniformSetter& setter, MockUniformParameter& uniform)
+			{
+				setter.scalar->SetInt( uniform.getAsInt() );
+			}
+			static void boolScalar(const UniformSetter& setter, MockUniformParameter& uniform)
+			{
+				setter.scalar->SetBool( uniform.getAsBool() );
+			}
+		};
+
+		D3DX11_EFFECT_TYPE_DESC descType;
+		setters.resize(uniformParameters.size());
+		for( size_t u = 0; u < uniformParameters.size(); ++u ) {
+			MockUniformParameter& uniform = uniformParameters[u];
+			UniformSetter& setter = setters[u];
+			setter.variable = (ID3DX11EffectVariable *)uniform.userData();
+			setter.resource = NULL;
+			setter.set = NULL;
+			setter.setFloats = NULL;
+			if (!setter.variable)  continue;
+
+			setter.variable->GetType()->GetDesc(&descType);
+
+			switch( uniform.type()) {
+				case MockUniformParameter::kTypeFloat: {
+					if (descType.Class == D3D10_SVC_SCALAR) {
+						setter.scalar = setter.variable->AsScalar();
+						setter.setFloats = Set::floatScalar;
+					} else if (descType.Class == D3D10_SVC_VECTOR) {
+						setter.vector = setter.variable->AsVector();
+						setter.setFloats = Set::floatVector;
+					} else if (descType.Class == D3D10_SVC_MATRIX_COLUMNS) {
+						setter.matrix = setter.variable->AsMatrix();
+						setter.setFloats = Set::matrix;
+					} else if (descType.Class == D3D10_SVC_MATRIX_ROWS) {
+						setter.matrix = setter.variable->AsMatrix();
+						setter.setFloats = Set::matrixTranspose;
+					}
+					if (setter.setFloats) {
+						setter.set = Set::floats;
+					}
+				} break;
+				case MockUniformParameter::kTypeInt:
+				case MockUniformParameter::kTypeEnum: {
+					if (descType.Class == D3D10_SVC_SCALAR) {
+						setter.scalar = setter.variable->AsScalar();
+						setter.set = Set::intScalar;
+					}
+				} break;
+				case MockUniformParameter::kTypeBool: {
+					if (descType.Class == D3D10_SVC_SCALAR) {
+						setter.scalar = setter.variable->AsScalar();
+						setter.set = Set::boolScalar;
+					}
+				} break;
+				case MockUniformParameter::kTypeString:
+					break;
+				default: {
+					if( uniform.isATexture()) {
+						ID3DX11EffectShaderResourceVariable* resourceVar = setter.variable->AsShaderResource();
+						if (resourceVar) {
+							setter.resource = resourceVar;
+						}
+					}
+				} break;
+			}
+		}
+	}
+
+	void pushWithSetters(MockUniformParameterList& uniformParameters, const UniformSetterList& setters)
+	{
+		for( int u = (int)uniformParameters.size(); u--; ) {
+			const UniformSetter& setter = setters[u];
+			if (!setter.variable) break;
+
+			if (setter.set) {
+				setter.set(setter, uniformParameters[u]);
+			}
+			else if (setter.resource) {
+				setter.resource->SetResource(NULL);
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// The parameters of a typical effect, in the order of its uniforms
+	struct Effect
+	{
+		Effect()
+		: scalarType("float", D3D10_SVC_SCALAR, 1, 1)
+		, intType("int", D3D10_SVC_SCALAR, 1, 1)
+		, boolType("bool", D3D10_SVC_SCALAR, 1, 1)
+		, vectorType("float4", D3D10_SVC_VECTOR, 1, 4)
+		, matrixType("float4x4", D3D10_SVC_MATRIX_ROWS, 4, 4)
+		, columnMatrixType("float4x4", D3D10_SVC_MATRIX_COLUMNS, 4, 4)
+		, textureType("Texture2D", D3D10_SVC_OBJECT, 0, 0)
+		{
+			for (int i = 0; i < 6; ++i)
+				add(MockUniformParameter::kTypeFloat, new MockMatrixVariable(i % 2 ? &columnMatrixType : &matrixType));
+			for (int i = 0; i < 12; ++i)
+				add(MockUniformParameter::kTypeFloat, new MockVectorVariable(&vectorType));
+			for (int i = 0; i < 12; ++i)
+				add(MockUniformParameter::kTypeFloat, new MockScalarVariable(&scalarType));
+			for (int i = 0; i < 4; ++i)
+				add(i % 2 ? MockUniformParameter::kTypeEnum : MockUniformParameter::kTypeInt, new MockScalarVariable(&intType));
+			for (int i = 0; i < 4; ++i)
+				add(MockUniformParameter::kTypeBool, new MockScalarVariable(&boolType));
+			for (int i = 0; i < 4; ++i)
+				add(MockUniformParameter::kType2DTexture, new MockShaderResourceVariable(&textureType));
+
+			// A type mismatch is never pushed
+			add(MockUniformParameter::kTypeInt, new MockVectorVariable(&vectorType));
+			add(MockUniformParameter::kTypeString, new MockScalarVariable(&scalarType));
+		}
+
+		~Effect()
+		{
+			for (size_t i = 0; i < variables.size(); ++i)
+				delete variables[i];
+		}
+
+		void add(MockUniformParameter::DataType type, ID3DX11EffectVariable* variable)
+		{
+			variables.push_back(variable);
+			uniformParameters.push_back(MockUniformParameter(type, variable, (float)uniformParameters.size()));
+		}
+
+		MockType scalarType;
+		MockType intType;
+		MockType boolType;
+		MockType vectorType;
+		MockType matrixType;
+		MockType columnMatrixType;
+		MockType textureType;
+		std::vector< ID3DX11EffectVariable* > variables;
+		MockUniformParameterList uniformParameters;
+	};
+
+	struct Result
+	{
+		double seconds;
+		double sum;
+		unsigned long long count;
+	};
+
+	template < class Push >
+	Result run(Push push, unsigned int draws, unsigned int repeat)
+	{
+		Result result = { 0.0, 0.0, 0 };
+		for (unsigned int r = 0; r < repeat; ++r)
+		{
+			sSink = Sink();
+			MTimer timer;
+			timer.beginTimer();
+			for (unsigned int d = 0; d < draws; ++d)
+				push();
+			timer.endTimer();
+			if (r == 0 || timer.elapsedTime() < result.seconds)
+				result.seconds = timer.elapsedTime();
+			result.sum = sSink.sum;
+			result.count = sSink.count;
+		}
+		return result;
+	}
+
+	struct PushWithTypeDesc
+	{
+		explicit PushWithTypeDesc(Effect& effect) : effect(effect) {}
+		void operator()() const { pushWithTypeDesc(effect.uniformParameters); }
+		Effect& effect;
+	};
+
+	struct PushWithSetters
+	{
+		PushWithSetters(Effect& effect, const UniformSetterList& setters) : effect(effect), setters(setters) {}
+		void operator()() const { pushWithSetters(effect.uniformParameters, setters); }
+		Effect& effect;
+		const UniformSetterList& setters;
+	};
+}
+
+int main(int argc, char** argv)
+{
+	bool quick = false;
+	unsigned int repeat = 3;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+			quick = true;
+		else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+			repeat = (unsigned int)std::max(atoi(argv[++i]), 1);
+		else
+		{
+			fprintf(stderr, "Usage: %s [--quick] [--repeat N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	Effect effect;
+	UniformSetterList setters;
+	buildUniformSetters(effect.uniformParameters, setters);
+
+	const unsigned int draws = (quick ? 2000 : 500000);
+	Result typeDesc = run(PushWithTypeDesc(effect), draws, repeat);
+	Result setterTable = run(PushWithSetters(effect, setters), draws, repeat);
+
+	// Each draw pushes all the parameters
+	const double calls = (double)draws * (double)effect.uniformParameters.size();
+	printf("{\"benchmark\": \"uniformSetters\", \"parameters\": %u, \"draws\": %u, \"repeat\": %u, \"results\": [\n",
+		(unsigned int)effect.uniformParameters.size(), draws, repeat);
+	printf("    {\"dispatch\": \"typeDesc\", \"ms\": %.3f, \"callsPerSecond\": %.0f},\n",
+		typeDesc.seconds * 1000.0, calls / std::max(typeDesc.seconds, 1e-9));
+	printf("    {\"dispatch\": \"setterTable\", \"ms\": %.3f, \"callsPerSecond\": %.0f, \"speedup\": %.2f}\n",
+		setterTable.seconds * 1000.0, calls / std::max(setterTable.seconds, 1e-9), typeDesc.seconds / std::max(setterTable.seconds, 1e-9));
+	printf("]}\n");
+
+	// The table must push the same values as the original code
+	if (typeDesc.count != setterTable.count || typeDesc.sum != setterTable.sum)
+	{
+		fprintf(stderr, "FAILED: the dispatches pushed different values (%llu, %llu)\n", typeDesc.count, setterTable.count);
+		return 1;
+	}
+	return 0;
+}
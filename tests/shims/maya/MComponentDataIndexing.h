@@ -0,0 +1,7 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <maya/MHWGeometry.h>
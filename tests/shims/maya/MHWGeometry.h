@@ -0,0 +1,125 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+// The buffers are plain memory: map() returns the data given by the test, and an index
+// buffer allocates its indices in acquire().
+//+
+
+#pragma once
+
+#include <maya/MStatus.h>
+#include <maya/MString.h>
+#include <maya/MUintArray.h>
+#include <vector>
+
+namespace MHWRender
+{
+	class MGeometry
+	{
+	public:
+		enum Primitive { kInvalidPrimitive, kPoints, kLines, kLineStrip, kTriangles, kTriangleStrip, kAdjacentTriangles, kAdjacentTriangleStrip, kAdjacentLines, kAdjacentLineStrip, kPatch };
+		enum DataType { kInvalidType, kFloat, kDouble, kChar, kUnsignedChar, kInt16, kUnsignedInt16, kInt32, kUnsignedInt32 };
+		enum Semantic { kInvalidSemantic, kPosition, kNormal, kTexture, kColor, kTangent, kBitangent };
+
+		static unsigned int dataTypeSize(DataType type)
+		{
+			switch (type)
+			{
+				case kChar: case kUnsignedChar: return 1;
+				case kInt16: case kUnsignedInt16: return 2;
+				case kDouble: return 8;
+				case kInvalidType: return 0;
+				default: return 4;
+			}
+		}
+	};
+
+	class MVertexBufferDescriptor
+	{
+	public:
+		MVertexBufferDescriptor(MGeometry::Semantic semantic = MGeometry::kInvalidSemantic) : fSemantic(semantic) {}
+		MGeometry::Semantic semantic() const { return fSemantic; }
+
+	private:
+		MGeometry::Semantic fSemantic;
+	};
+
+	class MVertexBuffer
+	{
+	public:
+		MVertexBuffer(const MVertexBufferDescriptor& descriptor, void* data, unsigned int vertexCount)
+		: fDescriptor(descriptor), fData(data), fVertexCount(vertexCount) {}
+
+		const MVertexBufferDescriptor& descriptor() const { return fDescriptor; }
+		unsigned int vertexCount() const { return fVertexCount; }
+		void* map() { return fData; }
+		void unmap() {}
+
+	private:
+		MVertexBufferDescriptor fDescriptor;
+		void* fData;
+		unsigned int fVertexCount;
+	};
+
+	class MVertexBufferArray
+	{
+	public:
+		void addBuffer(const MString&, MVertexBuffer* buffer) { fBuffers.push_back(buffer); }
+		unsigned int count() const { return (unsigned int)fBuffers.size(); }
+		MVertexBuffer* getBuffer(unsigned int index) const { return fBuffers[index]; }
+
+	private:
+		std::vector< MVertexBuffer* > fBuffers;
+	};
+
+	class MIndexBuffer
+	{
+	public:
+		MIndexBuffer(MGeometry::DataType type) : fType(type), fSize(0) {}
+
+		MGeometry::DataType dataType() const { return fType; }
+		unsigned int size() const { return fSize; }
+
+		void* acquire(unsigned int size, bool /*writeOnly*/)
+		{
+			fSize = size;
+			fData.assign((size_t)size * MGeometry::dataTypeSize(fType), 0);
+			return (fData.empty() ? NULL : &fData[0]);
+		}
+		void commit(void*) {}
+
+		// Shim only: the indices committed to the buffer
+		const void* data() const { return (fData.empty() ? NULL : &fData[0]); }
+
+	private:
+		MGeometry::DataType fType;
+		unsigned int fSize;
+		std::vector< unsigned char > fData;
+	};
+
+	class MComponentDataIndexing
+	{
+	public:
+		enum MComponentType { kFaceVertex, kVertex, kEdge, kFace };
+
+		MComponentDataIndexing(MComponentType type = kFaceVertex) : fType(type) {}
+
+		MComponentType componentType() const { return fType; }
+		MUintArray& indices() { return fIndices; }
+		const MUintArray& indices() const { return fIndices; }
+
+	private:
+		MComponentType fType;
+		MUintArray fIndices;
+	};
+
+	class MComponentDataIndexingList
+	{
+	public:
+		bool append(const MComponentDataIndexing& indexing) { fList.push_back(&indexing); return true; }
+		int length() const { return (int)fList.size(); }
+		const MComponentDataIndexing* operator[](int index) const { return fList[index]; }
+
+	private:
+		std::vector< const MComponentDataIndexing* > fList;
+	};
+}
@@ -0,0 +1,8 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+// Declared by the tested sources but not used.
+//+
+
+#pragma once
+
+#include <maya/MStatus.h>
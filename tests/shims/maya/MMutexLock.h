@@ -0,0 +1,18 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <mutex>
+
+class MMutexLock
+{
+public:
+	void lock() { fMutex.lock(); }
+	void unlock() { fMutex.unlock(); }
+	bool tryLock() { return fMutex.try_lock(); }
+
+private:
+	std::mutex fMutex;
+};
@@ -0,0 +1,22 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <maya/MHWGeometry.h>
+
+namespace MHWRender
+{
+	class MPxIndexBufferMutator
+	{
+	public:
+		MPxIndexBufferMutator() {}
+		virtual ~MPxIndexBufferMutator() {}
+
+		virtual MGeometry::Primitive mutateIndexing(const MComponentDataIndexingList& sourceIndexBuffers,
+			const MVertexBufferArray& vertexBuffers,
+			MIndexBuffer& indexBuffer,
+			int& primitiveStride) const = 0;
+	};
+}
@@ -0,0 +1,29 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <maya/MTypes.h>
+
+namespace MS
+{
+	enum MStatusCode { kSuccess = 0, kFailure = 1 };
+}
+
+class MStatus
+{
+public:
+	static const MS::MStatusCode kSuccess = MS::kSuccess;
+	static const MS::MStatusCode kFailure = MS::kFailure;
+
+	MStatus(MS::MStatusCode code = MS::kSuccess) : fCode(code) {}
+
+	MS::MStatusCode statusCode() const { return fCode; }
+	bool operator==(MS::MStatusCode code) const { return fCode == code; }
+	bool operator!=(MS::MStatusCode code) const { return fCode != code; }
+	operator bool() const { return fCode == MS::kSuccess; }
+
+private:
+	MS::MStatusCode fCode;
+};
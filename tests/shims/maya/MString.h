@@ -0,0 +1,45 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <string>
+#include <sstream>
+
+class MString
+{
+public:
+	MString() {}
+	MString(const char* str) : fString(str ? str : "") {}
+	MString(const char* str, int length) : fString(str, length) {}
+
+	const char* asChar() const { return fString.c_str(); }
+	unsigned int length() const { return (unsigned int)fString.size(); }
+
+	MString& operator+=(const MString& other) { fString += other.fString; return *this; }
+	MString& operator+=(const char* other) { fString += other; return *this; }
+	MString& operator+=(int value) { return append(value); }
+	MString& operator+=(unsigned int value) { return append(value); }
+	MString& operator+=(double value) { return append(value); }
+
+	bool operator==(const MString& other) const { return fString == other.fString; }
+	bool operator!=(const MString& other) const { return fString != other.fString; }
+	bool operator<(const MString& other) const { return fString < other.fString; }
+
+private:
+	template <typename T>
+	MString& append(T value)
+	{
+		std::ostringstream stream;
+		stream << value;
+		fString += stream.str();
+		return *this;
+	}
+
+	std::string fString;
+};
+
+inline MString operator+(const MString& lhs, const MString& rhs) { MString result(lhs); result += rhs; return result; }
+inline MString operator+(const MString& lhs, const char* rhs) { MString result(lhs); result += rhs; return result; }
+inline MString operator+(const char* lhs, const MString& rhs) { MString result(lhs); result += rhs; return result; }
@@ -0,0 +1,20 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <maya/MStatus.h>
+#include <maya/MString.h>
+#include <vector>
+
+class MStringArray
+{
+public:
+	MStatus append(const MString& str) { fStrings.push_back(str); return MS::kSuccess; }
+	unsigned int length() const { return (unsigned int)fStrings.size(); }
+	const MString& operator[](unsigned int index) const { return fStrings[index]; }
+
+private:
+	std::vector< MString > fStrings;
+};
@@ -0,0 +1,25 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+// Each asynchronous task runs on its own detached std::thread.
+//+
+
+#pragma once
+
+#include <maya/MStatus.h>
+#include <maya/MThreadPool.h>
+#include <thread>
+
+typedef void (*MThreadAsyncCallbackFunc)(void*);
+
+class MThreadAsync
+{
+public:
+	static MStatus init() { return MS::kSuccess; }
+	static void release() {}
+
+	static MStatus createTask(MThreadFunc func, void* data, MThreadAsyncCallbackFunc doneFunc, void* doneData)
+	{
+		std::thread([=]() { func(data); doneFunc(doneData); }).detach();
+		return MS::kSuccess;
+	}
+};
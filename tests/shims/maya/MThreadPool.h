@@ -0,0 +1,51 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+// The tasks of a parallel region each run on their own std::thread.
+//+
+
+#pragma once
+
+#include <maya/MStatus.h>
+#include <thread>
+#include <vector>
+
+typedef void* MThreadRetVal;
+typedef MThreadRetVal (*MThreadFunc)(void*);
+
+struct MThreadRootTask
+{
+	std::vector< std::pair< MThreadFunc, void* > > tasks;
+};
+
+typedef void (*MThreadCallbackFunc)(void*, MThreadRootTask*);
+
+class MThreadPool
+{
+public:
+	static MStatus init() { return MS::kSuccess; }
+	static void release() {}
+
+	static MStatus newParallelRegion(MThreadCallbackFunc func, void* data)
+	{
+		MThreadRootTask root;
+		func(data, &root);
+		return MS::kSuccess;
+	}
+
+	static MStatus createTask(MThreadFunc func, void* data, MThreadRootTask* root)
+	{
+		root->tasks.push_back(std::make_pair(func, data));
+		return MS::kSuccess;
+	}
+
+	static MStatus executeAndJoin(MThreadRootTask* root)
+	{
+		std::vector< std::thread > threads;
+		for (size_t i = 0; i < root->tasks.size(); ++i)
+			threads.push_back(std::thread(root->tasks[i].first, root->tasks[i].second));
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+		root->tasks.clear();
+		return MS::kSuccess;
+	}
+};
@@ -0,0 +1,13 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <thread>
+
+class MThreadUtils
+{
+public:
+	static int getNumThreads() { return (int)std::thread::hardware_concurrency(); }
+};
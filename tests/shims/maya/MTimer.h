@@ -0,0 +1,20 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <chrono>
+
+class MTimer
+{
+public:
+	void beginTimer() { fBegin = Clock::now(); }
+	void endTimer() { fEnd = Clock::now(); }
+	double elapsedTime() const { return std::chrono::duration< double >(fEnd - fBegin).count(); }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point fBegin;
+	Clock::time_point fEnd;
+};
@@ -0,0 +1,11 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+// Only what the tested sources use is declared.
+//+
+
+#pragma once
+
+#include <stddef.h>
+
+typedef unsigned long long MUint64;
+typedef long long MInt64;
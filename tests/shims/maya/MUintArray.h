@@ -0,0 +1,25 @@
+//-
+// Shim of the Maya API for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <vector>
+
+class MUintArray
+{
+public:
+	MUintArray() {}
+	MUintArray(const unsigned int* values, unsigned int count) : fValues(values, values + count) {}
+
+	unsigned int length() const { return (unsigned int)fValues.size(); }
+	void setLength(unsigned int length) { fValues.resize(length); }
+	void append(unsigned int value) { fValues.push_back(value); }
+	void clear() { fValues.clear(); }
+
+	unsigned int& operator[](unsigned int index) { return fValues[index]; }
+	unsigned int operator[](unsigned int index) const { return fValues[index]; }
+
+private:
+	std::vector< unsigned int > fValues;
+};
@@ -0,0 +1,241 @@
+//-
+// Shim of the few Win32 calls made by the PN-AEN patch disk cache, on top of POSIX,
+// for the stand-alone tests and benchmarks, see tests/README.md.
+//+
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <map>
+#include <mutex>
+
+typedef void* HANDLE;
+typedef unsigned long DWORD;
+typedef long long LONGLONG;
+typedef int BOOL;
+
+typedef union { LONGLONG QuadPart; } LARGE_INTEGER;
+typedef struct { DWORD dwLowDateTime; DWORD dwHighDateTime; } FILETIME;
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(ptrdiff_t)-1)
+#define GENERIC_READ 0x80000000
+#define FILE_WRITE_ATTRIBUTES 0x100
+#define FILE_SHARE_READ 1
+#define FILE_SHARE_WRITE 2
+#define FILE_SHARE_DELETE 4
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define PAGE_READONLY 2
+#define FILE_MAP_READ 4
+#define MOVEFILE_REPLACE_EXISTING 1
+
+enum GET_FILEEX_INFO_LEVELS { GetFileExInfoStandard };
+
+struct WIN32_FIND_DATAA
+{
+	DWORD nFileSizeHigh;
+	DWORD nFileSizeLow;
+	FILETIME ftLastWriteTime;
+	char cFileName[260];
+};
+
+struct WIN32_FILE_ATTRIBUTE_DATA
+{
+	DWORD nFileSizeHigh;
+	DWORD nFileSizeLow;
+	FILETIME ftLastWriteTime;
+};
+
+namespace shim
+{
+	// Files, file mappings and directory searches
+	struct Handle
+	{
+		Handle() : fd(-1), size(0), dir(NULL) {}
+
+		int fd;
+		size_t size;
+		DIR* dir;
+		std::string directory;
+		std::string pattern;
+	};
+
+	// Size of the mapped views, for UnmapViewOfFile
+	struct Views
+	{
+		std::mutex mutex;
+		std::map< const void*, size_t > sizes;
+	};
+
+	inline Views& views()
+	{
+		static Views sViews;
+		return sViews;
+	}
+
+	// 100ns intervals, the epoch does not matter to the callers
+	inline FILETIME fileTime(const struct timespec& time)
+	{
+		unsigned long long value = (unsigned long long)time.tv_sec * 10000000ULL + time.tv_nsec / 100;
+		FILETIME fileTime = { (DWORD)(value & 0xFFFFFFFF), (DWORD)(value >> 32) };
+		return fileTime;
+	}
+
+	inline bool nextFile(Handle* find, WIN32_FIND_DATAA* findData)
+	{
+		while (dirent* entry = readdir(find->dir))
+		{
+			struct stat status;
+			std::string path = find->directory + "/" + entry->d_name;
+			if (fnmatch(find->pattern.c_str(), entry->d_name, 0) != 0 || stat(path.c_str(), &status) != 0)
+				continue;
+
+			findData->nFileSizeHigh = (DWORD)((unsigned long long)status.st_size >> 32);
+			findData->nFileSizeLow = (DWORD)(status.st_size & 0xFFFFFFFF);
+			findData->ftLastWriteTime = fileTime(status.st_mtim);
+			strncpy(findData->cFileName, entry->d_name, sizeof(findData->cFileName) - 1);
+			findData->cFileName[sizeof(findData->cFileName) - 1] = 0;
+			return true;
+		}
+		return false;
+	}
+}
+
+inline HANDLE CreateFileA(const char* path, DWORD access, DWORD, void*, DWORD, DWORD, HANDLE)
+{
+	int fd = open(path, (access & GENERIC_READ) ? O_RDONLY : O_RDWR);
+	if (fd < 0 && !(access & GENERIC_READ))
+		fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return INVALID_HANDLE_VALUE;
+
+	struct stat status;
+	fstat(fd, &status);
+	shim::Handle* handle = new shim::Handle;
+	handle->fd = fd;
+	handle->size = (size_t)status.st_size;
+	return handle;
+}
+
+inline BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER* size)
+{
+	size->QuadPart = (LONGLONG)static_cast< shim::Handle* >(file)->size;
+	return 1;
+}
+
+inline HANDLE CreateFileMappingA(HANDLE file, void*, DWORD, DWORD, DWORD, const char*)
+{
+	shim::Handle* mapping = new shim::Handle;
+	mapping->fd = dup(static_cast< shim::Handle* >(file)->fd);
+	mapping->size = static_cast< shim::Handle* >(file)->size;
+	return mapping;
+}
+
+inline void* MapViewOfFile(HANDLE mapping, DWORD, DWORD, DWORD, size_t)
+{
+	shim::Handle* handle = static_cast< shim::Handle* >(mapping);
+	void* view = (handle->size > 0 ? mmap(NULL, handle->size, PROT_READ, MAP_PRIVATE, handle->fd, 0) : MAP_FAILED);
+	if (view == MAP_FAILED)
+		return NULL;
+
+	shim::Views& views = shim::views();
+	std::lock_guard< std::mutex > lock(views.mutex);
+	views.sizes[view] = handle->size;
+	return view;
+}
+
+inline BOOL UnmapViewOfFile(const void* view)
+{
+	shim::Views& views = shim::views();
+	std::lock_guard< std::mutex > lock(views.mutex);
+	std::map< const void*, size_t >::iterator it = views.sizes.find(view);
+	if (it == views.sizes.end())
+		return 0;
+	munmap(const_cast< void* >(view), it->second);
+	views.sizes.erase(it);
+	return 1;
+}
+
+inline BOOL CloseHandle(HANDLE handle)
+{
+	shim::Handle* file = static_cast< shim::Handle* >(handle);
+	if (file->fd >= 0)
+		close(file->fd);
+	delete file;
+	return 1;
+}
+
+inline void GetSystemTimeAsFileTime(FILETIME* time)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	*time = shim::fileTime(now);
+}
+
+// Only sets the last write time to now, which is how the callers use it
+inline BOOL SetFileTime(HANDLE file, const FILETIME*, const FILETIME*, const FILETIME* lastWriteTime)
+{
+	return (lastWriteTime == NULL || futimens(static_cast< shim::Handle* >(file)->fd, NULL) == 0);
+}
+
+inline BOOL DeleteFileA(const char* path) { return unlink(path) == 0; }
+inline BOOL CreateDirectoryA(const char* path, void*) { return mkdir(path, 0755) == 0; }
+inline BOOL MoveFileExA(const char* from, const char* to, DWORD) { return rename(from, to) == 0; }
+inline DWORD GetCurrentProcessId() { return (DWORD)getpid(); }
+inline DWORD GetCurrentThreadId() { return (DWORD)(size_t)pthread_self(); }
+
+inline HANDLE FindFirstFileA(const char* pattern, WIN32_FIND_DATAA* findData)
+{
+	std::string path(pattern);
+	size_t separator = path.rfind('/');
+	shim::Handle* find = new shim::Handle;
+	find->directory = (separator == std::string::npos ? std::string(".") : path.substr(0, separator));
+	find->pattern = (separator == std::string::npos ? path : path.substr(separator + 1));
+	find->dir = opendir(find->directory.c_str());
+	if (find->dir == NULL || !shim::nextFile(find, findData))
+	{
+		if (find->dir)
+			closedir(find->dir);
+		delete find;
+		return INVALID_HANDLE_VALUE;
+	}
+	return find;
+}
+
+inline BOOL FindNextFileA(HANDLE find, WIN32_FIND_DATAA* findData)
+{
+	return shim::nextFile(static_cast< shim::Handle* >(find), findData);
+}
+
+inline BOOL FindClose(HANDLE find)
+{
+	closedir(static_cast< shim::Handle* >(find)->dir);
+	delete static_cast< shim::Handle* >(find);
+	return 1;
+}
+
+inline BOOL GetFileAttributesExA(const char* path, GET_FILEEX_INFO_LEVELS, void* information)
+{
+	struct stat status;
+	if (stat(path, &status) != 0)
+		return 0;
+
+	WIN32_FILE_ATTRIBUTE_DATA* attributes = static_cast< WIN32_FILE_ATTRIBUTE_DATA* >(information);
+	attributes->nFileSizeHigh = (DWORD)((unsigned long long)status.st_size >> 32);
+	attributes->nFileSizeLow = (DWORD)(status.st_size & 0xFFFFFFFF);
+	attributes->ftLastWriteTime = shim::fileTime(status.st_mtim);
+	return 1;
+}
@@ -0,0 +1,145 @@
+//-
+// ==========================================================================
+// Copyright 2012 Autodesk, Inc. All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk
+// license agreement provided at the time of installation or download,
+// or which otherwise accompanies this software in either electronic
+// or hard copy form.
+// ==========================================================================
+//+
+
+// Synthetic triangle meshes for the crack-free primitive generator tests and benchmark.
+// Each mesh is laid out like the buffers Maya hands to mutateIndexing: one position
+// and one uv per face vertex, and a triangle list of face vertex ids.
+
+#pragma once
+
+#include <maya/MUintArray.h>
+#include <math.h>
+#include <vector>
+
+struct SyntheticMesh
+{
+	const char* name;
+	std::vector< float > positions;
+	std::vector< float > uvs;
+	MUintArray indices;
+
+	unsigned int faceVertexCount() const { return (unsigned int)(positions.size() / 3); }
+	unsigned int triangleCount() const { return indices.length() / 3; }
+
+	unsigned int addFaceVertex(float x, float y, float z, float u, float v)
+	{
+		positions.push_back(x);
+		positions.push_back(y);
+		positions.push_back(z);
+		uvs.push_back(u);
+		uvs.push_back(v);
+		return faceVertexCount() - 1;
+	}
+
+	void addTriangle(unsigned int v0, unsigned int v1, unsigned int v2)
+	{
+		indices.append(v0);
+		indices.append(v1);
+		indices.append(v2);
+	}
+
+	void addQuad(unsigned int v0, unsigned int v1, unsigned int v2, unsigned int v3)
+	{
+		addTriangle(v0, v1, v2);
+		addTriangle(v0, v2, v3);
+	}
+};
+
+// Regular grid of size x size quads sharing their vertices, with a wave so it is not flat.
+inline SyntheticMesh makeGrid(unsigned int size, const char* name = "grid")
+{
+	SyntheticMesh mesh;
+	mesh.name = name;
+	for (unsigned int j = 0; j <= size; ++j)
+		for (unsigned int i = 0; i <= size; ++i)
+			mesh.addFaceVertex((float)i, (float)j, sinf(i * 0.3f) * cosf(j * 0.2f), (float)i / size, (float)j / size);
+
+	for (unsigned int j = 0; j < size; ++j)
+	{
+		for (unsigned int i = 0; i < size; ++i)
+		{
+			unsigned int v0 = j * (size + 1) + i;
+			mesh.addQuad(v0, v0 + 1, v0 + size + 2, v0 + size + 1);
+		}
+	}
+	return mesh;
+}
+
+// UV sphere with the seams of a real uv layout: the first and last columns share their
+// positions with different u, and each pole is a row of face vertices at the same position.
+inline SyntheticMesh makeUVSphere(unsigned int segments, unsigned int rings, const char* name = "uvSphere")
+{
+	const float kPi = 3.14159265f;
+
+	SyntheticMesh mesh;
+	mesh.name = name;
+	for (unsigned int j = 0; j <= rings; ++j)
+	{
+		float theta = kPi * j / rings;
+		for (unsigned int i = 0; i <= segments; ++i)
+		{
+			// Wrap exactly so the seam welds
+			float phi = 2.0f * kPi * (i % segments) / segments;
+			mesh.addFaceVertex(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi), (float)i / segments, (float)j / rings);
+		}
+	}
+
+	for (unsigned int j = 0; j < rings; ++j)
+	{
+		for (unsigned int i = 0; i < segments; ++i)
+		{
+			unsigned int v0 = j * (segments + 1) + i;
+			unsigned int v1 = v0 + 1;
+			unsigned int v2 = v1 + segments + 1;
+			unsigned int v3 = v0 + segments + 1;
+			if (j == 0)
+				mesh.addTriangle(v0, v2, v3);
+			else if (j == rings - 1)
+				mesh.addTriangle(v0, v1, v3);
+			else
+				mesh.addQuad(v0, v1, v2, v3);
+		}
+	}
+	return mesh;
+}
+
+// Hard-surface model: size x size boxes of varying heights with split normals, so each box
+// face has its own four face vertices and every corner position is shared by three faces.
+inline SyntheticMesh makeHardSurface(unsigned int size, const char* name = "hardSurface")
+{
+	// Corners of a unit box, then the corners of each face, outward facing
+	static const float kCorners[8][3] = { {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1} };
+	static const unsigned int kFaces[6][4] = { {0,3,2,1}, {4,5,6,7}, {0,1,5,4}, {2,3,7,6}, {1,2,6,5}, {3,0,4,7} };
+
+	SyntheticMesh mesh;
+	mesh.name = name;
+	for (unsigned int j = 0; j < size; ++j)
+	{
+		for (unsigned int i = 0; i < size; ++i)
+		{
+			float height = 0.5f + ((i * 7 + j * 13) % 5) * 0.25f;
+			for (unsigned int face = 0; face < 6; ++face)
+			{
+				unsigned int faceVertexIds[4];
+				for (unsigned int corner = 0; corner < 4; ++corner)
+				{
+					const float* position = kCorners[kFaces[face][corner]];
+					float u = ((corner == 1 || corner == 2) ? 1.0f : 0.0f);
+					float v = (corner >= 2 ? 1.0f : 0.0f);
+					faceVertexIds[corner] = mesh.addFaceVertex(i * 1.5f + position[0], j * 1.5f + position[1], position[2] * height,
+						(face + u) / 6.0f, v);
+				}
+				mesh.addQuad(faceVertexIds[0], faceVertexIds[1], faceVertexIds[2], faceVertexIds[3]);
+			}
+		}
+	}
+	return mesh;
+}